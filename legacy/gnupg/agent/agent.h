@@ -180,6 +180,12 @@ struct server_control_s {
      passwd command.  */
   int in_passwd;
 
+  /* If set, operations which would need the pinentry or the
+     scdaemon fail with GPG_ERR_EWOULDBLOCK instead of waiting for
+     them.  This is used by worker threads which must not block on
+     user interaction.  */
+  int cache_only;
+
   /* The current S2K which might be different from the calibrated
      count. */
   unsigned long s2k_count;
@@ -292,7 +298,7 @@ int agent_is_dsa_key(gcry_sexp_t s_key);
 int agent_is_eddsa_key(gcry_sexp_t s_key);
 int agent_key_available(const unsigned char *grip);
 gpg_error_t agent_key_info_from_file(ctrl_t ctrl, const unsigned char *grip,
-                                     int *r_keytype,
+                                     int listing, int *r_keytype,
                                      unsigned char **r_shadow_info);
 gpg_error_t agent_delete_key(ctrl_t ctrl, const char *desc_text,
                              const unsigned char *grip, int force,
@@ -328,6 +334,20 @@ int agent_put_cache(const char *key, cache_mode_t cache_mode, const char *data,
 char *agent_get_cache(const char *key, cache_mode_t cache_mode);
 void agent_store_cache_hit(const char *key);
 
+/*-- keyindex.c --*/
+int agent_keyindex_available(const unsigned char *grip);
+gpg_error_t agent_keyindex_list(unsigned char **r_grips, size_t *r_ngrips);
+gpg_error_t agent_keyindex_get_key(const unsigned char *grip,
+                                   gcry_sexp_t *r_key);
+void agent_keyindex_put_key(const unsigned char *grip, const struct stat *st,
+                            gcry_sexp_t key);
+gpg_error_t agent_keyindex_get_info(const unsigned char *grip, int trust_dir,
+                                    int *r_keytype,
+                                    unsigned char **r_shadow_info);
+void agent_keyindex_put_info(const unsigned char *grip, int keytype,
+                             const unsigned char *shadow_info);
+void agent_keyindex_invalidate(const unsigned char *grip);
+
 /*-- pksign.c --*/
 int agent_pksign_do(ctrl_t ctrl, const char *cache_nonce, const char *desc_text,
                     gcry_sexp_t *signature_sexp, cache_mode_t cache_mode,
@@ -93,10 +93,12 @@ static gpg_error_t init_encryption(void) {
 
 static void release_data(struct secret_data_s *data) { xfree(data); }
 
-static gpg_error_t new_data(const char *string, struct secret_data_s **r_data) {
+/* Encrypt the LENGTH bytes at BUFFER and store them in a newly
+   allocated object at R_DATA.  */
+static gpg_error_t new_data(const void *buffer, size_t length,
+                            struct secret_data_s **r_data) {
   gpg_error_t err;
   struct secret_data_s *d, *d_enc;
-  size_t length;
   int total;
   size_t d_len;
 
@@ -105,8 +107,6 @@ static gpg_error_t new_data(const char *string, struct secret_data_s **r_data) {
   err = init_encryption();
   if (err) return err;
 
-  length = strlen(string) + 1;
-
   /* We pad the data to 32 bytes so that it get more complicated
      finding something out by watching allocation patterns.  This is
      usually not possible but we better assume nothing about our secure
@@ -116,7 +116,7 @@ static gpg_error_t new_data(const char *string, struct secret_data_s **r_data) {
 
   d_len = sizeof *d + total - 1;
   d = (secret_data_s *)Botan::allocate_memory(1, d_len);
-  memcpy(d->data, string, length);
+  memcpy(d->data, buffer, length);
 
   d_enc = (secret_data_s *)xtrymalloc(sizeof *d_enc + total - 1);
   if (!d_enc) {
@@ -144,6 +144,32 @@ static gpg_error_t new_data(const char *string, struct secret_data_s **r_data) {
   return 0;
 }
 
+/* Decrypt the object D into a newly allocated buffer in secure
+   memory and store it at R_VALUE.  The buffer has a size of
+   D->TOTALLEN - 8 bytes.  */
+static gpg_error_t get_data(struct secret_data_s *d, char **r_value) {
+  gpg_error_t err;
+  char *value;
+
+  *r_value = NULL;
+
+  if (d->totallen < 32) return GPG_ERR_INV_LENGTH;
+  err = init_encryption();
+  if (err) return err;
+  value = (char *)xtrymalloc_secure(d->totallen - 8);
+  if (!value) return gpg_error_from_syserror();
+
+  const Botan::secure_vector<uint8_t> enc_data(d->totallen);
+  memcpy((void *)(enc_data.data()), d->data, d->totallen);
+  Botan::secure_vector<uint8_t> val =
+      Botan::rfc3394_keyunwrap(enc_data, *encryption_handle);
+  assert(val.size() == d->totallen - 8);
+  memcpy(value, val.data(), val.size());
+
+  *r_value = value;
+  return 0;
+}
+
 /* Check whether there are items to expire.  */
 static void housekeeping(void) {
   ITEM r, rprev;
@@ -260,7 +286,7 @@ int agent_put_cache(const char *key, cache_mode_t cache_mode, const char *data,
       r->created = r->accessed = gnupg_get_time();
       r->ttl = ttl;
       r->cache_mode = cache_mode;
-      err = new_data(data, &r->pw);
+      err = new_data(data, strlen(data) + 1, &r->pw);
       if (err) log_error("error replacing cache item: %s\n", gpg_strerror(err));
     }
   } else if (data) /* Insert.  */
@@ -273,7 +299,7 @@ int agent_put_cache(const char *key, cache_mode_t cache_mode, const char *data,
       r->created = r->accessed = gnupg_get_time();
       r->ttl = ttl;
       r->cache_mode = cache_mode;
-      err = new_data(data, &r->pw);
+      err = new_data(data, strlen(data) + 1, &r->pw);
       if (err)
         xfree(r);
       else {
@@ -321,24 +347,8 @@ char *agent_get_cache(const char *key, cache_mode_t cache_mode) {
       /* Note: To avoid races KEY may not be accessed anymore below.  */
       r->accessed = gnupg_get_time();
       if (DBG_CACHE) log_debug("... hit\n");
-      if (r->pw->totallen < 32)
-        err = GPG_ERR_INV_LENGTH;
-      else if ((err = init_encryption()))
-        ;
-      else if (!(value = (char *)xtrymalloc_secure(r->pw->totallen - 8)))
-        err = gpg_error_from_syserror();
-      else {
-        const Botan::secure_vector<uint8_t> pw_data(r->pw->totallen);
-        memcpy((void *)(pw_data.data()), r->pw->data, r->pw->totallen);
-        Botan::secure_vector<uint8_t> val =
-            Botan::rfc3394_keyunwrap(pw_data, *encryption_handle);
-        assert(val.size() == r->pw->totallen - 8);
-        memcpy(value, val.data(), val.size());
-        err = 0;
-      }
+      err = get_data(r->pw, &value);
       if (err) {
-        xfree(value);
-        value = NULL;
         log_error("retrieving cache entry '%s' failed: %s\n", key,
                   gpg_strerror(err));
       }
@@ -358,26 +368,17 @@ void agent_store_cache_hit(const char *key) {
   char *neu;
   char *old;
 
-  /* To make sure the update is atomic under the non-preemptive thread
-   * model, we must make sure not to surrender control to a different
-   * thread.  Therefore, we avoid calling the allocator during the
-   * update.
-   *
-   * Background: xtrystrdup uses gcry_strdup which may use the secure
-   * memory allocator of Libgcrypt.  That allocator takes locks and
-   * since version 1.14 libgpg-error is nPth aware and thus taking a
-   * lock may now lead to thread switch.  Note that this only happens
-   * when secure memory is _allocated_ (the standard allocator uses
-   * malloc which is not nPth aware) but not when calling _xfree_
-   * because gcry_free needs to check whether the pointer is in secure
-   * memory and thus needs to take a lock.
-   */
+  /* We avoid calling the allocator while holding the lock because
+     the secure memory allocator of Libgcrypt takes its own locks.
+     The lock is required because agent_get_cache may use the stored
+     key from another thread.  */
   neu = key ? xtrystrdup(key) : NULL;
 
-  /* Atomic update.  */
-  old = last_stored_cache_key;
-  last_stored_cache_key = neu;
-  /* Done.  */
+  {
+    std::lock_guard<std::mutex> lock(cache_lock);
+    old = last_stored_cache_key;
+    last_stored_cache_key = neu;
+  }
 
   xfree(old);
 }
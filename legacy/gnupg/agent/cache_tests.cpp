@@ -0,0 +1,133 @@
+/* Tests for the passphrase cache
+   Copyright 2018 The NeoPG developers
+
+   NeoPG is released under the Simplified BSD License (see license.txt)
+*/
+
+#include <config.h>
+
+#include "gtest/gtest.h"
+
+#include <time.h>
+
+#include <string>
+
+#include "../common/gettime.h"
+#include "agent.h"
+
+namespace {
+
+/* Return the passphrase cached for KEY in CACHE_MODE, or "" on a
+   miss.  */
+std::string get_cache(const char *key, cache_mode_t cache_mode) {
+  char *value = agent_get_cache(key, cache_mode);
+  std::string result = value ? value : "";
+
+  xfree(value);
+  return result;
+}
+
+/* Freeze the time at a point in the future, so that the tests can
+   move it forward, and restore the options and the time.  */
+class SavedState {
+ public:
+  SavedState()
+      : m_def_cache_ttl(opt.def_cache_ttl),
+        m_max_cache_ttl(opt.max_cache_ttl) {
+    now = time(NULL) + 1000;
+    gnupg_set_time(now, 1);
+  }
+
+  ~SavedState() {
+    agent_flush_cache();
+    opt.def_cache_ttl = m_def_cache_ttl;
+    opt.max_cache_ttl = m_max_cache_ttl;
+    gnupg_set_time((time_t)-1, 0);
+  }
+
+  /* Move the frozen time SECONDS after the start.  */
+  void advance(time_t seconds) { gnupg_set_time(now + seconds, 1); }
+
+  time_t now;
+
+ private:
+  unsigned long m_def_cache_ttl;
+  unsigned long m_max_cache_ttl;
+};
+
+}  // namespace
+
+TEST(NeopgLegacyTest, agent_cache_test) {
+  SavedState saved;
+
+  opt.def_cache_ttl = 600;
+  opt.max_cache_ttl = 7200;
+
+  ASSERT_EQ(agent_put_cache("CACHE-TEST-1", CACHE_MODE_NORMAL, "secret", 0),
+            0);
+  ASSERT_EQ(agent_put_cache("CACHE-TEST-2", CACHE_MODE_USER, "user", 0), 0);
+  ASSERT_EQ(get_cache("CACHE-TEST-1", CACHE_MODE_NORMAL), "secret");
+  ASSERT_EQ(get_cache("CACHE-TEST-1", CACHE_MODE_ANY), "secret");
+  ASSERT_EQ(get_cache("CACHE-TEST-3", CACHE_MODE_NORMAL), "");
+
+  /* User and nonce entries are only found in the same mode, and
+     nothing is found or stored in the ignore mode.  */
+  ASSERT_EQ(get_cache("CACHE-TEST-2", CACHE_MODE_USER), "user");
+  ASSERT_EQ(get_cache("CACHE-TEST-1", CACHE_MODE_USER), "");
+  ASSERT_EQ(get_cache("CACHE-TEST-1", CACHE_MODE_NONCE), "");
+  ASSERT_EQ(get_cache("CACHE-TEST-1", CACHE_MODE_IGNORE), "");
+  ASSERT_EQ(agent_put_cache("CACHE-TEST-3", CACHE_MODE_IGNORE, "x", 0), 0);
+  ASSERT_EQ(get_cache("CACHE-TEST-3", CACHE_MODE_NORMAL), "");
+
+  /* Entries are replaced and deleted.  */
+  ASSERT_EQ(agent_put_cache("CACHE-TEST-1", CACHE_MODE_NORMAL, "other", 0),
+            0);
+  ASSERT_EQ(get_cache("CACHE-TEST-1", CACHE_MODE_NORMAL), "other");
+  ASSERT_EQ(agent_put_cache("CACHE-TEST-1", CACHE_MODE_NORMAL, NULL, 0), 0);
+  ASSERT_EQ(get_cache("CACHE-TEST-1", CACHE_MODE_NORMAL), "");
+
+  /* Flushing wipes all passphrases.  */
+  ASSERT_EQ(agent_put_cache("CACHE-TEST-1", CACHE_MODE_NORMAL, "secret", 0),
+            0);
+  agent_flush_cache();
+  ASSERT_EQ(get_cache("CACHE-TEST-1", CACHE_MODE_NORMAL), "");
+  ASSERT_EQ(get_cache("CACHE-TEST-2", CACHE_MODE_USER), "");
+}
+
+TEST(NeopgLegacyTest, agent_cache_expiry_test) {
+  SavedState saved;
+
+  opt.def_cache_ttl = 600;
+  opt.max_cache_ttl = 7200;
+
+  /* An entry expires TTL seconds after the last access.  */
+  ASSERT_EQ(agent_put_cache("CACHE-TEST-1", CACHE_MODE_NORMAL, "secret", 10),
+            0);
+  saved.advance(8);
+  ASSERT_EQ(get_cache("CACHE-TEST-1", CACHE_MODE_NORMAL), "secret");
+  saved.advance(18);
+  ASSERT_EQ(get_cache("CACHE-TEST-1", CACHE_MODE_NORMAL), "secret");
+  saved.advance(29);
+  ASSERT_EQ(get_cache("CACHE-TEST-1", CACHE_MODE_NORMAL), "");
+
+  /* The default TTL is used for a TTL of 0.  */
+  saved.advance(0);
+  ASSERT_EQ(agent_put_cache("CACHE-TEST-2", CACHE_MODE_NORMAL, "secret", 0),
+            0);
+  saved.advance(600);
+  ASSERT_EQ(get_cache("CACHE-TEST-2", CACHE_MODE_NORMAL), "secret");
+  saved.advance(1201);
+  ASSERT_EQ(get_cache("CACHE-TEST-2", CACHE_MODE_NORMAL), "");
+
+  /* All entries, even those without a TTL, expire after the maximum
+     TTL, however often they are used.  */
+  saved.advance(0);
+  ASSERT_EQ(agent_put_cache("CACHE-TEST-3", CACHE_MODE_NORMAL, "secret", -1),
+            0);
+  for (time_t t = 1000; t <= 7200; t += 1000) {
+    saved.advance(t);
+    ASSERT_EQ(get_cache("CACHE-TEST-3", CACHE_MODE_NORMAL), "secret");
+  }
+  saved.advance(7201);
+  ASSERT_EQ(get_cache("CACHE-TEST-3", CACHE_MODE_NORMAL), "");
+}
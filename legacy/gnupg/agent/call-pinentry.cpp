@@ -92,6 +92,7 @@ gpg_error_t agent_askpin(ctrl_t ctrl, const char *desc_text,
                          struct pin_entry_info_s *pininfo, const char *keyinfo,
                          cache_mode_t cache_mode) {
   gpg_error_t rc;
+  if (ctrl->cache_only) return GPG_ERR_EWOULDBLOCK;
   if (opt.batch) return 0; /* fixme: we should return BAD PIN */
 
   {
@@ -121,6 +122,7 @@ int agent_get_passphrase(ctrl_t ctrl, char **retpass, const char *desc,
                          const char *prompt, const char *errtext,
                          const char *keyinfo, cache_mode_t cache_mode) {
   *retpass = NULL;
+  if (ctrl->cache_only) return GPG_ERR_EWOULDBLOCK;
   if (opt.batch) return GPG_ERR_BAD_PASSPHRASE;
 
   {
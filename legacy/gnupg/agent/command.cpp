@@ -24,9 +24,15 @@
 
 #include <config.h>
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 #include <assert.h>
 #include <ctype.h>
-#include <dirent.h>
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -49,6 +55,10 @@
 #define MAXLEN_KEYPARAM 1024
 /* Maximum allowed size of key data as used in inquiries (bytes). */
 #define MAXLEN_KEYDATA 8192
+/* Maximum allowed size of the inquired PKBATCH request list.  */
+#define MAXLEN_PKBATCH (1024 * 1024)
+/* Maximum number of worker threads used by PKBATCH.  */
+#define MAX_PKBATCH_WORKERS 8
 
 /* A shortcut to call assuan_set_error using an gpg_error_t and a
    text string.  */
@@ -433,6 +443,14 @@ static gpg_error_t cmd_setkeydesc(assuan_context_t ctx, char *line) {
   return 0;
 }
 
+/* Return true if N is a supported length of a digest computed with
+   the hash algorithm ALGO.  */
+static int is_valid_digest_length(int algo, size_t n) {
+  if (algo == MD_USER_TLS_MD5SHA1 && n == 36) return 1;
+  return (n == 16 || n == 20 || n == 24 || n == 28 || n == 32 || n == 48 ||
+          n == 64);
+}
+
 static const char hlp_sethash[] =
     "SETHASH (--hash=<name>)|(<algonumber>) <hexstring>\n"
     "\n"
@@ -489,10 +507,7 @@ static gpg_error_t cmd_sethash(assuan_context_t ctx, char *line) {
   rc = parse_hexstring(ctx, line, &n);
   if (rc) return rc;
   n /= 2;
-  if (algo == MD_USER_TLS_MD5SHA1 && n == 36)
-    ;
-  else if (n != 16 && n != 20 && n != 24 && n != 28 && n != 32 && n != 48 &&
-           n != 64)
+  if (!is_valid_digest_length(algo, n))
     return set_error(GPG_ERR_ASS_PARAMETER, "unsupported length of hash");
 
   if (n > MAX_DIGEST_LEN)
@@ -587,6 +602,331 @@ static gpg_error_t cmd_pkdecrypt(assuan_context_t ctx, char *line) {
   return leave_cmd(ctx, rc);
 }
 
+/* Send the result record for PKBATCH request number IDX.  ERR is the
+   result of the operation; on success OUTBUF holds the canonical
+   S-expression returned by the operation and PADDING the padding
+   info as returned by agent_pkdecrypt.  The record is flushed so
+   that the client can process it while we work on the next
+   request.  */
+static gpg_error_t write_pkbatch_result(assuan_context_t ctx, unsigned int idx,
+                                        gpg_error_t err, int padding,
+                                        membuf_t *outbuf) {
+  gpg_error_t ae;
+  membuf_t mb;
+  char numbuf[3][35];
+  void *p;
+  size_t n;
+
+  snprintf(numbuf[0], sizeof numbuf[0], "%u", idx);
+  snprintf(numbuf[1], sizeof numbuf[1], "%u", (unsigned int)err);
+  snprintf(numbuf[2], sizeof numbuf[2], "%d", padding);
+
+  init_membuf_secure(&mb, 512);
+  put_membuf_printf(&mb, "(6:result%u:%s%u:%s%u:%s",
+                    (unsigned int)strlen(numbuf[0]), numbuf[0],
+                    (unsigned int)strlen(numbuf[1]), numbuf[1],
+                    (unsigned int)strlen(numbuf[2]), numbuf[2]);
+  p = get_membuf(outbuf, &n);
+  if (!err && p) {
+    put_membuf_printf(&mb, "%u:", (unsigned int)n);
+    put_membuf(&mb, p, n);
+  } else
+    put_membuf_str(&mb, "0:");
+  if (p) {
+    wipememory(p, n);
+    xfree(p);
+  }
+  put_membuf_str(&mb, ")");
+
+  ae = write_and_clear_outbuf(ctx, &mb);
+  if (!ae) ae = assuan_send_data(ctx, NULL, 0);
+  return ae;
+}
+
+/* Return true if the PKBATCH request REQ is a sign request.  */
+static int is_pkbatch_sign(gcry_sexp_t req) {
+  const char *s;
+  size_t n;
+
+  s = gcry_sexp_nth_data(req, 0, &n);
+  return s && n == 4 && !memcmp(s, "sign", 4);
+}
+
+/* Store the keygrip of the PKBATCH request REQ in CTRL.  If REQ is a
+   sign request, the digest is stored as well.  */
+static gpg_error_t parse_pkbatch_request(ctrl_t ctrl, gcry_sexp_t req) {
+  const char *s;
+  size_t n;
+  char *grip;
+
+  grip = gcry_sexp_nth_string(req, 1);
+  if (!grip) return GPG_ERR_INV_DATA;
+  if (strlen(grip) != 40 || hex2bin(grip, ctrl->keygrip, 20) < 0) {
+    xfree(grip);
+    return GPG_ERR_INV_VALUE;
+  }
+  xfree(grip);
+  ctrl->have_keygrip = 1;
+
+  if (is_pkbatch_sign(req)) {
+    char *algostr;
+    int algo;
+
+    /* The digest is checked like the one given to SETHASH.  */
+    algostr = gcry_sexp_nth_string(req, 2);
+    algo = algostr ? atoi(algostr) : 0;
+    xfree(algostr);
+    if (!algo || (algo != MD_USER_TLS_MD5SHA1 && gcry_md_test_algo(algo)))
+      return GPG_ERR_UNSUPPORTED_ALGORITHM;
+
+    s = gcry_sexp_nth_data(req, 3, &n);
+    if (!s || !n) return GPG_ERR_INV_DATA;
+    if (!is_valid_digest_length(algo, n) || n > MAX_DIGEST_LEN)
+      return GPG_ERR_INV_LENGTH;
+
+    ctrl->digest.algo = algo;
+    ctrl->digest.raw_value = 0;
+    memcpy(ctrl->digest.value, s, n);
+    ctrl->digest.valuelen = n;
+  }
+
+  return 0;
+}
+
+/* Process the single PKBATCH request REQ and store the result at
+   OUTBUF.  DESC is the description used for the pinentry.  The
+   keygrip and digest of CTRL are overwritten.  */
+static gpg_error_t process_pkbatch_request(ctrl_t ctrl, gcry_sexp_t req,
+                                           const char *cache_nonce,
+                                           const char *desc,
+                                           cache_mode_t cache_mode,
+                                           membuf_t *outbuf, int *r_padding) {
+  gpg_error_t err;
+  const char *s;
+  size_t n;
+  int is_sign;
+
+  *r_padding = -1;
+
+  is_sign = is_pkbatch_sign(req);
+  s = gcry_sexp_nth_data(req, 0, &n);
+  if (!is_sign && !(s && n == 7 && !memcmp(s, "decrypt", 7)))
+    return GPG_ERR_UNKNOWN_COMMAND;
+
+  err = parse_pkbatch_request(ctrl, req);
+  if (err) return err;
+
+  if (is_sign)
+    err = agent_pksign(ctrl, cache_nonce, desc, outbuf, cache_mode);
+  else {
+    s = gcry_sexp_nth_data(req, 2, &n);
+    if (!s || !n) return GPG_ERR_INV_DATA;
+    if (n > MAXLEN_CIPHERTEXT) return GPG_ERR_TOO_LARGE;
+
+    err = agent_pkdecrypt(ctrl, desc, (const unsigned char *)s, n, outbuf,
+                          r_padding);
+  }
+
+  return err;
+}
+
+/* A single PKBATCH request and its result.  */
+struct pkbatch_job_s {
+  gcry_sexp_t req;
+  gpg_error_t err;
+  int padding;
+  membuf_t outbuf;
+};
+
+/* The worker pool of one PKBATCH command.  The workers process the
+   requests without user interaction and append the index of each
+   finished request to FINISHED.  */
+struct pkbatch_pool_s {
+  std::vector<pkbatch_job_s> *jobs = nullptr;
+  const char *cache_nonce = nullptr;
+  cache_mode_t cache_mode = CACHE_MODE_NORMAL;
+  unsigned long s2k_count = 0;
+  std::atomic<size_t> next{0};
+  std::atomic<bool> stop{false};
+  std::mutex lock;
+  std::condition_variable cond;
+  std::vector<size_t> finished;
+};
+
+/* The worker thread of the PKBATCH pool.  Requests for keys which
+   are not in the clear and whose passphrase is not cached fail with
+   GPG_ERR_EWOULDBLOCK; they are later processed by the connection
+   thread which is able to run the pinentry.  */
+static void pkbatch_worker(struct pkbatch_pool_s *pool) {
+  std::vector<pkbatch_job_s> &jobs = *pool->jobs;
+  struct server_control_s wctrl;
+  size_t idx;
+
+  memset(&wctrl, 0, sizeof wctrl);
+  wctrl.cache_only = 1;
+  wctrl.s2k_count = pool->s2k_count;
+
+  while (!pool->stop && (idx = pool->next++) < jobs.size()) {
+    struct pkbatch_job_s &job = jobs[idx];
+
+    job.err = process_pkbatch_request(&wctrl, job.req, pool->cache_nonce, NULL,
+                                      pool->cache_mode, &job.outbuf,
+                                      &job.padding);
+    {
+      std::lock_guard<std::mutex> lock(pool->lock);
+      pool->finished.push_back(idx);
+    }
+    pool->cond.notify_all();
+  }
+
+  wipememory(&wctrl, sizeof wctrl);
+}
+
+static const char hlp_pkbatch[] =
+    "PKBATCH [<options>] [<cache_nonce>]\n"
+    "\n"
+    "Perform a list of sign and decrypt operations in one go.  The\n"
+    "requests are inquired with the keyword PKBATCH as a concatenation\n"
+    "of canonical S-expressions of the forms\n"
+    "\n"
+    "  (4:sign <hexkeygrip> <algonumber> <hashvalue>)\n"
+    "  (7:decrypt <hexkeygrip> <ciphertext>)\n"
+    "\n"
+    "where <ciphertext> is the canonical encoded ciphertext as used by\n"
+    "PKDECRYPT.  For each request one data record\n"
+    "\n"
+    "  (6:result <index> <errorcode> <padding> <value>)\n"
+    "\n"
+    "is sent back as soon as the operation has finished.  <value> is the\n"
+    "canonical S-expression which would be returned by PKSIGN or\n"
+    "PKDECRYPT and empty on error.  A failed request does not abort the\n"
+    "batch.  A description set with SETKEYDESC is used for all requests.\n"
+    "The records are sent as soon as the operations have finished and\n"
+    "thus not necessarily in the order of the requests.  Requests which\n"
+    "need user interaction, for example to ask for a passphrase, are\n"
+    "processed after all other requests.";
+static gpg_error_t cmd_pkbatch(assuan_context_t ctx, char *line) {
+  gpg_error_t rc;
+  ctrl_t ctrl = (ctrl_t)assuan_get_pointer(ctx);
+  cache_mode_t cache_mode = CACHE_MODE_NORMAL;
+  unsigned char *value = NULL;
+  size_t valuelen, off, n;
+  char *cache_nonce = NULL;
+  std::vector<pkbatch_job_s> jobs;
+  std::vector<std::thread> workers;
+  std::vector<size_t> deferred;
+  struct pkbatch_pool_s pool;
+  unsigned int idx;
+  size_t i;
+  char *p;
+
+  line = skip_options(line);
+
+  for (p = line; *p && *p != ' ' && *p != '\t'; p++)
+    ;
+  *p = '\0';
+  if (*line) cache_nonce = xtrystrdup(line);
+
+  if (opt.ignore_cache_for_signing)
+    cache_mode = CACHE_MODE_IGNORE;
+  else if (!ctrl->server_local->use_cache_for_signing)
+    cache_mode = CACHE_MODE_IGNORE;
+
+  rc = print_assuan_status(ctx, "INQUIRE_MAXLEN", "%u", MAXLEN_PKBATCH);
+  if (!rc)
+    rc = assuan_inquire(ctx, "PKBATCH", &value, &valuelen, MAXLEN_PKBATCH);
+  if (rc) goto leave;
+
+  for (off = 0; off < valuelen; off += n) {
+    struct pkbatch_job_s job;
+
+    n = gcry_sexp_canon_len(value + off, valuelen - off, NULL, &rc);
+    if (!n) {
+      rc = set_error(GPG_ERR_INV_SEXP, "invalid batch request");
+      goto leave;
+    }
+    memset(&job, 0, sizeof job);
+    rc = gcry_sexp_sscan(&job.req, NULL, (const char *)value + off, n);
+    if (rc) goto leave;
+    job.padding = -1;
+    init_membuf(&job.outbuf, 512);
+    jobs.push_back(job);
+  }
+
+  /* Let the worker pool process all requests which can be done
+     without user interaction, so that a pending pinentry does not
+     delay them.  A single request is directly processed.  */
+  if (jobs.size() > 1) {
+    unsigned int nworkers;
+
+    nworkers = std::min<unsigned int>(
+        std::max(std::thread::hardware_concurrency(), 1u), MAX_PKBATCH_WORKERS);
+    nworkers = std::min<size_t>(nworkers, jobs.size());
+    pool.jobs = &jobs;
+    pool.cache_nonce = cache_nonce;
+    pool.cache_mode = cache_mode;
+    pool.s2k_count = ctrl->s2k_count;
+    for (i = 0; i < nworkers; i++)
+      workers.push_back(std::thread(pkbatch_worker, &pool));
+
+    for (i = 0; i < jobs.size(); i++) {
+      std::unique_lock<std::mutex> lock(pool.lock);
+
+      pool.cond.wait(lock, [&pool, i] { return pool.finished.size() > i; });
+      idx = pool.finished[i];
+      lock.unlock();
+
+      if (jobs[idx].err == GPG_ERR_EWOULDBLOCK) {
+        deferred.push_back(idx);
+        continue;
+      }
+      if (jobs[idx].err)
+        log_info("PKBATCH request %u failed: %s\n", idx,
+                 gpg_strerror(jobs[idx].err));
+      rc = write_pkbatch_result(ctx, idx, jobs[idx].err, jobs[idx].padding,
+                                &jobs[idx].outbuf);
+      if (rc) goto leave;
+    }
+    std::sort(deferred.begin(), deferred.end());
+  } else
+    for (idx = 0; idx < jobs.size(); idx++) deferred.push_back(idx);
+
+  /* Now process the remaining requests which may run the pinentry.  */
+  for (i = 0; i < deferred.size(); i++) {
+    struct pkbatch_job_s &job = jobs[deferred[i]];
+
+    clear_outbuf(&job.outbuf);
+    init_membuf(&job.outbuf, 512);
+    job.err = process_pkbatch_request(ctrl, job.req, cache_nonce,
+                                      ctrl->server_local->keydesc, cache_mode,
+                                      &job.outbuf, &job.padding);
+    if (job.err)
+      log_info("PKBATCH request %u failed: %s\n", (unsigned int)deferred[i],
+               gpg_strerror(job.err));
+
+    rc = write_pkbatch_result(ctx, deferred[i], job.err, job.padding,
+                              &job.outbuf);
+    if (rc) goto leave;
+  }
+
+leave:
+  pool.stop = true;
+  for (i = 0; i < workers.size(); i++) workers[i].join();
+  for (i = 0; i < jobs.size(); i++) {
+    gcry_sexp_release(jobs[i].req);
+    clear_outbuf(&jobs[i].outbuf);
+  }
+
+  /* Do not leave the last keygrip or digest of the batch behind.  */
+  ctrl->have_keygrip = 0;
+  wipememory(&ctrl->digest, sizeof ctrl->digest);
+  xfree(value);
+  xfree(cache_nonce);
+  xfree(ctrl->server_local->keydesc);
+  ctrl->server_local->keydesc = NULL;
+  return leave_cmd(ctx, rc);
+}
+
 static const char hlp_genkey[] =
     "GENKEY [--no-protection] [--inq-passwd]\n"
     "       [--passwd-nonce=<s>] [<cache_nonce>]\n"
@@ -806,7 +1146,7 @@ static const char hlp_keyinfo[] =
     "More information may be added in the future.";
 static gpg_error_t do_one_keyinfo(ctrl_t ctrl, const unsigned char *grip,
                                   assuan_context_t ctx, int data, int ttl,
-                                  int disabled, int confirm) {
+                                  int disabled, int confirm, int listing) {
   gpg_error_t err;
   char hexgrip[40 + 1];
   char *fpr = NULL;
@@ -822,7 +1162,8 @@ static gpg_error_t do_one_keyinfo(ctrl_t ctrl, const unsigned char *grip,
   char ttlbuf[20];
   char flagsbuf[5];
 
-  err = agent_key_info_from_file(ctrl, grip, &keytype, &shadow_info);
+  err = agent_key_info_from_file(ctrl, grip, listing, &keytype,
+                                 &shadow_info);
   if (err) goto leave;
 
   /* Reformat the grip so that we use uppercase as good style. */
@@ -908,10 +1249,8 @@ static gpg_error_t cmd_keyinfo(assuan_context_t ctx, char *line) {
   ctrl_t ctrl = (ctrl_t)assuan_get_pointer(ctx);
   int err;
   unsigned char grip[20];
-  DIR *dir = NULL;
   int list_mode;
   int opt_data;
-  char hexgrip[41];
   int disabled, ttl, confirm;
 
   list_mode = has_option(line, "--list");
@@ -919,47 +1258,30 @@ static gpg_error_t cmd_keyinfo(assuan_context_t ctx, char *line) {
   line = skip_options(line);
 
   if (list_mode) {
-    char *dirname;
-    struct dirent *dir_entry;
-
-    dirname = make_filename_try(gnupg_homedir(), GNUPG_PRIVATE_KEYS_DIR, NULL);
-    if (!dirname) {
-      err = gpg_error_from_syserror();
-      goto leave;
-    }
-    dir = opendir(dirname);
-    if (!dir) {
-      err = gpg_error_from_syserror();
-      xfree(dirname);
-      goto leave;
-    }
-    xfree(dirname);
+    unsigned char *grips;
+    size_t ngrips, i;
 
-    while ((dir_entry = readdir(dir))) {
-      if (strlen(dir_entry->d_name) != 44 ||
-          strcmp(dir_entry->d_name + 40, ".key"))
-        continue;
-      strncpy(hexgrip, dir_entry->d_name, 40);
-      hexgrip[40] = 0;
-
-      if (hex2bin(hexgrip, grip, 20) < 0) continue; /* Bad hex string.  */
+    err = agent_keyindex_list(&grips, &ngrips);
+    if (err) goto leave;
 
+    for (i = 0; i < ngrips; i++) {
       disabled = ttl = confirm = 0;
 
-      err = do_one_keyinfo(ctrl, grip, ctx, opt_data, ttl, disabled, confirm);
-      if (err) goto leave;
+      err = do_one_keyinfo(ctrl, grips + 20 * i, ctx, opt_data, ttl, disabled,
+                           confirm, 1);
+      if (err) break;
     }
-    err = 0;
+    xfree(grips);
   } else {
     err = parse_keygrip(ctx, line, grip);
     if (err) goto leave;
     disabled = ttl = confirm = 0;
 
-    err = do_one_keyinfo(ctrl, grip, ctx, opt_data, ttl, disabled, confirm);
+    err = do_one_keyinfo(ctrl, grip, ctx, opt_data, ttl, disabled, confirm,
+                         0);
   }
 
 leave:
-  if (dir) closedir(dir);
   if (err && err != GPG_ERR_NOT_FOUND) leave_cmd(ctx, err);
   return err;
 }
@@ -1802,6 +2124,7 @@ static int register_commands(assuan_context_t ctx) {
                {"SETHASH", cmd_sethash, hlp_sethash},
                {"PKSIGN", cmd_pksign, hlp_pksign},
                {"PKDECRYPT", cmd_pkdecrypt, hlp_pkdecrypt},
+               {"PKBATCH", cmd_pkbatch, hlp_pkbatch},
                {"GENKEY", cmd_genkey, hlp_genkey},
                {"READKEY", cmd_readkey, hlp_readkey},
                {"GET_PASSPHRASE", cmd_get_passphrase, hlp_get_passphrase},
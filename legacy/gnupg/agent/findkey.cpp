@@ -124,6 +124,8 @@ int agent_write_private_key(const unsigned char *grip, const void *buffer,
   char hexgrip[40 + 4 + 1];
 
   bin2hex(grip, 20, hexgrip);
+  agent_keyindex_invalidate(grip);
+
   strcpy(hexgrip + 40, ".key");
 
   fname = make_filename(gnupg_homedir(), GNUPG_PRIVATE_KEYS_DIR, hexgrip, NULL);
@@ -546,6 +548,8 @@ static gpg_error_t read_key_file(const unsigned char *grip,
 
   *result = NULL;
 
+  if (!agent_keyindex_get_key(grip, result)) return 0;
+
   bin2hex(grip, 20, hexgrip);
   strcpy(hexgrip + 40, ".key");
 
@@ -559,6 +563,14 @@ static gpg_error_t read_key_file(const unsigned char *grip,
     return rc;
   }
 
+  if (fstat(es_fileno(fp), &st)) {
+    rc = gpg_error_from_syserror();
+    log_error("can't stat '%s': %s\n", fname, strerror(errno));
+    xfree(fname);
+    es_fclose(fp);
+    return rc;
+  }
+
   if (es_fread(&first, 1, 1, fp) != 1) {
     rc = gpg_error_from_syserror();
     log_error("error reading first byte from '%s': %s\n", fname,
@@ -593,20 +605,14 @@ static gpg_error_t read_key_file(const unsigned char *grip,
       if (rc)
         log_error("error getting private key from '%s': %s\n", fname,
                   gpg_strerror(rc));
+      else
+        agent_keyindex_put_key(grip, &st, *result);
     }
 
     xfree(fname);
     return rc;
   }
 
-  if (fstat(es_fileno(fp), &st)) {
-    rc = gpg_error_from_syserror();
-    log_error("can't stat '%s': %s\n", fname, strerror(errno));
-    xfree(fname);
-    es_fclose(fp);
-    return rc;
-  }
-
   buflen = st.st_size;
   buf = (unsigned char *)xtrymalloc(buflen + 1);
   if (!buf) {
@@ -639,6 +645,7 @@ static gpg_error_t read_key_file(const unsigned char *grip,
               gpg_strerror(rc));
     return rc;
   }
+  agent_keyindex_put_key(grip, &st, s_skey);
   *result = s_skey;
   return 0;
 }
@@ -650,6 +657,7 @@ static gpg_error_t remove_key_file(const unsigned char *grip) {
   char hexgrip[40 + 4 + 1];
 
   bin2hex(grip, 20, hexgrip);
+  agent_keyindex_invalidate(grip);
   strcpy(hexgrip + 40, ".key");
   fname = make_filename(gnupg_homedir(), GNUPG_PRIVATE_KEYS_DIR, hexgrip, NULL);
   if (gnupg_remove(fname)) err = gpg_error_from_syserror();
@@ -740,7 +748,7 @@ gpg_error_t agent_key_from_file(ctrl_t ctrl, const char *cache_nonce,
       if (!rc) {
         rc = unprotect(ctrl, cache_nonce, desc_text_final, &buf, grip,
                        cache_mode, lookup_ttl, r_passphrase);
-        if (rc)
+        if (rc && rc != GPG_ERR_EWOULDBLOCK)
           log_error("failed to unprotect the secret key: %s\n",
                     gpg_strerror(rc));
       }
@@ -748,7 +756,9 @@ gpg_error_t agent_key_from_file(ctrl_t ctrl, const char *cache_nonce,
       xfree(desc_text_final);
     } break;
     case PRIVATE_KEY_SHADOWED:
-      if (shadow_info) {
+      if (ctrl->cache_only)
+        rc = GPG_ERR_EWOULDBLOCK; /* The scdaemon may ask for a PIN.  */
+      else if (shadow_info) {
         const unsigned char *s;
         size_t n;
 
@@ -1079,25 +1089,17 @@ gpg_error_t agent_public_key_from_file(ctrl_t ctrl, const unsigned char *grip,
 /* Check whether the secret key identified by GRIP is available.
    Returns 0 is the key is available.  */
 int agent_key_available(const unsigned char *grip) {
-  int result;
-  char *fname;
-  char hexgrip[40 + 4 + 1];
-
-  bin2hex(grip, 20, hexgrip);
-  strcpy(hexgrip + 40, ".key");
-
-  fname = make_filename(gnupg_homedir(), GNUPG_PRIVATE_KEYS_DIR, hexgrip, NULL);
-  result = !access(fname, R_OK) ? 0 : -1;
-  xfree(fname);
-  return result;
+  return agent_keyindex_available(grip);
 }
 
 /* Return the information about the secret key specified by the binary
    keygrip GRIP.  If the key is a shadowed one the shadow information
    will be stored at the address R_SHADOW_INFO as an allocated
-   S-expression.  */
+   S-expression.  LISTING is set if GRIP has just been returned by
+   agent_keyindex_list; cached information is then used without
+   checking the key file.  */
 gpg_error_t agent_key_info_from_file(ctrl_t ctrl, const unsigned char *grip,
-                                     int *r_keytype,
+                                     int listing, int *r_keytype,
                                      unsigned char **r_shadow_info) {
   gpg_error_t err;
   unsigned char *buf;
@@ -1109,6 +1111,11 @@ gpg_error_t agent_key_info_from_file(ctrl_t ctrl, const unsigned char *grip,
   if (r_keytype) *r_keytype = PRIVATE_KEY_UNKNOWN;
   if (r_shadow_info) *r_shadow_info = NULL;
 
+  if (!agent_keyindex_get_info(grip, listing, &keytype, r_shadow_info)) {
+    if (r_keytype) *r_keytype = keytype;
+    return 0;
+  }
+
   {
     gcry_sexp_t sexp;
 
@@ -1155,7 +1162,11 @@ gpg_error_t agent_key_info_from_file(ctrl_t ctrl, const unsigned char *grip,
       break;
   }
 
-  if (!err && r_keytype) *r_keytype = keytype;
+  if (!err) {
+    if (r_keytype) *r_keytype = keytype;
+    agent_keyindex_put_info(grip, keytype,
+                            r_shadow_info ? *r_shadow_info : NULL);
+  }
 
   xfree(buf);
   return err;
@@ -0,0 +1,364 @@
+/* keyindex.cpp - In-memory index of the private key directory
+ * Copyright (C) 2018 The NeoPG developers
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* The index avoids scanning the private key directory and reading
+   and parsing the key files for each KEYINFO, HAVEKEY or public key
+   request.  The directory listing is reused as long as the
+   modification time of the directory does not change.  The parsed
+   key files are reused as long as the inode, size and modification
+   time of the file do not change.  To cope with the one second
+   resolution of the modification time, nothing is cached for files
+   or directories which have been modified within the last second.
+   KEYINFO --list trusts the cached key information as long as the
+   directory is unchanged, thus a key file which another program
+   rewrites in place is only noticed by the next lookup of that key.
+   Note that the S-expressions of unprotected keys are never cached
+   so that no plaintext secret keys are kept in memory.  */
+
+#include <config.h>
+
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "agent.h"
+
+/* Information about one key file.  */
+struct keyindex_entry_s {
+  /* The file attributes at the time the file was read.  */
+  ino_t ino;
+  off_t size;
+  time_t mtime;
+
+  /* The value of DIR_SCAN when the attributes were last checked.  */
+  unsigned int scan;
+
+  /* The parsed key file or NULL if the key is not protected.  */
+  gcry_sexp_t key;
+
+  /* The key type or PRIVATE_KEY_UNKNOWN if not yet known.  */
+  int keytype;
+
+  /* The canonical encoded shadow info of a shadowed key.  */
+  std::string shadow_info;
+};
+
+/* A mutex used to serialize access to the index.  */
+static std::mutex keyindex_lock;
+
+/* The keygrips of all key files in the private key directory as
+   uppercase hex strings, valid only if DIR_VALID is set.  */
+static std::set<std::string> dir_grips;
+static int dir_valid;
+static time_t dir_mtime;
+
+/* Counts the scans of the private key directory.  */
+static unsigned int dir_scan;
+
+/* The cached key files indexed by the uppercase hex keygrip.  */
+static std::map<std::string, keyindex_entry_s> file_cache;
+
+/* Return true if a file with the modification time MTIME may be
+   cached.  */
+static int cacheable_mtime(time_t mtime) {
+  return mtime < gnupg_get_time() - 1;
+}
+
+/* Return the file name of the private key directory or with GRIP
+   given of the key file.  Returns NULL on error.  */
+static char *key_file_name(const unsigned char *grip) {
+  char hexgrip[40 + 4 + 1];
+
+  if (!grip)
+    return make_filename_try(gnupg_homedir(), GNUPG_PRIVATE_KEYS_DIR, NULL);
+
+  bin2hex(grip, 20, hexgrip);
+  strcpy(hexgrip + 40, ".key");
+  return make_filename_try(gnupg_homedir(), GNUPG_PRIVATE_KEYS_DIR, hexgrip,
+                           NULL);
+}
+
+/* Make sure that DIR_GRIPS reflects the private key directory.  The
+   caller must hold KEYINDEX_LOCK.  */
+static gpg_error_t update_dir_index(void) {
+  gpg_error_t err;
+  char *dirname;
+  struct stat st;
+  DIR *dir;
+  struct dirent *dir_entry;
+  unsigned char grip[20];
+  char hexgrip[40 + 1];
+
+  dirname = key_file_name(NULL);
+  if (!dirname) return gpg_error_from_syserror();
+
+  if (stat(dirname, &st)) {
+    err = gpg_error_from_syserror();
+    xfree(dirname);
+    dir_valid = 0;
+    return err;
+  }
+  if (dir_valid && st.st_mtime == dir_mtime) {
+    xfree(dirname);
+    return 0;
+  }
+
+  dir = opendir(dirname);
+  if (!dir) {
+    err = gpg_error_from_syserror();
+    xfree(dirname);
+    dir_valid = 0;
+    return err;
+  }
+  xfree(dirname);
+
+  dir_grips.clear();
+  while ((dir_entry = readdir(dir))) {
+    if (strlen(dir_entry->d_name) != 44 ||
+        strcmp(dir_entry->d_name + 40, ".key"))
+      continue;
+    if (hex2bin(dir_entry->d_name, grip, 20) < 0) continue; /* Bad hex.  */
+    bin2hex(grip, 20, hexgrip);
+    dir_grips.insert(hexgrip);
+  }
+  closedir(dir);
+
+  dir_mtime = st.st_mtime;
+  dir_valid = cacheable_mtime(st.st_mtime);
+  dir_scan++;
+  if (DBG_CACHE)
+    log_debug("keyindex: %u keys in directory%s\n",
+              (unsigned int)dir_grips.size(), dir_valid ? "" : " (volatile)");
+  return 0;
+}
+
+/* Return the cache entry for GRIP if the key file has not been
+   changed since it was stored.  With TRUST_DIR set, the key file
+   itself is not checked if that has been done since the last scan of
+   a valid directory index.  The caller must hold KEYINDEX_LOCK.  */
+static keyindex_entry_s *lookup_file(const unsigned char *grip,
+                                     int trust_dir) {
+  char hexgrip[40 + 1];
+  char *fname;
+  struct stat st;
+  int rc;
+
+  bin2hex(grip, 20, hexgrip);
+  auto it = file_cache.find(hexgrip);
+  if (it == file_cache.end()) return NULL;
+  if (trust_dir && dir_valid && it->second.scan == dir_scan)
+    return &it->second;
+
+  fname = key_file_name(grip);
+  if (!fname) return NULL;
+  rc = stat(fname, &st);
+  xfree(fname);
+
+  if (rc || st.st_ino != it->second.ino || st.st_size != it->second.size ||
+      st.st_mtime != it->second.mtime) {
+    gcry_sexp_release(it->second.key);
+    file_cache.erase(it);
+    return NULL;
+  }
+  it->second.scan = dir_scan;
+  return &it->second;
+}
+
+/* Return 0 if the key file for GRIP exists in the private key
+   directory and is readable and -1 otherwise.  */
+int agent_keyindex_available(const unsigned char *grip) {
+  char hexgrip[40 + 1];
+  char *fname;
+  int result;
+
+  {
+    std::lock_guard<std::mutex> lock(keyindex_lock);
+
+    if (update_dir_index()) return -1;
+
+    bin2hex(grip, 20, hexgrip);
+    if (!dir_grips.count(hexgrip)) return -1;
+  }
+
+  /* The index only saves the lookup of missing keys.  */
+  fname = key_file_name(grip);
+  if (!fname) return -1;
+  result = !access(fname, R_OK) ? 0 : -1;
+  xfree(fname);
+  return result;
+}
+
+/* Store an array with the keygrips of all keys in the private key
+   directory at R_GRIPS and their number at R_NGRIPS.  The caller
+   needs to release the array.  */
+gpg_error_t agent_keyindex_list(unsigned char **r_grips, size_t *r_ngrips) {
+  gpg_error_t err;
+  unsigned char *grips;
+  size_t n;
+
+  *r_grips = NULL;
+  *r_ngrips = 0;
+
+  std::lock_guard<std::mutex> lock(keyindex_lock);
+
+  err = update_dir_index();
+  if (err) return err;
+
+  grips = (unsigned char *)xtrymalloc(20 * dir_grips.size() + 1);
+  if (!grips) return gpg_error_from_syserror();
+
+  n = 0;
+  for (const std::string &hexgrip : dir_grips)
+    hex2bin(hexgrip.c_str(), grips + 20 * n++, 20);
+
+  *r_grips = grips;
+  *r_ngrips = n;
+  return 0;
+}
+
+/* Store a copy of the cached key file for GRIP at R_KEY.  Returns
+   GPG_ERR_NOT_FOUND if the key file is not cached or has been
+   changed.  */
+gpg_error_t agent_keyindex_get_key(const unsigned char *grip,
+                                   gcry_sexp_t *r_key) {
+  keyindex_entry_s *entry;
+
+  *r_key = NULL;
+
+  std::lock_guard<std::mutex> lock(keyindex_lock);
+
+  entry = lookup_file(grip, 0);
+  if (!entry || !entry->key) return GPG_ERR_NOT_FOUND;
+  return gcry_sexp_build(r_key, NULL, "%S", entry->key);
+}
+
+/* Remember the key file for GRIP which has been parsed into KEY.  ST
+   are the attributes of the file at the time it was read.  Only the
+   attributes are stored for unprotected keys.  */
+void agent_keyindex_put_key(const unsigned char *grip, const struct stat *st,
+                            gcry_sexp_t key) {
+  char hexgrip[40 + 1];
+  gcry_sexp_t list;
+  keyindex_entry_s entry;
+
+  if (!cacheable_mtime(st->st_mtime)) return;
+
+  entry.ino = st->st_ino;
+  entry.size = st->st_size;
+  entry.mtime = st->st_mtime;
+  entry.key = NULL;
+  entry.keytype = PRIVATE_KEY_UNKNOWN;
+
+  list = gcry_sexp_find_token(key, "protected-private-key", 0);
+  if (!list) list = gcry_sexp_find_token(key, "shadowed-private-key", 0);
+  if (list) {
+    gcry_sexp_release(list);
+    if (gcry_sexp_build(&entry.key, NULL, "%S", key)) entry.key = NULL;
+  }
+
+  bin2hex(grip, 20, hexgrip);
+
+  std::lock_guard<std::mutex> lock(keyindex_lock);
+
+  entry.scan = dir_scan;
+  auto it = file_cache.find(hexgrip);
+  if (it != file_cache.end()) {
+    gcry_sexp_release(it->second.key);
+    it->second = entry;
+  } else
+    file_cache[hexgrip] = entry;
+}
+
+/* Store the cached key type of GRIP at R_KEYTYPE and, if R_SHADOW_INFO
+   is not NULL, a copy of the shadow info of a shadowed key at
+   R_SHADOW_INFO.  Returns GPG_ERR_NOT_FOUND if this information is
+   not cached.  With TRUST_DIR set, the key file is not checked for
+   changes while the directory is unchanged since the last call of
+   agent_keyindex_list.  */
+gpg_error_t agent_keyindex_get_info(const unsigned char *grip, int trust_dir,
+                                    int *r_keytype,
+                                    unsigned char **r_shadow_info) {
+  keyindex_entry_s *entry;
+
+  std::lock_guard<std::mutex> lock(keyindex_lock);
+
+  entry = lookup_file(grip, trust_dir);
+  if (!entry || entry->keytype == PRIVATE_KEY_UNKNOWN) return GPG_ERR_NOT_FOUND;
+
+  if (r_shadow_info && entry->keytype == PRIVATE_KEY_SHADOWED) {
+    *r_shadow_info = (unsigned char *)xtrymalloc(entry->shadow_info.size());
+    if (!*r_shadow_info) return gpg_error_from_syserror();
+    memcpy(*r_shadow_info, entry->shadow_info.data(),
+           entry->shadow_info.size());
+  }
+  *r_keytype = entry->keytype;
+  return 0;
+}
+
+/* Add the key type KEYTYPE and for shadowed keys the canonical encoded
+   SHADOW_INFO to the cache entry of GRIP.  This has no effect if the
+   key file is not cached.  */
+void agent_keyindex_put_info(const unsigned char *grip, int keytype,
+                             const unsigned char *shadow_info) {
+  keyindex_entry_s *entry;
+  size_t n;
+
+  if (keytype == PRIVATE_KEY_SHADOWED && !shadow_info) return;
+
+  std::lock_guard<std::mutex> lock(keyindex_lock);
+
+  entry = lookup_file(grip, 0);
+  if (!entry) return;
+
+  if (keytype == PRIVATE_KEY_SHADOWED) {
+    n = gcry_sexp_canon_len(shadow_info, 0, NULL, NULL);
+    if (!n) return;
+    entry->shadow_info.assign((const char *)shadow_info, n);
+  }
+  entry->keytype = keytype;
+}
+
+/* Forget everything about GRIP.  This needs to be called whenever the
+   agent writes or removes a key file.  */
+void agent_keyindex_invalidate(const unsigned char *grip) {
+  char hexgrip[40 + 1];
+
+  bin2hex(grip, 20, hexgrip);
+
+  std::lock_guard<std::mutex> lock(keyindex_lock);
+
+  dir_valid = 0;
+  auto it = file_cache.find(hexgrip);
+  if (it != file_cache.end()) {
+    gcry_sexp_release(it->second.key);
+    file_cache.erase(it);
+  }
+}
@@ -0,0 +1,238 @@
+/* Tests for the index of the private key directory
+   Copyright 2018 The NeoPG developers
+
+   NeoPG is released under the Simplified BSD License (see license.txt)
+*/
+
+#include <config.h>
+
+#include "gtest/gtest.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <string>
+
+#include "../common/util.h"
+#include "agent.h"
+
+#include "legacy_environment.h"
+
+using namespace NeoPG;
+
+namespace {
+
+const char PROTECTED_KEY[] = "(21:protected-private-key(3:rsa(1:n1:A)))";
+const char CLEAR_KEY[] = "(11:private-key(3:rsa(1:n1:A)))";
+
+/* Set the access and modification time of FNAME to WHEN.  */
+void set_mtime(const std::string &fname, time_t when) {
+  struct timeval tv[2];
+
+  tv[0].tv_sec = tv[1].tv_sec = when;
+  tv[0].tv_usec = tv[1].tv_usec = 0;
+  ASSERT_EQ(utimes(fname.c_str(), tv), 0) << fname;
+}
+
+/* Switch to a fresh home directory with an empty private key
+   directory, and restore the home directory and reset the index
+   afterwards.  */
+class KeyDirectory {
+ public:
+  KeyDirectory() : m_homedir(gnupg_homedir()) {
+    gnupg_set_homedir(m_dir.path().c_str());
+    path = m_dir.path() + "/" + GNUPG_PRIVATE_KEYS_DIR;
+    mkdir(path.c_str(), 0700);
+  }
+
+  ~KeyDirectory() {
+    for (unsigned char c : {0x11, 0x22, 0x33}) {
+      unsigned char grip[20];
+      memset(grip, c, sizeof grip);
+      agent_keyindex_invalidate(grip);
+    }
+    gnupg_set_homedir(m_homedir.c_str());
+  }
+
+  /* Return the name of the key file for GRIP.  */
+  std::string key_file(const unsigned char *grip) {
+    char hexgrip[40 + 1];
+
+    bin2hex(grip, 20, hexgrip);
+    return path + "/" + hexgrip + ".key";
+  }
+
+  std::string path;
+
+ private:
+  TemporaryDirectory m_dir;
+  std::string m_homedir;
+};
+
+/* Write DATA to the key file FNAME with the modification time WHEN
+   and store its attributes at R_ST.  */
+void write_key(const std::string &fname, const std::string &data,
+               time_t when, struct stat &r_st) {
+  std::ofstream(fname, std::ios::binary) << data;
+  ASSERT_NO_FATAL_FAILURE(set_mtime(fname, when));
+  ASSERT_EQ(stat(fname.c_str(), &r_st), 0);
+}
+
+/* Parse the key file DATA and remember it in the index for GRIP.  */
+void put_key(const unsigned char *grip, const std::string &data,
+             const struct stat &st) {
+  gcry_sexp_t key;
+
+  ASSERT_EQ(gcry_sexp_sscan(&key, NULL, data.data(), data.size()), 0);
+  agent_keyindex_put_key(grip, &st, key);
+  gcry_sexp_release(key);
+}
+
+/* Return the key type cached for GRIP or -1 on a miss.  */
+int get_info(const unsigned char *grip, int trust_dir) {
+  int keytype;
+
+  if (agent_keyindex_get_info(grip, trust_dir, &keytype, NULL)) return -1;
+  return keytype;
+}
+
+}  // namespace
+
+TEST(NeopgLegacyTest, agent_keyindex_available_test) {
+  KeyDirectory dir;
+  time_t past = time(NULL) - 100;
+  unsigned char grip1[20], grip2[20], grip3[20];
+  struct stat st;
+
+  memset(grip1, 0x11, sizeof grip1);
+  memset(grip2, 0x22, sizeof grip2);
+  memset(grip3, 0x33, sizeof grip3);
+  ASSERT_NO_FATAL_FAILURE(
+      write_key(dir.key_file(grip1), PROTECTED_KEY, past, st));
+  ASSERT_NO_FATAL_FAILURE(
+      write_key(dir.key_file(grip2), CLEAR_KEY, past, st));
+  /* Names which are no keygrips are ignored, and a dangling link is
+     listed but not available.  */
+  std::ofstream(dir.path + "/junk.key") << "junk";
+  std::ofstream(dir.path + "/" + std::string(40, 'Z') + ".key") << "junk";
+  ASSERT_EQ(symlink("missing", dir.key_file(grip3).c_str()), 0);
+  ASSERT_NO_FATAL_FAILURE(set_mtime(dir.path, past));
+
+  ASSERT_EQ(agent_keyindex_available(grip1), 0);
+  ASSERT_EQ(agent_keyindex_available(grip2), 0);
+  ASSERT_EQ(agent_keyindex_available(grip3), -1);
+  grip3[0] = 0x44;
+  ASSERT_EQ(agent_keyindex_available(grip3), -1);
+  grip3[0] = 0x33;
+
+  /* A key file which can't be read is not available, even though the
+     directory listing is reused.  */
+  if (geteuid() != 0) {
+    ASSERT_EQ(chmod(dir.key_file(grip2).c_str(), 0), 0);
+    ASSERT_EQ(agent_keyindex_available(grip2), -1);
+    ASSERT_EQ(chmod(dir.key_file(grip2).c_str(), 0600), 0);
+    ASSERT_EQ(agent_keyindex_available(grip2), 0);
+  }
+
+  unsigned char *grips;
+  size_t ngrips;
+  ASSERT_EQ(agent_keyindex_list(&grips, &ngrips), 0);
+  ASSERT_EQ(ngrips, 3);
+  ASSERT_EQ(memcmp(grips, grip1, 20), 0);
+  ASSERT_EQ(memcmp(grips + 20, grip2, 20), 0);
+  ASSERT_EQ(memcmp(grips + 40, grip3, 20), 0);
+  xfree(grips);
+
+  /* Keys added by the agent are found after the invalidation, even
+     if the modification time of the directory did not change.  */
+  grip3[0] = 0x44;
+  ASSERT_NO_FATAL_FAILURE(
+      write_key(dir.key_file(grip3), PROTECTED_KEY, past, st));
+  ASSERT_NO_FATAL_FAILURE(set_mtime(dir.path, past));
+  ASSERT_EQ(agent_keyindex_available(grip3), -1);
+  agent_keyindex_invalidate(grip3);
+  ASSERT_EQ(agent_keyindex_available(grip3), 0);
+}
+
+TEST(NeopgLegacyTest, agent_keyindex_cache_test) {
+  KeyDirectory dir;
+  time_t past = time(NULL) - 100;
+  unsigned char grip1[20], grip2[20];
+  unsigned char *grips;
+  size_t ngrips;
+  gcry_sexp_t key;
+  struct stat st;
+
+  memset(grip1, 0x11, sizeof grip1);
+  memset(grip2, 0x22, sizeof grip2);
+  ASSERT_NO_FATAL_FAILURE(
+      write_key(dir.key_file(grip1), PROTECTED_KEY, past, st));
+  ASSERT_NO_FATAL_FAILURE(put_key(grip1, PROTECTED_KEY, st));
+  ASSERT_NO_FATAL_FAILURE(
+      write_key(dir.key_file(grip2), CLEAR_KEY, past, st));
+  ASSERT_NO_FATAL_FAILURE(put_key(grip2, CLEAR_KEY, st));
+  ASSERT_NO_FATAL_FAILURE(set_mtime(dir.path, past));
+
+  /* Protected keys are cached, unprotected keys are not.  */
+  ASSERT_EQ(agent_keyindex_get_key(grip1, &key), 0);
+  char buffer[100];
+  size_t len =
+      gcry_sexp_sprint(key, GCRYSEXP_FMT_CANON, buffer, sizeof buffer);
+  ASSERT_EQ(std::string(buffer, len), PROTECTED_KEY);
+  gcry_sexp_release(key);
+  ASSERT_EQ(agent_keyindex_get_key(grip2, &key), GPG_ERR_NOT_FOUND);
+  ASSERT_EQ(key, nullptr);
+
+  /* The key type is cached for both.  */
+  ASSERT_EQ(get_info(grip1, 0), -1);
+  agent_keyindex_put_info(grip1, PRIVATE_KEY_PROTECTED, NULL);
+  agent_keyindex_put_info(grip2, PRIVATE_KEY_CLEAR, NULL);
+  ASSERT_EQ(get_info(grip1, 0), PRIVATE_KEY_PROTECTED);
+  ASSERT_EQ(get_info(grip2, 0), PRIVATE_KEY_CLEAR);
+
+  /* Files which have just been modified are not cached.  */
+  ASSERT_NO_FATAL_FAILURE(
+      write_key(dir.key_file(grip2), CLEAR_KEY, time(NULL), st));
+  ASSERT_NO_FATAL_FAILURE(put_key(grip2, CLEAR_KEY, st));
+  agent_keyindex_put_info(grip2, PRIVATE_KEY_CLEAR, NULL);
+  ASSERT_EQ(get_info(grip2, 0), -1);
+
+  /* A key file rewritten in place is noticed by a lookup, but not
+     while listing an unchanged directory once the key has been
+     checked since the last scan.  */
+  ASSERT_EQ(agent_keyindex_list(&grips, &ngrips), 0);
+  xfree(grips);
+  ASSERT_EQ(get_info(grip1, 1), PRIVATE_KEY_PROTECTED);
+  ASSERT_NO_FATAL_FAILURE(write_key(
+      dir.key_file(grip1), std::string(PROTECTED_KEY) + " ", past, st));
+  ASSERT_EQ(get_info(grip1, 1), PRIVATE_KEY_PROTECTED);
+  ASSERT_EQ(get_info(grip1, 0), -1);
+  ASSERT_EQ(agent_keyindex_get_key(grip1, &key), GPG_ERR_NOT_FOUND);
+
+  /* A key file replaced by a rename changes the directory, and so is
+     noticed while listing.  */
+  ASSERT_NO_FATAL_FAILURE(put_key(grip1, PROTECTED_KEY, st));
+  agent_keyindex_put_info(grip1, PRIVATE_KEY_PROTECTED, NULL);
+  ASSERT_EQ(get_info(grip1, 1), PRIVATE_KEY_PROTECTED);
+  std::string tmpname = dir.path + "/new.tmp";
+  ASSERT_NO_FATAL_FAILURE(write_key(tmpname, PROTECTED_KEY, past, st));
+  ASSERT_EQ(rename(tmpname.c_str(), dir.key_file(grip1).c_str()), 0);
+  ASSERT_NO_FATAL_FAILURE(set_mtime(dir.path, past + 1));
+  ASSERT_EQ(agent_keyindex_list(&grips, &ngrips), 0);
+  ASSERT_EQ(ngrips, 2);
+  xfree(grips);
+  ASSERT_EQ(get_info(grip1, 1), -1);
+
+  /* The agent drops the entries of key files it changes.  */
+  ASSERT_EQ(stat(dir.key_file(grip1).c_str(), &st), 0);
+  ASSERT_NO_FATAL_FAILURE(put_key(grip1, PROTECTED_KEY, st));
+  ASSERT_EQ(agent_keyindex_get_key(grip1, &key), 0);
+  gcry_sexp_release(key);
+  agent_keyindex_invalidate(grip1);
+  ASSERT_EQ(agent_keyindex_get_key(grip1, &key), GPG_ERR_NOT_FOUND);
+}
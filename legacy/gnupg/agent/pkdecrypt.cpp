@@ -64,7 +64,8 @@ int agent_pkdecrypt(ctrl_t ctrl, const char *desc_text,
   rc = agent_key_from_file(ctrl, NULL, desc_text, ctrl->keygrip, &shadow_info,
                            CACHE_MODE_NORMAL, NULL, &s_skey, NULL);
   if (rc) {
-    if (rc != GPG_ERR_NO_SECKEY) log_error("failed to read the secret key\n");
+    if (rc != GPG_ERR_NO_SECKEY && rc != GPG_ERR_EWOULDBLOCK)
+      log_error("failed to read the secret key\n");
     goto leave;
   }
 
@@ -225,6 +225,47 @@ static int do_encode_raw_pkcs1(const byte *md, size_t mdlen, unsigned int nbits,
   return rc;
 }
 
+/* Sign the DATALEN bytes at DATA, which are interpreted according
+   to the digest info in CTRL, using the unprotected secret key
+   S_SKEY.  On success the signature is stored at R_SIG.  */
+static int sign_with_key(ctrl_t ctrl, const unsigned char *data, int datalen,
+                         gcry_sexp_t s_skey, gcry_sexp_t *r_sig) {
+  gcry_sexp_t s_hash = NULL;
+  int dsaalgo = 0;
+  int rc;
+
+  *r_sig = NULL;
+
+  /* Put the hash into a sexp */
+  if (agent_is_eddsa_key(s_skey))
+    rc = do_encode_eddsa(data, datalen, &s_hash);
+  else if (ctrl->digest.algo == MD_USER_TLS_MD5SHA1)
+    rc = do_encode_raw_pkcs1(data, datalen, gcry_pk_get_nbits(s_skey),
+                             &s_hash);
+  else if ((dsaalgo = agent_is_dsa_key(s_skey)))
+    rc = do_encode_dsa(data, datalen, dsaalgo, s_skey, &s_hash);
+  else
+    rc = do_encode_md(data, datalen, ctrl->digest.algo, &s_hash,
+                      ctrl->digest.raw_value);
+  if (rc) return rc;
+
+  if (DBG_CRYPTO) {
+    gcry_log_debugsxp("skey", s_skey);
+    gcry_log_debugsxp("hash", s_hash);
+  }
+
+  /* sign */
+  rc = gcry_pk_sign(r_sig, s_hash, s_skey);
+  gcry_sexp_release(s_hash);
+  if (rc) {
+    log_error("signing failed: %s\n", gpg_strerror(rc));
+    return rc;
+  }
+
+  if (DBG_CRYPTO) gcry_log_debugsxp("rslt", *r_sig);
+  return 0;
+}
+
 /* SIGN whatever information we have accumulated in CTRL and return
    the signature S-expression.  LOOKUP is an optional function to
    provide a way for lower layers to ask for the caching TTL.  If a
@@ -260,7 +301,8 @@ int agent_pksign_do(ctrl_t ctrl, const char *cache_nonce, const char *desc_text,
   rc = agent_key_from_file(ctrl, cache_nonce, desc_text, ctrl->keygrip,
                            &shadow_info, cache_mode, lookup_ttl, &s_skey, NULL);
   if (rc) {
-    if (rc != GPG_ERR_NO_SECKEY) log_error("failed to read the secret key\n");
+    if (rc != GPG_ERR_NO_SECKEY && rc != GPG_ERR_EWOULDBLOCK)
+      log_error("failed to read the secret key\n");
     goto leave;
   }
 
@@ -368,34 +410,8 @@ int agent_pksign_do(ctrl_t ctrl, const char *cache_nonce, const char *desc_text,
     }
   } else {
     /* No smartcard, but a private key */
-    int dsaalgo = 0;
-
-    /* Put the hash into a sexp */
-    if (agent_is_eddsa_key(s_skey))
-      rc = do_encode_eddsa(data, datalen, &s_hash);
-    else if (ctrl->digest.algo == MD_USER_TLS_MD5SHA1)
-      rc = do_encode_raw_pkcs1(data, datalen, gcry_pk_get_nbits(s_skey),
-                               &s_hash);
-    else if ((dsaalgo = agent_is_dsa_key(s_skey)))
-      rc = do_encode_dsa(data, datalen, dsaalgo, s_skey, &s_hash);
-    else
-      rc = do_encode_md(data, datalen, ctrl->digest.algo, &s_hash,
-                        ctrl->digest.raw_value);
+    rc = sign_with_key(ctrl, data, datalen, s_skey, &s_sig);
     if (rc) goto leave;
-
-    if (DBG_CRYPTO) {
-      gcry_log_debugsxp("skey", s_skey);
-      gcry_log_debugsxp("hash", s_hash);
-    }
-
-    /* sign */
-    rc = gcry_pk_sign(&s_sig, s_hash, s_skey);
-    if (rc) {
-      log_error("signing failed: %s\n", gpg_strerror(rc));
-      goto leave;
-    }
-
-    if (DBG_CRYPTO) gcry_log_debugsxp("rslt", s_sig);
   }
 
 leave:
@@ -410,31 +426,33 @@ leave:
   return rc;
 }
 
+/* Append the canonical encoding of S_SIG to OUTBUF.  */
+static void put_signature(membuf_t *outbuf, gcry_sexp_t s_sig) {
+  char *buf;
+  size_t len;
+
+  len = gcry_sexp_sprint(s_sig, GCRYSEXP_FMT_CANON, NULL, 0);
+  assert(len);
+  buf = (char *)xmalloc(len);
+  len = gcry_sexp_sprint(s_sig, GCRYSEXP_FMT_CANON, buf, len);
+  assert(len);
+
+  put_membuf(outbuf, buf, len);
+  xfree(buf);
+}
+
 /* SIGN whatever information we have accumulated in CTRL and write it
    back to OUTFP.  If a CACHE_NONCE is given that cache item is first
    tried to get a passphrase.  */
 int agent_pksign(ctrl_t ctrl, const char *cache_nonce, const char *desc_text,
                  membuf_t *outbuf, cache_mode_t cache_mode) {
   gcry_sexp_t s_sig = NULL;
-  char *buf = NULL;
-  size_t len = 0;
   int rc = 0;
 
   rc = agent_pksign_do(ctrl, cache_nonce, desc_text, &s_sig, cache_mode, NULL,
                        NULL, 0);
-  if (rc) goto leave;
+  if (!rc) put_signature(outbuf, s_sig);
 
-  len = gcry_sexp_sprint(s_sig, GCRYSEXP_FMT_CANON, NULL, 0);
-  assert(len);
-  buf = (char *)xmalloc(len);
-  len = gcry_sexp_sprint(s_sig, GCRYSEXP_FMT_CANON, buf, len);
-  assert(len);
-
-  put_membuf(outbuf, buf, len);
-
-leave:
   gcry_sexp_release(s_sig);
-  xfree(buf);
-
   return rc;
 }
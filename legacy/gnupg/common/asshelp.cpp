@@ -268,6 +268,12 @@ gpg_error_t start_new_gpg_agent(assuan_context_t *r_ctx,
     return err;
   }
 
+  /* Binary data frames are only an optimization; without them the
+     classic data lines are used.  */
+  err = assuan_negotiate_binary_data(ctx);
+  if (err && debug)
+    log_debug("agent does not support binary data: %s\n", gpg_strerror(err));
+
   *r_ctx = ctx;
   return 0;
 }
@@ -325,6 +331,11 @@ gpg_error_t start_new_dirmngr(assuan_context_t *r_ctx, int verbose, int debug) {
 
   if (debug) log_debug("connection to the dirmngr established\n");
 
+  err = assuan_negotiate_binary_data(ctx);
+  if (err && debug)
+    log_debug("dirmngr does not support binary data: %s\n",
+              gpg_strerror(err));
+
   *r_ctx = ctx;
   return 0;
 }
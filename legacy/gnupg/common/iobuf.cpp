@@ -49,16 +49,28 @@
 
 #include <assuan.h>
 
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
 #include "iobuf.h"
 #include "sysutils.h"
 #include "util.h"
 
 /*-- Begin configurable part.  --*/
 
-/* The size of the internal buffers.
-   NOTE: If you change this value you MUST also adjust the regression
-   test "armored_key_8192" in armor.test! */
-#define IOBUF_BUFFER_SIZE 8192
+/* The default size of the internal buffers.  It can be changed at
+   runtime with iobuf_set_buffer_size.  */
+#define DEFAULT_IOBUF_BUFFER_SIZE (64 * 1024)
+
+/* The limits for iobuf_set_buffer_size in kilobytes.  */
+#define MIN_IOBUF_BUFFER_SIZE 4
+#define MAX_IOBUF_BUFFER_SIZE (16 * 1024)
+
+/* The number of blocks a thread filter may hold before the writer
+   has to wait.  */
+#define MAX_THREAD_FILTER_BLOCKS 8
 
 /* To avoid a potential DoS with compression packets we better limit
    the number of filters in a chain.  */
@@ -76,6 +88,9 @@
 
 int iobuf_debug_mode;
 
+/* The size of the internal buffers of new filters.  */
+static size_t iobuf_buffer_size = DEFAULT_IOBUF_BUFFER_SIZE;
+
 /* The context used by the file filter.  */
 typedef struct {
   gnupg_fd_t fp; /* Open file pointer or handle.  */
@@ -148,7 +163,7 @@ static int translate_file_handle(int fd, int for_write);
    to be sent to A's filter function.
 
    If A is a IOBUF_OUTPUT_TEMP filter, then this also enlarges the
-   buffer by IOBUF_BUFFER_SIZE.
+   buffer by the buffer size.
 
    May only be called on an IOBUF_OUTPUT or IOBUF_OUTPUT_TEMP filters.  */
 static int filter_flush(iobuf_t a);
@@ -827,6 +842,127 @@ int iobuf_print_chain(iobuf_t a) {
   return 0;
 }
 
+/* A block of data queued by a thread filter.  */
+struct thread_filter_block_s {
+  iobuf_t chain; /* The filter to write the block to.  */
+  byte *data;
+  size_t len;
+};
+
+/* The context used by the thread filter.  */
+typedef struct {
+  std::mutex lock;
+  std::condition_variable cond;
+  std::deque<struct thread_filter_block_s> blocks;
+  std::thread thread;
+  int done;      /* No more blocks will be queued.  */
+  int cancelled; /* Drop the queued blocks.  */
+  int error;     /* The first error returned by the chain.  */
+} thread_filter_ctx_t;
+
+/* The thread of a thread filter.  Writes the queued blocks to the
+   rest of the pipeline.  */
+static void thread_filter_run(thread_filter_ctx_t *tfx) {
+  std::unique_lock<std::mutex> lock(tfx->lock);
+
+  for (;;) {
+    tfx->cond.wait(lock, [tfx] { return tfx->done || !tfx->blocks.empty(); });
+    if (tfx->blocks.empty()) break;
+
+    struct thread_filter_block_s block = tfx->blocks.front();
+    int skip = tfx->error || tfx->cancelled;
+    int rc = 0;
+
+    tfx->blocks.pop_front();
+    tfx->cond.notify_all();
+    lock.unlock();
+    if (!skip) rc = iobuf_write(block.chain, block.data, block.len);
+    wipememory(block.data, block.len);
+    xfree(block.data);
+    lock.lock();
+    if (rc && !tfx->error) tfx->error = rc;
+  }
+}
+
+/* Wait until the thread of TFX has written all queued blocks.  */
+static void thread_filter_finish(thread_filter_ctx_t *tfx) {
+  {
+    std::lock_guard<std::mutex> lock(tfx->lock);
+    tfx->done = 1;
+  }
+  tfx->cond.notify_all();
+  if (tfx->thread.joinable()) tfx->thread.join();
+}
+
+/* The thread filter passes the data written to it on to CHAIN from a
+   separate thread, so that the filters before and after it run
+   concurrently.  The data is passed on in the same blocks, thus the
+   output is the same as without the filter.  */
+static int thread_filter(void *opaque, int control, iobuf_t chain, byte *buf,
+                         size_t *ret_len) {
+  thread_filter_ctx_t *tfx = (thread_filter_ctx_t *)opaque;
+  int rc = 0;
+
+  if (control == IOBUFCTRL_FLUSH) {
+    struct thread_filter_block_s block;
+    std::unique_lock<std::mutex> lock(tfx->lock);
+
+    if (!tfx->thread.joinable())
+      tfx->thread = std::thread(thread_filter_run, tfx);
+    tfx->cond.wait(lock, [tfx] {
+      return tfx->error || tfx->blocks.size() < MAX_THREAD_FILTER_BLOCKS;
+    });
+    if (tfx->error || !*ret_len) return tfx->error;
+
+    block.chain = chain;
+    block.len = *ret_len;
+    block.data = (byte *)xmalloc(block.len);
+    memcpy(block.data, buf, block.len);
+    tfx->blocks.push_back(block);
+    tfx->cond.notify_all();
+  } else if (control == IOBUFCTRL_CANCEL) {
+    /* Stop writing to CHAIN before the following filters are
+       cancelled.  */
+    {
+      std::lock_guard<std::mutex> lock(tfx->lock);
+      tfx->cancelled = 1;
+    }
+    thread_filter_finish(tfx);
+  } else if (control == IOBUFCTRL_FREE) {
+    thread_filter_finish(tfx);
+    rc = tfx->cancelled ? 0 : tfx->error;
+    delete tfx;
+  } else if (control == IOBUFCTRL_DESC) {
+    mem2str((char *)buf, "thread_filter", *ret_len);
+  }
+  return rc;
+}
+
+int iobuf_push_thread_filter(iobuf_t a) {
+  thread_filter_ctx_t *tfx;
+  int rc;
+
+  if (a->use != IOBUF_OUTPUT) return GPG_ERR_INV_ARG;
+
+  tfx = new thread_filter_ctx_t();
+  rc = iobuf_push_filter(a, thread_filter, tfx);
+  if (rc) delete tfx;
+  return rc;
+}
+
+unsigned int iobuf_set_buffer_size(unsigned int kilobyte) {
+  if (kilobyte) {
+    if (kilobyte < MIN_IOBUF_BUFFER_SIZE)
+      kilobyte = MIN_IOBUF_BUFFER_SIZE;
+    else if (kilobyte > MAX_IOBUF_BUFFER_SIZE)
+      kilobyte = MAX_IOBUF_BUFFER_SIZE;
+    iobuf_buffer_size = kilobyte * 1024;
+  }
+  return iobuf_buffer_size / 1024;
+}
+
+size_t iobuf_get_buffer_size(void) { return iobuf_buffer_size; }
+
 iobuf_t iobuf_alloc(int use, size_t bufsize) {
   iobuf_t a;
   static int number = 0;
@@ -835,7 +971,7 @@ iobuf_t iobuf_alloc(int use, size_t bufsize) {
          use == IOBUF_OUTPUT_TEMP);
   if (bufsize == 0) {
     log_bug("iobuf_alloc() passed a bufsize of 0!\n");
-    bufsize = IOBUF_BUFFER_SIZE;
+    bufsize = iobuf_buffer_size;
   }
 
   a = (iobuf_t)xcalloc(1, sizeof *a);
@@ -855,12 +991,14 @@ int iobuf_close(iobuf_t a) {
 
   for (; a; a = a_chain) {
     byte desc[MAX_IOBUF_DESC];
+    int rc1 = 0;
     int rc2 = 0;
 
     a_chain = a->chain;
 
-    if (a->use == IOBUF_OUTPUT && (rc = filter_flush(a)))
-      log_error("filter_flush failed on close: %s\n", gpg_strerror(rc));
+    if (a->use == IOBUF_OUTPUT && (rc1 = filter_flush(a)))
+      log_error("filter_flush failed on close: %s\n", gpg_strerror(rc1));
+    if (!rc && rc1) rc = rc1;
 
     if (DBG_IOBUF)
       log_debug("iobuf-%d.%d: close '%s'\n", a->no, a->subno,
@@ -868,7 +1006,7 @@ int iobuf_close(iobuf_t a) {
 
     if (a->filter && (rc2 = a->filter(a->filter_ov, IOBUFCTRL_FREE, a->chain,
                                       NULL, &dummy_len)))
-      log_error("IOBUFCTRL_FREE failed on close: %s\n", gpg_strerror(rc));
+      log_error("IOBUFCTRL_FREE failed on close: %s\n", gpg_strerror(rc2));
     if (!rc && rc2)
       /* Whoops!  An error occurred.  Save it in RC if we haven't
          already recorded an error.  */
@@ -923,7 +1061,7 @@ int iobuf_cancel(iobuf_t a) {
 }
 
 iobuf_t iobuf_temp(void) {
-  return iobuf_alloc(IOBUF_OUTPUT_TEMP, IOBUF_BUFFER_SIZE);
+  return iobuf_alloc(IOBUF_OUTPUT_TEMP, iobuf_buffer_size);
 }
 
 iobuf_t iobuf_temp_with_content(const char *buffer, size_t length) {
@@ -977,7 +1115,7 @@ static iobuf_t do_open(const char *fname, int special_filenames, int use,
     if (fp == GNUPG_INVALID_FD) return NULL;
   }
 
-  a = iobuf_alloc(use, IOBUF_BUFFER_SIZE);
+  a = iobuf_alloc(use, iobuf_buffer_size);
   fcx = (file_filter_ctx_t *)xmalloc(sizeof *fcx + strlen(fname));
   fcx->fp = fp;
   fcx->print_only_name = print_only;
@@ -1014,7 +1152,7 @@ static iobuf_t do_iobuf_fdopen(int fd, const char *mode, int keep_open) {
   fp = INT2FD(fd);
 
   a = iobuf_alloc(strchr(mode, 'w') ? IOBUF_OUTPUT : IOBUF_INPUT,
-                  IOBUF_BUFFER_SIZE);
+                  iobuf_buffer_size);
   fcx = (file_filter_ctx_t *)xmalloc(sizeof *fcx + 20);
   fcx->fp = fp;
   fcx->print_only_name = 1;
@@ -1044,7 +1182,7 @@ iobuf_t iobuf_esopen(estream_t estream, const char *mode, int keep_open) {
   size_t len = 0;
 
   a = iobuf_alloc(strchr(mode, 'w') ? IOBUF_OUTPUT : IOBUF_INPUT,
-                  IOBUF_BUFFER_SIZE);
+                  iobuf_buffer_size);
   fcx = (file_es_filter_ctx_t *)xtrymalloc(sizeof *fcx + 30);
   fcx->fp = estream;
   fcx->print_only_name = 1;
@@ -1066,7 +1204,7 @@ iobuf_t iobuf_sockopen(int fd, const char *mode) {
   size_t len;
 
   a = iobuf_alloc(strchr(mode, 'w') ? IOBUF_OUTPUT : IOBUF_INPUT,
-                  IOBUF_BUFFER_SIZE);
+                  iobuf_buffer_size);
   scx = xmalloc(sizeof *scx + 25);
   scx->sock = fd;
   scx->print_only_name = 1;
@@ -1241,12 +1379,12 @@ int iobuf_push_filter2(iobuf_t a,
        increased accordingly.  We don't need to allocate a 10 MB
        buffer for a non-terminal filter.  Just use the default
        size.  */
-    a->d.size = IOBUF_BUFFER_SIZE;
+    a->d.size = iobuf_buffer_size;
   } else if (a->use == IOBUF_INPUT_TEMP)
   /* Same idea as above.  */
   {
     a->use = IOBUF_INPUT;
-    a->d.size = IOBUF_BUFFER_SIZE;
+    a->d.size = iobuf_buffer_size;
   }
 
   /* The new filter (A) gets a new buffer.
@@ -1530,7 +1668,7 @@ static int filter_flush(iobuf_t a) {
   int rc;
 
   if (a->use == IOBUF_OUTPUT_TEMP) { /* increase the temp buffer */
-    size_t newsize = a->d.size + IOBUF_BUFFER_SIZE;
+    size_t newsize = a->d.size + iobuf_buffer_size;
 
     if (DBG_IOBUF)
       log_debug("increasing temp iobuf from %lu to %lu\n",
@@ -1618,6 +1756,35 @@ int iobuf_read(iobuf_t a, void *buffer, unsigned int buflen) {
       a->d.start += size;
       if (buf) buf += size;
     }
+    if (buf && buflen - n >= a->d.size && a->d.start == a->d.len &&
+        a->use == IOBUF_INPUT && a->filter && !a->filter_eof && !a->error) {
+      /* Nothing is buffered and the caller wants at least a full
+         buffer: let the filter write directly into BUFFER instead of
+         copying the data through the internal buffer.  */
+      size_t len = a->d.size;
+
+      c = a->filter(a->filter_ov, IOBUFCTRL_UNDERFLOW, a->chain, buf, &len);
+      if (DBG_IOBUF)
+        log_debug("iobuf-%d.%d: zero-copy read of %lu bytes, rc=%d\n", a->no,
+                  a->subno, (unsigned long)len, c);
+      n += len;
+      buf += len;
+      if (c == -1) {
+        /* EOF.  Release the filter like underflow does.  The pending
+           EOF is returned by the next call to underflow.  */
+        size_t dummy_len = 0;
+
+        if ((c = a->filter(a->filter_ov, IOBUFCTRL_FREE, a->chain, NULL,
+                           &dummy_len)))
+          log_error("IOBUFCTRL_FREE failed: %s\n", gpg_strerror(c));
+        if (a->filter_ov && a->filter_ov_owner) xfree(a->filter_ov);
+        a->filter_ov = NULL;
+        a->filter = NULL;
+        a->filter_eof = 1;
+      } else if (c)
+        a->error = c;
+      if (len) continue;
+    }
     if (n < buflen)
     /* Draining the internal buffer didn't fill BUFFER.  Call
        underflow to read more data into the filter's internal
@@ -244,6 +244,14 @@ struct iobuf_struct {
 
 extern int iobuf_debug_mode;
 
+/* Set the size of the buffers of new filters to KILOBYTE kilobytes,
+   clamped to 4 KiB ... 16 MiB.  Returns the current size in
+   kilobytes; with KILOBYTE 0 it is not changed.  */
+unsigned int iobuf_set_buffer_size(unsigned int kilobyte);
+
+/* Returns the size of the buffers of new filters in bytes.  */
+size_t iobuf_get_buffer_size(void);
+
 /* Returns whether the specified filename corresponds to a pipe.  In
    particular, this function checks if FNAME is "-" and, if special
    filenames are enabled (see check_special_filename), whether
@@ -397,6 +405,11 @@ int iobuf_push_filter2(iobuf_t a,
                                 byte *buf, size_t *len),
                        void *ov, int rel_ov);
 
+/* Push a filter onto the output pipeline A which passes the data
+   written to it on to the rest of the pipeline from a separate
+   thread.  The filters above and below it then run concurrently.  */
+int iobuf_push_thread_filter(iobuf_t a);
+
 /* Pop the top filter.  The top filter must have the filter function F
    and the cookie OV.  The cookie check is ignored if OV is NULL.  */
 int iobuf_pop_filter(iobuf_t a, int (*f)(void *opaque, int control,
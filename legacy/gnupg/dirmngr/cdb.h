@@ -67,11 +67,13 @@ struct cdb_make {
   /* private */
   cdbi_t cdb_dpos;             /* data position so far */
   cdbi_t cdb_rcnt;             /* record count so far */
-  char cdb_buf[4096];          /* write buffer */
+  char *cdb_buf;               /* write buffer of CDB_MAKE_BUFSIZE */
   char *cdb_bpos;              /* current buf position */
   struct cdb_rl *cdb_rec[256]; /* list of arrays of record infos */
 };
 
+#define CDB_MAKE_BUFSIZE 65536
+
 int cdb_make_start(struct cdb_make *cdbmp, int fd);
 int cdb_make_add(struct cdb_make *cdbmp, const void *key, cdbi_t klen,
                  const void *val, cdbi_t vlen);
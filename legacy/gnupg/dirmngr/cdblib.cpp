@@ -89,15 +89,24 @@ struct cdb_rec {
   cdbi_t rpos;
 };
 
+/* A list of record infos.  The lists of a hash table are allocated
+   with growing sizes between CDB_RL_MIN and CDB_RL_MAX records, so
+   that databases with millions of records need only few
+   allocations.  */
 struct cdb_rl {
   struct cdb_rl *next;
   cdbi_t cnt;
-  struct cdb_rec rec[254];
+  cdbi_t size;
+  struct cdb_rec rec[1];
 };
 
+#define CDB_RL_MIN 254
+#define CDB_RL_MAX 65536
+
 static int make_find(struct cdb_make *cdbmp, const void *key, cdbi_t klen,
                      cdbi_t hval, struct cdb_rl **rlp);
 static int make_write(struct cdb_make *cdbmp, const char *ptr, cdbi_t len);
+static struct cdb_rl *make_reclist(struct cdb_make *cdbmp, cdbi_t hval);
 
 /* Initializes structure given by CDBP pointer and associates it with
    the open file descriptor FD.  Allocate memory for the structure
@@ -497,17 +506,8 @@ int cdb_make_add(struct cdb_make *cdbmp, const void *key, cdbi_t klen,
     return -1;
   }
   hval = cdb_hash(key, klen);
-  rl = cdbmp->cdb_rec[hval & 255];
-  if (!rl || rl->cnt >= sizeof(rl->rec) / sizeof(rl->rec[0])) {
-    rl = (struct cdb_rl *)malloc(sizeof(struct cdb_rl));
-    if (!rl) {
-      gpg_err_set_errno(ENOMEM);
-      return -1;
-    }
-    rl->cnt = 0;
-    rl->next = cdbmp->cdb_rec[hval & 255];
-    cdbmp->cdb_rec[hval & 255] = rl;
-  }
+  rl = make_reclist(cdbmp, hval);
+  if (!rl) return -1;
   rl->rec[rl->cnt].hval = hval;
   rl->rec[rl->cnt].rpos = cdbmp->cdb_dpos;
   ++rl->cnt;
@@ -548,17 +548,8 @@ int cdb_make_put(struct cdb_make *cdbmp, const void *key, cdbi_t klen,
     /* fall through */
 
     case CDB_PUT_ADD:
-      rl = cdbmp->cdb_rec[hval & 255];
-      if (!rl || rl->cnt >= sizeof(rl->rec) / sizeof(rl->rec[0])) {
-        rl = (struct cdb_rl *)malloc(sizeof(struct cdb_rl));
-        if (!rl) {
-          gpg_err_set_errno(ENOMEM);
-          return -1;
-        }
-        rl->cnt = 0;
-        rl->next = cdbmp->cdb_rec[hval & 255];
-        cdbmp->cdb_rec[hval & 255] = rl;
-      }
+      rl = make_reclist(cdbmp, hval);
+      if (!rl) return -1;
       c = rl->cnt;
       r = 0;
       break;
@@ -588,6 +579,29 @@ int cdb_make_put(struct cdb_make *cdbmp, const void *key, cdbi_t klen,
   return r;
 }
 
+/* Return the record list for hash value HVAL with room for one more
+   record.  */
+static struct cdb_rl *make_reclist(struct cdb_make *cdbmp, cdbi_t hval) {
+  struct cdb_rl *rl = cdbmp->cdb_rec[hval & 255];
+  cdbi_t size;
+
+  if (rl && rl->cnt < rl->size) return rl;
+
+  size = rl ? rl->size * 2 : CDB_RL_MIN;
+  if (size > CDB_RL_MAX) size = CDB_RL_MAX;
+  rl = (struct cdb_rl *)malloc(sizeof(struct cdb_rl) +
+                               (size - 1) * sizeof(struct cdb_rec));
+  if (!rl) {
+    gpg_err_set_errno(ENOMEM);
+    return NULL;
+  }
+  rl->cnt = 0;
+  rl->size = size;
+  rl->next = cdbmp->cdb_rec[hval & 255];
+  cdbmp->cdb_rec[hval & 255] = rl;
+  return rl;
+}
+
 static int match(int fd, cdbi_t pos, const char *key, cdbi_t klen) {
   unsigned char buf[64]; /*XXX cdb_buf may be used here instead */
   if (lseek(fd, pos, SEEK_SET) < 0 || read(fd, buf, 8) != 8) return -1;
@@ -653,9 +667,15 @@ void cdb_pack(cdbi_t num, unsigned char buf[4]) {
 
 /* Initializes structure to create a database.  File FD should be
    opened read-write and should be seekable.  Returns 0 on success or
-   negative value on error. */
+   negative value on error.  The write buffer is allocated here and
+   released by cdb_make_finish(). */
 int cdb_make_start(struct cdb_make *cdbmp, int fd) {
   memset(cdbmp, 0, sizeof *cdbmp);
+  cdbmp->cdb_buf = (char *)malloc(CDB_MAKE_BUFSIZE);
+  if (!cdbmp->cdb_buf) {
+    gpg_err_set_errno(ENOMEM);
+    return -1;
+  }
   cdbmp->cdb_fd = fd;
   cdbmp->cdb_dpos = 2048;
   cdbmp->cdb_bpos = cdbmp->cdb_buf + 2048;
@@ -675,17 +695,17 @@ static int ewrite(int fd, const char *buf, int len) {
 }
 
 static int make_write(struct cdb_make *cdbmp, const char *ptr, cdbi_t len) {
-  cdbi_t l = sizeof(cdbmp->cdb_buf) - (cdbmp->cdb_bpos - cdbmp->cdb_buf);
+  cdbi_t l = CDB_MAKE_BUFSIZE - (cdbmp->cdb_bpos - cdbmp->cdb_buf);
   cdbmp->cdb_dpos += len;
   if (len > l) {
     memcpy(cdbmp->cdb_bpos, ptr, l);
-    if (ewrite(cdbmp->cdb_fd, cdbmp->cdb_buf, sizeof(cdbmp->cdb_buf)) < 0)
+    if (ewrite(cdbmp->cdb_fd, cdbmp->cdb_buf, CDB_MAKE_BUFSIZE) < 0)
       return -1;
     ptr += l;
     len -= l;
-    l = len / sizeof(cdbmp->cdb_buf);
+    l = len / CDB_MAKE_BUFSIZE;
     if (l) {
-      l *= sizeof(cdbmp->cdb_buf);
+      l *= CDB_MAKE_BUFSIZE;
       if (ewrite(cdbmp->cdb_fd, ptr, l) < 0) return -1;
       ptr += l;
       len -= l;
@@ -787,7 +807,10 @@ static void cdb_make_free(struct cdb_make *cdbmp) {
       rl = rl->next;
       free(tm);
     }
+    cdbmp->cdb_rec[t] = NULL;
   }
+  free(cdbmp->cdb_buf);
+  cdbmp->cdb_buf = cdbmp->cdb_bpos = NULL;
 }
 
 /* Finalizes database file, constructing all needed indexes, and frees
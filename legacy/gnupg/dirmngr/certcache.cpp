@@ -19,7 +19,10 @@
 
 #include <config.h>
 
+#include <condition_variable>
 #include <mutex>
+#include <string>
+#include <unordered_map>
 
 #include <assert.h>
 #include <dirent.h>
@@ -66,6 +69,8 @@ struct cert_item_s {
   char *issuer_dn;          /* The malloced issuer DN.  */
   ksba_sexp_t sn;           /* The malloced serial number  */
   char *subject_dn;         /* The malloced subject DN - maybe NULL.  */
+  ksba_sexp_t ski;          /* The malloced subject key identifier -
+                               maybe NULL.  */
 
   /* If this field is set the certificate has been taken from some
    * configuration and shall not be flushed from the cache.  */
@@ -81,8 +86,69 @@ typedef struct cert_item_s *cert_item_t;
    the first byte of the fingerprint.  */
 static cert_item_t cert_cache[256];
 
+/* Indexes of the valid items in CERT_CACHE for the lookups done
+   while building certificate chains.  The keys are the subject DN,
+   the issuer DN, the issuer DN and the serial number, and the subject
+   key identifier.  */
+typedef std::unordered_multimap<std::string, cert_item_t> cert_index_t;
+static cert_index_t subject_index;
+static cert_index_t issuer_index;
+static cert_index_t sn_index;
+static cert_index_t ski_index;
+
+/* A reader/writer lock.  Lookups take it shared so that they can run
+   concurrently, changes to the cache take it exclusively.  Waiting
+   writers block new readers so that they don't starve.  The lock is
+   not recursive.  */
+class cache_rwlock {
+ public:
+  void lock_shared() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cond.wait(lock, [this] { return !m_writer && !m_writers_waiting; });
+    m_readers++;
+  }
+
+  void unlock_shared() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!--m_readers) m_cond.notify_all();
+  }
+
+  void lock() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_writers_waiting++;
+    m_cond.wait(lock, [this] { return !m_writer && !m_readers; });
+    m_writers_waiting--;
+    m_writer = true;
+  }
+
+  void unlock() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_writer = false;
+    m_cond.notify_all();
+  }
+
+ private:
+  std::mutex m_mutex;
+  std::condition_variable m_cond;
+  unsigned int m_readers{0};
+  unsigned int m_writers_waiting{0};
+  bool m_writer{false};
+};
+
+/* Holds a cache_rwlock shared for the lifetime of the object.  */
+class cache_read_guard {
+ public:
+  explicit cache_read_guard(cache_rwlock &lock) : m_lock(lock) {
+    m_lock.lock_shared();
+  }
+  ~cache_read_guard() { m_lock.unlock_shared(); }
+
+ private:
+  cache_rwlock &m_lock;
+};
+
 /* This is the global cache_lock variable.  */
-static std::mutex cache_lock;
+static cache_rwlock cache_lock;
 
 /* Flag to track whether the cache has been initialized.  */
 static int initialization_done;
@@ -147,6 +213,45 @@ unsigned char *cert_compute_fpr(ksba_cert_t cert, unsigned char *digest) {
   return digest;
 }
 
+/* Return the canonical S-expression SEXP as a string.  */
+static std::string sexp_key(ksba_sexp_t sexp) {
+  size_t n = gcry_sexp_canon_len(sexp, 0, NULL, NULL);
+  return std::string((const char *)sexp, n);
+}
+
+/* Return the key for ISSUER_DN and SERIALNO in SN_INDEX.  */
+static std::string sn_key(const char *issuer_dn, ksba_sexp_t serialno) {
+  std::string key = issuer_dn;
+  key.push_back('\0');
+  return key + sexp_key(serialno);
+}
+
+/* Remove CI, which is stored under KEY, from INDEX.  */
+static void index_erase(cert_index_t &index, const std::string &key,
+                        cert_item_t ci) {
+  auto range = index.equal_range(key);
+  for (auto it = range.first; it != range.second; ++it)
+    if (it->second == ci) {
+      index.erase(it);
+      return;
+    }
+}
+
+/* Add CI to or (with REMOVE set) remove it from the indexes.  */
+static void update_indexes(cert_item_t ci, int remove) {
+  if (remove) {
+    index_erase(issuer_index, ci->issuer_dn, ci);
+    index_erase(sn_index, sn_key(ci->issuer_dn, ci->sn), ci);
+    if (ci->subject_dn) index_erase(subject_index, ci->subject_dn, ci);
+    if (ci->ski) index_erase(ski_index, sexp_key(ci->ski), ci);
+  } else {
+    issuer_index.emplace(ci->issuer_dn, ci);
+    sn_index.emplace(sn_key(ci->issuer_dn, ci->sn), ci);
+    if (ci->subject_dn) subject_index.emplace(ci->subject_dn, ci);
+    if (ci->ski) ski_index.emplace(sexp_key(ci->ski), ci);
+  }
+}
+
 /* Cleanup one slot.  This releases all resourses but keeps the actual
    slot in the cache marked for reuse. */
 static void clean_cache_slot(cert_item_t ci) {
@@ -154,6 +259,9 @@ static void clean_cache_slot(cert_item_t ci) {
 
   if (!ci->cert) return; /* Already cleaned.  */
 
+  if (ci->issuer_dn && ci->sn) update_indexes(ci, 1);
+  ksba_free(ci->ski);
+  ci->ski = NULL;
   ksba_free(ci->sn);
   ci->sn = NULL;
   ksba_free(ci->issuer_dn);
@@ -251,8 +359,10 @@ static gpg_error_t put_cert(ksba_cert_t cert, int permanent,
     return GPG_ERR_INV_CERT_OBJ;
   }
   ci->subject_dn = ksba_cert_get_subject(cert, 0);
+  if (ksba_cert_get_subj_key_id(cert, NULL, &ci->ski)) ci->ski = NULL;
   ci->permanent = !!permanent;
   ci->trustclasses = trustclass;
+  update_indexes(ci, 0);
 
   if (!permanent) total_nonperm_certificates++;
 
@@ -557,7 +667,7 @@ void cert_cache_init(const std::vector<std::string> &hkp_cacerts) {
   if (initialization_done) return;
 
   {
-    std::lock_guard<std::mutex> lock(cache_lock);
+    std::lock_guard<cache_rwlock> lock(cache_lock);
     load_certs_from_system();
 
     fname = make_filename_try(gnupg_sysconfdir(), "trusted-certs", NULL);
@@ -590,7 +700,7 @@ void cert_cache_deinit(int full) {
 
   if (!initialization_done) return;
 
-  std::lock_guard<std::mutex> lock(cache_lock);
+  std::lock_guard<cache_rwlock> lock(cache_lock);
 
   for (i = 0; i < 256; i++)
     for (ci = cert_cache[i]; ci; ci = ci->next) clean_cache_slot(ci);
@@ -605,6 +715,10 @@ void cert_cache_deinit(int full) {
     }
   }
 
+  subject_index.clear();
+  issuer_index.clear();
+  sn_index.clear();
+  ski_index.clear();
   total_nonperm_certificates = 0;
   initialization_done = 0;
 }
@@ -621,7 +735,7 @@ void cert_cache_print_stats(void) {
   unsigned int n_trustclass_hkp = 0;
   unsigned int n_trustclass_hkpspool = 0;
 
-  std::lock_guard<std::mutex> lock(cache_lock);
+  cache_read_guard lock(cache_lock);
   for (idx = 0; idx < 256; idx++)
     for (ci = cert_cache[idx]; ci; ci = ci->next)
       if (ci->cert) {
@@ -652,7 +766,7 @@ void cert_cache_print_stats(void) {
 gpg_error_t cache_cert(ksba_cert_t cert) {
   gpg_error_t err;
 
-  std::lock_guard<std::mutex> lock(cache_lock);
+  std::lock_guard<cache_rwlock> lock(cache_lock);
   err = put_cert(cert, 0, 0, NULL);
   if (err == GPG_ERR_DUP_VALUE)
     log_info(_("certificate already cached\n"));
@@ -670,7 +784,7 @@ gpg_error_t cache_cert(ksba_cert_t cert) {
 gpg_error_t cache_cert_silent(ksba_cert_t cert, void *fpr_buffer) {
   gpg_error_t err;
 
-  std::lock_guard<std::mutex> lock(cache_lock);
+  std::lock_guard<cache_rwlock> lock(cache_lock);
   err = put_cert(cert, 0, 0, fpr_buffer);
   if (err == GPG_ERR_DUP_VALUE) err = 0;
   if (err) log_error(_("error caching certificate: %s\n"), gpg_strerror(err));
@@ -686,7 +800,7 @@ gpg_error_t cache_cert_silent(ksba_cert_t cert, void *fpr_buffer) {
 ksba_cert_t get_cert_byfpr(const unsigned char *fpr) {
   cert_item_t ci;
 
-  std::lock_guard<std::mutex> lock(cache_lock);
+  cache_read_guard lock(cache_lock);
   for (ci = cert_cache[*fpr]; ci; ci = ci->next)
     if (ci->cert && !memcmp(ci->fpr, fpr, 20)) {
       ksba_cert_ref(ci->cert);
@@ -729,39 +843,24 @@ ksba_cert_t get_cert_byhexfpr(const char *string) {
 
 /* Return the certificate matching ISSUER_DN and SERIALNO.  */
 ksba_cert_t get_cert_bysn(const char *issuer_dn, ksba_sexp_t serialno) {
-  /* Simple and inefficient implementation.   fixme! */
-  cert_item_t ci;
-  int i;
+  cache_read_guard lock(cache_lock);
+  auto it = sn_index.find(sn_key(issuer_dn, serialno));
+  if (it == sn_index.end()) return NULL;
 
-  std::lock_guard<std::mutex> lock(cache_lock);
-  for (i = 0; i < 256; i++) {
-    for (ci = cert_cache[i]; ci; ci = ci->next)
-      if (ci->cert && !strcmp(ci->issuer_dn, issuer_dn) &&
-          !compare_serialno(ci->sn, serialno)) {
-        ksba_cert_ref(ci->cert);
-        return ci->cert;
-      }
-  }
-
-  return NULL;
+  ksba_cert_ref(it->second->cert);
+  return it->second->cert;
 }
 
 /* Return the certificate matching ISSUER_DN.  SEQ should initially be
    set to 0 and bumped up to get the next issuer with that DN. */
 ksba_cert_t get_cert_byissuer(const char *issuer_dn, unsigned int seq) {
-  /* Simple and very inefficient implementation and API.  fixme! */
-  cert_item_t ci;
-  int i;
-
-  std::lock_guard<std::mutex> lock(cache_lock);
-  for (i = 0; i < 256; i++) {
-    for (ci = cert_cache[i]; ci; ci = ci->next)
-      if (ci->cert && !strcmp(ci->issuer_dn, issuer_dn))
-        if (!seq--) {
-          ksba_cert_ref(ci->cert);
-          return ci->cert;
-        }
-  }
+  cache_read_guard lock(cache_lock);
+  auto range = issuer_index.equal_range(issuer_dn);
+  for (auto it = range.first; it != range.second; ++it)
+    if (!seq--) {
+      ksba_cert_ref(it->second->cert);
+      return it->second->cert;
+    }
 
   return NULL;
 }
@@ -769,21 +868,33 @@ ksba_cert_t get_cert_byissuer(const char *issuer_dn, unsigned int seq) {
 /* Return the certificate matching SUBJECT_DN.  SEQ should initially be
    set to 0 and bumped up to get the next subject with that DN. */
 ksba_cert_t get_cert_bysubject(const char *subject_dn, unsigned int seq) {
-  /* Simple and very inefficient implementation and API.  fixme! */
-  cert_item_t ci;
-  int i;
+  if (!subject_dn) return NULL;
+
+  cache_read_guard lock(cache_lock);
+  auto range = subject_index.equal_range(subject_dn);
+  for (auto it = range.first; it != range.second; ++it)
+    if (!seq--) {
+      ksba_cert_ref(it->second->cert);
+      return it->second->cert;
+    }
 
+  return NULL;
+}
+
+/* Return the certificate matching SUBJECT_DN and the subject key
+   identifier KEYID.  */
+static ksba_cert_t get_cert_bysubject_ski(const char *subject_dn,
+                                          ksba_sexp_t keyid) {
   if (!subject_dn) return NULL;
 
-  std::lock_guard<std::mutex> lock(cache_lock);
-  for (i = 0; i < 256; i++) {
-    for (ci = cert_cache[i]; ci; ci = ci->next)
-      if (ci->cert && ci->subject_dn && !strcmp(ci->subject_dn, subject_dn))
-        if (!seq--) {
-          ksba_cert_ref(ci->cert);
-          return ci->cert;
-        }
-  }
+  cache_read_guard lock(cache_lock);
+  auto range = ski_index.equal_range(sexp_key(keyid));
+  for (auto it = range.first; it != range.second; ++it)
+    if (it->second->subject_dn &&
+        !strcmp(it->second->subject_dn, subject_dn)) {
+      ksba_cert_ref(it->second->cert);
+      return it->second->cert;
+    }
 
   return NULL;
 }
@@ -1144,7 +1255,6 @@ ksba_cert_t find_cert_bysn(ctrl_t ctrl, const char *issuer_dn,
 ksba_cert_t find_cert_bysubject(ctrl_t ctrl, const char *subject_dn,
                                 ksba_sexp_t keyid) {
   gpg_error_t err;
-  int seq;
   ksba_cert_t cert = NULL;
   cert_fetch_context_t context = NULL;
   ksba_sexp_t subj;
@@ -1156,35 +1266,26 @@ ksba_cert_t find_cert_bysubject(ctrl_t ctrl, const char *subject_dn,
    * for example required by Telesec certificates where a keyId is
    * used but the issuer certificate comes without a subject keyId! */
   if (ctrl->ocsp_certs && subject_dn) {
-    cert_item_t ci;
     cert_ref_t cr;
-    int i;
 
     /* For efficiency reasons we won't use get_cert_bysubject here. */
-    std::lock_guard<std::mutex> lock(cache_lock);
-    for (i = 0; i < 256; i++)
-      for (ci = cert_cache[i]; ci; ci = ci->next)
-        if (ci->cert && ci->subject_dn && !strcmp(ci->subject_dn, subject_dn))
-          for (cr = ctrl->ocsp_certs; cr; cr = cr->next)
-            if (!memcmp(ci->fpr, cr->fpr, 20)) {
-              ksba_cert_ref(ci->cert);
-              return ci->cert; /* We use this certificate. */
-            }
+    cache_read_guard lock(cache_lock);
+    auto range = subject_index.equal_range(subject_dn);
+    for (auto it = range.first; it != range.second; ++it)
+      for (cr = ctrl->ocsp_certs; cr; cr = cr->next)
+        if (!memcmp(it->second->fpr, cr->fpr, 20)) {
+          ksba_cert_ref(it->second->cert);
+          return it->second->cert; /* We use this certificate. */
+        }
     if (DBG_LOOKUP)
       log_debug("find_cert_bysubject: certificate not in ocsp_certs\n");
   }
 
   /* No check whether the certificate is cached.  */
-  for (seq = 0; (cert = get_cert_bysubject(subject_dn, seq)); seq++) {
-    if (!keyid) break; /* No keyid requested, so return the first one found. */
-    if (!ksba_cert_get_subj_key_id(cert, NULL, &subj) &&
-        !cmp_simple_canon_sexp(keyid, subj)) {
-      xfree(subj);
-      break; /* Found matching cert. */
-    }
-    xfree(subj);
-    ksba_cert_release(cert);
-  }
+  if (keyid)
+    cert = get_cert_bysubject_ski(subject_dn, keyid);
+  else
+    cert = get_cert_bysubject(subject_dn, 0);
   if (cert) return cert; /* Done.  */
 
   if (DBG_LOOKUP) log_debug("find_cert_bysubject: certificate not in cache\n");
@@ -1290,7 +1391,7 @@ gpg_error_t is_trusted_cert(ksba_cert_t cert, unsigned int trustclasses) {
 
   cert_compute_fpr(cert, fpr);
 
-  std::lock_guard<std::mutex> lock(cache_lock);
+  cache_read_guard lock(cache_lock);
   for (ci = cert_cache[*fpr]; ci; ci = ci->next)
     if (ci->cert && !memcmp(ci->fpr, fpr, 20)) {
       if ((ci->trustclasses & trustclasses)) {
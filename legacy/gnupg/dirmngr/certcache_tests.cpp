@@ -0,0 +1,319 @@
+/* Tests for the certificate cache
+   Copyright 2018 The NeoPG developers
+
+   NeoPG is released under the Simplified BSD License (see license.txt)
+*/
+
+#include <config.h>
+
+#include "gtest/gtest.h"
+
+#include <string.h>
+
+#include <atomic>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <botan/base64.h>
+
+#include "dirmngr.h"
+
+#include "certcache.h"
+
+#include "legacy_environment.h"
+
+using namespace NeoPG;
+
+namespace {
+
+/* A self-signed CA certificate and a leaf certificate issued by it,
+   with subject and authority key identifiers.  The serial number of
+   the leaf certificate is 0102030405060708.  */
+const char CA_CERT[] =
+    "MIIBUTCB+aADAgECAgEBMAoGCCqGSM49BAMCMBgxFjAUBgNVBAMMDU5lb1BHIFRl"
+    "c3QgQ0EwIBcNMjYxMDE4MDkxNjU4WhgPMjEyNjA5MjQwOTE2NThaMBgxFjAUBgNV"
+    "BAMMDU5lb1BHIFRlc3QgQ0EwWTATBgcqhkjOPQIBBggqhkjOPQMBBwNCAAQJlv48"
+    "j9VRTO6dHFGvDpSviKuJRUJR0buJfPfVQhl8V5s52PW36TGtX6iFhVMKCxjhHwvQ"
+    "umbpViKAD0AefdyLozIwMDAPBgNVHRMBAf8EBTADAQH/MB0GA1UdDgQWBBTiJ6IT"
+    "A29vyxPo0YpccV8PuZBXHjAKBggqhkjOPQQDAgNHADBEAiB2v7HhtKmcm79wkAYz"
+    "GDKpAkJ7kw05K/jSZ52iBIAvtAIgCqpI5aT80B7regp81F1h1taNbeVWzk7x4mHH"
+    "LdSb4HE=";
+const char LEAF_CERT[] =
+    "MIIBdzCCAR2gAwIBAgIIAQIDBAUGBwgwCgYIKoZIzj0EAwIwGDEWMBQGA1UEAwwN"
+    "TmVvUEcgVGVzdCBDQTAgFw0yNjEwMTgwOTE2NThaGA8yMTI2MDkyNDA5MTY1OFow"
+    "GjEYMBYGA1UEAwwPTmVvUEcgVGVzdCBMZWFmMFkwEwYHKoZIzj0CAQYIKoZIzj0D"
+    "AQcDQgAECI2oMICvgbY3MZFQPF0xzx9Bj/PV0uhO7LBKaC7OHnnJe1U1bpT6hJ1B"
+    "M5y9PqsFslKxzlegLp5qJ+ZJuE7GxqNNMEswCQYDVR0TBAIwADAdBgNVHQ4EFgQU"
+    "BwDESSHud6Z1+4ulgT4QKz1zTeIwHwYDVR0jBBgwFoAU4ieiEwNvb8sT6NGKXHFf"
+    "D7mQVx4wCgYIKoZIzj0EAwIDSAAwRQIga9JYXCO4jvxg8h9I2MnRUFAi04II7dZY"
+    "wOuSb8kidKYCIQD1iwPI88A+WjtLZJfWTLzkEtEiOc330X3kLMtU3Oivuw==";
+
+const char CA_DN[] = "CN=NeoPG Test CA";
+const char LEAF_DN[] = "CN=NeoPG Test Leaf";
+
+/* The number of certificates the cache holds before it drops 5
+   percent of them.  */
+const int MAX_NONPERM_CACHED_CERTS = 1000;
+
+std::string der(const char *base64) {
+  auto data = Botan::base64_decode(std::string(base64));
+  return std::string((const char *)data.data(), data.size());
+}
+
+/* Parse the DER encoded DATA into R_CERT.  */
+void make_cert(const std::string &data, ksba_cert_t &r_cert) {
+  r_cert = NULL;
+  ASSERT_EQ(ksba_cert_new(&r_cert), 0);
+  ASSERT_EQ(ksba_cert_init_from_mem(r_cert, data.data(), data.size()), 0);
+}
+
+/* Make a copy of the leaf certificate with the serial number
+   01000000xxxxxxxx, where the last four bytes are N.  The signature
+   is not valid, which the cache does not check.  */
+void make_variant(uint32_t n, ksba_cert_t &r_cert) {
+  std::string data = der(LEAF_CERT);
+  size_t pos = data.find("\x01\x02\x03\x04\x05\x06\x07\x08");
+
+  ASSERT_NE(pos, std::string::npos);
+  data.replace(pos + 1, 3, 3, '\0');
+  for (int i = 0; i < 4; i++) data[pos + 7 - i] = (char)(n >> (8 * i));
+  ASSERT_NO_FATAL_FAILURE(make_cert(data, r_cert));
+}
+
+/* Return the fingerprint of CERT as a string.  */
+std::string fpr(ksba_cert_t cert) {
+  unsigned char digest[20];
+
+  if (!cert) return "";
+  cert_compute_fpr(cert, digest);
+  return std::string((const char *)digest, 20);
+}
+
+/* Return the fingerprint of the certificate CERT as returned by a
+   lookup, releasing CERT.  */
+std::string found(ksba_cert_t cert) {
+  std::string result = fpr(cert);
+
+  ksba_cert_release(cert);
+  return result;
+}
+
+/* Return true if CERT is in the cache by fingerprint and by issuer
+   and serial number.  */
+bool cached(ksba_cert_t cert) {
+  unsigned char digest[20];
+  ksba_sexp_t serial = ksba_cert_get_serial(cert);
+  char *issuer = ksba_cert_get_issuer(cert, 0);
+  bool byfpr = !found(get_cert_byfpr(cert_compute_fpr(cert, digest))).empty();
+  bool bysn = found(get_cert_bysn(issuer, serial)) == fpr(cert);
+
+  ksba_free(serial);
+  ksba_free(issuer);
+  EXPECT_EQ(byfpr, bysn);
+  return byfpr && bysn;
+}
+
+/* Return the number of cached certificates with ISSUER_DN.  */
+unsigned int count_byissuer(const char *issuer_dn) {
+  unsigned int n = 0;
+  ksba_cert_t cert;
+
+  while ((cert = get_cert_byissuer(issuer_dn, n))) {
+    ksba_cert_release(cert);
+    n++;
+  }
+  return n;
+}
+
+/* The certificate cache with the CA certificate loaded as a trusted
+   certificate if TRUSTED_CA is set.  The cache is released
+   afterwards.  */
+class TestCertCache {
+ public:
+  explicit TestCertCache(bool trusted_ca = false) {
+    if (trusted_ca) {
+      std::string data = der(CA_CERT);
+      m_hkp_cacerts.push_back(m_dir.path() + "/ca.der");
+      std::ofstream(m_hkp_cacerts[0], std::ios::binary) << data;
+    }
+    init();
+    make_cert(der(CA_CERT), ca);
+    make_cert(der(LEAF_CERT), leaf);
+  }
+
+  ~TestCertCache() {
+    ksba_cert_release(ca);
+    ksba_cert_release(leaf);
+    cert_cache_deinit(1);
+  }
+
+  void init() { cert_cache_init(m_hkp_cacerts); }
+
+  ksba_cert_t ca{NULL};
+  ksba_cert_t leaf{NULL};
+
+ private:
+  TemporaryDirectory m_dir;
+  std::vector<std::string> m_hkp_cacerts;
+};
+
+}  // namespace
+
+TEST(NeopgLegacyTest, dirmngr_cert_cache_test) {
+  TestCertCache cache;
+  struct server_control_s ctrl = {};
+  unsigned char digest[20];
+  char hexfpr[3 * 20 + 1];
+  ksba_cert_t cert;
+
+  ASSERT_NE(cache.leaf, nullptr);
+  ASSERT_FALSE(cached(cache.leaf));
+  ASSERT_EQ(cache_cert(cache.ca), 0);
+  ASSERT_EQ(cache_cert_silent(cache.leaf, digest), 0);
+  ASSERT_EQ(std::string((const char *)digest, 20), fpr(cache.leaf));
+  ASSERT_EQ(cache_cert(cache.leaf), GPG_ERR_DUP_VALUE);
+  ASSERT_EQ(cache_cert_silent(cache.leaf, NULL), 0);
+
+  /* Lookups by fingerprint.  */
+  ASSERT_TRUE(cached(cache.ca));
+  ASSERT_TRUE(cached(cache.leaf));
+  for (int i = 0; i < 20; i++)
+    snprintf(hexfpr + 3 * i, 4, "%02X:", digest[i]);
+  hexfpr[3 * 20 - 1] = '\0';
+  ASSERT_EQ(found(get_cert_byhexfpr(hexfpr)), fpr(cache.leaf));
+  bin2hex(digest, 20, hexfpr);
+  ASSERT_EQ(found(get_cert_byhexfpr(hexfpr)), fpr(cache.leaf));
+
+  /* Lookups by issuer and serial number.  */
+  ksba_sexp_t serial = ksba_cert_get_serial(cache.leaf);
+  ASSERT_EQ(found(get_cert_bysn(CA_DN, serial)), fpr(cache.leaf));
+  ASSERT_EQ(found(find_cert_bysn(&ctrl, CA_DN, serial)), fpr(cache.leaf));
+  ASSERT_EQ(get_cert_bysn(LEAF_DN, serial), nullptr);
+  serial[3]++;
+  ASSERT_EQ(get_cert_bysn(CA_DN, serial), nullptr);
+  ksba_free(serial);
+
+  /* Lookups by issuer and by subject.  */
+  std::string first = found(get_cert_byissuer(CA_DN, 0));
+  std::string second = found(get_cert_byissuer(CA_DN, 1));
+  ASSERT_TRUE((first == fpr(cache.ca) && second == fpr(cache.leaf)) ||
+              (first == fpr(cache.leaf) && second == fpr(cache.ca)));
+  ASSERT_EQ(get_cert_byissuer(CA_DN, 2), nullptr);
+  ASSERT_EQ(get_cert_byissuer(LEAF_DN, 0), nullptr);
+  ASSERT_EQ(found(get_cert_bysubject(LEAF_DN, 0)), fpr(cache.leaf));
+  ASSERT_EQ(get_cert_bysubject(LEAF_DN, 1), nullptr);
+  ASSERT_EQ(found(get_cert_bysubject(CA_DN, 0)), fpr(cache.ca));
+
+  /* Lookups by subject key identifier, which finds the issuer.  */
+  ksba_sexp_t keyid;
+  ASSERT_EQ(ksba_cert_get_subj_key_id(cache.leaf, NULL, &keyid), 0);
+  ASSERT_EQ(found(find_cert_bysubject(&ctrl, LEAF_DN, keyid)),
+            fpr(cache.leaf));
+  ksba_free(keyid);
+  ASSERT_EQ(find_issuing_cert(&ctrl, cache.leaf, &cert), 0);
+  ASSERT_EQ(found(cert), fpr(cache.ca));
+  ASSERT_EQ(find_issuing_cert(&ctrl, cache.ca, &cert), 0);
+  ASSERT_EQ(found(cert), fpr(cache.ca));
+
+  /* Certificates cached at runtime are not trusted.  */
+  ASSERT_EQ(is_trusted_cert(cache.ca, 15), GPG_ERR_NOT_TRUSTED);
+}
+
+TEST(NeopgLegacyTest, dirmngr_cert_cache_eviction_test) {
+  TestCertCache cache(true);
+  std::vector<ksba_cert_t> certs;
+
+  ASSERT_EQ(is_trusted_cert(cache.ca, CERTTRUST_CLASS_HKP), 0);
+  ASSERT_EQ(cache_cert_silent(cache.leaf, NULL), 0);
+  for (unsigned int i = 1; i <= MAX_NONPERM_CACHED_CERTS; i++) {
+    ksba_cert_t cert;
+    ASSERT_NO_FATAL_FAILURE(make_variant(i, cert));
+    certs.push_back(cert);
+  }
+
+  /* The cache is filled up to the limit.  */
+  for (int i = 0; i < MAX_NONPERM_CACHED_CERTS - 1; i++)
+    ASSERT_EQ(cache_cert_silent(certs[i], NULL), 0);
+  ASSERT_EQ(count_byissuer(CA_DN), MAX_NONPERM_CACHED_CERTS + 1);
+
+  /* The next certificate drops 5 percent of the others, and the
+     indexes forget them as well.  The trusted CA certificate is
+     kept.  */
+  ASSERT_EQ(cache_cert_silent(certs.back(), NULL), 0);
+  unsigned int present = cached(cache.leaf);
+  for (auto cert : certs) present += cached(cert);
+  ASSERT_EQ(present, MAX_NONPERM_CACHED_CERTS + 1 -
+                         MAX_NONPERM_CACHED_CERTS / 20);
+  ASSERT_TRUE(cached(certs.back()));
+  ASSERT_TRUE(cached(cache.ca));
+  ASSERT_EQ(count_byissuer(CA_DN), present + 1);
+
+  /* Dropped certificates can be cached again.  */
+  for (auto cert : certs)
+    if (!cached(cert)) {
+      ASSERT_EQ(cache_cert_silent(cert, NULL), 0);
+      ASSERT_TRUE(cached(cert));
+      break;
+    }
+
+  /* After a reload only the certificates from the configuration are
+     cached.  The released slots are reused.  */
+  cert_cache_deinit(0);
+  cache.init();
+  ASSERT_TRUE(cached(cache.ca));
+  ASSERT_EQ(is_trusted_cert(cache.ca, CERTTRUST_CLASS_HKP), 0);
+  ASSERT_FALSE(cached(cache.leaf));
+  ASSERT_EQ(count_byissuer(CA_DN), 1);
+  ASSERT_EQ(get_cert_bysubject(LEAF_DN, 0), nullptr);
+  for (auto cert : certs) ASSERT_EQ(cache_cert_silent(cert, NULL), 0);
+  ASSERT_EQ(count_byissuer(CA_DN), MAX_NONPERM_CACHED_CERTS + 1);
+  for (auto cert : certs) {
+    ASSERT_TRUE(cached(cert));
+    ksba_cert_release(cert);
+  }
+}
+
+TEST(NeopgLegacyTest, dirmngr_cert_cache_threads_test) {
+  TestCertCache cache;
+  std::vector<ksba_cert_t> certs;
+  std::atomic<bool> done{false};
+  std::atomic<int> failures{0};
+  std::vector<std::thread> readers;
+
+  ASSERT_EQ(cache_cert_silent(cache.ca, NULL), 0);
+  ASSERT_EQ(cache_cert_silent(cache.leaf, NULL), 0);
+  for (unsigned int i = 1; i <= 500; i++) {
+    ksba_cert_t cert;
+    ASSERT_NO_FATAL_FAILURE(make_variant(i, cert));
+    certs.push_back(cert);
+  }
+
+  /* Lookups run concurrently with each other and with changes to the
+     cache, and always see consistent indexes.  */
+  for (int i = 0; i < 4; i++)
+    readers.emplace_back([&cache, &done, &failures] {
+      struct server_control_s ctrl = {};
+      do {
+        ksba_cert_t cert;
+        if (!cached(cache.leaf)) failures++;
+        if (find_issuing_cert(&ctrl, cache.leaf, &cert))
+          failures++;
+        else if (found(cert) != fpr(cache.ca))
+          failures++;
+      } while (!done);
+    });
+  for (auto cert : certs) {
+    if (cache_cert_silent(cert, NULL)) failures++;
+  }
+  done = true;
+  for (auto &reader : readers) reader.join();
+
+  ASSERT_EQ(failures, 0);
+  ASSERT_EQ(count_byissuer(CA_DN), certs.size() + 2);
+  for (auto cert : certs) {
+    ASSERT_TRUE(cached(cert));
+    ksba_cert_release(cert);
+  }
+}
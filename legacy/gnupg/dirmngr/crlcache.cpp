@@ -90,7 +90,16 @@
 #include <config.h>
 
 #include <boost/format.hpp>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
 #include <ostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include <assert.h>
 #include <dirent.h>
@@ -125,11 +134,18 @@
 #define DBDIRFILE "DIR.txt"
 #define DBDIRVERSION 1
 
-/* The number of DB files we may have open at one time.  We need to
-   limit this because there is no guarantee that the number of issuers
-   has a upper limit.  We are currently using mmap, so it is a good
-   idea anyway to limit the number of opened cache files. */
-#define MAX_OPEN_DB_FILES 5
+/* The number of DB files we may have open at one time.  Cache files
+   are kept open and mapped once they have been used, so that
+   revocation checks don't need to open and map them again.  We still
+   need a limit because there is no guarantee that the number of
+   issuers has a upper limit. */
+#define MAX_OPEN_DB_FILES 256
+
+/* The number of bits per revoked serial number in the Bloom filter
+   of a cache entry and the number of hash functions.  This gives a
+   false positive rate of about 1%.  */
+#define BLOOM_BITS_PER_KEY 10
+#define BLOOM_HASHES 7
 
 static const char oidstr_crlNumber[] = "2.5.29.20";
 /* static const char oidstr_issuingDistributionPoint[] = "2.5.29.28"; */
@@ -160,8 +176,13 @@ struct crl_cache_entry_s {
 
   unsigned int cdb_use_count; /* Current use count. */
   unsigned int cdb_lru_count; /* Used for LRU purposes. */
+  int cdb_opening;            /* The cache file is being opened.  */
   int dbfile_checked;         /* Set to true if the dbfile_hash value has
                                  been checked one. */
+
+  unsigned char *bloom; /* Bloom filter over the serial numbers in the
+                           cache file or NULL if not yet built.  */
+  size_t bloom_bits;    /* The size of BLOOM in bits.  */
 };
 
 /* Definition of the entire cache object. */
@@ -179,6 +200,14 @@ static crl_cache_entry_t find_entry(crl_cache_entry_t first,
    right at startup.  */
 static crl_cache_t current_cache;
 
+/* Protects the list of entries in the current cache, which is also
+   used by the background refresher.  */
+static std::mutex entries_lock;
+
+/* Signalled with ENTRIES_LOCK held when lock_db_file has finished
+   opening a cache file.  */
+static std::condition_variable db_file_opened;
+
 /* Return the current cache object or bail out if it is has not yet
    been initialized.  */
 static crl_cache_t get_current_cache(void) {
@@ -318,16 +347,22 @@ static char *next_line_from_file(estream_t fp, gpg_error_t *r_err) {
   return tmpbuf;
 }
 
+/* Close the cache file of ENTRY.  */
+static void close_db_file(crl_cache_entry_t entry) {
+  int fd = cdb_fileno(entry->cdb);
+
+  cdb_free(entry->cdb);
+  xfree(entry->cdb);
+  entry->cdb = NULL;
+  if (close(fd))
+    log_error(_("error closing cache file: %s\n"), strerror(errno));
+}
+
 /* Release one cache entry.  */
 static void release_one_cache_entry(crl_cache_entry_t entry) {
   if (entry) {
-    if (entry->cdb) {
-      int fd = cdb_fileno(entry->cdb);
-      cdb_free(entry->cdb);
-      xfree(entry->cdb);
-      if (close(fd))
-        log_error(_("error closing cache file: %s\n"), strerror(errno));
-    }
+    if (entry->cdb) close_db_file(entry);
+    xfree(entry->bloom);
     xfree(entry->release_ptr);
     xfree(entry->check_trust_anchor);
     xfree(entry);
@@ -911,29 +946,106 @@ static int check_dbfile(const char *fname, const char *md5hexvalue) {
   return memcmp(buffer1, buffer2, 16);
 }
 
+/* Return a hash of the serial number SN/SNLEN for the Bloom filter.  */
+static uint64_t bloom_hash(const unsigned char *sn, size_t snlen) {
+  uint64_t h = 0xcbf29ce484222325ULL; /* FNV-1a.  */
+
+  for (; snlen; sn++, snlen--) {
+    h ^= *sn;
+    h *= 0x100000001b3ULL;
+  }
+  /* Mix the high bits, which are used for the second hash.  */
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h;
+}
+
+/* Set (if SET is true) or test the bits for the hash H in the Bloom
+   filter BLOOM of NBITS bits.  Returns true if all bits are set.  */
+static int bloom_bit_positions(unsigned char *bloom, size_t nbits,
+                               uint64_t h, int set) {
+  uint32_t h1 = (uint32_t)h;
+  uint32_t h2 = (uint32_t)(h >> 32) | 1;
+  int i;
+
+  for (i = 0; i < BLOOM_HASHES; i++) {
+    size_t bit = (h1 + (uint64_t)i * h2) % nbits;
+    if (set)
+      bloom[bit / 8] |= 1 << (bit % 8);
+    else if (!(bloom[bit / 8] & (1 << (bit % 8))))
+      return 0;
+  }
+  return 1;
+}
+
+/* Build the Bloom filter for the open cache file CDB of the issuer
+   ISSUER_HASH and return it with its size in bits at R_NBITS.  On
+   error NULL is returned and all lookups go to the cache file.  */
+static unsigned char *build_bloom_filter(struct cdb *cdb,
+                                         const char *issuer_hash,
+                                         size_t *r_nbits) {
+  struct cdb_find cdbfp;
+  std::vector<uint64_t> hashes;
+  unsigned char *bloom;
+  size_t n, nbits;
+  int rc;
+
+  rc = cdb_findinit(&cdbfp, cdb, NULL, 0);
+  while (!rc && (rc = cdb_findnext(&cdbfp)) > 0) {
+    rc = 0;
+    n = cdb_keylen(cdb);
+    if (cdb_keypos(cdb) > cdb->cdb_fsize ||
+        cdb->cdb_fsize - cdb_keypos(cdb) < n)
+      return NULL;
+    hashes.push_back(bloom_hash(cdb->cdb_mem + cdb_keypos(cdb), n));
+  }
+  if (rc < 0) return NULL;
+
+  nbits = std::max<size_t>(64, hashes.size() * BLOOM_BITS_PER_KEY);
+  bloom = (unsigned char *)xtrycalloc((nbits + 7) / 8, 1);
+  if (!bloom) return NULL;
+  for (uint64_t h : hashes) bloom_bit_positions(bloom, nbits, h, 1);
+
+  if (DBG_LOOKUP)
+    log_debug("crlcache: Bloom filter for %s with %u serial numbers\n",
+              issuer_hash, (unsigned int)hashes.size());
+  *r_nbits = nbits;
+  return bloom;
+}
+
 /* Open the cache file for ENTRY.  This function implements a caching
    strategy and might close unused cache files. It is required to use
-   unlock_db_file after using the file. */
-static struct cdb *lock_db_file(crl_cache_t cache, crl_cache_entry_t entry) {
+   unlock_db_file after using the file.  LOCK holds ENTRIES_LOCK.  It
+   is released while the file is opened and its checksum verified, so
+   that lookups in other cache files do not wait.  Other threads which
+   need the same file meanwhile wait for it instead of opening it
+   again.  */
+static struct cdb *lock_db_file(crl_cache_t cache, crl_cache_entry_t entry,
+                                std::unique_lock<std::mutex> &lock) {
   char *fname;
   int fd;
   int open_count;
+  int checked;
+  struct cdb *cdb;
+  unsigned char *bloom = NULL;
+  size_t nbits = 0;
   crl_cache_entry_t e;
 
-  if (entry->cdb) {
-    entry->cdb_use_count++;
-    return entry->cdb;
-  }
+  /* The use count keeps ENTRY from being released while the lock is
+     not held.  */
+  entry->cdb_use_count++;
+  db_file_opened.wait(lock, [entry] { return !entry->cdb_opening; });
+  if (entry->cdb) return entry->cdb;
 
   for (open_count = 0, e = cache->entries; e; e = e->next) {
-    if (e->cdb) open_count++;
+    if (e->cdb || e->cdb_opening) open_count++;
     /*       log_debug ("CACHE: cdb=%p use_count=%u lru_count=%u\n", */
     /*                  e->cdb,e->cdb_use_count,e->cdb_lru_count); */
   }
 
   /* If there are too many file open, find the least recent used DB
-     file and close it.  Note that for Pth thread safeness we need to
-     use a loop here. */
+     file and close it.  */
   while (open_count >= MAX_OPEN_DB_FILES) {
     crl_cache_entry_t last_e = NULL;
     unsigned int last_lru = (unsigned int)(-1);
@@ -945,55 +1057,65 @@ static struct cdb *lock_db_file(crl_cache_t cache, crl_cache_entry_t entry) {
       }
     if (!last_e) {
       log_error(_("too many open cache files; can't open anymore\n"));
+      entry->cdb_use_count--;
       return NULL;
     }
 
     /*       log_debug ("CACHE: closing file at cdb=%p\n", last_e->cdb); */
 
-    fd = cdb_fileno(last_e->cdb);
-    cdb_free(last_e->cdb);
-    xfree(last_e->cdb);
-    last_e->cdb = NULL;
-    if (close(fd))
-      log_error(_("error closing cache file: %s\n"), strerror(errno));
+    close_db_file(last_e);
     open_count--;
   }
 
+  entry->cdb_opening = 1;
+  checked = entry->dbfile_checked;
+  lock.unlock();
+
   fname = make_db_file_name(entry->issuer_hash);
   if (opt.verbose) log_info(_("opening cache file '%s'\n"), fname);
 
-  if (!entry->dbfile_checked) {
-    if (!check_dbfile(fname, entry->dbfile_hash)) entry->dbfile_checked = 1;
-    /* Note, in case of an error we don't print an error here but
-       let require the caller to do that check. */
-  }
+  /* Note, in case of an error we don't print an error here but let
+     require the caller to do that check. */
+  if (!checked && !check_dbfile(fname, entry->dbfile_hash)) checked = 1;
 
-  entry->cdb = (cdb *)xtrycalloc(1, sizeof *entry->cdb);
-  if (!entry->cdb) {
-    xfree(fname);
-    return NULL;
-  }
-  fd = open(fname, O_RDONLY);
-  if (fd == -1) {
-    log_error(_("error opening cache file '%s': %s\n"), fname, strerror(errno));
-    xfree(entry->cdb);
-    entry->cdb = NULL;
-    xfree(fname);
-    return NULL;
+  cdb = (struct cdb *)xtrycalloc(1, sizeof *cdb);
+  if (cdb) {
+    fd = open(fname, O_RDONLY);
+    if (fd == -1) {
+      log_error(_("error opening cache file '%s': %s\n"), fname,
+                strerror(errno));
+      xfree(cdb);
+      cdb = NULL;
+    } else if (cdb_init(cdb, fd)) {
+      log_error(_("error initializing cache file '%s' for reading: %s\n"),
+                fname, strerror(errno));
+      xfree(cdb);
+      cdb = NULL;
+      close(fd);
+    }
   }
-  if (cdb_init(entry->cdb, fd)) {
-    log_error(_("error initializing cache file '%s' for reading: %s\n"), fname,
-              strerror(errno));
-    xfree(entry->cdb);
-    entry->cdb = NULL;
-    close(fd);
-    xfree(fname);
+  xfree(fname);
+
+  /* The filter is only used for a file with a good checksum.  */
+  if (cdb && checked && !entry->bloom)
+    bloom = build_bloom_filter(cdb, entry->issuer_hash, &nbits);
+
+  lock.lock();
+  entry->cdb_opening = 0;
+  db_file_opened.notify_all();
+  if (!cdb) {
+    entry->cdb_use_count--;
     return NULL;
   }
-  xfree(fname);
 
-  entry->cdb_use_count = 1;
+  entry->cdb = cdb;
   entry->cdb_lru_count = 0;
+  if (checked) entry->dbfile_checked = 1;
+  if (bloom && !entry->bloom) {
+    entry->bloom = bloom;
+    entry->bloom_bits = nbits;
+  } else
+    xfree(bloom);
 
   return entry->cdb;
 }
@@ -1027,6 +1149,22 @@ static void unlock_db_file(crl_cache_t cache, crl_cache_entry_t entry) {
   }
 }
 
+/* Remove the entries marked for deletion which are not in use from
+   CACHE.  */
+static void purge_deleted_entries(crl_cache_t cache) {
+  crl_cache_entry_t *ep = &cache->entries;
+
+  while (*ep) {
+    crl_cache_entry_t e = *ep;
+
+    if (e->deleted && !e->cdb_use_count) {
+      *ep = e->next;
+      release_one_cache_entry(e);
+    } else
+      ep = &e->next;
+  }
+}
+
 /* Find ISSUER_HASH in our cache FIRST. This may be used to enumerate
    the linked list we use to keep the CRLs of an issuer. */
 static crl_cache_entry_t find_entry(crl_cache_entry_t first,
@@ -1057,6 +1195,8 @@ void crl_cache_init(void) {
 /* Remove the cache information and all its resources.  Note that we
    still keep the cache on disk. */
 void crl_cache_deinit(void) {
+  std::lock_guard<std::mutex> lock(entries_lock);
+
   if (current_cache) {
     release_cache(current_cache);
     current_cache = NULL;
@@ -1088,9 +1228,10 @@ static crl_cache_result_t cache_isvalid(ctrl_t ctrl, const char *issuer_hash,
   crl_cache_entry_t entry;
   gnupg_isotime_t current_time;
   size_t n;
+  int user_trust_req;
+  std::string trust_anchor;
 
-  (void)ctrl;
-
+  std::unique_lock<std::mutex> lock(entries_lock);
   entry = find_entry(cache->entries, issuer_hash);
   if (!entry) {
     log_info(_("no CRL available for issuer id %s\n"), issuer_hash);
@@ -1128,17 +1269,26 @@ static crl_cache_result_t cache_isvalid(ctrl_t ctrl, const char *issuer_hash,
     return CRL_CACHE_CANTUSE;
   }
 
-  cdb = lock_db_file(cache, entry);
-  if (!cdb) return CRL_CACHE_DONTKNOW; /* Hmmm, not the best error code. */
+  /* The Bloom filter answers most queries for serial numbers which
+     are not listed without looking at the cache file.  */
+  if (entry->dbfile_checked && entry->bloom &&
+      !bloom_bit_positions(entry->bloom, entry->bloom_bits,
+                           bloom_hash(sn, snlen), 0)) {
+    cdb = NULL;
+    rc = 0;
+  } else {
+    cdb = lock_db_file(cache, entry, lock);
+    if (!cdb) return CRL_CACHE_DONTKNOW; /* Hmmm, not the best error code. */
 
-  if (!entry->dbfile_checked) {
-    log_error(_("cached CRL for issuer id %s tampered; we need to update\n"),
-              issuer_hash);
-    unlock_db_file(cache, entry);
-    return CRL_CACHE_DONTKNOW;
-  }
+    if (!entry->dbfile_checked) {
+      log_error(_("cached CRL for issuer id %s tampered; we need to update\n"),
+                issuer_hash);
+      unlock_db_file(cache, entry);
+      return CRL_CACHE_DONTKNOW;
+    }
 
-  rc = cdb_find(cdb, sn, snlen);
+    rc = cdb_find(cdb, sn, snlen);
+  }
   if (rc == 1) {
     n = cdb_datalen(cdb);
     if (n != 16) {
@@ -1169,12 +1319,18 @@ static crl_cache_result_t cache_isvalid(ctrl_t ctrl, const char *issuer_hash,
     retval = CRL_CACHE_DONTKNOW;
   }
 
-  if (entry->user_trust_req &&
+  user_trust_req = entry->user_trust_req;
+  if (entry->check_trust_anchor) trust_anchor = entry->check_trust_anchor;
+  if (cdb) unlock_db_file(cache, entry);
+  /* Asking the client may take a while.  */
+  lock.unlock();
+
+  if (user_trust_req &&
       (retval == CRL_CACHE_VALID || retval == CRL_CACHE_INVALID)) {
-    if (!entry->check_trust_anchor) {
+    if (trust_anchor.empty()) {
       log_error("inconsistent data on user trust check\n");
       retval = CRL_CACHE_CANTUSE;
-    } else if (get_istrusted_from_client(ctrl, entry->check_trust_anchor)) {
+    } else if (get_istrusted_from_client(ctrl, trust_anchor.c_str())) {
       if (opt.verbose)
         log_info("no system trust and client does not trust either\n");
       retval = CRL_CACHE_CANTUSE;
@@ -1184,8 +1340,6 @@ static crl_cache_result_t cache_isvalid(ctrl_t ctrl, const char *issuer_hash,
     }
   }
 
-  unlock_db_file(cache, entry);
-
   return retval;
 }
 
@@ -1386,6 +1540,165 @@ static void abort_sig_check(ksba_crl_t crl, gcry_md_hd_t md) {
   gcry_md_close(md);
 }
 
+/* Loading a large CRL is split into three stages which run on their
+   own threads: the parsing of the CRL, the hashing of its signed part
+   and the writing of the cache file.  The stages are connected by
+   bounded queues.  */
+
+/* The number of items passed to the writer at once.  */
+#define CRL_ITEM_BATCH 1024
+
+/* The amount of signed data passed to the hasher at once.  */
+#define CRL_HASH_CHUNK 65536
+
+/* The maximum number of batches or chunks waiting in a queue.  */
+#define CRL_QUEUE_LIMIT 16
+
+/* A bounded queue between two stages.  */
+template <typename T>
+class crl_queue {
+ public:
+  /* Append ITEM, waiting while the queue is full.  */
+  void push(T item) {
+    std::unique_lock<std::mutex> lock(m_lock);
+    m_not_full.wait(lock, [this] { return m_items.size() < CRL_QUEUE_LIMIT; });
+    m_items.push_back(std::move(item));
+    m_not_empty.notify_one();
+  }
+
+  /* Tell the consumer that no more items follow.  */
+  void close() {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_closed = true;
+    m_not_empty.notify_one();
+  }
+
+  /* Remove the next item and store it at ITEM.  Returns false once
+     the queue has been closed and is empty.  */
+  bool pop(T &item) {
+    std::unique_lock<std::mutex> lock(m_lock);
+    m_not_empty.wait(lock, [this] { return m_closed || !m_items.empty(); });
+    if (m_items.empty()) return false;
+    item = std::move(m_items.front());
+    m_items.pop_front();
+    m_not_full.notify_one();
+    return true;
+  }
+
+ private:
+  std::mutex m_lock;
+  std::condition_variable m_not_empty;
+  std::condition_variable m_not_full;
+  std::deque<T> m_items;
+  bool m_closed{false};
+};
+
+/* One revoked certificate: the serial number as key and the record
+   with the reason and the revocation date.  */
+struct crl_item_s {
+  std::string serial;
+  unsigned char record[1 + 15];
+};
+
+typedef std::vector<struct crl_item_s> crl_item_batch_t;
+
+/* The hashing and writing stages of crl_parse_insert.  */
+class crl_insert_pipeline {
+ public:
+  explicit crl_insert_pipeline(struct cdb_make *cdb)
+      : m_cdb(cdb), m_writer(&crl_insert_pipeline::write_items, this) {
+    m_batch.reserve(CRL_ITEM_BATCH);
+  }
+
+  ~crl_insert_pipeline() {
+    finish_hashing();
+    finish_writing();
+  }
+
+  /* Hash the signed data of CRL with MD on the hashing thread.  */
+  void start_hashing(ksba_crl_t crl, gcry_md_hd_t md) {
+    m_md = md;
+    m_hasher = std::thread(&crl_insert_pipeline::hash_chunks, this);
+    ksba_crl_set_hash_function(crl, queue_hash_data, this);
+  }
+
+  /* Wait until all signed data has been hashed.  */
+  void finish_hashing(void) {
+    if (!m_hasher.joinable()) return;
+    if (!m_chunk.empty()) m_chunks.push(std::move(m_chunk));
+    m_chunk.clear();
+    m_chunks.close();
+    m_hasher.join();
+  }
+
+  /* Queue the item with serial number SN of length SNLEN and RECORD
+     for writing.  */
+  void add_item(const unsigned char *sn, size_t snlen,
+                const unsigned char *record) {
+    m_batch.push_back(crl_item_s());
+    m_batch.back().serial.assign((const char *)sn, snlen);
+    memcpy(m_batch.back().record, record, sizeof m_batch.back().record);
+    if (m_batch.size() == CRL_ITEM_BATCH) {
+      m_batches.push(std::move(m_batch));
+      m_batch = crl_item_batch_t();
+      m_batch.reserve(CRL_ITEM_BATCH);
+    }
+  }
+
+  /* Wait until all items have been written.  Returns 0 on success or
+     the errno of the first failed write.  */
+  int finish_writing(void) {
+    if (m_writer.joinable()) {
+      if (!m_batch.empty()) m_batches.push(std::move(m_batch));
+      m_batch.clear();
+      m_batches.close();
+      m_writer.join();
+    }
+    return m_write_errno;
+  }
+
+ private:
+  struct cdb_make *m_cdb;
+  gcry_md_hd_t m_md{nullptr};
+  std::string m_chunk;
+  crl_queue<std::string> m_chunks;
+  crl_item_batch_t m_batch;
+  crl_queue<crl_item_batch_t> m_batches;
+  int m_write_errno{0};
+  std::thread m_hasher;
+  std::thread m_writer;
+
+  static void queue_hash_data(void *arg, const void *data, size_t len) {
+    crl_insert_pipeline *self = (crl_insert_pipeline *)arg;
+
+    self->m_chunk.append((const char *)data, len);
+    if (self->m_chunk.size() >= CRL_HASH_CHUNK) {
+      self->m_chunks.push(std::move(self->m_chunk));
+      self->m_chunk.clear();
+    }
+  }
+
+  void hash_chunks(void) {
+    std::string chunk;
+
+    while (m_chunks.pop(chunk)) gcry_md_write(m_md, chunk.data(), chunk.size());
+  }
+
+  void write_items(void) {
+    crl_item_batch_t batch;
+
+    /* After an error the database can't be completed, but we keep on
+       reading so that the parser is not blocked.  */
+    while (m_batches.pop(batch))
+      for (const auto &item : batch) {
+        if (m_write_errno) break;
+        if (cdb_make_add(m_cdb, item.serial.data(), item.serial.size(),
+                         item.record, sizeof item.record))
+          m_write_errno = errno ? errno : EIO;
+      }
+  }
+};
+
 /* Workhorse of the CRL loading machinery.  The CRL is read using the
    CRL object and stored in the data base file DB with the name FNAME
    (only used for printing error messages).  That DB should be a
@@ -1411,6 +1724,8 @@ static int crl_parse_insert(ctrl_t ctrl, ksba_crl_t crl, struct cdb_make *cdb,
   gcry_md_hd_t md = NULL;
   int algo = 0;
   size_t n;
+  crl_insert_pipeline pipeline(cdb);
+  int rc;
 
   (void)fname;
 
@@ -1430,6 +1745,7 @@ static int crl_parse_insert(ctrl_t ctrl, ksba_crl_t crl, struct cdb_make *cdb,
       case KSBA_SR_BEGIN_ITEMS: {
         err = start_sig_check(crl, &md, &algo);
         if (err) goto failure;
+        pipeline.start_hashing(crl, md);
 
         err = ksba_crl_get_update_times(crl, thisupdate, nextupdate);
         if (err) {
@@ -1456,7 +1772,6 @@ static int crl_parse_insert(ctrl_t ctrl, ksba_crl_t crl, struct cdb_make *cdb,
         const unsigned char *p;
         ksba_isotime_t rdate;
         ksba_crl_reason_t reason;
-        int rc;
         unsigned char record[1 + 15];
 
         err = ksba_crl_get_item(crl, &serial, rdate, &reason);
@@ -1470,19 +1785,20 @@ static int crl_parse_insert(ctrl_t ctrl, ksba_crl_t crl, struct cdb_make *cdb,
         if (!p) BUG();
         record[0] = (reason & 0xff);
         memcpy(record + 1, rdate, 15);
-        rc = cdb_make_add(cdb, p, n, record, 1 + 15);
-        if (rc) {
-          err = gpg_error_from_errno(errno);
-          log_error(_("error inserting item into "
-                      "temporary cache file: %s\n"),
-                    strerror(errno));
-          goto failure;
-        }
+        pipeline.add_item(p, n, record);
 
         ksba_free(serial);
       } break;
 
       case KSBA_SR_END_ITEMS:
+        rc = pipeline.finish_writing();
+        if (rc) {
+          err = gpg_error_from_errno(rc);
+          log_error(_("error inserting item into "
+                      "temporary cache file: %s\n"),
+                    strerror(rc));
+          goto failure;
+        }
         break;
 
       case KSBA_SR_READY: {
@@ -1547,6 +1863,7 @@ static int crl_parse_insert(ctrl_t ctrl, ksba_crl_t crl, struct cdb_make *cdb,
           goto failure;
         }
 
+        pipeline.finish_hashing();
         err = finish_sig_check(crl, md, algo, crlissuer_cert);
         if (err) {
           log_error(_("CRL signature verification failed: %s\n"),
@@ -1577,6 +1894,8 @@ static int crl_parse_insert(ctrl_t ctrl, ksba_crl_t crl, struct cdb_make *cdb,
   assert(!err);
 
 failure:
+  pipeline.finish_hashing();
+  pipeline.finish_writing();
   if (md) abort_sig_check(crl, md);
   ksba_cert_release(crlissuer_cert);
   return err;
@@ -1735,7 +2054,12 @@ gpg_error_t crl_cache_insert(ctrl_t ctrl, const char *url,
               strerror(errno));
     goto leave;
   }
-  cdb_make_start(&cdb, fd_cdb);
+  if (cdb_make_start(&cdb, fd_cdb)) {
+    err = gpg_error_from_errno(errno);
+    log_error(_("error creating temporary cache file '%s': %s\n"), fname,
+              strerror(errno));
+    goto leave;
+  }
 
   err = crl_parse_insert(ctrl, crl, &cdb, fname, &issuer, thisupdate,
                          nextupdate, &trust_anchor);
@@ -1839,63 +2163,68 @@ gpg_error_t crl_cache_insert(ctrl_t ctrl, const char *url,
   entry->crl_number = get_crl_number(crl);
   entry->authority_issuer = get_auth_key_id(crl, &entry->authority_serialno);
   entry->invalid = invalidate_crl;
+  /* We just computed the checksum from the file.  */
+  entry->dbfile_checked = 1;
   entry->user_trust_req = !!trust_anchor;
   entry->check_trust_anchor = trust_anchor;
   trust_anchor = NULL;
 
-  /* Check whether we already have an entry for this issuer and mark
-     it as deleted. We better use a loop, just in case duplicates got
-     somehow into the list. */
-  for (e = cache->entries; (e = find_entry(e, entry->issuer_hash)); e = e->next)
-    e->deleted = 1;
-
-  /* Rename the temporary DB to the real name. */
-  newfname = make_db_file_name(entry->issuer_hash);
-  if (opt.verbose) log_info(_("creating cache file '%s'\n"), newfname);
-
-  /* Just in case close unused matching files.  Actually we need this
-     only under Windows but saving file descriptors is never bad.  */
   {
-    int any;
-    do {
-      any = 0;
-      for (e = cache->entries; e; e = e->next)
-        if (!e->cdb_use_count && e->cdb &&
-            !strcmp(e->issuer_hash, entry->issuer_hash)) {
-          int fd = cdb_fileno(e->cdb);
-          cdb_free(e->cdb);
-          xfree(e->cdb);
-          e->cdb = NULL;
-          if (close(fd))
-            log_error(_("error closing cache file: %s\n"), strerror(errno));
-          any = 1;
-          break;
-        }
-    } while (any);
-  }
+    /* The old cache file stays valid for revocation checks which
+       already use it, while the new one is published with a rename.  */
+    std::lock_guard<std::mutex> lock(entries_lock);
+
+    /* Check whether we already have an entry for this issuer and mark
+       it as deleted. We better use a loop, just in case duplicates got
+       somehow into the list. */
+    for (e = cache->entries; (e = find_entry(e, entry->issuer_hash));
+         e = e->next)
+      e->deleted = 1;
+
+    /* Rename the temporary DB to the real name. */
+    newfname = make_db_file_name(entry->issuer_hash);
+    if (opt.verbose) log_info(_("creating cache file '%s'\n"), newfname);
+
+    /* Just in case close unused matching files.  Actually we need this
+       only under Windows but saving file descriptors is never bad.  */
+    {
+      int any;
+      do {
+        any = 0;
+        for (e = cache->entries; e; e = e->next)
+          if (!e->cdb_use_count && e->cdb &&
+              !strcmp(e->issuer_hash, entry->issuer_hash)) {
+            close_db_file(e);
+            any = 1;
+            break;
+          }
+      } while (any);
+    }
 #ifdef HAVE_W32_SYSTEM
-  gnupg_remove(newfname);
+    gnupg_remove(newfname);
 #endif
-  if (rename(fname, newfname)) {
-    err = gpg_error_from_syserror();
-    log_error(_("problem renaming '%s' to '%s': %s\n"), fname, newfname,
-              gpg_strerror(err));
-    goto leave;
-  }
-  xfree(fname);
-  fname = NULL; /*(let the cleanup code not try to remove it)*/
+    if (rename(fname, newfname)) {
+      err = gpg_error_from_syserror();
+      log_error(_("problem renaming '%s' to '%s': %s\n"), fname, newfname,
+                gpg_strerror(err));
+      goto leave;
+    }
+    xfree(fname);
+    fname = NULL; /*(let the cleanup code not try to remove it)*/
 
-  /* Link the new entry in. */
-  entry->next = cache->entries;
-  cache->entries = entry;
-  entry = NULL;
+    /* Link the new entry in. */
+    entry->next = cache->entries;
+    cache->entries = entry;
+    entry = NULL;
 
-  err = update_dir(cache);
-  if (err) {
-    log_error(
-        _("updating the DIR file failed - "
-          "cache entry will get lost with the next program start\n"));
-    err = 0; /* Keep on running. */
+    err = update_dir(cache);
+    if (err) {
+      log_error(
+          _("updating the DIR file failed - "
+            "cache entry will get lost with the next program start\n"));
+      err = 0; /* Keep on running. */
+    }
+    purge_deleted_entries(cache);
   }
 
 leave:
@@ -1917,6 +2246,7 @@ leave:
 /* Print one cached entry E in a human readable format to stream
    FP. Return 0 on success. */
 static gpg_error_t list_one_crl_entry(crl_cache_t cache, crl_cache_entry_t e,
+                                      std::unique_lock<std::mutex> &lock,
                                       std::ostream &out) {
   struct cdb_find cdbfp;
   struct cdb *cdb;
@@ -1958,7 +2288,7 @@ static gpg_error_t list_one_crl_entry(crl_cache_t cache, crl_cache_entry_t e,
         "due to an unknown critical extension!\n");
   if ((e->invalid & ~3)) out << _(" ERROR: The CRL will not be used\n");
 
-  cdb = lock_db_file(cache, e);
+  cdb = lock_db_file(cache, e, lock);
   if (!cdb) return GPG_ERR_GENERAL;
 
   if (!e->dbfile_checked)
@@ -2033,9 +2363,10 @@ gpg_error_t crl_cache_list(std::ostream &out) {
   crl_cache_entry_t entry;
   gpg_error_t err = 0;
 
+  std::unique_lock<std::mutex> lock(entries_lock);
   for (entry = cache->entries; entry && !entry->deleted && !err;
        entry = entry->next)
-    err = list_one_crl_entry(cache, entry, out);
+    err = list_one_crl_entry(cache, entry, lock, out);
 
   return err;
 }
@@ -2123,6 +2454,8 @@ gpg_error_t crl_cache_reload_crl(ctrl_t ctrl, ksba_cert_t cert) {
       if (err) {
         log_error(_("crl_cache_insert via DP failed: %s\n"), gpg_strerror(err));
         last_err = err;
+        crl_close_reader(reader);
+        reader = NULL;
         continue; /* with the next name. */
       }
       last_err = 0;
@@ -2187,3 +2520,159 @@ leave:
   ksba_free(issuer);
   return err;
 }
+
+/* The background refresher.  It fetches a new CRL for every cached
+   issuer shortly before the cached one expires, so that revocation
+   checks don't need to wait for the download.  */
+
+/* How often the refresher looks for CRLs which are due.  */
+#define REFRESH_INTERVAL 60
+
+/* A CRL is refreshed a tenth of its validity period before it
+   expires, but within these bounds, plus a random jitter of up to
+   half of that so that the CRLs of many issuers expiring at the same
+   time are not all fetched at once.  */
+#define REFRESH_LEAD_MIN (5 * 60)
+#define REFRESH_LEAD_MAX (60 * 60)
+
+/* The time to wait before trying again after a refresh which did not
+   change next_update, e.g. because the fetch failed.  */
+#define REFRESH_RETRY (15 * 60)
+
+/* The maximum number of CRLs fetched at the same time.  */
+#define MAX_REFRESH_WORKERS 2
+
+/* The refresh schedule for one issuer.  */
+struct refresh_item_s {
+  std::string next_update; /* The next_update DUE was computed for.  */
+  time_t due;              /* When to fetch a new CRL.  */
+};
+
+static std::mutex refresh_lock;
+static std::condition_variable refresh_cond;
+static std::thread refresh_thread;
+static int refresh_stop;
+
+/* Only used by the refresher thread.  */
+static std::map<std::string, struct refresh_item_s> refresh_schedule;
+
+/* A CRL to be refreshed.  */
+struct refresh_job_s {
+  std::string issuer_hash;
+  std::string issuer;
+  std::string url;
+};
+
+/* Compute the time when the CRL of ENTRY should be refreshed.  */
+static time_t refresh_due_time(crl_cache_entry_t entry) {
+  static std::minstd_rand rng(std::random_device{}());
+  time_t this_update = isotime2epoch(entry->this_update);
+  time_t next_update = isotime2epoch(entry->next_update);
+  time_t lead;
+
+  if (next_update == (time_t)(-1)) return (time_t)(-1);
+
+  lead = this_update == (time_t)(-1) ? 0 : (next_update - this_update) / 10;
+  lead = std::max<time_t>(REFRESH_LEAD_MIN,
+                          std::min<time_t>(lead, REFRESH_LEAD_MAX));
+  lead += rng() % (lead / 2 + 1);
+  return next_update - lead;
+}
+
+/* Collect up to MAX_REFRESH_WORKERS cached CRLs which are due at
+   time NOW.  */
+static std::vector<struct refresh_job_s> collect_refresh_jobs(time_t now) {
+  std::vector<struct refresh_job_s> jobs;
+  std::lock_guard<std::mutex> lock(entries_lock);
+  crl_cache_entry_t e;
+
+  if (!current_cache) return jobs;
+
+  for (e = current_cache->entries; e; e = e->next) {
+    if (e->deleted) continue;
+
+    struct refresh_item_s &item = refresh_schedule[e->issuer_hash];
+    if (item.next_update != e->next_update) {
+      item.next_update = e->next_update;
+      item.due = refresh_due_time(e);
+    }
+    if (item.due == (time_t)(-1) || item.due > now ||
+        jobs.size() >= MAX_REFRESH_WORKERS)
+      continue;
+
+    /* Don't try again before the retry time if the new CRL has the
+       same next_update.  */
+    item.due = now + REFRESH_RETRY;
+    jobs.push_back({e->issuer_hash, e->issuer, e->url});
+  }
+
+  return jobs;
+}
+
+/* Fetch a new CRL for JOB and insert it into the cache.  */
+static void refresh_one_crl(const struct refresh_job_s &job) {
+  struct server_control_s ctrlbuf;
+  ksba_reader_t reader = NULL;
+  gpg_error_t err;
+
+  memset(&ctrlbuf, 0, sizeof ctrlbuf);
+  dirmngr_init_default_ctrl(&ctrlbuf);
+
+  if (opt.verbose)
+    log_info("refreshing CRL for issuer id %s from '%s'\n",
+             job.issuer_hash.c_str(), job.url.c_str());
+  if (job.url == "default location(s)")
+    err = crl_fetch_default(&ctrlbuf, job.issuer.c_str(), &reader);
+  else
+    err = crl_fetch(&ctrlbuf, job.url.c_str(), &reader);
+  if (!err) err = crl_cache_insert(&ctrlbuf, job.url.c_str(), reader);
+  if (err)
+    log_error("refreshing CRL for issuer id %s failed: %s\n",
+              job.issuer_hash.c_str(), gpg_strerror(err));
+  crl_close_reader(reader);
+
+  dirmngr_deinit_default_ctrl(&ctrlbuf);
+}
+
+static void refresh_loop(void) {
+  std::unique_lock<std::mutex> lock(refresh_lock);
+
+  while (!refresh_stop) {
+    std::vector<struct refresh_job_s> jobs = collect_refresh_jobs(time(NULL));
+
+    if (jobs.empty()) {
+      refresh_cond.wait_for(lock, std::chrono::seconds(REFRESH_INTERVAL));
+      continue;
+    }
+
+    /* Run the fetches without holding the lock so that we can be
+       asked to stop in the meantime.  */
+    lock.unlock();
+    std::vector<std::thread> workers;
+    for (const auto &job : jobs) workers.emplace_back(refresh_one_crl, job);
+    for (auto &worker : workers) worker.join();
+    lock.lock();
+  }
+}
+
+/* Start the background refresher.  */
+void crl_cache_start_refresher(void) {
+  std::lock_guard<std::mutex> lock(refresh_lock);
+
+  if (refresh_thread.joinable()) return;
+  refresh_stop = 0;
+  refresh_thread = std::thread(refresh_loop);
+}
+
+/* Stop the background refresher and wait for running fetches to
+   finish.  */
+void crl_cache_stop_refresher(void) {
+  {
+    std::lock_guard<std::mutex> lock(refresh_lock);
+
+    if (!refresh_thread.joinable()) return;
+    refresh_stop = 1;
+  }
+  refresh_cond.notify_all();
+  refresh_thread.join();
+}
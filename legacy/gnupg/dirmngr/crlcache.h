@@ -60,4 +60,7 @@ gpg_error_t crl_cache_load(ctrl_t ctrl, const char *filename);
 
 gpg_error_t crl_cache_reload_crl(ctrl_t ctrl, ksba_cert_t cert);
 
+void crl_cache_start_refresher(void);
+void crl_cache_stop_refresher(void);
+
 #endif /* CRLCACHE_H */
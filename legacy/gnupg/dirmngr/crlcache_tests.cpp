@@ -0,0 +1,179 @@
+/* Tests for the CRL cache
+   Copyright 2018 The NeoPG developers
+
+   NeoPG is released under the Simplified BSD License (see license.txt)
+*/
+
+#include <config.h>
+
+#include "gtest/gtest.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dirmngr.h"
+
+#include "cdb.h"
+#include "crlcache.h"
+
+#include "legacy_environment.h"
+
+using namespace NeoPG;
+
+namespace {
+
+const std::string ISSUER1 = std::string(40, '1');
+const std::string ISSUER2 = std::string(40, '2');
+const std::string TAMPERED = std::string(40, '3');
+const std::string UNKNOWN = std::string(40, '4');
+
+/* The serial numbers used in the tests.  The even ones below
+   NREVOKED are revoked.  */
+const int NSERIALS = 4000;
+const int NREVOKED = 2000;
+
+std::string serial(int i) {
+  char buf[9];
+  snprintf(buf, sizeof buf, "%08X", i);
+  return buf;
+}
+
+bool revoked(int i) { return i < NREVOKED && i % 2 == 0; }
+
+/* A CRL cache in a temporary directory.  The cache files are written
+   directly in the format of the cache.  */
+class TestCrlCache {
+ public:
+  TestCrlCache() : m_homedir_cache(opt.homedir_cache) {
+    opt.homedir_cache = m_dir.path().c_str();
+    mkdir((m_dir.path() + "/crls.d").c_str(), 0700);
+  }
+
+  ~TestCrlCache() {
+    crl_cache_deinit();
+    opt.homedir_cache = m_homedir_cache;
+  }
+
+  /* Write the cache file for ISSUER_HASH with the revoked serial
+     numbers.  Unless TAMPERED is set, the file has a good checksum in
+     the directory file.  */
+  void add(const std::string& issuer_hash, bool tampered = false) {
+    std::string fname = m_dir.path() + "/crls.d/crl-" + issuer_hash + ".db";
+    struct cdb_make cdb;
+    const char record[] = "\x02" "20000101T000000";
+    int fd;
+
+    fd = open(fname.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(cdb_make_start(&cdb, fd), 0);
+    for (int i = 0; i < NSERIALS; i++)
+      if (revoked(i)) {
+        unsigned char sn[4] = {(unsigned char)(i >> 24),
+                               (unsigned char)(i >> 16),
+                               (unsigned char)(i >> 8), (unsigned char)i};
+        ASSERT_EQ(cdb_make_add(&cdb, sn, sizeof sn, record, 16), 0);
+      }
+    ASSERT_EQ(cdb_make_finish(&cdb), 0);
+    close(fd);
+
+    std::ifstream file(fname, std::ios::binary);
+    std::string data((std::istreambuf_iterator<char>(file)),
+                     std::istreambuf_iterator<char>());
+    data = "crls.d/DIR.txt:1" + data;
+    unsigned char md5[16];
+    gcry_md_hash_buffer(GCRY_MD_MD5, md5, data.data(), data.size());
+    char hex[33];
+    for (int i = 0; i < 16; i++) sprintf(hex + 2 * i, "%02X", md5[i]);
+    if (tampered) hex[0] = hex[0] == '0' ? '1' : '0';
+
+    m_dirfile += "c:" + issuer_hash + ":CN=Test:none:20000101T000000:" +
+                 "20991231T235959:" + hex + "\n";
+  }
+
+  /* Load the cache from the files written by add().  */
+  void init() {
+    std::ofstream(m_dir.path() + "/crls.d/DIR.txt") << "v:1:\n" << m_dirfile;
+    crl_cache_init();
+  }
+
+ private:
+  TemporaryDirectory m_dir;
+  const char* m_homedir_cache;
+  std::string m_dirfile;
+};
+
+}  // namespace
+
+TEST(NeopgLegacyTest, dirmngr_crl_cache_test) {
+  TestCrlCache cache;
+  struct server_control_s ctrl = {};
+
+  cache.add(ISSUER1);
+  cache.add(TAMPERED, true);
+  cache.init();
+
+  /* The Bloom filter is built when the cache file is first used.
+     From then on, it answers for the serial numbers which are not
+     listed, while the listed ones are still looked up in the file.
+     It must neither miss a revoked certificate nor reject a valid
+     one.  */
+  for (int round = 0; round < 2; round++)
+    for (int i = 0; i < NSERIALS; i++)
+      ASSERT_EQ(crl_cache_isvalid(&ctrl, ISSUER1.c_str(), serial(i).c_str(),
+                                  0),
+                revoked(i) ? CRL_CACHE_INVALID : CRL_CACHE_VALID)
+          << "serial " << i;
+
+  /* The filter is not used for a cache file with a bad checksum.  */
+  for (int i = 0; i < 10; i++)
+    ASSERT_EQ(
+        crl_cache_isvalid(&ctrl, TAMPERED.c_str(), serial(i).c_str(), 0),
+        CRL_CACHE_DONTKNOW);
+  ASSERT_EQ(crl_cache_isvalid(&ctrl, UNKNOWN.c_str(), serial(1).c_str(), 0),
+            CRL_CACHE_DONTKNOW);
+}
+
+TEST(NeopgLegacyTest, dirmngr_crl_cache_concurrent_test) {
+  TestCrlCache cache;
+  std::vector<std::thread> threads;
+  std::atomic<int> errors{0};
+
+  cache.add(ISSUER1);
+  cache.add(ISSUER2);
+  cache.add(TAMPERED, true);
+  cache.init();
+
+  /* All threads start with files which are not yet open, so that they
+     wait for each other while a file is opened and checked.  */
+  for (int t = 0; t < 8; t++)
+    threads.emplace_back([t, &errors] {
+      struct server_control_s ctrl = {};
+      const std::string* issuers[] = {&ISSUER1, &ISSUER2, &TAMPERED};
+
+      for (int n = 0; n < NSERIALS; n++) {
+        int i = (n * 7 + t * 997) % NSERIALS;
+        const std::string& issuer = *issuers[(n + t) % 3];
+        crl_cache_result_t expected =
+            &issuer == &TAMPERED
+                ? CRL_CACHE_DONTKNOW
+                : revoked(i) ? CRL_CACHE_INVALID : CRL_CACHE_VALID;
+        if (crl_cache_isvalid(&ctrl, issuer.c_str(), serial(i).c_str(), 0) !=
+            expected)
+          errors++;
+      }
+    });
+  for (auto& thread : threads) thread.join();
+
+  ASSERT_EQ(errors, 0);
+}
@@ -22,16 +22,173 @@
 
 #include <errno.h>
 #include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
 
 #include <neopg/http.h>
 
 #include "crlfetch.h"
+#include "misc.h"
+
+/* The maximum size of a CRL we are willing to download.  */
+#define MAX_CRL_SIZE (1024L * 1024 * 1024)
+
+/* The maximum amount of decoded CRL data buffered between the
+   download and the parser.  */
+#define MAX_CRL_QUEUED (1024 * 1024)
+
+/* A CRL download.  The download runs in its own thread, decodes PEM
+   on the fly and queues the DER data.  The ksba reader pulls the data
+   from the queue, so that the download, the decoding and the parsing
+   of the CRL run as one pipeline in bounded memory.  */
+struct crl_stream_s {
+  std::string url;
+  NeoPG::Http request;
+  std::thread thread;
+
+  std::mutex lock;
+  std::condition_variable cond;
+  std::deque<std::string> chunks; /* The queued data.  */
+  size_t offset{0};               /* Read offset into the first chunk.  */
+  size_t queued{0};               /* Number of bytes in CHUNKS.  */
+  int started{0};                 /* Data has been queued or EOF.  */
+  int eof{0};                     /* The download has finished.  */
+  int cancel{0};                  /* The reader has been closed.  */
+  std::string error;              /* The download error, if any.  */
+
+  /* Only used by the download thread.  */
+  int is_pem{-1}; /* -1 until the format is known.  */
+  gpgrt_b64state_t b64state{NULL};
+};
+typedef struct crl_stream_s *crl_stream_t;
+
+/* The streams for the readers returned by crl_fetch, so that
+   crl_close_reader can stop the download.  */
+static std::mutex crl_streams_lock;
+static std::map<ksba_reader_t, crl_stream_t> crl_streams;
+
+/* Queue the CRL data in {DATA,LEN} received by the download thread of
+   STREAM.  Blocks while the queue is full.  */
+static void crl_stream_push(crl_stream_t stream, const char *data,
+                            size_t len) {
+  std::string chunk(data, len);
+
+  /* Check for PEM, such as http://grid.fzk.de/ca/gridka-crl.pem
+     (2008-2017).  */
+  if (stream->is_pem == -1 && len) {
+    uint8_t c = data[0];
+    if (((c & 0xc0) >> 6) == 0 /* class: universal */
+        && (c & 0x1f) == 16    /* sequence */
+        && (c & 0x20) /* is constructed */)
+      stream->is_pem = 0; /* Binary data.  */
+    else {
+      stream->is_pem = 1;
+      stream->b64state = gpgrt_b64dec_start("");
+      if (!stream->b64state) throw std::bad_alloc();
+    }
+  }
+  if (stream->is_pem == 1) {
+    /* Decode PEM in place.  */
+    size_t new_size;
+    gpgrt_b64dec_proc(stream->b64state, (void *)chunk.data(), chunk.size(),
+                      &new_size);
+    chunk.resize(new_size);
+  }
+  if (chunk.empty()) return;
+
+  std::unique_lock<std::mutex> lock(stream->lock);
+  stream->cond.wait(lock, [stream] {
+    return stream->cancel || stream->queued < MAX_CRL_QUEUED;
+  });
+  if (stream->cancel) throw std::runtime_error("cancelled");
+  stream->queued += chunk.size();
+  stream->chunks.push_back(std::move(chunk));
+  stream->started = 1;
+  stream->cond.notify_all();
+}
+
+/* The download thread of STREAM.  */
+static void crl_stream_thread(crl_stream_t stream) {
+  std::string error;
+
+  try {
+    stream->request.fetch([stream](const char *data, size_t len) {
+      crl_stream_push(stream, data, len);
+    });
+  } catch (const std::exception &e) {
+    error = e.what();
+    if (error.empty()) error = "unknown error";
+  }
+  if (stream->b64state) gpgrt_b64dec_finish(stream->b64state);
+
+  std::lock_guard<std::mutex> lock(stream->lock);
+  stream->error = error;
+  stream->eof = 1;
+  stream->started = 1;
+  stream->cond.notify_all();
+}
+
+/* The ksba reader callback for a CRL download.  */
+static int crl_stream_read_cb(void *opaque, char *buffer, size_t count,
+                              size_t *nread) {
+  crl_stream_t stream = (crl_stream_t)opaque;
+
+  if (!buffer && !count && !nread) return GPG_ERR_NOT_SUPPORTED; /* Rewind.  */
+
+  *nread = 0;
+  std::unique_lock<std::mutex> lock(stream->lock);
+  stream->cond.wait(
+      lock, [stream] { return !stream->chunks.empty() || stream->eof; });
+  if (stream->chunks.empty()) {
+    if (stream->error.empty()) return GPG_ERR_EOF;
+    log_error(_("error retrieving '%s': %s\n"), stream->url.c_str(),
+              stream->error.c_str());
+    return GPG_ERR_NO_DATA;
+  }
+
+  while (count && !stream->chunks.empty()) {
+    std::string &chunk = stream->chunks.front();
+    size_t n = std::min(count, chunk.size() - stream->offset);
+    memcpy(buffer, chunk.data() + stream->offset, n);
+    buffer += n;
+    count -= n;
+    *nread += n;
+    stream->offset += n;
+    stream->queued -= n;
+    if (stream->offset == chunk.size()) {
+      stream->chunks.pop_front();
+      stream->offset = 0;
+    }
+  }
+  stream->cond.notify_all();
+  return 0;
+}
+
+/* Stop the download of STREAM and release it.  */
+static void crl_stream_release(crl_stream_t stream) {
+  {
+    std::lock_guard<std::mutex> lock(stream->lock);
+    stream->cancel = 1;
+    stream->cond.notify_all();
+  }
+  /* Also stop a download which is waiting for the server.  */
+  stream->request.abort();
+  stream->thread.join();
+  delete stream;
+}
 
 /* Fetch CRL from URL and return the entire CRL using new ksba reader
-   object in READER. */
+   object in READER.  The CRL is downloaded in the background while
+   the caller reads it.  */
 gpg_error_t crl_fetch(ctrl_t ctrl, const char *url, ksba_reader_t *reader) {
   gpg_error_t err;
-  std::string response;
+  crl_stream_t stream;
   *reader = NULL;
 
   if (!url) return GPG_ERR_INV_ARG;
@@ -53,8 +210,14 @@ gpg_error_t crl_fetch(ctrl_t ctrl, const char *url, ksba_reader_t *reader) {
     return GPG_ERR_NOT_SUPPORTED;
   }
 
-  NeoPG::Http request;
-  request.set_url(url).forbid_reuse().set_timeout(ctrl->timeout).no_cache();
+  stream = new crl_stream_s;
+  stream->url = url;
+
+  NeoPG::Http &request = stream->request;
+  request.set_url(url).use_pool().set_timeout(ctrl->timeout);
+  /* Always revalidate cached responses.  */
+  request.use_cache(dirmngr_http_cache()).no_cache();
+  request.set_maxfilesize(MAX_CRL_SIZE);
 
   if (opt.http_proxy)
     request.set_proxy(opt.http_proxy);
@@ -66,42 +229,35 @@ gpg_error_t crl_fetch(ctrl_t ctrl, const char *url, ksba_reader_t *reader) {
   else if (opt.disable_ipv4)
     request.set_ipresolve(NeoPG::Http::Resolve::IPv6);
 
-  try {
-    response = request.fetch();
-  } catch (const std::runtime_error &e) {
-    log_error(_("error retrieving '%s': %s\n"), url, e.what());
-    return GPG_ERR_NO_DATA;
-  }
+  stream->thread = std::thread(crl_stream_thread, stream);
 
-  /* Check for PEM, such as http://grid.fzk.de/ca/gridka-crl.pem (2008-2017). */
-  if (response.size()) {
-    uint8_t c = response[0];
-    if (((c & 0xc0) >> 6) == 0 /* class: universal */
-        && (c & 0x1f) == 16    /* sequence */
-        && (c & 0x20) /* is constructed */)
-      ; /* Binary data.  */
-    else {
-      /* Decode PEM.  */
-      gpgrt_b64state_t b64state;
-      b64state = gpgrt_b64dec_start("");
-      size_t new_size;
-      gpgrt_b64dec_proc(b64state, (void *)response.data(), response.size(),
-                        &new_size);
-      gpgrt_b64dec_finish(b64state);
-      response.resize(new_size);
+  /* Wait for the response so that errors are reported here.  */
+  {
+    std::unique_lock<std::mutex> lock(stream->lock);
+    stream->cond.wait(lock, [stream] { return stream->started; });
+    if (stream->chunks.empty() && stream->error.size()) {
+      log_error(_("error retrieving '%s': %s\n"), url,
+                stream->error.c_str());
+      err = GPG_ERR_NO_DATA;
+      lock.unlock();
+      crl_stream_release(stream);
+      return err;
     }
   }
 
   err = ksba_reader_new(reader);
-  if (!err) {
-    err = ksba_reader_set_mem(*reader, response.data(), response.size());
-  }
+  if (!err) err = ksba_reader_set_cb(*reader, crl_stream_read_cb, stream);
   if (err) {
     log_error(_("error initializing reader object: %s\n"), gpg_strerror(err));
     ksba_reader_release(*reader);
     *reader = NULL;
+    crl_stream_release(stream);
+    return err;
   }
-  return err;
+
+  std::lock_guard<std::mutex> lock(crl_streams_lock);
+  crl_streams[*reader] = stream;
+  return 0;
 }
 
 /* Fetch CRL for ISSUER using a default server. Return the entire CRL
@@ -180,11 +336,23 @@ gpg_error_t fetch_cert_by_url(ctrl_t ctrl, const char *url,
 }
 
 /* This function is to be used to close the reader object.  In
-   addition to running ksba_reader_release it also releases the LDAP
-   or HTTP contexts associated with that reader.  */
+   addition to running ksba_reader_release it also stops the download
+   associated with that reader.  */
 void crl_close_reader(ksba_reader_t reader) {
+  crl_stream_t stream = NULL;
+
   if (!reader) return;
 
+  {
+    std::lock_guard<std::mutex> lock(crl_streams_lock);
+    auto it = crl_streams.find(reader);
+    if (it != crl_streams.end()) {
+      stream = it->second;
+      crl_streams.erase(it);
+    }
+  }
+
   /* Now get rid of the reader object. */
   ksba_reader_release(reader);
+  if (stream) crl_stream_release(stream);
 }
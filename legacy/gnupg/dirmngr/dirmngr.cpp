@@ -52,6 +52,8 @@
 #include "crlcache.h"
 #include "crlfetch.h"
 #include "misc.h"
+#include "ocsp.h"
+#include "ocspcache.h"
 
 #ifndef ENAMETOOLONG
 #define ENAMETOOLONG EINVAL
@@ -102,6 +104,8 @@ enum cmd_and_opt_values {
   oFakedSystemTime,
   oForce,
   oAllowOCSP,
+  oPersistentOCSPCache,
+  oCRLPrefetch,
   oAllowVersionCheck,
   oHTTPWrapperProgram,
   oIgnoreCertExtension,
@@ -110,6 +114,7 @@ enum cmd_and_opt_values {
   oKeyServer,
   oConnectTimeout,
   oConnectQuickTimeout,
+  oKeyServerMaxRequests,
   aTest
 };
 
@@ -140,6 +145,10 @@ static ARGPARSE_OPTS opts[] = {
     ARGPARSE_s_n(oBatch, "batch", N_("run without asking a user")),
     ARGPARSE_s_n(oForce, "force", N_("force loading of outdated CRLs")),
     ARGPARSE_s_n(oAllowOCSP, "allow-ocsp", N_("allow sending OCSP requests")),
+    ARGPARSE_s_n(oPersistentOCSPCache, "persistent-ocsp-cache",
+                 N_("keep cached OCSP responses across restarts")),
+    ARGPARSE_s_n(oCRLPrefetch, "crl-prefetch",
+                 N_("refresh cached CRLs before they expire")),
     ARGPARSE_s_n(oAllowVersionCheck, "allow-version-check",
                  N_("allow online software version check")),
     ARGPARSE_s_n(oDisableHTTP, "disable-http", N_("inhibit the use of HTTP")),
@@ -163,6 +172,8 @@ static ARGPARSE_OPTS opts[] = {
                  N_("|N|do not return more than N items in one query")),
 
     ARGPARSE_s_s(oKeyServer, "keyserver", "@"),
+    ARGPARSE_s_i(oKeyServerMaxRequests, "keyserver-max-requests",
+                 N_("|N|send up to N concurrent requests to a keyserver")),
     ARGPARSE_s_s(oHkpCaCert, "hkp-cacert",
                  N_("|FILE|use the CA certificates in FILE for HKP over TLS")),
 
@@ -203,6 +214,7 @@ static struct debug_flags_s debug_flags[] = {
 };
 
 #define DEFAULT_MAX_REPLIES 10
+#define DEFAULT_KS_MAX_REQUESTS 8
 
 #define DEFAULT_CONNECT_TIMEOUT (15 * 1000)      /* 15 seconds */
 #define DEFAULT_CONNECT_QUICK_TIMEOUT (2 * 1000) /*  2 seconds */
@@ -326,12 +338,15 @@ static int parse_rereadable_options(ARGPARSE_ARGS *pargs, int reread) {
     opt.ignore_http_dp = 0;
     opt.ignore_ocsp_service_url = 0;
     opt.allow_ocsp = 0;
+    opt.persistent_ocsp_cache = 0;
+    opt.crl_prefetch = 0;
     opt.allow_version_check = 0;
     opt.ocsp_responder = NULL;
     opt.ocsp_max_clock_skew = 10 * 60;     /* 10 minutes.  */
     opt.ocsp_max_period = 90 * 86400;      /* 90 days.  */
     opt.ocsp_current_period = 3 * 60 * 60; /* 3 hours. */
     opt.max_replies = DEFAULT_MAX_REPLIES;
+    opt.ks_max_requests = DEFAULT_KS_MAX_REQUESTS;
     while (opt.ocsp_signer) {
       fingerprint_list_t tmp = opt.ocsp_signer->next;
       xfree(opt.ocsp_signer);
@@ -398,6 +413,12 @@ static int parse_rereadable_options(ARGPARSE_ARGS *pargs, int reread) {
     case oAllowOCSP:
       opt.allow_ocsp = 1;
       break;
+    case oPersistentOCSPCache:
+      opt.persistent_ocsp_cache = 1;
+      break;
+    case oCRLPrefetch:
+      opt.crl_prefetch = 1;
+      break;
     case oAllowVersionCheck:
       opt.allow_version_check = 1;
       break;
@@ -447,6 +468,10 @@ static int parse_rereadable_options(ARGPARSE_ARGS *pargs, int reread) {
       opt.connect_quick_timeout = pargs->r.ret_ulong * 1000;
       break;
 
+    case oKeyServerMaxRequests:
+      opt.ks_max_requests = pargs->r.ret_int > 0 ? pargs->r.ret_int : 1;
+      break;
+
     default:
       return 0; /* Not handled. */
   }
@@ -713,6 +738,7 @@ next_pass:
 
     cert_cache_init(hkp_cacert_filenames);
     crl_cache_init();
+    if (opt.crl_prefetch) crl_cache_start_refresher();
     start_command_handler();
   } else if (cmd == aListCRLs) {
     /* Just list the CRL cache and exit. */
@@ -760,13 +786,16 @@ next_pass:
     /* Delete cache and exit. */
     if (argc) wrong_args("--flush");
     rc = crl_cache_flush();
+    ocsp_cache_flush();
   }
   cleanup();
   return !!rc;
 }
 
 static void cleanup(void) {
+  crl_cache_stop_refresher();
   crl_cache_deinit();
+  ocsp_cache_deinit();
   cert_cache_deinit(1);
 }
 
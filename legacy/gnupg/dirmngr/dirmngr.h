@@ -93,6 +93,8 @@ struct dirmngr_options {
   std::set<std::string> ignored_cert_extensions;
 
   int allow_ocsp{0}; /* Allow using OCSP. */
+  int persistent_ocsp_cache{0}; /* Store cached OCSP responses on disk.  */
+  int crl_prefetch{0}; /* Refresh cached CRLs in the background.  */
 
   int max_replies{0};
 
@@ -108,6 +110,7 @@ struct dirmngr_options {
                                       current after nextUpdate. */
 
   std::vector<std::string> keyserver; /* List of default keyservers.  */
+  unsigned int ks_max_requests{0};    /* Concurrent keyserver requests.  */
 };
 extern struct dirmngr_options dirmngr_opt;
 #define opt dirmngr_opt
@@ -126,10 +126,11 @@ gpg_error_t ks_action_search(ctrl_t ctrl, uri_item_t keyservers,
 }
 
 /* Get the requested keys (matching PATTERNS) using all configured
-   keyservers and write the result to the provided output stream.  */
+   keyservers and pass the response for each pattern to DATA_CB as
+   soon as it has been received.  */
 gpg_error_t ks_action_get(ctrl_t ctrl, uri_item_t keyservers,
                           const std::vector<std::string> &patterns,
-                          std::string &response) {
+                          const ks_data_cb_t &data_cb) {
   gpg_error_t err = 0;
   gpg_error_t first_err = 0;
   int any_server = 0;
@@ -147,31 +148,18 @@ gpg_error_t ks_action_get(ctrl_t ctrl, uri_item_t keyservers,
   for (uri = keyservers; !err && uri; uri = uri->next) {
     int is_http = uri->parsed_uri->is_http;
 
-    printf("considering %s %i\n", uri->uri, is_http);
-
     if (is_http) {
-      std::string one_response;
       any_server = 1;
-      for (auto &pattern : patterns) {
-        {
-          err =
-              ks_hkp_get(ctrl, uri->parsed_uri, pattern.c_str(), one_response);
-          if (err) break;
-        }
-
-        if (err) {
-          /* It is possible that a server does not carry a
-             key, thus we only save the error and continue
-             with the next pattern.  FIXME: It is an open
-             question how to return such an error condition to
-             the caller.  */
-          first_err = err;
-          err = 0;
-        } else {
-          response.append(one_response);
-          any_data = 1;
-        }
-      }
+      /* It is possible that a server does not carry a key, thus
+         ks_hkp_get only saves the first error and continues with the
+         next pattern.  FIXME: It is an open question how to return
+         such an error condition to the caller.  */
+      err = ks_hkp_get(ctrl, uri->parsed_uri, patterns,
+                       [&](const std::string &response) {
+                         any_data = 1;
+                         return data_cb(response);
+                       },
+                       &first_err);
     }
     if (any_data) break; /* Stop loop after a keyserver returned something.  */
   }
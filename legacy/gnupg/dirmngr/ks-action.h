@@ -21,16 +21,20 @@
 #ifndef DIRMNGR_KS_ACTION_H
 #define DIRMNGR_KS_ACTION_H 1
 
+#include <functional>
 #include <string>
 #include <vector>
 
+/* Callback to receive the response for one request.  */
+typedef std::function<gpg_error_t(const std::string &response)> ks_data_cb_t;
+
 gpg_error_t ks_action_help(ctrl_t ctrl, const char *url);
 gpg_error_t ks_action_search(ctrl_t ctrl, uri_item_t keyservers,
                              const std::vector<std::string> &patterns,
                              std::string &output);
 gpg_error_t ks_action_get(ctrl_t ctrl, uri_item_t keyservers,
                           const std::vector<std::string> &patterns,
-                          std::string &output);
+                          const ks_data_cb_t &data_cb);
 gpg_error_t ks_action_fetch(ctrl_t ctrl, const char *url, std::string &output);
 gpg_error_t ks_action_put(ctrl_t ctrl, uri_item_t keyservers, void *data,
                           size_t datalen, void *info, size_t infolen);
@@ -89,14 +89,11 @@ static std::string make_host_part(ctrl_t ctrl, const std::string &scheme,
   return hostport;
 }
 
-/* Send an HTTP request.  On success returns response in RESPONSE.  If
-   POST_CB is not NULL a post request is used and that callback is
-   called to allow writing the post data.  If R_HTTP_STATUS is not
-   NULL, the http status code will be stored there.  */
-static gpg_error_t send_request(ctrl_t ctrl, const std::string &url,
-                                tao::optional<std::string> post_data,
-                                std::string &response,
-                                unsigned int *r_http_status) {
+/* Configure REQUEST for URL.  If POST_DATA is set a post request is
+   used.  */
+static gpg_error_t setup_request(ctrl_t ctrl, const std::string &url,
+                                 const tao::optional<std::string> &post_data,
+                                 NeoPG::Http &request) {
   if (url.empty()) return GPG_ERR_INV_ARG;
 
   if (opt.disable_http) {
@@ -110,8 +107,10 @@ static gpg_error_t send_request(ctrl_t ctrl, const std::string &url,
     return GPG_ERR_NOT_SUPPORTED;
   }
 
-  NeoPG::Http request;
-  request.set_url(url).forbid_reuse().set_timeout(ctrl->timeout).no_cache();
+  request.set_url(url).use_pool().set_timeout(ctrl->timeout);
+  request.set_maxfilesize(MAX_KS_RESPONSE_SIZE);
+  /* Always revalidate cached responses.  */
+  request.use_cache(dirmngr_http_cache()).no_cache();
 
   if (opt.http_proxy)
     request.set_proxy(opt.http_proxy);
@@ -136,6 +135,22 @@ static gpg_error_t send_request(ctrl_t ctrl, const std::string &url,
     request.set_cainfo(pemname);
   }
 
+  return 0;
+}
+
+/* Send an HTTP request.  On success returns response in RESPONSE.  If
+   POST_DATA is set a post request is used.  If R_HTTP_STATUS is not
+   NULL, the http status code will be stored there.  */
+static gpg_error_t send_request(ctrl_t ctrl, const std::string &url,
+                                tao::optional<std::string> post_data,
+                                std::string &response,
+                                unsigned int *r_http_status) {
+  gpg_error_t err;
+  NeoPG::Http request;
+
+  err = setup_request(ctrl, url, post_data, request);
+  if (err) return err;
+
   try {
     response = request.fetch();
     /* FIXMEFIXMEFIXME: Return http status in r_http_status.  */
@@ -223,19 +238,18 @@ gpg_error_t ks_hkp_search(ctrl_t ctrl, parsed_uri_t uri, const char *pattern,
   return 0;
 }
 
-/* Get the key described key the KEYSPEC string from the keyserver
-   identified by URI.  On success data is in RESPONSE.  The data will
-   be provided in a format GnuPG can import (either a binary OpenPGP
-   message or an armored one).  */
-gpg_error_t ks_hkp_get(ctrl_t ctrl, parsed_uri_t uri, const char *keyspec,
-                       std::string &response) {
+/* Build the URL to get the key described by the KEYSPEC string from
+   the keyserver identified by URI.  The URL is stored at R_REQUEST
+   and the host part of it at R_HOSTPORT.  */
+static gpg_error_t make_get_request(ctrl_t ctrl, parsed_uri_t uri,
+                                    const char *keyspec,
+                                    std::string &r_hostport,
+                                    std::string &r_request) {
   gpg_error_t err;
   KEYDB_SEARCH_DESC desc;
   char kidbuf[2 + 40 + 1];
   const char *exactname = NULL;
   std::string searchkey;
-  std::string hostport;
-  std::string request;
 
   /* Remove search type indicator and adjust PATTERN accordingly.
      Note that HKP keyservers like the 0x to be present when searching
@@ -274,16 +288,73 @@ gpg_error_t ks_hkp_get(ctrl_t ctrl, parsed_uri_t uri, const char *keyspec,
       http_escape_string(exactname ? exactname : kidbuf, EXTRA_ESCAPE_CHARS);
 
   /* Build the request string.  */
-  hostport = make_host_part(ctrl, uri->scheme, uri->host, uri->port);
-  request = hostport + "/pks/lookup?op=get&options=mr&search=" + searchkey +
-            (exactname ? "&exact=on" : "");
+  r_hostport = make_host_part(ctrl, uri->scheme, uri->host, uri->port);
+  r_request = r_hostport + "/pks/lookup?op=get&options=mr&search=" +
+              searchkey + (exactname ? "&exact=on" : "");
+  return 0;
+}
 
-  /* Send the request.  */
-  response.clear();
-  err = send_request(ctrl, request, tao::nullopt, response, NULL);
-  if (err) return err;
+/* Get the keys described by the KEYSPECS from the keyserver
+   identified by URI.  Up to OPT.KS_MAX_REQUESTS requests are sent
+   concurrently and DATA_CB is called with the response for a key
+   spec as soon as it arrives, thus not necessarily in the order of
+   KEYSPECS.  The data will be provided in a format GnuPG can import
+   (either a binary OpenPGP message or an armored one).  An error
+   returned by DATA_CB cancels the remaining requests and is returned.
+   Otherwise the error of the first failed key spec is stored at
+   R_FIRST_ERR and 0 is returned.  */
+gpg_error_t ks_hkp_get(ctrl_t ctrl, parsed_uri_t uri,
+                       const std::vector<std::string> &keyspecs,
+                       const ks_data_cb_t &data_cb, gpg_error_t *r_first_err) {
+  gpg_error_t err = 0;
+  std::string hostport;
+  int any_data = 0;
+
+  *r_first_err = 0;
+
+  NeoPG::HttpMulti multi(opt.ks_max_requests);
+  for (auto &keyspec : keyspecs) {
+    std::string request;
+    std::unique_ptr<NeoPG::Http> http(new NeoPG::Http);
+
+    err = make_get_request(ctrl, uri, keyspec.c_str(), hostport, request);
+    if (!err) err = setup_request(ctrl, request, tao::nullopt, *http);
+    if (err) {
+      /* It is possible that a key spec can't be handled by this
+         server, thus we only save the error and continue with the
+         next key spec.  */
+      if (!*r_first_err) *r_first_err = err;
+      err = 0;
+      continue;
+    }
+
+    multi.add(std::move(http), [&, request](NeoPG::Http &,
+                                            const std::string &response,
+                                            const std::string &error) {
+      if (error.size()) {
+        log_error(_("error retrieving '%s': %s\n"), request.c_str(),
+                  error.c_str());
+        if (!*r_first_err) *r_first_err = GPG_ERR_NO_DATA;
+        return;
+      }
+      if (!any_data) {
+        any_data = 1;
+        err = dirmngr_status(ctrl, "SOURCE", hostport.c_str(), NULL);
+      }
+      if (!err) err = data_cb(response);
+      if (err) multi.cancel();
+    });
+  }
 
-  return dirmngr_status(ctrl, "SOURCE", hostport.c_str(), NULL);
+  try {
+    multi.perform();
+  } catch (const std::runtime_error &e) {
+    log_error("error retrieving keys from '%s': %s\n", hostport.c_str(),
+              e.what());
+    if (!err) err = GPG_ERR_GENERAL;
+  }
+
+  return err;
 }
 
 /* Send the key in {DATA,DATALEN} to the keyserver identified by URI.  */
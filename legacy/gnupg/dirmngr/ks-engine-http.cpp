@@ -70,7 +70,10 @@ gpg_error_t ks_http_fetch(ctrl_t ctrl, const char *url, std::string &response) {
   /* Note that we only use the system provided certificates.  */
   /* ctrl->http_no_crl support?  */
   NeoPG::Http request;
-  request.set_url(url).forbid_reuse().set_timeout(ctrl->timeout).no_cache();
+  request.set_url(url).use_pool().set_timeout(ctrl->timeout);
+  request.set_maxfilesize(MAX_KS_RESPONSE_SIZE);
+  /* Always revalidate cached responses.  */
+  request.use_cache(dirmngr_http_cache()).no_cache();
 
   if (opt.http_proxy)
     request.set_proxy(opt.http_proxy);
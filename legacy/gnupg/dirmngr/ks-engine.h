@@ -22,6 +22,13 @@
 #define DIRMNGR_KS_ENGINE_H 1
 
 #include "http.h"
+#include "ks-action.h"
+
+/* The maximum size of a keyserver response.  Keys with many
+   signatures can exceed several MiB, so this is only meant to stop
+   unbounded downloads, for example of chunked responses which do not
+   announce their size.  */
+#define MAX_KS_RESPONSE_SIZE (64L * 1024 * 1024)
 
 /*-- ks-action.c --*/
 gpg_error_t ks_print_help(ctrl_t ctrl, const char *text);
@@ -32,8 +39,9 @@ gpg_error_t ks_printf_help(ctrl_t ctrl, const char *format, ...)
 gpg_error_t ks_hkp_help(ctrl_t ctrl, parsed_uri_t uri);
 gpg_error_t ks_hkp_search(ctrl_t ctrl, parsed_uri_t uri, const char *pattern,
                           std::string &response, unsigned int *r_http_status);
-gpg_error_t ks_hkp_get(ctrl_t ctrl, parsed_uri_t uri, const char *keyspec,
-                       std::string &response);
+gpg_error_t ks_hkp_get(ctrl_t ctrl, parsed_uri_t uri,
+                       const std::vector<std::string> &keyspecs,
+                       const ks_data_cb_t &data_cb, gpg_error_t *r_first_err);
 gpg_error_t ks_hkp_put(ctrl_t ctrl, parsed_uri_t uri, const void *data,
                        size_t datalen);
 
@@ -26,10 +26,15 @@
 #include <string.h>
 #include <time.h>
 
+#include <neopg/http_cache.h>
+
 #include "../common/util.h"
 #include "dirmngr.h"
 #include "misc.h"
 
+/* The name of the HTTP cache directory below the cache home.  */
+#define HTTP_CACHE_DIR "http.d"
+
 char *serial_hex(ksba_sexp_t serial) {
   unsigned char *p = serial;
   char *endp;
@@ -413,3 +418,13 @@ gpg_error_t armor_data(char **r_string, const void *data, size_t datalen) {
   *r_string = buffer;
   return 0;
 }
+
+NeoPG::HttpCache &dirmngr_http_cache(void) {
+  static NeoPG::HttpCache cache([] {
+    char *dname = make_filename(opt.homedir_cache, HTTP_CACHE_DIR, NULL);
+    std::string directory = dname;
+    xfree(dname);
+    return directory;
+  }());
+  return cache;
+}
@@ -21,6 +21,10 @@
 #ifndef MISC_H
 #define MISC_H
 
+namespace NeoPG {
+class HttpCache;
+}
+
 /* Returns the serial number as a hex string.  */
 char *serial_hex(ksba_sexp_t serial);
 
@@ -65,4 +69,8 @@ gpg_error_t create_estream_ksba_reader(ksba_reader_t *r_reader, estream_t fp);
    responsible for freeing *R_STRING.  */
 gpg_error_t armor_data(char **r_string, const void *data, size_t datalen);
 
+/* Return the cache for HTTP responses, which is shared by all
+   requests to keyservers and CRL distribution points.  */
+NeoPG::HttpCache &dirmngr_http_cache(void);
+
 #endif /* MISC_H */
@@ -23,6 +23,9 @@
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
 
 #include <neopg/http.h>
 
@@ -30,6 +33,7 @@
 #include "dirmngr.h"
 #include "misc.h"
 #include "ocsp.h"
+#include "ocspcache.h"
 #include "validate.h"
 
 /* The maximum size we allow as a response from an OCSP reponder. */
@@ -45,6 +49,39 @@ static const char oidstr_ocsp[] = "1.3.6.1.5.5.7.48.1";
  */
 /* static const char oidstr_certHash[] = "1.3.36.8.3.13"; */
 
+/* Return the cache key for CERT issued by ISSUER_CERT in R_KEY.  */
+static gpg_error_t ocsp_cache_key(ksba_cert_t cert, ksba_cert_t issuer_cert,
+                                  std::string &r_key) {
+  gpg_error_t err;
+  ksba_sexp_t pubkey;
+  ksba_sexp_t serial;
+  gcry_sexp_t s_pkey = NULL;
+  unsigned char grip[20];
+  char hexgrip[40 + 1];
+  char *hexserial;
+
+  pubkey = ksba_cert_get_public_key(issuer_cert);
+  if (!pubkey) return GPG_ERR_INV_OBJ;
+  err = canon_sexp_to_gcry(pubkey, &s_pkey);
+  xfree(pubkey);
+  if (err) return err;
+  if (!gcry_pk_get_keygrip(s_pkey, grip)) {
+    gcry_sexp_release(s_pkey);
+    return GPG_ERR_INV_OBJ;
+  }
+  gcry_sexp_release(s_pkey);
+  bin2hex(grip, 20, hexgrip);
+
+  serial = ksba_cert_get_serial(cert);
+  hexserial = serial ? serial_hex(serial) : NULL;
+  ksba_free(serial);
+  if (!hexserial) return GPG_ERR_INV_OBJ;
+
+  r_key = std::string(hexgrip) + ":" + hexserial;
+  xfree(hexserial);
+  return 0;
+}
+
 /* Read from FP and return a newly allocated buffer in R_BUFFER with the
    entire data read from FP. */
 static gpg_error_t read_response(estream_t fp, unsigned char **r_buffer,
@@ -151,7 +188,8 @@ static gpg_error_t do_ocsp_request(ctrl_t ctrl, ksba_ocsp_t ocsp,
   }
 
   NeoPG::Http request;
-  request.set_url(url).forbid_reuse().set_timeout(ctrl->timeout).no_cache();
+  request.set_url(url).use_pool().set_timeout(ctrl->timeout).no_cache();
+  request.set_maxfilesize(MAX_RESPONSE_SIZE);
 
   if (opt.http_proxy)
     request.set_proxy(opt.http_proxy);
@@ -234,9 +272,12 @@ static gpg_error_t do_ocsp_request(ctrl_t ctrl, ksba_ocsp_t ocsp,
 
 /* Validate that CERT is indeed valid to sign an OCSP response. If
    SIGNER_FPR_LIST is not NULL we simply check that CERT matches one
-   of the fingerprints in this list. */
+   of the fingerprints in this list.  Otherwise the fingerprint of
+   CERT, whose validity needs to be checked by the client, is stored
+   at R_RESPONDER_FPR. */
 static gpg_error_t validate_responder_cert(ctrl_t ctrl, ksba_cert_t cert,
-                                           fingerprint_list_t signer_fpr_list) {
+                                           fingerprint_list_t signer_fpr_list,
+                                           std::string &r_responder_fpr) {
   gpg_error_t err;
   char *fpr;
 
@@ -266,11 +307,12 @@ static gpg_error_t validate_responder_cert(ctrl_t ctrl, ksba_cert_t cert,
        (neither DirMngr nor gpgsm have the ability for concurrent
        access to DirMngr.   */
 
-    /* FIXME: We should cache this certificate locally, so that the next
-       call to dirmngr won't need to look it up - if this works at
-       all. */
+    /* Cache the certificate, so that the next call to dirmngr won't
+       need to look it up.  */
+    cache_cert_silent(cert, NULL);
     fpr = get_fingerprint_hexstring(cert);
     dirmngr_status(ctrl, "ONLY_VALID_IF_CERT_VALID", fpr, NULL);
+    r_responder_fpr = fpr;
     xfree(fpr);
     err = 0;
   }
@@ -281,7 +323,8 @@ static gpg_error_t validate_responder_cert(ctrl_t ctrl, ksba_cert_t cert,
 /* Helper for check_signature. */
 static int check_signature_core(ctrl_t ctrl, ksba_cert_t cert,
                                 gcry_sexp_t s_sig, gcry_sexp_t s_hash,
-                                fingerprint_list_t signer_fpr_list) {
+                                fingerprint_list_t signer_fpr_list,
+                                std::string &r_responder_fpr) {
   gpg_error_t err;
   ksba_sexp_t pubkey;
   gcry_sexp_t s_pkey = NULL;
@@ -293,7 +336,9 @@ static int check_signature_core(ctrl_t ctrl, ksba_cert_t cert,
     err = canon_sexp_to_gcry(pubkey, &s_pkey);
   xfree(pubkey);
   if (!err) err = gcry_pk_verify(s_sig, s_hash, s_pkey);
-  if (!err) err = validate_responder_cert(ctrl, cert, signer_fpr_list);
+  if (!err)
+    err = validate_responder_cert(ctrl, cert, signer_fpr_list,
+                                  r_responder_fpr);
   if (!err) {
     gcry_sexp_release(s_pkey);
     return 0; /* Successfully verified the signature. */
@@ -309,10 +354,12 @@ static int check_signature_core(ctrl_t ctrl, ksba_cert_t cert,
    the response.  This function automagically finds the correct public
    key.  If SIGNER_FPR_LIST is not NULL, the default OCSP reponder has been
    used and thus the certificate is one of those identified by
-   the fingerprints. */
+   the fingerprints.  R_RESPONDER_FPR receives the fingerprint of a
+   responder certificate which needs to be validated by the client. */
 static gpg_error_t check_signature(ctrl_t ctrl, ksba_ocsp_t ocsp,
                                    gcry_sexp_t s_sig, gcry_md_hd_t md,
-                                   fingerprint_list_t signer_fpr_list) {
+                                   fingerprint_list_t signer_fpr_list,
+                                   std::string &r_responder_fpr) {
   gpg_error_t err;
   int algo, cert_idx;
   gcry_sexp_t s_hash;
@@ -342,7 +389,8 @@ static gpg_error_t check_signature(ctrl_t ctrl, ksba_ocsp_t ocsp,
     cert = get_cert_byhexfpr(signer_fpr_list->hexfpr);
     if (!cert) cert = get_cert_local(ctrl, signer_fpr_list->hexfpr);
     if (cert) {
-      err = check_signature_core(ctrl, cert, s_sig, s_hash, signer_fpr_list);
+      err = check_signature_core(ctrl, cert, s_sig, s_hash, signer_fpr_list,
+                                 r_responder_fpr);
       ksba_cert_release(cert);
       cert = NULL;
       if (!err) {
@@ -392,7 +440,8 @@ static gpg_error_t check_signature(ctrl_t ctrl, ksba_ocsp_t ocsp,
     ksba_free(keyid);
 
     if (cert) {
-      err = check_signature_core(ctrl, cert, s_sig, s_hash, signer_fpr_list);
+      err = check_signature_core(ctrl, cert, s_sig, s_hash, signer_fpr_list,
+                                 r_responder_fpr);
       ksba_cert_release(cert);
       if (!err) {
         gcry_sexp_release(s_hash);
@@ -429,6 +478,10 @@ gpg_error_t ocsp_isvalid(ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
   char *oid;
   ksba_name_t name;
   fingerprint_list_t default_signer = NULL;
+  std::string cache_key;
+  std::string responder_fpr;
+  ocsp_cache_entry_s cached;
+  int from_cache = 0;
 
   /* Get the certificate.  */
   if (cert) {
@@ -506,6 +559,23 @@ gpg_error_t ocsp_isvalid(ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
     if (opt.verbose) log_info(_("using OCSP responder '%s'\n"), url);
   }
 
+  /* Use a cached response if we have a current one.  */
+  if (ocsp_cache_key(cert, issuer_cert, cache_key))
+    cache_key.clear();
+  else if (ocsp_cache_get(cache_key, !!default_signer, cached)) {
+    if (opt.verbose) log_info(_("using cached OCSP response\n"));
+    if (cached.responder_fpr.size())
+      dirmngr_status(ctrl, "ONLY_VALID_IF_CERT_VALID",
+                     cached.responder_fpr.c_str(), NULL);
+    status = cached.status;
+    reason = cached.reason;
+    gnupg_copy_time(this_update, cached.this_update);
+    gnupg_copy_time(next_update, cached.next_update);
+    gnupg_copy_time(revocation_time, cached.revocation_time);
+    from_cache = 1;
+    goto have_status;
+  }
+
   /* Ask the OCSP responder. */
   err = gcry_md_open(&md, GCRY_MD_SHA1, 0);
   if (err) {
@@ -525,7 +595,7 @@ gpg_error_t ocsp_isvalid(ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
   if ((err = canon_sexp_to_gcry(sigval, &s_sig))) goto leave;
   xfree(sigval);
   sigval = NULL;
-  err = check_signature(ctrl, ocsp, s_sig, md, default_signer);
+  err = check_signature(ctrl, ocsp, s_sig, md, default_signer, responder_fpr);
   if (err) goto leave;
 
   /* We only support one certificate per request.  Check that the
@@ -538,6 +608,7 @@ gpg_error_t ocsp_isvalid(ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
     goto leave;
   }
 
+have_status:
   /* In case the certificate has been revoked, we better invalidate
      our cached validation status. */
   if (status == KSBA_STATUS_REVOKED) {
@@ -641,6 +712,24 @@ gpg_error_t ocsp_isvalid(ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
     }
   }
 
+  /* Cache the verified response until NEXT_UPDATE.  */
+  if (!from_cache && cache_key.size() && *next_update &&
+      (!err || err == GPG_ERR_CERT_REVOKED)) {
+    ocsp_cache_entry_s entry;
+
+    entry.status = status;
+    entry.reason = reason;
+    gnupg_copy_time(entry.this_update, this_update);
+    gnupg_copy_time(entry.next_update, next_update);
+    if (status == KSBA_STATUS_REVOKED)
+      gnupg_copy_time(entry.revocation_time, revocation_time);
+    else
+      *entry.revocation_time = 0;
+    entry.default_responder = !!default_signer;
+    entry.responder_fpr = responder_fpr;
+    ocsp_cache_put(cache_key, entry);
+  }
+
 leave:
   gcry_md_close(md);
   gcry_sexp_release(s_sig);
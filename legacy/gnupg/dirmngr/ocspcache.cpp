@@ -0,0 +1,310 @@
+/* ocspcache.cpp - Cache of OCSP responses
+   Copyright 2018 The NeoPG developers
+
+   NeoPG is released under the Simplified BSD License (see license.txt)
+*/
+
+#include <config.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "dirmngr.h"
+#include "ocspcache.h"
+
+/* The name of the file with the persistent OCSP response cache.  */
+#define OCSP_CACHE_FILE "ocsp-cache.txt"
+
+/* The first line of the cache file.  */
+#define OCSP_CACHE_HEADER "# OCSP response cache - do not edit\n"
+
+/* The maximum number of cached OCSP responses.  */
+#define MAX_OCSP_CACHE_ENTRIES 10000
+
+/* A mutex used to serialize access to the OCSP cache.  */
+static std::mutex ocsp_cache_lock;
+
+/* The cached OCSP responses indexed by their key.  */
+static std::map<std::string, ocsp_cache_entry_s> ocsp_cache;
+static int ocsp_cache_loaded;
+
+/* The number of entries in the cache file.  New responses are
+   appended, so this includes replaced and expired entries.  The file
+   is rewritten once it has twice as many entries as the cache.  */
+static size_t ocsp_cache_file_entries;
+
+/* Return true if S consists of 1 to MAXLEN hex digits.  */
+static int all_hex(const std::string &s, size_t maxlen) {
+  if (s.empty() || s.size() > maxlen) return 0;
+  for (char c : s)
+    if (!hexdigitp(&c)) return 0;
+  return 1;
+}
+
+/* Return true if S is a small decimal number.  */
+static int is_number(const std::string &s) {
+  return !s.empty() && s.size() <= 5 &&
+         s.find_first_not_of("0123456789") == std::string::npos;
+}
+
+static int valid_isotime(const std::string &s) {
+  return s.size() == 15 && isotime_p(s.c_str());
+}
+
+/* Parse the cache file LINE into R_KEY and R_ENTRY.  Fields are
+   separated by single spaces: key status reason this_update
+   next_update revocation_time default_responder responder_fpr.
+   Empty times and fingerprints are written as "-".  Returns false
+   for a malformed line, for example one that was cut short.  */
+static int parse_cache_line(const char *line, std::string &r_key,
+                            ocsp_cache_entry_s &r_entry) {
+  std::vector<std::string> fields;
+  std::istringstream in(line);
+  std::string field;
+  size_t len = strlen(line);
+
+  if (!len || line[len - 1] != '\n') return 0;
+  while (in >> field) fields.push_back(field);
+  if (fields.size() != 8) return 0;
+
+  const std::string &key = fields[0];
+  if (key.size() < 42 || key[40] != ':' || !all_hex(key.substr(0, 40), 40) ||
+      !all_hex(key.substr(41), 200))
+    return 0;
+
+  /* Only good and revoked states are cached.  */
+  if (fields[1] == std::to_string((int)KSBA_STATUS_GOOD))
+    r_entry.status = KSBA_STATUS_GOOD;
+  else if (fields[1] == std::to_string((int)KSBA_STATUS_REVOKED))
+    r_entry.status = KSBA_STATUS_REVOKED;
+  else
+    return 0;
+
+  if (!is_number(fields[2])) return 0;
+  r_entry.reason = (ksba_crl_reason_t)std::stoi(fields[2]);
+
+  if (!valid_isotime(fields[3]) || !valid_isotime(fields[4])) return 0;
+  strcpy(r_entry.this_update, fields[3].c_str());
+  strcpy(r_entry.next_update, fields[4].c_str());
+
+  if (fields[5] == "-" && r_entry.status != KSBA_STATUS_REVOKED)
+    *r_entry.revocation_time = 0;
+  else if (valid_isotime(fields[5]))
+    strcpy(r_entry.revocation_time, fields[5].c_str());
+  else
+    return 0;
+
+  if (fields[6] != "0" && fields[6] != "1") return 0;
+  r_entry.default_responder = fields[6] == "1";
+
+  if (fields[7] == "-")
+    r_entry.responder_fpr.clear();
+  else if (fields[7].size() == 40 && all_hex(fields[7], 40))
+    r_entry.responder_fpr = fields[7];
+  else
+    return 0;
+
+  r_key = key;
+  return 1;
+}
+
+/* Write the cache file line for KEY and E to FP.  */
+static void write_cache_line(estream_t fp, const std::string &key,
+                             const ocsp_cache_entry_s &e) {
+  es_fprintf(fp, "%s %d %d %s %s %s %d %s\n", key.c_str(), (int)e.status,
+             (int)e.reason, e.this_update, e.next_update,
+             *e.revocation_time ? e.revocation_time : "-",
+             e.default_responder,
+             e.responder_fpr.empty() ? "-" : e.responder_fpr.c_str());
+}
+
+/* Load the persistent OCSP cache.  The file is ignored unless it is
+   a regular file owned by us which nobody else can write, and starts
+   with our header.  Malformed lines are skipped.  The caller must
+   hold OCSP_CACHE_LOCK.  */
+static void ocsp_cache_load(void) {
+  char *fname;
+  estream_t fp;
+  char line[512];
+  struct stat st;
+  ksba_isotime_t current_time;
+
+  ocsp_cache_loaded = 1;
+  ocsp_cache_file_entries = 0;
+  if (!opt.persistent_ocsp_cache) return;
+
+  fname = make_filename(opt.homedir_cache, OCSP_CACHE_FILE, NULL);
+  fp = es_fopen(fname, "r");
+  if (!fp) {
+    xfree(fname);
+    return;
+  }
+
+  if (fstat(es_fileno(fp), &st) || !S_ISREG(st.st_mode) ||
+      st.st_uid != getuid() || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+    log_info(_("ignoring '%s': not a private file\n"), fname);
+    goto leave;
+  }
+  if (!es_fgets(line, sizeof line, fp) || strcmp(line, OCSP_CACHE_HEADER)) {
+    log_info(_("ignoring '%s': invalid header\n"), fname);
+    goto leave;
+  }
+
+  gnupg_get_isotime(current_time);
+  while (es_fgets(line, sizeof line, fp)) {
+    std::string key;
+    ocsp_cache_entry_s entry;
+
+    if (!parse_cache_line(line, key, entry)) {
+      log_info(_("ignoring invalid entry in '%s'\n"), fname);
+      continue;
+    }
+    ocsp_cache_file_entries++;
+    /* Later entries replace earlier ones for the same key.  */
+    if (strcmp(entry.next_update, current_time) <= 0)
+      ocsp_cache.erase(key);
+    else
+      ocsp_cache[key] = entry;
+  }
+  while (ocsp_cache.size() > MAX_OCSP_CACHE_ENTRIES)
+    ocsp_cache.erase(ocsp_cache.begin());
+
+leave:
+  es_fclose(fp);
+  xfree(fname);
+}
+
+/* Rewrite the persistent OCSP cache with the current entries.  The
+   caller must hold OCSP_CACHE_LOCK.  */
+static void ocsp_cache_save(void) {
+  char *fname, *tmpfname;
+  estream_t fp;
+
+  if (!opt.persistent_ocsp_cache) return;
+
+  fname = make_filename(opt.homedir_cache, OCSP_CACHE_FILE, NULL);
+  tmpfname = strconcat(fname, ".tmp", NULL);
+  fp = es_fopen(tmpfname, "w,mode=-rw");
+  if (!fp) {
+    log_error(_("error creating '%s': %s\n"), tmpfname, strerror(errno));
+    xfree(tmpfname);
+    xfree(fname);
+    return;
+  }
+
+  es_fputs(OCSP_CACHE_HEADER, fp);
+  for (auto &item : ocsp_cache) write_cache_line(fp, item.first, item.second);
+  if (es_fclose(fp) || rename(tmpfname, fname)) {
+    log_error(_("error writing '%s': %s\n"), fname, strerror(errno));
+    gnupg_remove(tmpfname);
+  } else
+    ocsp_cache_file_entries = ocsp_cache.size();
+  xfree(tmpfname);
+  xfree(fname);
+}
+
+/* Append the entry E for KEY to the persistent OCSP cache.  The
+   caller must hold OCSP_CACHE_LOCK.  */
+static void ocsp_cache_append(const std::string &key,
+                              const ocsp_cache_entry_s &e) {
+  char *fname;
+  estream_t fp;
+
+  if (!opt.persistent_ocsp_cache) return;
+
+  fname = make_filename(opt.homedir_cache, OCSP_CACHE_FILE, NULL);
+  fp = es_fopen(fname, "a,mode=-rw");
+  if (!fp) {
+    log_error(_("error opening '%s': %s\n"), fname, strerror(errno));
+    xfree(fname);
+    return;
+  }
+  write_cache_line(fp, key, e);
+  if (es_fclose(fp))
+    log_error(_("error writing '%s': %s\n"), fname, strerror(errno));
+  else
+    ocsp_cache_file_entries++;
+  xfree(fname);
+}
+
+int ocsp_cache_get(const std::string &key, int default_responder,
+                   ocsp_cache_entry_s &r_entry) {
+  ksba_isotime_t current_time;
+
+  std::lock_guard<std::mutex> lock(ocsp_cache_lock);
+
+  if (!ocsp_cache_loaded) ocsp_cache_load();
+
+  auto it = ocsp_cache.find(key);
+  if (it == ocsp_cache.end()) return 0;
+
+  gnupg_get_isotime(current_time);
+  if (strcmp(it->second.next_update, current_time) <= 0) {
+    ocsp_cache.erase(it);
+    return 0;
+  }
+  if (it->second.default_responder != default_responder) return 0;
+
+  r_entry = it->second;
+  return 1;
+}
+
+void ocsp_cache_put(const std::string &key, const ocsp_cache_entry_s &entry) {
+  ksba_isotime_t current_time;
+
+  std::lock_guard<std::mutex> lock(ocsp_cache_lock);
+
+  if (!ocsp_cache_loaded) ocsp_cache_load();
+
+  if (ocsp_cache.size() >= MAX_OCSP_CACHE_ENTRIES) {
+    gnupg_get_isotime(current_time);
+    for (auto it = ocsp_cache.begin(); it != ocsp_cache.end();)
+      if (strcmp(it->second.next_update, current_time) <= 0)
+        it = ocsp_cache.erase(it);
+      else
+        ++it;
+    if (ocsp_cache.size() >= MAX_OCSP_CACHE_ENTRIES)
+      ocsp_cache.erase(ocsp_cache.begin());
+  }
+  ocsp_cache[key] = entry;
+
+  /* Appending keeps the cost of a new response independent of the
+     size of the cache.  A missing or unusable file is replaced.  */
+  if (!ocsp_cache_file_entries ||
+      ocsp_cache_file_entries >= 2 * ocsp_cache.size())
+    ocsp_cache_save();
+  else
+    ocsp_cache_append(key, entry);
+}
+
+void ocsp_cache_flush(void) {
+  char *fname;
+
+  std::lock_guard<std::mutex> lock(ocsp_cache_lock);
+
+  ocsp_cache.clear();
+  ocsp_cache_loaded = 1;
+  ocsp_cache_file_entries = 0;
+  fname = make_filename(opt.homedir_cache, OCSP_CACHE_FILE, NULL);
+  gnupg_remove(fname);
+  xfree(fname);
+}
+
+void ocsp_cache_deinit(void) {
+  std::lock_guard<std::mutex> lock(ocsp_cache_lock);
+
+  if (ocsp_cache_loaded && ocsp_cache_file_entries > ocsp_cache.size())
+    ocsp_cache_save();
+  ocsp_cache.clear();
+  ocsp_cache_loaded = 0;
+  ocsp_cache_file_entries = 0;
+}
@@ -0,0 +1,48 @@
+/* ocspcache.h - Cache of OCSP responses
+   Copyright 2018 The NeoPG developers
+
+   NeoPG is released under the Simplified BSD License (see license.txt)
+*/
+
+#ifndef OCSPCACHE_H
+#define OCSPCACHE_H
+
+#include <string>
+
+/* A cached OCSP status of one certificate.  Only responses with a
+   verified signature and a NEXT_UPDATE are cached.  They are used
+   until NEXT_UPDATE.  */
+struct ocsp_cache_entry_s {
+  ksba_status_t status;
+  ksba_crl_reason_t reason;
+  ksba_isotime_t this_update;
+  ksba_isotime_t next_update;
+  ksba_isotime_t revocation_time;
+  int default_responder; /* The response is from the default responder.  */
+  /* The fingerprint of the responder certificate if its validity has
+     to be checked by the client, otherwise empty.  The client is told
+     with an ONLY_VALID_IF_CERT_VALID status.  */
+  std::string responder_fpr;
+};
+
+/* Look up the cached status for KEY in R_ENTRY.  KEY is the hex
+   encoded keygrip of the issuer key and the hex encoded serial
+   number, separated by a colon.  Only responses from the default
+   responder are used if DEFAULT_RESPONDER is set, and only responses
+   from other responders otherwise.  Returns true if an entry was
+   found.  */
+int ocsp_cache_get(const std::string &key, int default_responder,
+                   ocsp_cache_entry_s &r_entry);
+
+/* Store ENTRY for KEY in the cache.  With a persistent cache, the
+   entry is appended to the cache file.  */
+void ocsp_cache_put(const std::string &key, const ocsp_cache_entry_s &entry);
+
+/* Remove all cached OCSP responses.  */
+void ocsp_cache_flush(void);
+
+/* Compact the cache file and release the cached responses.  The
+   persistent cache is loaded again on the next access.  */
+void ocsp_cache_deinit(void);
+
+#endif /*OCSPCACHE_H*/
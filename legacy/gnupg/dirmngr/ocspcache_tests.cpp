@@ -0,0 +1,201 @@
+/* Tests for the OCSP response cache
+   Copyright 2018 The NeoPG developers
+
+   NeoPG is released under the Simplified BSD License (see license.txt)
+*/
+
+#include <config.h>
+
+#include "gtest/gtest.h"
+
+#include <string.h>
+#include <sys/stat.h>
+
+#include <fstream>
+#include <string>
+
+#include "dirmngr.h"
+#include "ocspcache.h"
+
+#include "legacy_environment.h"
+
+using namespace NeoPG;
+
+namespace {
+
+const std::string KEY1 = std::string(40, 'A') + ":01";
+const std::string KEY2 = std::string(40, 'A') + ":02";
+const std::string RESPONDER_FPR = std::string(40, 'B');
+
+const char PAST[] = "20000101T000000";
+const char FUTURE[] = "20991231T235959";
+
+ocsp_cache_entry_s make_entry(ksba_status_t status, const char *next_update,
+                              const std::string &responder_fpr = "") {
+  ocsp_cache_entry_s entry;
+
+  entry.status = status;
+  entry.reason = status == KSBA_STATUS_REVOKED ? KSBA_CRLREASON_KEY_COMPROMISE
+                                               : (ksba_crl_reason_t)0;
+  strcpy(entry.this_update, PAST);
+  strcpy(entry.next_update, next_update);
+  strcpy(entry.revocation_time, status == KSBA_STATUS_REVOKED ? PAST : "");
+  entry.default_responder = 0;
+  entry.responder_fpr = responder_fpr;
+  return entry;
+}
+
+/* A persistent OCSP cache in a temporary directory.  */
+class PersistentCache {
+ public:
+  PersistentCache()
+      : m_homedir_cache(opt.homedir_cache),
+        m_persistent(opt.persistent_ocsp_cache) {
+    opt.homedir_cache = m_dir.path().c_str();
+    opt.persistent_ocsp_cache = 1;
+    ocsp_cache_flush();
+    ocsp_cache_deinit();
+  }
+
+  ~PersistentCache() {
+    ocsp_cache_flush();
+    ocsp_cache_deinit();
+    opt.homedir_cache = m_homedir_cache;
+    opt.persistent_ocsp_cache = m_persistent;
+  }
+
+  std::string filename() const { return m_dir.path() + "/ocsp-cache.txt"; }
+
+  int lines() const {
+    std::ifstream file(filename());
+    std::string line;
+    int count = 0;
+    while (std::getline(file, line)) count++;
+    return count;
+  }
+
+  void write(const std::string &content) const {
+    std::ofstream(filename()) << content;
+    chmod(filename().c_str(), 0600);
+  }
+
+ private:
+  TemporaryDirectory m_dir;
+  const char *m_homedir_cache;
+  int m_persistent;
+};
+
+}  // namespace
+
+TEST(NeopgLegacyTest, dirmngr_ocsp_cache_test) {
+  PersistentCache cache;
+  ocsp_cache_entry_s entry;
+
+  ocsp_cache_put(KEY1, make_entry(KSBA_STATUS_GOOD, FUTURE));
+  ocsp_cache_entry_s revoked =
+      make_entry(KSBA_STATUS_REVOKED, FUTURE, RESPONDER_FPR);
+  revoked.default_responder = 1;
+  ocsp_cache_put(KEY2, revoked);
+
+  /* Responses are only used for the same kind of responder.  */
+  ASSERT_TRUE(ocsp_cache_get(KEY1, 0, entry));
+  ASSERT_FALSE(ocsp_cache_get(KEY1, 1, entry));
+  ASSERT_FALSE(ocsp_cache_get(KEY2, 0, entry));
+
+  /* The file is private and survives a restart.  */
+  struct stat st;
+  ASSERT_EQ(stat(cache.filename().c_str(), &st), 0);
+  ASSERT_EQ(st.st_mode & 077, 0);
+  ocsp_cache_deinit();
+
+  ASSERT_TRUE(ocsp_cache_get(KEY1, 0, entry));
+  ASSERT_EQ(entry.status, KSBA_STATUS_GOOD);
+  ASSERT_STREQ(entry.this_update, PAST);
+  ASSERT_STREQ(entry.next_update, FUTURE);
+  ASSERT_STREQ(entry.revocation_time, "");
+  /* Without a responder fingerprint, no ONLY_VALID_IF_CERT_VALID
+     status is sent.  */
+  ASSERT_EQ(entry.responder_fpr, "");
+
+  ASSERT_TRUE(ocsp_cache_get(KEY2, 1, entry));
+  ASSERT_EQ(entry.status, KSBA_STATUS_REVOKED);
+  ASSERT_EQ(entry.reason, KSBA_CRLREASON_KEY_COMPROMISE);
+  ASSERT_STREQ(entry.revocation_time, PAST);
+  ASSERT_EQ(entry.default_responder, 1);
+  /* The responder certificate still has to be checked by the client
+     with ONLY_VALID_IF_CERT_VALID.  */
+  ASSERT_EQ(entry.responder_fpr, RESPONDER_FPR);
+}
+
+TEST(NeopgLegacyTest, dirmngr_ocsp_cache_expiry_test) {
+  PersistentCache cache;
+  ocsp_cache_entry_s entry;
+
+  ocsp_cache_put(KEY1, make_entry(KSBA_STATUS_GOOD, PAST));
+  ocsp_cache_put(KEY2, make_entry(KSBA_STATUS_GOOD, FUTURE));
+  ASSERT_FALSE(ocsp_cache_get(KEY1, 0, entry));
+  ASSERT_TRUE(ocsp_cache_get(KEY2, 0, entry));
+
+  /* Expired responses are not loaded either.  */
+  ocsp_cache_put(KEY1, make_entry(KSBA_STATUS_GOOD, PAST));
+  ocsp_cache_deinit();
+  ASSERT_FALSE(ocsp_cache_get(KEY1, 0, entry));
+  ASSERT_TRUE(ocsp_cache_get(KEY2, 0, entry));
+}
+
+TEST(NeopgLegacyTest, dirmngr_ocsp_cache_append_test) {
+  PersistentCache cache;
+  ocsp_cache_entry_s entry;
+
+  /* New responses are appended to the file.  */
+  for (int i = 0; i < 10; i++) {
+    std::string key = std::string(40, 'C') + ":0" + std::to_string(i);
+    ocsp_cache_put(key, make_entry(KSBA_STATUS_GOOD, FUTURE));
+  }
+  ASSERT_EQ(cache.lines(), 11);
+
+  /* Replaced responses are removed when the file is rewritten.  */
+  for (int i = 0; i < 100; i++)
+    ocsp_cache_put(KEY1, make_entry(KSBA_STATUS_GOOD, FUTURE));
+  ASSERT_LE(cache.lines(), 1 + 2 * 11);
+  ocsp_cache_put(KEY1, make_entry(KSBA_STATUS_REVOKED, FUTURE));
+  ocsp_cache_deinit();
+  ASSERT_EQ(cache.lines(), 12);
+  ASSERT_TRUE(ocsp_cache_get(KEY1, 0, entry));
+  ASSERT_EQ(entry.status, KSBA_STATUS_REVOKED);
+}
+
+TEST(NeopgLegacyTest, dirmngr_ocsp_cache_load_test) {
+  PersistentCache cache;
+  ocsp_cache_entry_s entry;
+  const std::string header = "# OCSP response cache - do not edit\n";
+  const std::string good = " 2 0 20000101T000000 20991231T235959 - 0 -\n";
+  const std::string key3 = std::string(40, 'A') + ":03";
+
+  /* Malformed lines are skipped, later lines replace earlier ones.  */
+  cache.write(header + KEY1 +
+              " 4 1 20000101T000000 20991231T235959 20000101T000000 0 -\n" +
+              KEY1 + good + KEY2 +
+              " 7 0 20000101T000000 20991231T235959 - 0 -\n" + key3 +
+              " 2 0 20000101T000000 2099 - 0 -\n" + std::string(40, 'A') +
+              ":04 2 0 20000101T000000 20991231T235959 - 0 " +
+              std::string(39, 'B') + "\n" + std::string(40, 'A') + ":05" +
+              good.substr(0, 20));
+  ASSERT_TRUE(ocsp_cache_get(KEY1, 0, entry));
+  ASSERT_EQ(entry.status, KSBA_STATUS_GOOD);
+  ASSERT_FALSE(ocsp_cache_get(KEY2, 0, entry));
+  ASSERT_FALSE(ocsp_cache_get(key3, 0, entry));
+  ASSERT_FALSE(ocsp_cache_get(std::string(40, 'A') + ":04", 0, entry));
+  ASSERT_FALSE(ocsp_cache_get(std::string(40, 'A') + ":05", 0, entry));
+  ocsp_cache_deinit();
+
+  /* A file that others can write is ignored.  */
+  chmod(cache.filename().c_str(), 0622);
+  ASSERT_FALSE(ocsp_cache_get(KEY1, 0, entry));
+  ocsp_cache_deinit();
+
+  /* So is a file without the header.  */
+  cache.write(KEY1 + good);
+  ASSERT_FALSE(ocsp_cache_get(KEY1, 0, entry));
+  ocsp_cache_deinit();
+}
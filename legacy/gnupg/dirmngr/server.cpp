@@ -1156,13 +1156,15 @@ static const char hlp_ks_get[] =
     "\n"
     "Get the keys matching PATTERN from the configured OpenPGP keyservers\n"
     "(see command KEYSERVER).  Each pattern should be a keyid, a fingerprint,\n"
-    "or an exact name indicated by the '=' prefix.";
+    "or an exact name indicated by the '=' prefix.\n"
+    "\n"
+    "The patterns are looked up concurrently.  The data for each pattern is\n"
+    "sent as soon as it arrives and followed by a PART status line.";
 static gpg_error_t cmd_ks_get(assuan_context_t ctx, char *line) {
   ctrl_t ctrl = (ctrl_t)assuan_get_pointer(ctx);
   gpg_error_t err;
   std::vector<std::string> list;
   char *p;
-  std::string output;
 
   if (has_option(line, "--quick")) ctrl->timeout = opt.connect_quick_timeout;
   line = skip_options(line);
@@ -1188,11 +1190,19 @@ static gpg_error_t cmd_ks_get(assuan_context_t ctx, char *line) {
   err = ensure_keyserver(ctrl);
   if (err) leave_cmd(ctx, err);
 
-  err = ks_action_get(ctrl, ctrl->server_local->keyservers, list, output);
-  if (err) return leave_cmd(ctx, err);
-
-  err = assuan_send_data(ctx, output.data(), output.size());
-  if (!err) err = assuan_send_data(ctx, NULL, 0);
+  /* Each response is sent as soon as it arrives and is terminated by
+     a PART status line, so that the client can import the keys while
+     the remaining requests are still in flight.  */
+  err = ks_action_get(ctrl, ctrl->server_local->keyservers, list,
+                      [&](const std::string &response) {
+                        gpg_error_t rc;
+
+                        rc = assuan_send_data(ctx, response.data(),
+                                              response.size());
+                        if (!rc) rc = assuan_send_data(ctx, NULL, 0);
+                        if (!rc) rc = dirmngr_status(ctrl, "PART", NULL);
+                        return rc;
+                      });
 
   return leave_cmd(ctx, err);
 }
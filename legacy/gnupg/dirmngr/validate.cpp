@@ -21,6 +21,11 @@
 
 #include <config.h>
 
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
@@ -64,6 +69,26 @@ static const char oid_kp_emailProtection[] = "1.3.6.1.5.5.7.3.4";
 static const char oid_kp_timeStamping[] = "1.3.6.1.5.5.7.3.8";
 static const char oid_kp_ocspSigning[] = "1.3.6.1.5.5.7.3.9";
 
+/* The maximum number of cached certificate signature checks.  */
+#define MAX_SIG_CACHE_ENTRIES 4096
+
+/* Certificate signatures which have been verified.  The key is the
+   length of the DER image of the certificate, a colon, the image and
+   the image of the issuer certificate, so that an entry is never used
+   for a certificate which differs in any byte.  The value is the
+   earlier expiration time of the two certificates; the entry is not
+   used after that time.  Only the signature is cached, revocations
+   are checked for each validation.  When the cache is full, the least
+   recently used entry is evicted.  */
+struct sig_cache_entry_s {
+  std::string not_after;
+  std::list<std::string>::iterator lru; /* Position in SIG_CACHE_LRU.  */
+};
+static std::unordered_map<std::string, sig_cache_entry_s> sig_cache;
+/* The keys of SIG_CACHE, most recently used first.  */
+static std::list<std::string> sig_cache_lru;
+static std::mutex sig_cache_lock;
+
 /* Prototypes.  */
 static gpg_error_t check_cert_sig(ksba_cert_t issuer_cert, ksba_cert_t cert);
 
@@ -199,6 +224,65 @@ static gpg_error_t allowed_ca(ksba_cert_t cert, int *chainlen) {
   return 0;
 }
 
+/* Check the signature of CERT with ISSUER_CERT like check_cert_sig,
+   but use the result of an earlier check if it is still valid at
+   CURRENT_TIME.  */
+gpg_error_t check_cert_sig_cached(ksba_cert_t issuer_cert, ksba_cert_t cert,
+                                  const ksba_isotime_t current_time) {
+  gpg_error_t err;
+  const unsigned char *image, *issuer_image;
+  size_t imagelen, issuer_imagelen;
+  ksba_isotime_t not_after, issuer_not_after;
+
+  image = ksba_cert_get_image(cert, &imagelen);
+  issuer_image = ksba_cert_get_image(issuer_cert, &issuer_imagelen);
+  if (!image || !issuer_image) return check_cert_sig(issuer_cert, cert);
+  std::string key = std::to_string(imagelen) + ":";
+  key.append((const char *)image, imagelen);
+  key.append((const char *)issuer_image, issuer_imagelen);
+
+  {
+    std::lock_guard<std::mutex> lock(sig_cache_lock);
+    auto it = sig_cache.find(key);
+    if (it != sig_cache.end()) {
+      if (strcmp(current_time, it->second.not_after.c_str()) <= 0) {
+        sig_cache_lru.splice(sig_cache_lru.begin(), sig_cache_lru,
+                             it->second.lru);
+        if (DBG_X509) log_debug("certificate signature is good (cached)\n");
+        return 0;
+      }
+      sig_cache_lru.erase(it->second.lru);
+      sig_cache.erase(it);
+    }
+  }
+
+  err = check_cert_sig(issuer_cert, cert);
+  if (err) return err;
+
+  if (ksba_cert_get_validity(cert, 1, not_after)) *not_after = 0;
+  if (ksba_cert_get_validity(issuer_cert, 1, issuer_not_after))
+    *issuer_not_after = 0;
+  if (!*not_after || (*issuer_not_after &&
+                      strcmp(issuer_not_after, not_after) < 0))
+    gnupg_copy_time(not_after, issuer_not_after);
+  if (!*not_after) return 0; /* No expiration time - don't cache.  */
+
+  std::lock_guard<std::mutex> lock(sig_cache_lock);
+  auto it = sig_cache.find(key);
+  if (it != sig_cache.end()) {
+    /* Another thread checked the same signature meanwhile.  */
+    it->second.not_after = not_after;
+    return 0;
+  }
+  if (sig_cache.size() >= MAX_SIG_CACHE_ENTRIES) {
+    sig_cache.erase(sig_cache_lru.back());
+    sig_cache_lru.pop_back();
+  }
+  sig_cache_lru.push_front(key);
+  sig_cache[key] = {not_after, sig_cache_lru.begin()};
+  return 0;
+}
+
 /* Helper for validate_cert_chain.  */
 static gpg_error_t check_revocations(ctrl_t ctrl, chain_item_t chain) {
   gpg_error_t err = 0;
@@ -384,7 +468,7 @@ gpg_error_t validate_cert_chain(ctrl_t ctrl, ksba_cert_t cert,
       err = 0; /* Not available or other error. */
     else {
       /* If the validation is not older than 30 minutes we are ready. */
-      if (validated_at < gnupg_get_time() + (30 * 60)) {
+      if (validated_at + (30 * 60) > gnupg_get_time()) {
         if (opt.verbose) log_info("certificate is good (cached)\n");
         /* Note, that we can't jump to leave here as this would
            falsely updated the validation timestamp.  */
@@ -472,7 +556,7 @@ gpg_error_t validate_cert_chain(ctrl_t ctrl, ksba_cert_t cert,
     /* Is this a self-signed certificate? */
     if (is_root_cert(subject_cert, issuer, subject)) {
       /* Yes, this is our trust anchor.  */
-      if (check_cert_sig(subject_cert, subject_cert)) {
+      if (check_cert_sig_cached(subject_cert, subject_cert, current_time)) {
         log_error(_("selfsigned certificate has a BAD signature"));
         err = depth ? GPG_ERR_BAD_CERT_CHAIN : GPG_ERR_BAD_CERT;
         goto leave;
@@ -566,7 +650,7 @@ gpg_error_t validate_cert_chain(ctrl_t ctrl, ksba_cert_t cert,
     /* Now check the signature of the certificate.  FIXME: we should
      * delay this until later so that faked certificates can't be
      * turned into a DoS easily.  */
-    err = check_cert_sig(issuer_cert, subject_cert);
+    err = check_cert_sig_cached(issuer_cert, subject_cert, current_time);
     if (err) {
       log_error(_("certificate has a BAD signature"));
 #if 0
@@ -62,4 +62,10 @@ gpg_error_t check_cert_use_ocsp(ksba_cert_t cert);
 /* Return 0 if the certificate CERT is usable for signing CRLs. */
 gpg_error_t check_cert_use_crl(ksba_cert_t cert);
 
+/* Return 0 if the signature of CERT is valid for the public key of
+   ISSUER_CERT.  The result is cached until CURRENT_TIME passes the
+   expiration time of one of the certificates.  */
+gpg_error_t check_cert_sig_cached(ksba_cert_t issuer_cert, ksba_cert_t cert,
+                                  const ksba_isotime_t current_time);
+
 #endif /*VALIDATE_H*/
@@ -0,0 +1,131 @@
+/* Tests for the certificate validation
+   Copyright 2018 The NeoPG developers
+
+   NeoPG is released under the Simplified BSD License (see license.txt)
+*/
+
+#include <config.h>
+
+#include "gtest/gtest.h"
+
+#include <string>
+
+#include <botan/base64.h>
+
+#include "dirmngr.h"
+
+#include "validate.h"
+
+namespace {
+
+/* A self-signed RSA CA certificate, another one with the same subject
+   and a different key, and a leaf certificate issued by the first.
+   The leaf certificate expires at 21250512T092014.  */
+const char CA_CERT[] =
+    "MIICCzCCAXSgAwIBAgIBATANBgkqhkiG9w0BAQsFADAYMRYwFAYDVQQDDA1OZW9Q"
+    "RyBUZXN0IENBMCAXDTI2MTAxODA5MjAxNFoYDzIxMjYwOTI0MDkyMDE0WjAYMRYw"
+    "FAYDVQQDDA1OZW9QRyBUZXN0IENBMIGfMA0GCSqGSIb3DQEBAQUAA4GNADCBiQKB"
+    "gQDgHd0ol58v8Z646OBdSngI+liS4f1+4FTUvnBYXla671y9QvjtuqJrOKFXCWts"
+    "NVNzKi55M11divumc7pTH45We7vIEMVPubTHvU4D2MyPgTF8yGTtMrd5evJq1ryi"
+    "tMAIDP0SlZ0BZbB2pLYlVBS40R+KaUEJUZFJ7euPg7Pw1wIDAQABo2MwYTAdBgNV"
+    "HQ4EFgQUyCswfOuOKu1/3J8wj7JEeWvxlYgwHwYDVR0jBBgwFoAUyCswfOuOKu1/"
+    "3J8wj7JEeWvxlYgwDwYDVR0TAQH/BAUwAwEB/zAOBgNVHQ8BAf8EBAMCAQYwDQYJ"
+    "KoZIhvcNAQELBQADgYEAtXi+5gZwjga/KHsqpYHIp9taZAFF3ZtjMc20OerTJMwR"
+    "2bAN49DFS0ODal2c8oPnKxRvWdqKCTWqkViYx8kJ9DEdPBnux03hbGGzcYnbtO+i"
+    "3A1l+3QjLnQi2ViRZoRuKvek46YidbKT5blF7b5DF++dYaqq+bv6dB4zBne3QNQ=";
+const char OTHER_CA_CERT[] =
+    "MIICCzCCAXSgAwIBAgIBATANBgkqhkiG9w0BAQsFADAYMRYwFAYDVQQDDA1OZW9Q"
+    "RyBUZXN0IENBMCAXDTI2MTAxODA5MjAxNFoYDzIxMjYwOTI0MDkyMDE0WjAYMRYw"
+    "FAYDVQQDDA1OZW9QRyBUZXN0IENBMIGfMA0GCSqGSIb3DQEBAQUAA4GNADCBiQKB"
+    "gQC5wSWeBEMcrxmJ/Kfbxg4a8StPrvdQzTMpGv5bEhXiLo9T6JQnp9/ZnS1pMLwu"
+    "MdJ6O7P5LBKgzM9cZr0WvBW4OJ+M/5+Fs3Zy/Y/Nk/zD9gXTWaM4lsgx2swvzdgt"
+    "l4Z7rpOAPq+/qMCIR3nhJaJkH/CGWBq0VHEFr4su4O+b4wIDAQABo2MwYTAdBgNV"
+    "HQ4EFgQUxRzoboHJcSlJp0mQAfttayGeeGkwHwYDVR0jBBgwFoAUxRzoboHJcSlJ"
+    "p0mQAfttayGeeGkwDwYDVR0TAQH/BAUwAwEB/zAOBgNVHQ8BAf8EBAMCAQYwDQYJ"
+    "KoZIhvcNAQELBQADgYEAjCaOCID/DtoQ2ecIpLVRAqN0gUNYq5lEU47EHcqgkx97"
+    "BCX6KLVoMh40PEvyKhL18msFsXS6VIjnYsDoOn2DGq4BSOV/zSREchEjrigmMENz"
+    "fRAVn7VmL4kIX0I3V1ypMj8MyVOsSjkGBTh/UkfXhhNxSFm2EAdgOe5l/pI8fj0=";
+const char LEAF_CERT[] =
+    "MIIBqjCCARMCCAECAwQFBgcIMA0GCSqGSIb3DQEBCwUAMBgxFjAUBgNVBAMMDU5l"
+    "b1BHIFRlc3QgQ0EwIBcNMjYxMDE4MDkyMDE0WhgPMjEyNTA1MTIwOTIwMTRaMBox"
+    "GDAWBgNVBAMMD05lb1BHIFRlc3QgTGVhZjCBnzANBgkqhkiG9w0BAQEFAAOBjQAw"
+    "gYkCgYEAvm00q3iAtqVmTTLAlR1GV1jFwVZLV/o4HLKOJrq5hewNLmHTRjaldZbk"
+    "UA9aZ0ukSLYq61eIjw+4NS3ALqHB1F9T2eqNR70qydol3rdCeZGcWg+kaMZDY2JN"
+    "Mp/qDhY6eitRBlUam8IXDFHsoOLqW4H+KSC4b+BoSJS5KiUoJyMCAwEAATANBgkq"
+    "hkiG9w0BAQsFAAOBgQDRxQmzvJDIa9cYsZEPXEjbnwmxMBp90kUvumqRTGOSwlmc"
+    "7nYK0A1XCOatkP/vWLUi40LPQQUKgWDZJ9Z3CHVIZviunPTkAUuiG7CdFvTqv2Zr"
+    "JrhWr0zIh9I5rxFz6B6nWdZ6nVknAEoV82WaHekGUdpPgzOARfL+bvc2+9EKwA==";
+
+std::string der(const char *base64) {
+  auto data = Botan::base64_decode(std::string(base64));
+  return std::string((const char *)data.data(), data.size());
+}
+
+/* A certificate parsed from DER encoded data.  */
+class Cert {
+ public:
+  explicit Cert(const std::string &data) {
+    ksba_cert_new(&m_cert);
+    m_err = ksba_cert_init_from_mem(m_cert, data.data(), data.size());
+  }
+
+  ~Cert() { ksba_cert_release(m_cert); }
+
+  operator ksba_cert_t() const { return m_cert; }
+
+  gpg_error_t error() const { return m_err; }
+
+ private:
+  ksba_cert_t m_cert = NULL;
+  gpg_error_t m_err;
+};
+
+/* Check the signature of CERT with ISSUER_CERT at the time NOW.  */
+gpg_error_t check(const Cert &issuer_cert, const Cert &cert,
+                  const char *now = "20300101T000000") {
+  return check_cert_sig_cached(issuer_cert, cert, now);
+}
+
+}  // namespace
+
+TEST(NeopgLegacyTest, dirmngr_validate_sig_cache_test) {
+  Cert ca(der(CA_CERT));
+  Cert other_ca(der(OTHER_CA_CERT));
+  Cert leaf(der(LEAF_CERT));
+  ASSERT_EQ(ca.error(), 0);
+  ASSERT_EQ(other_ca.error(), 0);
+  ASSERT_EQ(leaf.error(), 0);
+
+  /* Good signatures are found again, also after the certificates have
+     expired, when they are checked anew.  */
+  for (int i = 0; i < 2; i++) {
+    ASSERT_EQ(check(ca, leaf), 0);
+    ASSERT_EQ(check(ca, ca), 0);
+  }
+  ASSERT_EQ(check(ca, leaf, "21250512T092014"), 0);
+  ASSERT_EQ(check(ca, leaf, "22000101T000000"), 0);
+  ASSERT_EQ(check(ca, leaf), 0);
+
+  /* An issuer with the same subject but another key is not taken for
+     the cached one, nor is the issuer itself checked with it.  */
+  ASSERT_EQ(check(other_ca, leaf), GPG_ERR_BAD_SIGNATURE);
+  ASSERT_EQ(check(other_ca, ca), GPG_ERR_BAD_SIGNATURE);
+
+  /* Certificates which differ from the cached one only in the serial
+     number or in the signature do not match its entry.  */
+  std::string data = der(LEAF_CERT);
+  size_t pos = data.find("\x01\x02\x03\x04\x05\x06\x07\x08");
+  ASSERT_NE(pos, std::string::npos);
+  data[pos + 7] ^= 1;
+  Cert serial(data);
+  ASSERT_EQ(serial.error(), 0);
+  data = der(LEAF_CERT);
+  data[data.size() - 1] ^= 1;
+  Cert signature(data);
+  ASSERT_EQ(signature.error(), 0);
+  for (int i = 0; i < 2; i++) {
+    ASSERT_EQ(check(ca, serial), GPG_ERR_BAD_SIGNATURE);
+    ASSERT_EQ(check(ca, signature), GPG_ERR_BAD_SIGNATURE);
+  }
+  ASSERT_EQ(check(ca, leaf), 0);
+}
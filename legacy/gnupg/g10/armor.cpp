@@ -28,6 +28,8 @@
 #include <botan/base64.h>
 #include <boost/algorithm/string.hpp>
 
+#include <neopg/radix64.h>
+
 #include "../common/iobuf.h"
 #include "../common/status.h"
 #include "../common/util.h"
@@ -39,14 +41,10 @@
 
 #define MAX_LINELEN 20000
 
-#define CRCINIT 0xB704CE
-#define CRCPOLY 0X864CFB
-#define CRCUPDATE(a, c)                                 \
-  do {                                                  \
-    a = ((a) << 8) ^ crc_table[((a)&0xff >> 16) ^ (c)]; \
-    a &= 0x00ffffff;                                    \
-  } while (0)
-static u32 crc_table[256];
+/* Whole lines of radix64 are encoded at once, up to this many.  */
+#define ENCODE_LINES 64
+
+#define CRCINIT NeoPG::CRC24_INIT
 static byte bintoasc[] =
     "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
     "abcdefghijklmnopqrstuvwxyz"
@@ -138,24 +136,9 @@ int push_armor_filter(armor_filter_context_t *afx, iobuf_t iobuf) {
 }
 
 static void initialize(void) {
-  int i, j;
-  u32 t;
+  int i;
   byte *s;
 
-  /* init the crc lookup table */
-  crc_table[0] = 0;
-  for (i = j = 0; j < 128; j++) {
-    t = crc_table[j];
-    if (t & 0x00800000) {
-      t <<= 1;
-      crc_table[i++] = t ^ CRCPOLY;
-      crc_table[i++] = t;
-    } else {
-      t <<= 1;
-      crc_table[i++] = t;
-      crc_table[i++] = t ^ CRCPOLY;
-    }
-  }
   /* build the helptable for radix64 to bin conversion */
   for (i = 0; i < 256; i++)
     asctobin[i] = 255; /* used to detect invalid characters */
@@ -670,13 +653,25 @@ static int radix64_read(armor_filter_context_t *afx, IOBUF a, size_t *retn,
   int checkcrc = 0;
   int rc = 0;
   size_t n = 0;
-  int idx, i, onlypad = 0;
+  int idx, onlypad = 0;
   u32 crc;
 
   crc = afx->crc;
   idx = afx->idx;
   val = afx->radbuf[0];
   for (n = 0; n < size;) {
+    if (!idx && afx->buffer_pos < afx->buffer_len) {
+      /* Decode the run of complete groups in one go.  Anything else
+         is left to the code below.  */
+      size_t len = std::min((size_t)(afx->buffer_len - afx->buffer_pos),
+                            (size - n) / 3 * 4);
+      len = NeoPG::radix64_decode((char *)afx->buffer + afx->buffer_pos, len,
+                                  buf + n);
+      afx->buffer_pos += len;
+      n += len / 4 * 3;
+      if (n == size) break;
+    }
+
     if (afx->buffer_pos < afx->buffer_len)
       c = afx->buffer[afx->buffer_pos++];
     else { /* read the next line */
@@ -759,9 +754,7 @@ static int radix64_read(armor_filter_context_t *afx, IOBUF a, size_t *retn,
     idx = (idx + 1) % 4;
   }
 
-  for (i = 0; i < n; i++)
-    crc = (crc << 8) ^ crc_table[((crc >> 16) & 0xff) ^ buf[i]];
-  crc &= 0x00ffffff;
+  crc = NeoPG::crc24_update(crc, buf, n);
   afx->crc = crc;
   afx->idx = idx;
   afx->radbuf[0] = val;
@@ -1010,12 +1003,28 @@ static int armor_filter(void *opaque, int control, IOBUF a, byte *buf,
     idx2 = afx->idx2;
     for (i = 0; i < idx; i++) radbuf[i] = afx->radbuf[i];
 
-    for (i = 0; i < size; i++)
-      crc = (crc << 8) ^ crc_table[((crc >> 16) & 0xff) ^ buf[i]];
-    crc &= 0x00ffffff;
+    crc = NeoPG::crc24_update(crc, buf, size);
+
+    while (size) {
+      if (!idx && !idx2 && size >= 48) {
+        /* Encode whole lines at once.  */
+        char lines[ENCODE_LINES * (64 + sizeof(afx->eol))];
+        size_t eol_len = strlen((const char *)afx->eol);
+        char *p = lines;
+
+        for (i = 0; i < ENCODE_LINES && size >= 48; i++) {
+          p += NeoPG::radix64_encode(buf, 48, p);
+          memcpy(p, afx->eol, eol_len);
+          p += eol_len;
+          buf += 48;
+          size -= 48;
+        }
+        if ((rc = iobuf_write(a, lines, p - lines))) return rc;
+        continue;
+      }
 
-    for (; size; buf++, size--) {
-      radbuf[idx++] = *buf;
+      radbuf[idx++] = *buf++;
+      size--;
       if (idx > 2) {
         idx = 0;
         c = bintoasc[(*radbuf >> 2) & 077];
@@ -88,6 +88,15 @@ struct import_key_parm_s {
   size_t keylen;
 };
 
+struct pkbatch_parm_s {
+  struct default_inq_parm_s *dflt;
+  unsigned char *request;
+  size_t requestlen;
+  agent_pkbatch_item_t items;
+  size_t nitems;
+  membuf_t pending;
+};
+
 struct cache_nonce_parm_s {
   char **cache_nonce_addr;
   char **passwd_nonce_addr;
@@ -1434,6 +1443,47 @@ static gpg_error_t padding_info_cb(void *opaque, const char *line) {
   return 0;
 }
 
+/* Extract the plaintext from the Nul terminated result BUF of length
+   LEN (including the Nul) of a PKDECRYPT command.  BUF is taken over
+   and either released or returned at R_BUF with the length of the
+   plaintext stored at R_BUFLEN.  */
+static gpg_error_t extract_pkdecrypt_value(char *buf, size_t len,
+                                           unsigned char **r_buf,
+                                           size_t *r_buflen) {
+  size_t n;
+  char *p, *endp;
+
+  if (*buf != '(') {
+    xfree(buf);
+    return GPG_ERR_INV_SEXP;
+  }
+
+  if (len < 13 || memcmp(buf, "(5:value", 8)) /* "(5:valueN:D)\0" */
+  {
+    xfree(buf);
+    return GPG_ERR_INV_SEXP;
+  }
+  len -= 10;   /* Count only the data of the second part. */
+  p = buf + 8; /* Skip leading parenthesis and the value tag. */
+
+  n = strtoul(p, &endp, 10);
+  if (!n || *endp != ':') {
+    xfree(buf);
+    return GPG_ERR_INV_SEXP;
+  }
+  endp++;
+  if (endp - p + n > len) {
+    xfree(buf);
+    return GPG_ERR_INV_SEXP; /* Oops: Inconsistent S-Exp. */
+  }
+
+  memmove(buf, endp, n);
+
+  *r_buflen = n;
+  *r_buf = (unsigned char *)buf;
+  return 0;
+}
+
 /* Call the agent to do a decrypt operation using the key identified
    by the hex string KEYGRIP and the input data S_CIPHERTEXT.  On the
    success the decoded value is stored verbatim at R_BUF and its
@@ -1448,8 +1498,8 @@ gpg_error_t agent_pkdecrypt(ctrl_t ctrl, const char *keygrip, const char *desc,
   gpg_error_t err;
   char line[ASSUAN_LINELENGTH];
   membuf_t data;
-  size_t n, len;
-  char *p, *buf, *endp;
+  size_t len;
+  char *buf;
   struct default_inq_parm_s dfltparm;
 
   memset(&dfltparm, 0, sizeof dfltparm);
@@ -1504,35 +1554,200 @@ gpg_error_t agent_pkdecrypt(ctrl_t ctrl, const char *keygrip, const char *desc,
   if (!buf) return gpg_error_from_syserror();
   log_assert(len); /* (we forced Nul termination.)  */
 
-  if (*buf != '(') {
-    xfree(buf);
-    return GPG_ERR_INV_SEXP;
+  return extract_pkdecrypt_value(buf, len, r_buf, r_buflen);
+}
+
+/* Handle the PKBATCH inquiry.  */
+static gpg_error_t inq_pkbatch_cb(void *opaque, const char *line) {
+  struct pkbatch_parm_s *parm = (pkbatch_parm_s *)opaque;
+  gpg_error_t rc;
+
+  if (has_leading_keyword(line, "PKBATCH")) {
+    assuan_begin_confidential(parm->dflt->ctx);
+    rc = assuan_send_data(parm->dflt->ctx, parm->request, parm->requestlen);
+    assuan_end_confidential(parm->dflt->ctx);
+  } else
+    rc = default_inq_cb(parm->dflt, line);
+
+  return rc;
+}
+
+/* Store the PKBATCH result record REC at the matching item.  */
+static gpg_error_t store_pkbatch_result(struct pkbatch_parm_s *parm,
+                                        gcry_sexp_t rec) {
+  struct agent_pkbatch_item_s *item;
+  unsigned long idx;
+  const char *s;
+  char *tmp;
+  size_t n;
+
+  s = gcry_sexp_nth_data(rec, 0, &n);
+  if (!s || n != 6 || memcmp(s, "result", 6)) return GPG_ERR_INV_RESPONSE;
+
+  tmp = gcry_sexp_nth_string(rec, 1);
+  if (!tmp) return GPG_ERR_INV_RESPONSE;
+  idx = strtoul(tmp, NULL, 10);
+  xfree(tmp);
+  if (idx >= parm->nitems) return GPG_ERR_INV_RESPONSE;
+  item = parm->items + idx;
+
+  tmp = gcry_sexp_nth_string(rec, 2);
+  if (!tmp) return GPG_ERR_INV_RESPONSE;
+  item->err = (gpg_error_t)strtoul(tmp, NULL, 10);
+  xfree(tmp);
+
+  tmp = gcry_sexp_nth_string(rec, 3);
+  if (!tmp) return GPG_ERR_INV_RESPONSE;
+  item->padding = atoi(tmp);
+  xfree(tmp);
+
+  if (item->err) return 0;
+
+  s = gcry_sexp_nth_data(rec, 4, &n);
+  if (!s || !n) {
+    item->err = GPG_ERR_INV_RESPONSE;
+    return 0;
   }
 
-  if (len < 13 || memcmp(buf, "(5:value", 8)) /* "(5:valueN:D)\0" */
-  {
-    xfree(buf);
-    return GPG_ERR_INV_SEXP;
+  if (!item->s_ciphertext)
+    item->err = gcry_sexp_sscan(&item->sigval, NULL, s, n);
+  else {
+    char *buf;
+
+    buf = (char *)xtrymalloc_secure(n + 1);
+    if (!buf) return gpg_error_from_syserror();
+    memcpy(buf, s, n);
+    buf[n] = 0;
+    item->err = extract_pkdecrypt_value(buf, n + 1, &item->plain,
+                                        &item->plainlen);
   }
-  len -= 10;   /* Count only the data of the second part. */
-  p = buf + 8; /* Skip leading parenthesis and the value tag. */
+  return 0;
+}
 
-  n = strtoul(p, &endp, 10);
-  if (!n || *endp != ':') {
-    xfree(buf);
-    return GPG_ERR_INV_SEXP;
+/* Collect the streamed PKBATCH result records.  A record may be split
+   across several data lines, thus we buffer until we have a complete
+   canonical S-expression.  */
+static gpg_error_t pkbatch_data_cb(void *opaque, const void *buffer,
+                                   size_t length) {
+  struct pkbatch_parm_s *parm = (pkbatch_parm_s *)opaque;
+  const unsigned char *p;
+  gpg_error_t err;
+  gcry_sexp_t rec;
+  size_t len, n;
+
+  put_membuf(&parm->pending, buffer, length);
+
+  for (;;) {
+    p = (const unsigned char *)peek_membuf(&parm->pending, &len);
+    if (!p) return gpg_error_from_syserror();
+    if (!len) break;
+
+    n = gcry_sexp_canon_len(p, len, NULL, &err);
+    if (!n) {
+      /* An incomplete record; wait for more data.  */
+      if (err == GPG_ERR_SEXP_STRING_TOO_LONG) break;
+      return err;
+    }
+    err = gcry_sexp_sscan(&rec, NULL, (const char *)p, n);
+    if (!err) {
+      err = store_pkbatch_result(parm, rec);
+      gcry_sexp_release(rec);
+    }
+    clear_membuf(&parm->pending, n);
+    if (err) return err;
   }
-  endp++;
-  if (endp - p + n > len) {
-    xfree(buf);
-    return GPG_ERR_INV_SEXP; /* Oops: Inconsistent S-Exp. */
+
+  return 0;
+}
+
+/* Call the agent to do the NITEMS sign or decrypt operations described
+   by ITEMS with a single PKBATCH command.  DESC and CACHE_NONCE are
+   used for all items as with agent_pksign.  The per-item result is
+   stored in the output fields of ITEMS; the return value only
+   indicates a failure of the batch as a whole.  Items without a result
+   from the agent have their error set to GPG_ERR_NO_DATA.  */
+gpg_error_t agent_pkbatch(ctrl_t ctrl, const char *cache_nonce,
+                          const char *desc, agent_pkbatch_item_t items,
+                          size_t nitems) {
+  gpg_error_t err;
+  char line[ASSUAN_LINELENGTH];
+  struct default_inq_parm_s dfltparm;
+  struct pkbatch_parm_s parm;
+  membuf_t request;
+  size_t i;
+
+  memset(&dfltparm, 0, sizeof dfltparm);
+  dfltparm.ctrl = ctrl;
+
+  for (i = 0; i < nitems; i++) {
+    items[i].err = GPG_ERR_NO_DATA;
+    items[i].sigval = NULL;
+    items[i].plain = NULL;
+    items[i].plainlen = 0;
+    items[i].padding = -1;
   }
+  if (!nitems) return 0;
 
-  memmove(buf, endp, n);
+  err = start_agent(ctrl, 0);
+  if (err) return err;
+  dfltparm.ctx = agent_ctx;
 
-  *r_buflen = n;
-  *r_buf = (unsigned char *)buf;
-  return 0;
+  err = assuan_transact(agent_ctx, "RESET", NULL, NULL, NULL, NULL, NULL, NULL);
+  if (err) return err;
+
+  if (desc) {
+    snprintf(line, DIM(line), "SETKEYDESC %s", desc);
+    err = assuan_transact(agent_ctx, line, NULL, NULL, NULL, NULL, NULL, NULL);
+    if (err) return err;
+  }
+
+  init_membuf_secure(&request, 4096);
+  for (i = 0; i < nitems; i++) {
+    if (!items[i].keygrip || strlen(items[i].keygrip) != 40) {
+      err = GPG_ERR_INV_VALUE;
+      break;
+    }
+    if (items[i].s_ciphertext) {
+      unsigned char *ciphertext;
+      size_t ciphertextlen;
+
+      err = make_canon_sexp(items[i].s_ciphertext, &ciphertext, &ciphertextlen);
+      if (err) break;
+      put_membuf_printf(&request, "(7:decrypt40:%s%u:", items[i].keygrip,
+                        (unsigned int)ciphertextlen);
+      put_membuf(&request, ciphertext, ciphertextlen);
+      xfree(ciphertext);
+    } else {
+      char algostr[35];
+
+      snprintf(algostr, sizeof algostr, "%d", items[i].digestalgo);
+      put_membuf_printf(&request, "(4:sign40:%s%u:%s%u:", items[i].keygrip,
+                        (unsigned int)strlen(algostr), algostr,
+                        (unsigned int)items[i].digestlen);
+      put_membuf(&request, items[i].digest, items[i].digestlen);
+    }
+    put_membuf_str(&request, ")");
+  }
+  if (err) {
+    xfree(get_membuf(&request, NULL));
+    return err;
+  }
+
+  parm.dflt = &dfltparm;
+  parm.items = items;
+  parm.nitems = nitems;
+  parm.request = (unsigned char *)get_membuf(&request, &parm.requestlen);
+  if (!parm.request) return gpg_error_from_syserror();
+  init_membuf_secure(&parm.pending, 1024);
+
+  snprintf(line, sizeof line, "PKBATCH%s%s", cache_nonce ? " -- " : "",
+           cache_nonce ? cache_nonce : "");
+  err = assuan_transact(agent_ctx, line, pkbatch_data_cb, &parm,
+                        inq_pkbatch_cb, &parm, NULL, NULL);
+
+  xfree(parm.request);
+  xfree(get_membuf(&parm.pending, NULL));
+  return err;
 }
 
 /* Handle the inquiry for an IMPORT_KEY command.  */
@@ -71,6 +71,22 @@ struct agent_card_info_s {
   unsigned int status_indicator;
 };
 
+/* A single sign or decrypt request for agent_pkbatch.  */
+struct agent_pkbatch_item_s {
+  const char *keygrip;         /* Hex encoded keygrip of the key.  */
+  int digestalgo;              /* The hash algorithm for signing.  */
+  const unsigned char *digest; /* The hash value to sign.  */
+  size_t digestlen;
+  gcry_sexp_t s_ciphertext; /* If set, decrypt this instead of signing.  */
+
+  gpg_error_t err;      /* The result of this request.  */
+  gcry_sexp_t sigval;   /* The signature; to be released by the caller.  */
+  unsigned char *plain; /* The decrypted value; malloced.  */
+  size_t plainlen;
+  int padding; /* The padding info for decryption or -1.  */
+};
+typedef struct agent_pkbatch_item_s *agent_pkbatch_item_t;
+
 /* Release the card info structure. */
 void agent_release_card_info(struct agent_card_info_s *info);
 
@@ -169,6 +185,11 @@ gpg_error_t agent_pkdecrypt(ctrl_t ctrl, const char *keygrip, const char *desc,
                             gcry_sexp_t s_ciphertext, unsigned char **r_buf,
                             size_t *r_buflen, int *r_padding);
 
+/* Sign or decrypt a list of values with one request.  */
+gpg_error_t agent_pkbatch(ctrl_t ctrl, const char *cache_nonce,
+                          const char *desc, agent_pkbatch_item_t items,
+                          size_t nitems);
+
 /* Retrieve a key encryption key.  */
 gpg_error_t agent_keywrap_key(ctrl_t ctrl, int forexport, void **r_kek,
                               size_t *r_keklen);
@@ -0,0 +1,101 @@
+/* Tests for the agent calls
+   Copyright 2018 The NeoPG developers
+
+   NeoPG is released under the Simplified BSD License (see license.txt)
+*/
+
+#include <config.h>
+
+#include "gtest/gtest.h"
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "../common/util.h"
+#include "call-agent.h"
+#include "gpg.h"
+
+#include "legacy_environment.h"
+
+using namespace NeoPG;
+
+TEST(NeopgLegacyTest, g10_agent_pkbatch_test) {
+  const size_t nitems = 9;
+  TemporaryDirectory homedir;
+  gcry_sexp_t s_pubkey = NULL;
+  unsigned char grip[20];
+  char hexgrip[41];
+
+  gnupg_set_homedir(homedir.path().c_str());
+  ASSERT_EQ(agent_genkey(NULL, NULL, NULL, "(genkey(rsa(nbits 4:1024)))", 1,
+                         NULL, &s_pubkey),
+            0);
+  ASSERT_NE(gcry_pk_get_keygrip(s_pubkey, grip), nullptr);
+  bin2hex(grip, 20, hexgrip);
+
+  /* Alternate sign and decrypt requests, each with its own input, so
+     that a result at the wrong index does not verify.  */
+  std::vector<std::string> inputs(nitems);
+  std::vector<agent_pkbatch_item_s> items(nitems);
+  for (size_t i = 0; i < nitems; i++) {
+    agent_pkbatch_item_s &item = items[i];
+
+    memset(&item, 0, sizeof item);
+    item.keygrip = hexgrip;
+    if (i % 2) {
+      gcry_mpi_t value;
+
+      /* A raw RSA value below the modulus.  */
+      inputs[i] = std::string(64, (char)i);
+      inputs[i][0] = 1;
+      ASSERT_EQ(gcry_mpi_scan(&value, GCRYMPI_FMT_USG, inputs[i].data(),
+                              inputs[i].size(), NULL),
+                0);
+      gcry_sexp_t s_data;
+      ASSERT_EQ(gcry_sexp_build(&s_data, NULL, "(data(flags raw)(value %m))",
+                                value),
+                0);
+      ASSERT_EQ(gcry_pk_encrypt(&item.s_ciphertext, s_data, s_pubkey), 0);
+      gcry_sexp_release(s_data);
+      gcry_mpi_release(value);
+    } else {
+      inputs[i].resize(32);
+      gcry_md_hash_buffer(GCRY_MD_SHA256, &inputs[i][0],
+                          ("message " + std::to_string(i)).c_str(),
+                          8 + std::to_string(i).size());
+      item.digestalgo = GCRY_MD_SHA256;
+      item.digest = (const unsigned char *)inputs[i].data();
+      item.digestlen = inputs[i].size();
+    }
+  }
+
+  ASSERT_EQ(agent_pkbatch(NULL, NULL, NULL, items.data(), nitems), 0);
+
+  for (size_t i = 0; i < nitems; i++) {
+    agent_pkbatch_item_s &item = items[i];
+
+    ASSERT_EQ(item.err, 0) << "item " << i;
+    if (i % 2) {
+      ASSERT_EQ(item.sigval, nullptr);
+      ASSERT_EQ(std::string((const char *)item.plain, item.plainlen),
+                inputs[i]);
+      xfree(item.plain);
+      gcry_sexp_release(item.s_ciphertext);
+    } else {
+      gcry_sexp_t s_hash;
+
+      ASSERT_NE(item.sigval, nullptr);
+      ASSERT_EQ(gcry_sexp_build(&s_hash, NULL,
+                                "(data(flags pkcs1)(hash sha256 %b))",
+                                (int)item.digestlen, item.digest),
+                0);
+      ASSERT_EQ(gcry_pk_verify(item.sigval, s_hash, s_pubkey), 0);
+      gcry_sexp_release(s_hash);
+      gcry_sexp_release(item.sigval);
+    }
+  }
+
+  gcry_sexp_release(s_pubkey);
+}
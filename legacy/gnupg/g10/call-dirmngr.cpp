@@ -43,6 +43,7 @@
 struct ks_status_parm_s {
   const char *keyword; /* Look for this keyword or NULL for "SOURCE". */
   char *source;
+  struct ks_get_parm_s *getparm; /* Link to the KS_GET parameter.  */
 };
 
 /* Parameter structure used with the KS_SEARCH command.  */
@@ -59,6 +60,9 @@ struct ks_search_parm_s {
 /* Parameter structure used with the KS_GET command.  */
 struct ks_get_parm_s {
   estream_t memfp;
+  int collect_parts; /* Start a new stream at each PART status.  */
+  estream_t *parts;  /* The completed parts.  */
+  size_t nparts;     /* The number of streams in PARTS.  */
 };
 
 /* Parameter structure used with the KS_PUT command.  */
@@ -247,6 +251,27 @@ static void clear_context_flags(ctrl_t ctrl, assuan_context_t ctx) {
   log_fatal("clear_context_flags on unknown dirmngr ctx %p\n", ctx);
 }
 
+/* Keep the data received so far for a KS_GET command as a completed
+   part and start over with an empty buffer.  */
+static gpg_error_t ks_get_end_part(struct ks_get_parm_s *parm) {
+  estream_t *parts;
+  estream_t memfp;
+
+  memfp = es_fopenmem(0, "rwb");
+  if (!memfp) return gpg_error_from_syserror();
+  parts = (estream_t *)xtryrealloc(parm->parts,
+                                   (parm->nparts + 1) * sizeof *parts);
+  if (!parts) {
+    gpg_error_t err = gpg_error_from_syserror();
+    es_fclose(memfp);
+    return err;
+  }
+  parts[parm->nparts++] = parm->memfp;
+  parm->parts = parts;
+  parm->memfp = memfp;
+  return 0;
+}
+
 /* Status callback for ks_list, ks_get and ks_search.  */
 static gpg_error_t ks_status_cb(void *opaque, const char *line) {
   struct ks_status_parm_s *parm = (ks_status_parm_s *)opaque;
@@ -261,6 +286,9 @@ static gpg_error_t ks_status_cb(void *opaque, const char *line) {
       parm->source = xtrystrdup(s);
       if (!parm->source) err = gpg_error_from_syserror();
     }
+  } else if (parm->getparm && parm->getparm->collect_parts &&
+             has_leading_keyword(line, "PART")) {
+    err = ks_get_end_part(parm->getparm);
   } else if ((s = has_leading_keyword(line, "WARNING"))) {
     if ((s2 = has_leading_keyword(s, "tor_not_running")))
       warn = _("Tor is not running");
@@ -464,13 +492,23 @@ static gpg_error_t ks_get_data_cb(void *opaque, const void *data,
    If R_SOURCE is not NULL the source of the data is stored as a
    malloced string there.  If a source is not known NULL is stored.
 
+   If PART_CB is not NULL, the data is split where the dirmngr signals
+   that it has sent the complete response for one pattern.  PART_CB
+   is called with a stream for each of these parts in turn, after the
+   command has finished and the context has been released, so that it
+   may use the dirmngr again.  The stream returned at R_FP then only
+   contains the data after the last part.  An error returned by
+   PART_CB is returned.
+
    If there are too many patterns the function returns an error.  That
    could be fixed by issuing several search commands or by
    implementing a different interface.  However with long keyids we
    are able to ask for (1000-10-1)/(2+8+1) = 90 keys at once.  */
 gpg_error_t gpg_dirmngr_ks_get(ctrl_t ctrl, char **pattern,
                                keyserver_spec_t override_keyserver, int quick,
-                               estream_t *r_fp, char **r_source) {
+                               gpg_error_t (*part_cb)(void *, estream_t),
+                               void *part_cb_value, estream_t *r_fp,
+                               char **r_source) {
   gpg_error_t err;
   assuan_context_t ctx;
   struct ks_status_parm_s stparm;
@@ -479,6 +517,7 @@ gpg_error_t gpg_dirmngr_ks_get(ctrl_t ctrl, char **pattern,
   size_t linelen;
   membuf_t mb;
   int idx;
+  size_t n;
 
   memset(&stparm, 0, sizeof stparm);
   memset(&parm, 0, sizeof parm);
@@ -530,6 +569,8 @@ gpg_error_t gpg_dirmngr_ks_get(ctrl_t ctrl, char **pattern,
     err = gpg_error_from_syserror();
     goto leave;
   }
+  parm.collect_parts = !!part_cb;
+  stparm.getparm = &parm;
   err = assuan_transact(ctx, line, ks_get_data_cb, &parm, NULL, NULL,
                         ks_status_cb, &stparm);
   if (err) goto leave;
@@ -548,6 +589,23 @@ leave:
   xfree(stparm.source);
   xfree(line);
   close_context(ctrl, ctx);
+
+  for (n = 0; n < parm.nparts; n++) {
+    if (!err) {
+      es_rewind(parm.parts[n]);
+      err = part_cb(part_cb_value, parm.parts[n]);
+    }
+    es_fclose(parm.parts[n]);
+  }
+  xfree(parm.parts);
+  if (err && *r_fp) {
+    es_fclose(*r_fp);
+    *r_fp = NULL;
+    if (r_source) {
+      xfree(*r_source);
+      *r_source = NULL;
+    }
+  }
   return err;
 }
 
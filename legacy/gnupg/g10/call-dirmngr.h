@@ -29,7 +29,9 @@ gpg_error_t gpg_dirmngr_ks_search(ctrl_t ctrl, const char *searchstr,
                                   void *cb_value);
 gpg_error_t gpg_dirmngr_ks_get(ctrl_t ctrl, char *pattern[],
                                keyserver_spec_t override_keyserver, int quick,
-                               estream_t *r_fp, char **r_source);
+                               gpg_error_t (*part_cb)(void *, estream_t),
+                               void *part_cb_value, estream_t *r_fp,
+                               char **r_source);
 gpg_error_t gpg_dirmngr_ks_fetch(ctrl_t ctrl, const char *url, estream_t *r_fp);
 gpg_error_t gpg_dirmngr_ks_put(ctrl_t ctrl, void *data, size_t datalen,
                                kbnode_t keyblock);
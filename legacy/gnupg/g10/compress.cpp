@@ -31,10 +31,17 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <condition_variable>
+#include <deque>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include <botan/compression.h>
+#include <botan/hash.h>
 
 #include "../common/util.h"
 #include "filter.h"
@@ -47,6 +54,188 @@ const std::map<int, std::string> algo_to_spec{{COMPRESS_ALGO_ZIP, "deflate"},
                                               {COMPRESS_ALGO_ZLIB, "zlib"},
                                               {COMPRESS_ALGO_BZIP2, "bz2"}};
 
+/* The amount of compressed data read at once by the decompressor.  */
+#define DECOMPRESS_READ_SIZE (16 * 1024)
+
+/* The state of the decompressor.  OUTPUT holds the result of the last
+   update and is handed out from POS on, so that returning a part of it
+   does not move the rest.  The buffer is reused for the next read.  */
+typedef struct {
+  std::unique_ptr<Botan::Decompression_Algorithm> decompressor;
+  Botan::secure_vector<uint8_t> output;
+  size_t pos{0};
+} decompress_state_t;
+
+/* The state of the sequential compressor, with a buffer reused for
+   every flush.  */
+typedef struct {
+  std::unique_ptr<Botan::Compression_Algorithm> compressor;
+  Botan::secure_vector<uint8_t> buffer;
+} compress_state_t;
+
+/* The amount of input compressed as one unit in parallel mode.  */
+#define PARALLEL_COMPRESS_BLOCK (128 * 1024)
+
+/* Parallel compression for ZIP and ZLIB.  The input is cut into
+   blocks which are compressed on a pool of worker threads, each into
+   a fresh raw deflate stream that is ended with a sync flush
+   (Z_SYNC_FLUSH, which is what Botan uses for a flush) instead of a
+   final block.  Such a run of non-final deflate blocks ends on a byte
+   boundary, and as every block starts a new stream it does not refer
+   to earlier data, so the runs can be concatenated in order and
+   terminated with an empty final block to form a single valid deflate
+   stream.  For ZLIB, the RFC 1950 header and the Adler-32 checksum of
+   the input are added around it.  */
+class parallel_compressor {
+ public:
+  parallel_compressor(int algo, int nthreads) {
+    if (algo == COMPRESS_ALGO_ZLIB)
+      m_adler = Botan::HashFunction::create_or_throw("Adler32");
+    m_input.reserve(PARALLEL_COMPRESS_BLOCK);
+    for (int i = 0; i < nthreads; i++)
+      m_workers.emplace_back(&parallel_compressor::worker, this);
+  }
+
+  ~parallel_compressor() {
+    {
+      std::lock_guard<std::mutex> lock(m_lock);
+      m_stop = true;
+    }
+    m_cond.notify_all();
+    for (auto &worker : m_workers) worker.join();
+  }
+
+  gpg_error_t write(iobuf_t a, const byte *buf, size_t len) {
+    gpg_error_t rc;
+
+    if ((rc = start(a))) return rc;
+    if (m_adler) m_adler->update(buf, len);
+    while (len) {
+      size_t n = std::min(len, PARALLEL_COMPRESS_BLOCK - m_input.size());
+      m_input.insert(m_input.end(), buf, buf + n);
+      buf += n;
+      len -= n;
+      if (m_input.size() == PARALLEL_COMPRESS_BLOCK && (rc = submit(a)))
+        return rc;
+    }
+    return 0;
+  }
+
+  gpg_error_t finish(iobuf_t a) {
+    /* An empty final block with fixed Huffman codes.  */
+    static const byte final_block[2] = {0x03, 0x00};
+    gpg_error_t rc;
+
+    if ((rc = start(a))) return rc;
+    if (!m_input.empty() && (rc = submit(a))) return rc;
+    if ((rc = drain(a, 0))) return rc;
+    if ((rc = iobuf_write(a, final_block, sizeof(final_block)))) return rc;
+    if (m_adler) {
+      auto checksum = m_adler->final();
+      rc = iobuf_write(a, checksum.data(), checksum.size());
+    }
+    return rc;
+  }
+
+ private:
+  struct block {
+    Botan::secure_vector<uint8_t> data;
+    bool done{false};
+  };
+
+  std::mutex m_lock;
+  std::condition_variable m_cond;
+  /* All blocks not yet written, in input order.  */
+  std::deque<std::shared_ptr<block>> m_pending;
+  /* The blocks waiting for a worker.  */
+  std::deque<block *> m_jobs;
+  std::vector<std::thread> m_workers;
+  bool m_stop{false};
+  bool m_failed{false};
+  bool m_started{false};
+  Botan::secure_vector<uint8_t> m_input;
+  std::unique_ptr<Botan::HashFunction> m_adler;
+
+  /* Write the ZLIB header.  */
+  gpg_error_t start(iobuf_t a) {
+    static const byte zlib_header[2] = {0x78, 0x9c};
+
+    if (m_started) return 0;
+    m_started = true;
+    if (!m_adler) return 0;
+    return iobuf_write(a, zlib_header, sizeof(zlib_header));
+  }
+
+  /* Queue the collected input for compression and write out what is
+     done, waiting if too many blocks are in flight.  */
+  gpg_error_t submit(iobuf_t a) {
+    auto item = std::make_shared<block>();
+
+    item->data.swap(m_input);
+    m_input.reserve(PARALLEL_COMPRESS_BLOCK);
+    {
+      std::lock_guard<std::mutex> lock(m_lock);
+      m_pending.push_back(item);
+      m_jobs.push_back(item.get());
+    }
+    m_cond.notify_all();
+    return drain(a, 2 * m_workers.size());
+  }
+
+  /* Write the finished blocks at the head of the queue, until at most
+     LIMIT blocks are pending.  */
+  gpg_error_t drain(iobuf_t a, size_t limit) {
+    for (;;) {
+      std::shared_ptr<block> head;
+      {
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_cond.wait(lock, [&] {
+          return m_failed || m_pending.size() <= limit ||
+                 m_pending.front()->done;
+        });
+        if (m_failed) {
+          log_error("parallel compression failed\n");
+          return GPG_ERR_GENERAL;
+        }
+        if (m_pending.empty() || !m_pending.front()->done) return 0;
+        head = m_pending.front();
+        m_pending.pop_front();
+      }
+      gpg_error_t rc = iobuf_write(a, head->data.data(), head->data.size());
+      if (rc) return rc;
+    }
+  }
+
+  void worker() {
+    std::unique_ptr<Botan::Compression_Algorithm> compressor(
+        Botan::make_compressor("deflate"));
+
+    for (;;) {
+      block *job;
+      bool ok = true;
+      {
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_cond.wait(lock, [&] { return m_stop || !m_jobs.empty(); });
+        if (m_stop) return;
+        job = m_jobs.front();
+        m_jobs.pop_front();
+      }
+      try {
+        compressor->start(0);  // compression level: default
+        compressor->update(job->data, 0, true);
+      } catch (const std::exception &) {
+        ok = false;
+      }
+      {
+        std::lock_guard<std::mutex> lock(m_lock);
+        job->done = true;
+        if (!ok) m_failed = true;
+      }
+      m_cond.notify_all();
+    }
+  }
+};
+
 int compress_filter(void *opaque, int control, IOBUF a, byte *buf,
                     size_t *ret_len) {
   size_t size = *ret_len;
@@ -57,37 +246,32 @@ int compress_filter(void *opaque, int control, IOBUF a, byte *buf,
     if (!zfx->status) {
       /* We just found out we are used as a decompressor.  */
       std::string algo = algo_to_spec.at(zfx->algo);
-      auto decompressor = Botan::make_decompressor(algo);
-      auto input = new Botan::secure_vector<uint8_t>;
-      zfx->opaque =
-          new std::pair<Botan::Decompression_Algorithm *,
-                        Botan::secure_vector<uint8_t> *>(decompressor, input);
-      decompressor->start();
+      auto state = new decompress_state_t;
+      state->decompressor.reset(Botan::make_decompressor(algo));
+      state->decompressor->start();
+      zfx->opaque = state;
       zfx->status = 1;
     }
-    auto *opaque_ = (std::pair<Botan::Decompression_Algorithm *,
-                               Botan::secure_vector<uint8_t> *> *)zfx->opaque;
-    auto decompressor = opaque_->first;
-    auto input = opaque_->second;
-    while (input->empty() && decompressor) {
-      input->resize(2048);
-      int nread = iobuf_read(a, input->data(), input->size());
+    auto state = (decompress_state_t *)zfx->opaque;
+    auto &output = state->output;
+    while (state->pos == output.size() && state->decompressor) {
+      output.resize(DECOMPRESS_READ_SIZE);
+      state->pos = 0;
+      int nread = iobuf_read(a, output.data(), output.size());
       if (nread <= 0) {
-        input->clear();
-        decompressor->finish(*input);
-        delete decompressor;
-        decompressor = nullptr;
-        opaque_->first = nullptr;
+        output.clear();
+        state->decompressor->finish(output);
+        state->decompressor.reset();
       } else {
-        input->resize(nread);
-        decompressor->update(*input);
+        output.resize(nread);
+        state->decompressor->update(output);
       }
     }
-    if (!input->empty()) {
-      size_t amount = std::min(input->size(), size);
-      memcpy(buf, input->data(), amount);
+    if (state->pos < output.size()) {
+      size_t amount = std::min(output.size() - state->pos, size);
+      memcpy(buf, output.data() + state->pos, amount);
+      state->pos += amount;
       *ret_len = amount;
-      input->erase(input->begin(), input->begin() + amount);
     } else {
       *ret_len = 0;
       rc = -1;
@@ -105,50 +289,67 @@ int compress_filter(void *opaque, int control, IOBUF a, byte *buf,
       pkt.pkt.compressed = &cd;
       if (build_packet(a, &pkt))
         log_bug("build_packet(PKT_COMPRESSED) failed\n");
-      std::string algo = algo_to_spec.at(zfx->algo);
-      zfx->opaque = Botan::make_compressor(algo);
-      auto compression = (Botan::Compression_Algorithm *)zfx->opaque;
-      compression->start(0);  // compression level: default
-      zfx->status = 2;
+      if (opt.compress_threads > 1 && zfx->algo != COMPRESS_ALGO_BZIP2) {
+        /* Concatenated bzip2 streams are not portable, so only ZIP
+           and ZLIB are compressed in parallel.  */
+        zfx->opaque =
+            new parallel_compressor(zfx->algo, opt.compress_threads);
+        zfx->status = 3;
+      } else {
+        std::string algo = algo_to_spec.at(zfx->algo);
+        auto state = new compress_state_t;
+        state->compressor.reset(Botan::make_compressor(algo));
+        state->compressor->start(0);  // compression level: default
+        zfx->opaque = state;
+        zfx->status = 2;
+      }
     }
 
-    Botan::secure_vector<uint8_t> input(size);
-    memcpy(input.data(), buf, size);
-    auto compression = (Botan::Compression_Algorithm *)zfx->opaque;
-    compression->update(input, 0, false);
+    if (zfx->status == 3)
+      return ((parallel_compressor *)zfx->opaque)->write(a, buf, size);
+
+    auto state = (compress_state_t *)zfx->opaque;
+    auto &input = state->buffer;
+    input.assign(buf, buf + size);
+    state->compressor->update(input, 0, false);
     if ((rc = iobuf_write(a, input.data(), input.size()))) {
       log_debug("bzCompress: iobuf_write failed\n");
       return rc;
     }
   } else if (control == IOBUFCTRL_FREE) {
     if (zfx->status == 1) {
-      auto opaque_ = (std::pair<Botan::Decompression_Algorithm *,
-                                Botan::secure_vector<uint8_t> *> *)zfx->opaque;
-      auto decompressor = opaque_->first;
-      auto input = opaque_->second;
-      if (decompressor) delete decompressor;
-      delete input;
-      delete opaque_;
+      delete (decompress_state_t *)zfx->opaque;
       zfx->opaque = NULL;
     } else if (zfx->status == 2) {
-      Botan::secure_vector<uint8_t> input;
-      auto compression = (Botan::Compression_Algorithm *)zfx->opaque;
+      auto state = (compress_state_t *)zfx->opaque;
+      auto &input = state->buffer;
 
-      compression->update(input, 0, true);
+      input.clear();
+      state->compressor->update(input, 0, true);
       if ((rc = iobuf_write(a, input.data(), input.size()))) {
         log_debug("bzCompress: iobuf_write failed\n");
         return rc;
       }
 
       input.clear();
-      compression->finish(input, 0);
+      state->compressor->finish(input, 0);
       if ((rc = iobuf_write(a, input.data(), input.size()))) {
         log_debug("bzCompress: iobuf_write failed\n");
         return rc;
       }
 
-      delete compression;
+      delete state;
+      zfx->opaque = NULL;
+    } else if (zfx->status == 3) {
+      auto compressor = (parallel_compressor *)zfx->opaque;
+
+      rc = compressor->finish(a);
+      delete compressor;
       zfx->opaque = NULL;
+      if (rc) {
+        log_debug("compress: iobuf_write failed\n");
+        return rc;
+      }
     }
     if (zfx->release) zfx->release(zfx);
   } else if (control == IOBUFCTRL_DESC)
@@ -0,0 +1,152 @@
+/* Tests for the compress filter
+   Copyright 2018 The NeoPG developers
+
+   NeoPG is released under the Simplified BSD License (see license.txt)
+*/
+
+#include <config.h>
+
+#include "gtest/gtest.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+
+#include <botan/compression.h>
+
+#include "../common/util.h"
+#include "filter.h"
+#include "gpg.h"
+#include "main.h"
+#include "options.h"
+#include "packet.h"
+
+#include "legacy_environment.h"
+
+using namespace NeoPG;
+
+namespace {
+
+/* The block size of the parallel compressor.  */
+const size_t BLOCK = 128 * 1024;
+
+/* Return LEN bytes of input, partly compressible and partly not.  */
+std::string make_input(size_t len) {
+  std::string data;
+  uint32_t x = 1;
+
+  while (data.size() < len) {
+    data += "line " + std::to_string(data.size()) + "\n";
+    for (int i = 0; i < 16; i++) {
+      x = x * 1103515245 + 12345;
+      data += (char)(x >> 24);
+    }
+  }
+  data.resize(len);
+  return data;
+}
+
+uint32_t adler32(const std::string &data) {
+  uint32_t a = 1, b = 0;
+
+  for (unsigned char c : data) {
+    a = (a + c) % 65521;
+    b = (b + a) % 65521;
+  }
+  return (b << 16) | a;
+}
+
+/* Compress DATA with ALGO into the file FNAME and return the
+   compressed stream without the packet header in R_STREAM.  The data
+   is written in pieces which do not line up with the blocks.  */
+void compress_packet(const std::string &fname, int algo,
+                     const std::string &data, std::string &r_stream) {
+  compress_filter_context_t zfx;
+  iobuf_t out;
+
+  memset(&zfx, 0, sizeof zfx);
+  out = iobuf_create(fname.c_str(), 0);
+  ASSERT_NE(out, nullptr);
+  push_compress_filter(out, &zfx, algo);
+  for (size_t pos = 0; pos < data.size(); pos += 10007)
+    ASSERT_EQ(iobuf_write(out, data.data() + pos,
+                          std::min<size_t>(10007, data.size() - pos)),
+              0);
+  ASSERT_EQ(iobuf_close(out), 0);
+
+  std::ifstream file(fname, std::ios::binary);
+  std::string packet((std::istreambuf_iterator<char>(file)),
+                     std::istreambuf_iterator<char>());
+
+  /* An old format header with an indeterminate length and the
+     algorithm.  */
+  ASSERT_GE(packet.size(), 2u);
+  ASSERT_EQ((unsigned char)packet[0], 0x80 | (PKT_COMPRESSED << 2) | 3);
+  ASSERT_EQ(packet[1], algo);
+  r_stream = packet.substr(2);
+}
+
+std::string decompress(const std::string &spec, const std::string &stream) {
+  std::unique_ptr<Botan::Decompression_Algorithm> decompressor(
+      Botan::make_decompressor(spec));
+  Botan::secure_vector<uint8_t> buf(stream.begin(), stream.end());
+
+  decompressor->start();
+  decompressor->finish(buf);
+  return std::string(buf.begin(), buf.end());
+}
+
+/* Restore the options changed by a test.  */
+class SavedOptions {
+ public:
+  SavedOptions() : m_compress_threads(opt.compress_threads) {}
+  ~SavedOptions() { opt.compress_threads = m_compress_threads; }
+
+ private:
+  int m_compress_threads;
+};
+
+}  // namespace
+
+TEST(NeopgLegacyTest, g10_compress_parallel_test) {
+  TemporaryDirectory dir;
+  SavedOptions saved;
+  /* No input, exactly one block and several blocks with a short last
+     one.  */
+  const size_t sizes[] = {0, BLOCK, 5 * BLOCK + 777};
+
+  opt.compress_threads = 4;
+  for (size_t size : sizes) {
+    std::string data = make_input(size);
+    std::string fname = dir.path() + "/" + std::to_string(size);
+    std::string stream;
+
+    /* ZLIB has the RFC 1950 header, the deflate stream ending with an
+       empty final block and the Adler-32 checksum in network byte
+       order.  */
+    ASSERT_NO_FATAL_FAILURE(
+        compress_packet(fname + ".zlib", COMPRESS_ALGO_ZLIB, data, stream));
+    ASSERT_GE(stream.size(), 2 + 2 + 4u) << "size " << size;
+    ASSERT_EQ(stream.substr(0, 2), "\x78\x9c") << "size " << size;
+    ASSERT_EQ(stream.substr(stream.size() - 6, 2), std::string("\x03\x00", 2))
+        << "size " << size;
+    uint32_t checksum = adler32(data);
+    const char expected[4] = {(char)(checksum >> 24), (char)(checksum >> 16),
+                              (char)(checksum >> 8), (char)checksum};
+    ASSERT_EQ(stream.substr(stream.size() - 4), std::string(expected, 4))
+        << "size " << size;
+    ASSERT_EQ(decompress("zlib", stream), data) << "size " << size;
+
+    /* ZIP is the raw deflate stream.  */
+    ASSERT_NO_FATAL_FAILURE(
+        compress_packet(fname + ".zip", COMPRESS_ALGO_ZIP, data, stream));
+    ASSERT_GE(stream.size(), 2u) << "size " << size;
+    ASSERT_EQ(stream.substr(stream.size() - 2), std::string("\x03\x00", 2))
+        << "size " << size;
+    ASSERT_EQ(decompress("deflate", stream), data) << "size " << size;
+  }
+}
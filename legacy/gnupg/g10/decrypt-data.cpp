@@ -281,12 +281,48 @@ leave:
   return rc;
 }
 
+/* Read data from STREAM into BUFFER at OFFSET until NBYTES bytes are
+   in BUFFER or, for a fixed length packet, the packet ends.  The data
+   is read in blocks and not byte by byte.  Sets the EOF_SEEN flag of
+   DFX and returns the number of bytes in BUFFER.  */
+static size_t fill_buffer(decode_filter_ctx_t dfx, IOBUF stream, byte *buffer,
+                          size_t nbytes, size_t offset) {
+  size_t nread = offset;
+  size_t curr;
+  int ret;
+
+  if (dfx->partial) {
+    while (nread < nbytes) {
+      curr = nbytes - nread;
+      ret = iobuf_read(stream, buffer + nread, curr);
+      if (ret == -1) {
+        dfx->eof_seen = 1; /* Normal EOF. */
+        break;
+      }
+      nread += ret;
+    }
+  } else {
+    while (nread < nbytes && dfx->length) {
+      curr = nbytes - nread;
+      if (curr > dfx->length) curr = dfx->length;
+      ret = iobuf_read(stream, buffer + nread, curr);
+      if (ret == -1) {
+        dfx->eof_seen = 3; /* Premature EOF. */
+        break;
+      }
+      nread += ret;
+      dfx->length -= ret;
+    }
+    if (!dfx->length) dfx->eof_seen = 1; /* Normal EOF.  */
+  }
+  return nread;
+}
+
 static int mdc_decode_filter(void *opaque, int control, IOBUF a, byte *buf,
                              size_t *ret_len) {
   decode_filter_ctx_t dfx = (decode_filter_ctx_t)opaque;
   size_t n, size = *ret_len;
   int rc = 0;
-  int c;
 
   /* Note: We need to distinguish between a partial and a fixed length
      packet.  The first is the usual case as created by GPG.  However
@@ -304,18 +340,7 @@ static int mdc_decode_filter(void *opaque, int control, IOBUF a, byte *buf,
     log_assert(size > 44); /* Our code requires at least this size.  */
 
     /* Get at least 22 bytes and put it ahead in the buffer.  */
-    if (dfx->partial) {
-      for (n = 22; n < 44; n++) {
-        if ((c = iobuf_get(a)) == -1) break;
-        buf[n] = c;
-      }
-    } else {
-      for (n = 22; n < 44 && dfx->length; n++, dfx->length--) {
-        c = iobuf_get(a);
-        if (c == -1) break; /* Premature EOF.  */
-        buf[n] = c;
-      }
-    }
+    n = fill_buffer(dfx, a, buf, 44, 22);
     if (n == 44) {
       /* We have enough stuff - flush the deferred stuff.  */
       if (!dfx->defer_filled) /* First time. */
@@ -326,25 +351,7 @@ static int mdc_decode_filter(void *opaque, int control, IOBUF a, byte *buf,
         memcpy(buf, dfx->defer, 22);
       }
       /* Fill up the buffer. */
-      if (dfx->partial) {
-        for (; n < size; n++) {
-          if ((c = iobuf_get(a)) == -1) {
-            dfx->eof_seen = 1; /* Normal EOF. */
-            break;
-          }
-          buf[n] = c;
-        }
-      } else {
-        for (; n < size && dfx->length; n++, dfx->length--) {
-          c = iobuf_get(a);
-          if (c == -1) {
-            dfx->eof_seen = 3; /* Premature EOF. */
-            break;
-          }
-          buf[n] = c;
-        }
-        if (!dfx->length) dfx->eof_seen = 1; /* Normal EOF.  */
-      }
+      n = fill_buffer(dfx, a, buf, size, n);
 
       /* Move the trailing 22 bytes back to the defer buffer.  We
          have at least 44 bytes thus a memmove is not needed.  */
@@ -386,7 +393,7 @@ static int decode_filter(void *opaque, int control, IOBUF a, byte *buf,
   decode_filter_ctx_t fc = (decode_filter_ctx_t)opaque;
   size_t size = *ret_len;
   size_t n;
-  int c, rc = 0;
+  int rc = 0;
 
   if (control == IOBUFCTRL_UNDERFLOW && fc->eof_seen) {
     *ret_len = 0;
@@ -394,26 +401,7 @@ static int decode_filter(void *opaque, int control, IOBUF a, byte *buf,
   } else if (control == IOBUFCTRL_UNDERFLOW) {
     log_assert(a);
 
-    if (fc->partial) {
-      for (n = 0; n < size; n++) {
-        c = iobuf_get(a);
-        if (c == -1) {
-          fc->eof_seen = 1; /* Normal EOF. */
-          break;
-        }
-        buf[n] = c;
-      }
-    } else {
-      for (n = 0; n < size && fc->length; n++, fc->length--) {
-        c = iobuf_get(a);
-        if (c == -1) {
-          fc->eof_seen = 3; /* Premature EOF. */
-          break;
-        }
-        buf[n] = c;
-      }
-      if (!fc->length) fc->eof_seen = 1; /* Normal EOF.  */
-    }
+    n = fill_buffer(fc, a, buf, size, 0);
     if (n) {
       if (fc->cipher_hd) gcry_cipher_decrypt(fc->cipher_hd, buf, n, NULL, 0);
     } else {
@@ -198,6 +198,10 @@ static int encrypt_simple(const char *filename, int mode, int use_seskey) {
     afx = new_armor_context();
     push_armor_filter(afx, out);
   }
+  if (opt.flags.pipelined_encryption && (rc = iobuf_push_thread_filter(out))) {
+    log_error("iobuf_push_thread_filter failed: %s\n", gpg_strerror(rc));
+    goto leave;
+  }
 
   if (s2k) {
     PKT_symkey_enc *enc =
@@ -258,6 +262,10 @@ static int encrypt_simple(const char *filename, int mode, int use_seskey) {
 
   /* Register the cipher filter. */
   if (mode) iobuf_push_filter(out, cipher_filter, &cfx);
+  if (opt.flags.pipelined_encryption && (rc = iobuf_push_thread_filter(out))) {
+    log_error("iobuf_push_thread_filter failed: %s\n", gpg_strerror(rc));
+    goto leave;
+  }
 
   /* Register the compress filter. */
   if (do_compress) {
@@ -269,14 +277,15 @@ static int encrypt_simple(const char *filename, int mode, int use_seskey) {
   if ((rc = build_packet(out, &pkt)))
     log_error("build_packet failed: %s\n", gpg_strerror(rc));
 
-  /* Finish the stuff.  */
+/* Finish the stuff.  */
+leave:
   iobuf_close(inp);
   if (rc)
     iobuf_cancel(out);
-  else {
-    iobuf_close(out); /* fixme: check returncode */
-    if (mode) write_status(STATUS_END_ENCRYPTION);
-  }
+  else if ((rc = iobuf_close(out)))
+    log_error("error writing the output: %s\n", gpg_strerror(rc));
+  else if (mode)
+    write_status(STATUS_END_ENCRYPTION);
   if (pt) pt->buf = NULL;
   free_packet(&pkt, NULL);
   xfree(cfx.dek);
@@ -434,6 +443,10 @@ int encrypt_crypt(
     afx = new_armor_context();
     push_armor_filter(afx, out);
   }
+  if (opt.flags.pipelined_encryption && (rc = iobuf_push_thread_filter(out))) {
+    log_error("iobuf_push_thread_filter failed: %s\n", gpg_strerror(rc));
+    goto leave;
+  }
 
   /* Create a session key. */
   cfx.dek = (DEK *)Botan::allocate_memory(1, sizeof(*cfx.dek));
@@ -568,6 +581,10 @@ int encrypt_crypt(
 
   /* Register the cipher filter. */
   iobuf_push_filter(out, cipher_filter, &cfx);
+  if (opt.flags.pipelined_encryption && (rc = iobuf_push_thread_filter(out))) {
+    log_error("iobuf_push_thread_filter failed: %s\n", gpg_strerror(rc));
+    goto leave;
+  }
 
   /* Register the compress filter. */
   if (do_compress) {
@@ -601,10 +618,10 @@ leave:
   iobuf_close(inp);
   if (rc)
     iobuf_cancel(out);
-  else {
-    iobuf_close(out); /* fixme: check returncode */
+  else if ((rc = iobuf_close(out)))
+    log_error("error writing the output: %s\n", gpg_strerror(rc));
+  else
     write_status(STATUS_END_ENCRYPTION);
-  }
   if (pt) pt->buf = NULL;
   free_packet(&pkt, NULL);
   Botan::deallocate_memory(cfx.dek, 1, sizeof(*cfx.dek));
@@ -0,0 +1,291 @@
+/* Tests for the encryption
+   Copyright 2018 The NeoPG developers
+
+   NeoPG is released under the Simplified BSD License (see license.txt)
+*/
+
+#include <config.h>
+
+#include "gtest/gtest.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gpg.h"
+#include "keydb.h"
+#include "main.h"
+#include "options.h"
+#include "packet.h"
+
+#include "legacy_environment.h"
+
+using namespace NeoPG;
+
+namespace {
+
+std::string read_file(const std::string &fname) {
+  std::ifstream file(fname, std::ios::binary);
+  return std::string((std::istreambuf_iterator<char>(file)),
+                     std::istreambuf_iterator<char>());
+}
+
+/* Write an input file which spans many I/O buffers.  */
+std::string write_input(const TemporaryDirectory &dir) {
+  std::string fname = dir.path() + "/input.txt";
+  std::ofstream file(fname, std::ios::binary);
+
+  for (int i = 0; i < 100000; i++) file << "line " << i * 7919 << "\n";
+  return fname;
+}
+
+/* Split DATA into OpenPGP packets of tag and body.  The parts of a
+   body with partial lengths are joined.  */
+std::vector<std::pair<int, std::string>> parse_packets(
+    const std::string &data) {
+  std::vector<std::pair<int, std::string>> packets;
+  size_t pos = 0;
+  auto octet = [&]() -> size_t { return (unsigned char)data.at(pos++); };
+  auto take = [&](size_t len) {
+    if (len > data.size() - pos) throw std::runtime_error("truncated packet");
+    pos += len;
+    return data.substr(pos - len, len);
+  };
+
+  while (pos < data.size()) {
+    size_t ctb = octet();
+    std::string body;
+    int tag;
+
+    if (!(ctb & 0x80)) throw std::runtime_error("invalid packet");
+    if (ctb & 0x40) {
+      size_t c, len;
+
+      tag = ctb & 0x3f;
+      do {
+        c = octet();
+        if (c < 192)
+          len = c;
+        else if (c < 224)
+          len = ((c - 192) << 8) + octet() + 192;
+        else if (c == 255) {
+          len = octet() << 24;
+          len |= octet() << 16;
+          len |= octet() << 8;
+          len |= octet();
+        } else
+          len = (size_t)1 << (c & 0x1f);
+        body += take(len);
+      } while (c >= 224 && c < 255);
+    } else {
+      size_t len = 0;
+
+      tag = (ctb >> 2) & 0x0f;
+      if ((ctb & 3) == 3)
+        len = data.size() - pos;
+      else
+        for (int n = 1 << (ctb & 3); n; n--) len = (len << 8) | octet();
+      body = take(len);
+    }
+    packets.emplace_back(tag, body);
+  }
+  return packets;
+}
+
+/* Decrypt the session key in the PKESK packet body PKESK with
+   S_SECKEY and use it to decrypt the SEIPD packet body SEIPD.  The
+   contents without the random prefix and the MDC packet are returned
+   in R_PLAIN.  */
+void decrypt_packets(const std::string &pkesk, const std::string &seipd,
+                     gcry_sexp_t s_seckey, std::string &r_plain) {
+  gcry_mpi_t value;
+  gcry_sexp_t s_ciph, s_plain, s_value;
+  gcry_cipher_hd_t hd;
+  size_t nbits, n;
+
+  /* Version, key ID, algorithm and one MPI.  */
+  ASSERT_GT(pkesk.size(), 12u);
+  ASSERT_EQ((unsigned char)pkesk[0], 3);
+  ASSERT_EQ((unsigned char)pkesk[9], PUBKEY_ALGO_RSA);
+  nbits = ((unsigned char)pkesk[10] << 8) | (unsigned char)pkesk[11];
+  ASSERT_EQ(pkesk.size(), 12 + (nbits + 7) / 8);
+  ASSERT_EQ(gcry_mpi_scan(&value, GCRYMPI_FMT_USG, pkesk.data() + 12,
+                          pkesk.size() - 12, NULL),
+            0);
+  ASSERT_EQ(gcry_sexp_build(&s_ciph, NULL, "(enc-val(flags pkcs1)(rsa(a%m)))",
+                            value),
+            0);
+  gcry_mpi_release(value);
+  ASSERT_EQ(gcry_pk_decrypt(&s_plain, s_ciph, s_seckey), 0);
+  gcry_sexp_release(s_ciph);
+  s_value = gcry_sexp_find_token(s_plain, "value", 0);
+  ASSERT_NE(s_value, nullptr);
+  std::string seskey((const char *)gcry_sexp_nth_data(s_value, 1, &n), n);
+  gcry_sexp_release(s_value);
+  gcry_sexp_release(s_plain);
+
+  /* The algorithm, the key and a checksum.  */
+  ASSERT_EQ(seskey.size(), 1 + 32 + 2u);
+  ASSERT_EQ((unsigned char)seskey[0], CIPHER_ALGO_AES256);
+
+  /* The SEIPD packet has a version octet, a random prefix whose last
+     two octets are repeated, the data and an MDC packet.  */
+  ASSERT_GT(seipd.size(), 1 + 18 + 22u);
+  ASSERT_EQ((unsigned char)seipd[0], 1);
+  std::string plain = seipd.substr(1);
+  ASSERT_EQ(gcry_cipher_open(&hd, GCRY_CIPHER_AES256, GCRY_CIPHER_MODE_CFB, 0),
+            0);
+  ASSERT_EQ(gcry_cipher_setkey(hd, seskey.data() + 1, 32), 0);
+  ASSERT_EQ(gcry_cipher_decrypt(hd, &plain[0], plain.size(), NULL, 0), 0);
+  gcry_cipher_close(hd);
+  ASSERT_EQ(plain.substr(14, 2), plain.substr(16, 2));
+  ASSERT_EQ(plain.substr(plain.size() - 22, 2), "\xd3\x14");
+  r_plain = plain.substr(18, plain.size() - 18 - 22);
+}
+
+/* Generate a 1024 bit RSA key.  The public key is returned in R_PK
+   and the secret key in R_SECKEY.  */
+void generate_key(PKT_public_key *&r_pk, gcry_sexp_t &r_seckey) {
+  gcry_sexp_t s_parms, s_key, s_pubkey;
+
+  ASSERT_EQ(gcry_sexp_build(&s_parms, NULL, "(genkey(rsa(nbits 4:1024)))"),
+            0);
+  ASSERT_EQ(gcry_pk_genkey(&s_key, s_parms), 0);
+  gcry_sexp_release(s_parms);
+  s_pubkey = gcry_sexp_find_token(s_key, "public-key", 0);
+  r_seckey = gcry_sexp_find_token(s_key, "private-key", 0);
+  gcry_sexp_release(s_key);
+  ASSERT_NE(s_pubkey, nullptr);
+  ASSERT_NE(r_seckey, nullptr);
+
+  r_pk = (PKT_public_key *)xmalloc_clear(sizeof *r_pk);
+  r_pk->version = 4;
+  r_pk->timestamp = 1514764800;
+  r_pk->pubkey_algo = PUBKEY_ALGO_RSA;
+  ASSERT_EQ(gcry_sexp_extract_param(s_pubkey, NULL, "ne", &r_pk->pkey[0],
+                                    &r_pk->pkey[1], NULL),
+            0);
+  gcry_sexp_release(s_pubkey);
+}
+
+/* Restore the options changed by a test.  */
+class SavedOptions {
+ public:
+  SavedOptions()
+      : m_compress_algo(opt.compress_algo),
+        m_def_cipher_algo(opt.def_cipher_algo),
+        m_expert(opt.expert),
+        m_pipelined(opt.flags.pipelined_encryption) {}
+
+  ~SavedOptions() {
+    opt.compress_algo = m_compress_algo;
+    opt.def_cipher_algo = m_def_cipher_algo;
+    opt.expert = m_expert;
+    opt.flags.pipelined_encryption = m_pipelined;
+    opt.outfile = tao::nullopt;
+  }
+
+ private:
+  int m_compress_algo;
+  int m_def_cipher_algo;
+  bool m_expert;
+  bool m_pipelined;
+};
+
+}  // namespace
+
+TEST(NeopgLegacyTest, g10_encrypt_store_pipelined_test) {
+  TemporaryDirectory dir;
+  SavedOptions saved;
+  std::string input = write_input(dir);
+  std::string output[2];
+
+  opt.compress_algo = COMPRESS_ALGO_ZLIB;
+  for (int pipelined = 0; pipelined < 2; pipelined++) {
+    output[pipelined] = dir.path() + "/output" + std::to_string(pipelined);
+    opt.flags.pipelined_encryption = pipelined;
+    opt.outfile.emplace(output[pipelined]);
+    ASSERT_EQ(encrypt_store(input.c_str()), 0);
+  }
+
+  /* Without a session key, the output is the same.  */
+  ASSERT_GT(read_file(output[0]).size(), 0u);
+  ASSERT_EQ(read_file(output[0]), read_file(output[1]));
+}
+
+TEST(NeopgLegacyTest, g10_encrypt_pipelined_test) {
+  TemporaryDirectory dir;
+  SavedOptions saved;
+  std::string input = write_input(dir);
+  PKT_public_key *pk = NULL;
+  gcry_sexp_t s_seckey = NULL;
+  std::string plain[2];
+
+  ASSERT_NO_FATAL_FAILURE(generate_key(pk, s_seckey));
+  struct pk_list recipient = {NULL, pk, 0};
+
+  opt.compress_algo = COMPRESS_ALGO_ZLIB;
+  opt.def_cipher_algo = CIPHER_ALGO_AES256;
+  opt.expert = true;
+  for (int pipelined = 0; pipelined < 2; pipelined++) {
+    std::string output = dir.path() + "/output" + std::to_string(pipelined);
+    int fd = open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+
+    ASSERT_GE(fd, 0);
+    opt.flags.pipelined_encryption = pipelined;
+    ASSERT_EQ(encrypt_crypt(NULL, -1, input.c_str(), {}, 0, &recipient, fd),
+              0);
+    close(fd);
+
+    auto packets = parse_packets(read_file(output));
+    ASSERT_EQ(packets.size(), 2u);
+    ASSERT_EQ(packets[0].first, PKT_PUBKEY_ENC);
+    ASSERT_EQ(packets[1].first, PKT_ENCRYPTED_MDC);
+    const std::string &pkesk = packets[0].second;
+    const std::string &seipd = packets[1].second;
+    ASSERT_NO_FATAL_FAILURE(
+        decrypt_packets(pkesk, seipd, s_seckey, plain[pipelined]));
+  }
+
+  /* Apart from the session key, the output is the same.  */
+  ASSERT_GT(plain[0].size(), 0u);
+  ASSERT_EQ(plain[0], plain[1]);
+
+  free_public_key(pk);
+  gcry_sexp_release(s_seckey);
+}
+
+TEST(NeopgLegacyTest, g10_encrypt_write_error_test) {
+  TemporaryDirectory dir;
+  SavedOptions saved;
+  std::string input = dir.path() + "/input.txt";
+  PKT_public_key *pk = NULL;
+  gcry_sexp_t s_seckey = NULL;
+
+  ASSERT_NO_FATAL_FAILURE(generate_key(pk, s_seckey));
+  struct pk_list recipient = {NULL, pk, 0};
+
+  /* The output fits into the buffers, thus the write error only
+     happens when the output is closed.  */
+  std::ofstream(input, std::ios::binary) << "hello\n";
+  opt.def_cipher_algo = CIPHER_ALGO_AES256;
+  opt.expert = true;
+  for (int pipelined = 0; pipelined < 2; pipelined++) {
+    int fd = open("/dev/full", O_WRONLY);
+
+    ASSERT_GE(fd, 0);
+    opt.flags.pipelined_encryption = pipelined;
+    ASSERT_NE(encrypt_crypt(NULL, -1, input.c_str(), {}, 0, &recipient, fd),
+              0);
+    close(fd);
+  }
+
+  free_public_key(pk);
+  gcry_sexp_release(s_seckey);
+}
@@ -101,6 +101,9 @@ typedef struct {
   unsigned buffer_len;  /* used length of the buffer */
   unsigned buffer_pos;  /* read position */
   int truncated;        /* number of truncated lines */
+  unsigned line_len;    /* length of the current line so far */
+  int flush_eol;        /* a CR,LF is still to be written */
+  int skip_line;        /* skipping the rest of a truncated line */
   int escape_from;
   gcry_md_hd_t md;
   int pending_lf;
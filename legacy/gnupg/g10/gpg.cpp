@@ -311,6 +311,9 @@ enum cmd_and_opt_values {
   oKeyidFormat,
   oExitOnStatusWriteError,
   oLimitCardInsertTries,
+  oIOBufSize,
+  oPipelinedEncryption,
+  oCompressThreads,
   oRequireCrossCert,
   oNoRequireCrossCert,
   oAutoKeyLocate,
@@ -649,6 +652,9 @@ const static ARGPARSE_OPTS opts[] = {
     ARGPARSE_s_s(oKeyidFormat, "keyid-format", "@"),
     ARGPARSE_s_n(oExitOnStatusWriteError, "exit-on-status-write-error", "@"),
     ARGPARSE_s_i(oLimitCardInsertTries, "limit-card-insert-tries", "@"),
+    ARGPARSE_s_u(oIOBufSize, "iobuf-size", "@"),
+    ARGPARSE_s_n(oPipelinedEncryption, "pipelined-encryption", "@"),
+    ARGPARSE_s_i(oCompressThreads, "compress-threads", "@"),
 
     ARGPARSE_s_n(oEnableLargeRSA, "enable-large-rsa", "@"),
     ARGPARSE_s_n(oDisableLargeRSA, "disable-large-rsa", "@"),
@@ -2456,6 +2462,20 @@ next_pass:
         opt.limit_card_insert_tries = pargs.r.ret_int;
         break;
 
+      case oIOBufSize:
+        /* The size of the I/O buffers in kilobytes.  */
+        iobuf_set_buffer_size(pargs.r.ret_ulong);
+        break;
+
+      case oPipelinedEncryption:
+        opt.flags.pipelined_encryption = true;
+        break;
+
+      case oCompressThreads:
+        /* The number of threads for ZIP and ZLIB compression.  */
+        opt.compress_threads = std::min(std::max(pargs.r.ret_int, 0), 64);
+        break;
+
       case oRequireCrossCert:
         opt.flags.require_cross_cert = true;
         break;
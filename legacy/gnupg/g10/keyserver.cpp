@@ -1059,6 +1059,51 @@ leave:
   return err;
 }
 
+/* Structure to convey the arg to keyserver_import_part.  */
+struct ks_import_part_arg_s {
+  ctrl_t ctrl;
+  import_stats_t stats_handle;
+  unsigned char **r_fpr;
+  size_t *r_fprlen;
+  struct ks_retrieval_screener_arg_s screenerarg;
+};
+
+/* Import the keys received from the keyserver in FP.  This is called
+   for each part of the data after the KS_GET command has finished and
+   once more for the remaining data.  */
+static gpg_error_t keyserver_import_part(void *opaque, estream_t fp) {
+  struct ks_import_part_arg_s *arg = (ks_import_part_arg_s *)opaque;
+  unsigned char *fpr = NULL;
+  size_t fprlen = 0;
+
+  /* FIXME: Check whether this comment should be moved to dirmngr.
+
+     Slurp up all the key data.  In the future, it might be nice
+     to look for KEY foo OUTOFBAND and FAILED indicators.  It's
+     harmless to ignore them, but ignoring them does make gpg
+     complain about "no valid OpenPGP data found".  One way to do
+     this could be to continue parsing this line-by-line and make
+     a temp iobuf for each key.  Note that we don't allow the
+     import of secret keys from a keyserver.  Keyservers should
+     never accept or send them but we better protect against rogue
+     keyservers. */
+
+  import_keys_es_stream(
+      arg->ctrl, fp, arg->stats_handle, arg->r_fpr ? &fpr : NULL, &fprlen,
+      (opt.keyserver_options.import_options | IMPORT_NO_SECKEY),
+      keyserver_retrieval_screener, &arg->screenerarg);
+
+  /* Only the first key imported with STATS_HANDLE yields a
+     fingerprint.  Free a value stored earlier instead of overwriting
+     it.  */
+  if (fpr) {
+    xfree(*arg->r_fpr);
+    *arg->r_fpr = fpr;
+    *arg->r_fprlen = fprlen;
+  }
+  return 0;
+}
+
 /* Helper for keyserver_get.  Here we only receive a chunk of the
    description to be processed in one batch.  This is required due to
    the limited number of patterns the dirmngr interface (KS_GET) can
@@ -1072,6 +1117,7 @@ static gpg_error_t keyserver_get_chunk(
   gpg_error_t err = 0;
   char **pattern;
   int idx, npat;
+  struct ks_import_part_arg_s importarg;
   estream_t datastream;
   char *source = NULL;
   size_t linelen; /* Estimated linelen for KS_GET.  */
@@ -1186,33 +1232,25 @@ static gpg_error_t keyserver_get_chunk(
      this is different from NPAT.  */
   *r_ndesc_used = idx;
 
+  importarg.ctrl = ctrl;
+  importarg.stats_handle = stats_handle;
+  importarg.r_fpr = r_fpr;
+  importarg.r_fprlen = r_fprlen;
+  importarg.screenerarg.desc = desc;
+  importarg.screenerarg.ndesc = *r_ndesc_used;
+
   err = gpg_dirmngr_ks_get(ctrl, pattern, override_keyserver, quick,
-                           &datastream, &source);
+                           keyserver_import_part, &importarg, &datastream,
+                           &source);
   for (idx = 0; idx < npat; idx++) xfree(pattern[idx]);
   xfree(pattern);
   if (opt.verbose && source) log_info("data source: %s\n", source);
 
-  if (!err) {
-    struct ks_retrieval_screener_arg_s screenerarg;
-
-    /* FIXME: Check whether this comment should be moved to dirmngr.
-
-       Slurp up all the key data.  In the future, it might be nice
-       to look for KEY foo OUTOFBAND and FAILED indicators.  It's
-       harmless to ignore them, but ignoring them does make gpg
-       complain about "no valid OpenPGP data found".  One way to do
-       this could be to continue parsing this line-by-line and make
-       a temp iobuf for each key.  Note that we don't allow the
-       import of secret keys from a keyserver.  Keyservers should
-       never accept or send them but we better protect against rogue
-       keyservers. */
-
-    screenerarg.desc = desc;
-    screenerarg.ndesc = *r_ndesc_used;
-    import_keys_es_stream(
-        ctrl, datastream, stats_handle, r_fpr, r_fprlen,
-        (opt.keyserver_options.import_options | IMPORT_NO_SECKEY),
-        keyserver_retrieval_screener, &screenerarg);
+  /* Import the data which has not already been imported part by
+     part.  */
+  if (!err && es_getc(datastream) != EOF) {
+    es_rewind(datastream);
+    keyserver_import_part(&importarg, datastream);
   }
   es_fclose(datastream);
   xfree(source);
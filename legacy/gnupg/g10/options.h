@@ -196,6 +196,7 @@ struct options {
   int def_digest_algo{0};
   int cert_digest_algo{0};
   int compress_algo{-1}; /* defaults to DEFAULT_COMPRESS_ALGO */
+  int compress_threads{0}; /* > 1 to compress ZIP and ZLIB in parallel */
   std::vector<std::pair<std::string, unsigned int>> def_secret_key;
   tao::optional<std::string> def_recipient;
   int def_recipient_self{0};
@@ -310,6 +311,8 @@ struct options {
     bool disable_signer_uid{false};
     /* Flag to enbale experimental features from RFC4880bis.  */
     bool rfc4880bis{false};
+    /* Compress, encrypt and write on separate threads.  */
+    bool pipelined_encryption{false};
   } flags;
 
   /* Linked list of ways to find a key if the key isn't on the local
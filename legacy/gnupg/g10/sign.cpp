@@ -210,13 +210,12 @@ static void hash_sigversion_to_magic(gcry_md_hd_t md,
   gcry_md_write(md, buf, 6);
 }
 
-/* Perform the sign operation.  If CACHE_NONCE is given the agent is
-   advised to use that cached passphrase for the key.  */
-static int do_sign(ctrl_t ctrl, PKT_public_key *pksk, PKT_signature *sig,
-                   gcry_md_hd_t md, int mdalgo, const char *cache_nonce) {
-  gpg_error_t err;
+/* Check that PKSK may be used to make the signature SIG over the
+   finalized hash MD with the hash algorithm MDALGO and prepare SIG
+   for the signature values.  The digest to sign is stored at R_DP.  */
+static gpg_error_t prepare_sign(PKT_public_key *pksk, PKT_signature *sig,
+                                gcry_md_hd_t md, int mdalgo, byte **r_dp) {
   byte *dp;
-  char *hexgrip;
 
   if (pksk->timestamp > sig->timestamp) {
     unsigned long d = pksk->timestamp - sig->timestamp;
@@ -231,16 +230,13 @@ static int do_sign(ctrl_t ctrl, PKT_public_key *pksk, PKT_signature *sig,
 
   print_pubkey_algo_note((pubkey_algo_t)(pksk->pubkey_algo));
 
-  if (!mdalgo) mdalgo = gcry_md_get_algo(md);
-
   /* Check compliance.  */
   if (!gnupg_digest_is_allowed(opt.compliance, 1, (digest_algo_t)(mdalgo))) {
     log_error(_("you may not use digest algorithm '%s'"
                 " while in %s mode\n"),
               gcry_md_algo_name(mdalgo),
               gnupg_compliance_option_string(opt.compliance));
-    err = GPG_ERR_DIGEST_ALGO;
-    goto leave;
+    return GPG_ERR_DIGEST_ALGO;
   }
 
   if (!gnupg_pk_is_allowed(opt.compliance, PK_USE_SIGNING, pksk->pubkey_algo,
@@ -248,8 +244,7 @@ static int do_sign(ctrl_t ctrl, PKT_public_key *pksk, PKT_signature *sig,
     log_error(_("key %s not suitable for signing while in %s mode\n"),
               keystr_from_pk(pksk),
               gnupg_compliance_option_string(opt.compliance));
-    err = GPG_ERR_PUBKEY_ALGO;
-    goto leave;
+    return GPG_ERR_PUBKEY_ALGO;
   }
 
   print_digest_algo_note((digest_algo_t)(mdalgo));
@@ -262,6 +257,54 @@ static int do_sign(ctrl_t ctrl, PKT_public_key *pksk, PKT_signature *sig,
   mpi_release(sig->data[1]);
   sig->data[1] = NULL;
 
+  *r_dp = dp;
+  return 0;
+}
+
+/* Store the signature values from the S-expression S_SIGVAL returned
+   by the agent for the key PKSK in SIG.  */
+static void put_sig_values(PKT_public_key *pksk, PKT_signature *sig,
+                           gcry_sexp_t s_sigval) {
+  if (pksk->pubkey_algo == GCRY_PK_RSA || pksk->pubkey_algo == GCRY_PK_RSA_S)
+    sig->data[0] = get_mpi_from_sexp(s_sigval, "s", GCRYMPI_FMT_USG);
+  else if (openpgp_oid_is_ed25519(pksk->pkey[0])) {
+    sig->data[0] = get_mpi_from_sexp(s_sigval, "r", GCRYMPI_FMT_OPAQUE);
+    sig->data[1] = get_mpi_from_sexp(s_sigval, "s", GCRYMPI_FMT_OPAQUE);
+  } else {
+    sig->data[0] = get_mpi_from_sexp(s_sigval, "r", GCRYMPI_FMT_USG);
+    sig->data[1] = get_mpi_from_sexp(s_sigval, "s", GCRYMPI_FMT_USG);
+  }
+}
+
+/* Report the result ERR of making the signature SIG with PKSK.  */
+static void sign_done(ctrl_t ctrl, PKT_public_key *pksk, PKT_signature *sig,
+                      gpg_error_t err) {
+  if (err)
+    log_error(_("signing failed: %s\n"), gpg_strerror(err));
+  else {
+    if (opt.verbose) {
+      char *ustr = get_user_id_string_native(ctrl, sig->keyid);
+      log_info(_("%s/%s signature from: \"%s\"\n"),
+               openpgp_pk_algo_name((pubkey_algo_t)(pksk->pubkey_algo)),
+               openpgp_md_algo_name(sig->digest_algo), ustr);
+      xfree(ustr);
+    }
+  }
+}
+
+/* Perform the sign operation.  If CACHE_NONCE is given the agent is
+   advised to use that cached passphrase for the key.  */
+static int do_sign(ctrl_t ctrl, PKT_public_key *pksk, PKT_signature *sig,
+                   gcry_md_hd_t md, int mdalgo, const char *cache_nonce) {
+  gpg_error_t err;
+  byte *dp;
+  char *hexgrip;
+
+  if (!mdalgo) mdalgo = gcry_md_get_algo(md);
+
+  err = prepare_sign(pksk, sig, md, mdalgo, &dp);
+  if (err) goto leave;
+
   err = hexkeygrip_from_pk(pksk, &hexgrip);
   if (!err) {
     char *desc;
@@ -273,38 +316,73 @@ static int do_sign(ctrl_t ctrl, PKT_public_key *pksk, PKT_signature *sig,
                        gcry_md_get_algo_dlen(mdalgo), mdalgo, &s_sigval);
     xfree(desc);
 
-    if (err)
-      ;
-    else if (pksk->pubkey_algo == GCRY_PK_RSA ||
-             pksk->pubkey_algo == GCRY_PK_RSA_S)
-      sig->data[0] = get_mpi_from_sexp(s_sigval, "s", GCRYMPI_FMT_USG);
-    else if (openpgp_oid_is_ed25519(pksk->pkey[0])) {
-      sig->data[0] = get_mpi_from_sexp(s_sigval, "r", GCRYMPI_FMT_OPAQUE);
-      sig->data[1] = get_mpi_from_sexp(s_sigval, "s", GCRYMPI_FMT_OPAQUE);
-    } else {
-      sig->data[0] = get_mpi_from_sexp(s_sigval, "r", GCRYMPI_FMT_USG);
-      sig->data[1] = get_mpi_from_sexp(s_sigval, "s", GCRYMPI_FMT_USG);
-    }
+    if (!err) put_sig_values(pksk, sig, s_sigval);
 
     gcry_sexp_release(s_sigval);
   }
   xfree(hexgrip);
 
 leave:
-  if (err)
-    log_error(_("signing failed: %s\n"), gpg_strerror(err));
-  else {
-    if (opt.verbose) {
-      char *ustr = get_user_id_string_native(ctrl, sig->keyid);
-      log_info(_("%s/%s signature from: \"%s\"\n"),
-               openpgp_pk_algo_name((pubkey_algo_t)(pksk->pubkey_algo)),
-               openpgp_md_algo_name(sig->digest_algo), ustr);
-      xfree(ustr);
-    }
-  }
+  sign_done(ctrl, pksk, sig, err);
   return err;
 }
 
+/* Make the NSIGS signatures SIGS with the keys PKS over the finalized
+   hashes MDS like do_sign, but with a single PKBATCH request to the
+   agent instead of one round-trip per signature.  The result of each
+   signature is stored at ERRS.  The batch shares a single key
+   description, so none is given and the agent uses its generic
+   prompt if it needs to ask for a passphrase.  */
+static void do_sign_batch(ctrl_t ctrl, PKT_public_key **pks,
+                          PKT_signature **sigs, gcry_md_hd_t *mds,
+                          size_t nsigs, const char *cache_nonce,
+                          gpg_error_t *errs) {
+  gpg_error_t err = 0;
+  agent_pkbatch_item_t items;
+  char **hexgrips;
+  size_t *idx;
+  size_t i, n;
+
+  items = (agent_pkbatch_item_t)xtrycalloc(nsigs, sizeof *items);
+  hexgrips = (char **)xtrycalloc(nsigs, sizeof *hexgrips);
+  idx = (size_t *)xtrycalloc(nsigs, sizeof *idx);
+  if (!items || !hexgrips || !idx) err = gpg_error_from_syserror();
+
+  for (i = 0, n = 0; i < nsigs; i++) {
+    byte *dp;
+
+    errs[i] = err;
+    if (!errs[i])
+      errs[i] =
+          prepare_sign(pks[i], sigs[i], mds[i], sigs[i]->digest_algo, &dp);
+    if (!errs[i]) errs[i] = hexkeygrip_from_pk(pks[i], &hexgrips[i]);
+    if (errs[i]) continue;
+
+    items[n].keygrip = hexgrips[i];
+    items[n].digestalgo = sigs[i]->digest_algo;
+    items[n].digest = dp;
+    items[n].digestlen = gcry_md_get_algo_dlen(sigs[i]->digest_algo);
+    idx[n++] = i;
+  }
+
+  if (n) err = agent_pkbatch(NULL /*ctrl*/, cache_nonce, NULL, items, n);
+
+  for (i = 0; i < n; i++) {
+    errs[idx[i]] = err ? err : items[i].err;
+    if (!errs[idx[i]])
+      put_sig_values(pks[idx[i]], sigs[idx[i]], items[i].sigval);
+    gcry_sexp_release(items[i].sigval);
+  }
+
+  for (i = 0; i < nsigs; i++) {
+    sign_done(ctrl, pks[i], sigs[i], errs[i]);
+    if (hexgrips) xfree(hexgrips[i]);
+  }
+  xfree(idx);
+  xfree(hexgrips);
+  xfree(items);
+}
+
 static int complete_sig(ctrl_t ctrl, PKT_signature *sig, PKT_public_key *pksk,
                         gcry_md_hd_t md, const char *cache_nonce) {
   int rc;
@@ -556,26 +634,47 @@ static int write_plaintext_packet(IOBUF out, IOBUF inp, const char *fname,
 
 /*
  * Write the signatures from the SK_LIST to OUT. HASH must be a non-finalized
- * hash which will not be changes here.
+ * hash which will not be changes here.  With several keys all
+ * signatures are made with a single request to the agent.
  */
 static int write_signature_packets(ctrl_t ctrl, SK_LIST sk_list, IOBUF out,
                                    gcry_md_hd_t hash, int sigclass,
                                    u32 timestamp, u32 duration,
                                    int status_letter, const char *cache_nonce) {
   SK_LIST sk_rover;
+  PKT_public_key **pks;
+  PKT_signature **sigs;
+  gcry_md_hd_t *mds;
+  gpg_error_t *errs;
+  size_t nsigs, i;
+  int rc = 0;
+
+  for (nsigs = 0, sk_rover = sk_list; sk_rover; sk_rover = sk_rover->next)
+    nsigs++;
+  if (!nsigs) return 0;
 
-  /* Loop over the certificates with secret keys. */
-  for (sk_rover = sk_list; sk_rover; sk_rover = sk_rover->next) {
+  pks = (PKT_public_key **)xtrycalloc(nsigs, sizeof *pks);
+  sigs = (PKT_signature **)xtrycalloc(nsigs, sizeof *sigs);
+  mds = (gcry_md_hd_t *)xtrycalloc(nsigs, sizeof *mds);
+  errs = (gpg_error_t *)xtrycalloc(nsigs, sizeof *errs);
+  if (!pks || !sigs || !mds || !errs) {
+    rc = gpg_error_from_syserror();
+    goto leave;
+  }
+
+  /* Build the signature packets and their hashes.  */
+  for (i = 0, sk_rover = sk_list; sk_rover; sk_rover = sk_rover->next, i++) {
     PKT_public_key *pk;
     PKT_signature *sig;
-    gcry_md_hd_t md;
-    int rc;
 
-    pk = sk_rover->pk;
+    pk = pks[i] = sk_rover->pk;
 
-    /* Build the signature packet.  */
     sig = (PKT_signature *)xtrycalloc(1, sizeof *sig);
-    if (!sig) return gpg_error_from_syserror();
+    if (!sig) {
+      rc = gpg_error_from_syserror();
+      goto leave;
+    }
+    sigs[i] = sig;
 
     if (duration || !opt.sig_policy_url.empty() || opt.sig_notations ||
         !opt.sig_keyserver_url.empty())
@@ -593,38 +692,66 @@ static int write_signature_packets(ctrl_t ctrl, SK_LIST sk_list, IOBUF out,
     if (duration) sig->expiredate = sig->timestamp + duration;
     sig->sig_class = sigclass;
 
-    if (gcry_md_copy(&md, hash)) BUG();
+    if (gcry_md_copy(&mds[i], hash)) BUG();
 
     if (sig->version >= 4) {
       build_sig_subpkt_from_sig(sig, pk);
       mk_notation_policy_etc(sig, NULL, pk);
     }
 
-    hash_sigversion_to_magic(md, sig);
-    gcry_md_final(md);
+    hash_sigversion_to_magic(mds[i], sig);
+    gcry_md_final(mds[i]);
+  }
 
-    rc = do_sign(ctrl, pk, sig, md, hash_for(pk), cache_nonce);
-    gcry_md_close(md);
-    if (!rc) {
-      /* Write the packet.  */
-      PACKET pkt;
-
-      init_packet(&pkt);
-      pkt.pkttype = PKT_SIGNATURE;
-      pkt.pkt.signature = sig;
-      rc = build_packet(out, &pkt);
-      if (!rc && is_status_enabled())
-        print_status_sig_created(pk, sig, status_letter);
-      free_packet(&pkt, NULL);
-      if (rc)
-        log_error("build signature packet failed: %s\n", gpg_strerror(rc));
-    } else
-      xfree(sig);
+  if (nsigs == 1)
+    errs[0] = do_sign(ctrl, pks[0], sigs[0], mds[0], sigs[0]->digest_algo,
+                      cache_nonce);
+  else
+    do_sign_batch(ctrl, pks, sigs, mds, nsigs, cache_nonce, errs);
+
+  /* Write the packets in the order of the keys.  */
+  for (i = 0; i < nsigs; i++) {
+    PACKET pkt;
+
+    rc = errs[i];
+    if (rc) break;
 
-    if (rc) return rc;
+    init_packet(&pkt);
+    pkt.pkttype = PKT_SIGNATURE;
+    pkt.pkt.signature = sigs[i];
+    sigs[i] = NULL;
+    rc = build_packet(out, &pkt);
+    if (!rc && is_status_enabled())
+      print_status_sig_created(pks[i], pkt.pkt.signature, status_letter);
+    free_packet(&pkt, NULL);
+    if (rc) {
+      log_error("build signature packet failed: %s\n", gpg_strerror(rc));
+      break;
+    }
   }
 
-  return 0;
+leave:
+  for (i = 0; i < nsigs; i++) {
+    if (mds) gcry_md_close(mds[i]);
+    if (sigs && sigs[i]) free_seckey_enc(sigs[i]);
+  }
+  xfree(errs);
+  xfree(mds);
+  xfree(sigs);
+  xfree(pks);
+  return rc;
+}
+
+/* Read INP up to its end, so that the filters on it can calculate the
+   digest.  The data is read in blocks of the iobuf buffer size, which
+   iobuf_read hands to the filters without copying it.  */
+static void hash_input(IOBUF inp) {
+  size_t size = iobuf_get_buffer_size();
+  byte *buffer = (byte *)xmalloc(size);
+
+  while (iobuf_read(inp, buffer, size) != -1)
+    ;
+  xfree(buffer);
 }
 
 /****************
@@ -885,16 +1012,14 @@ int sign_file(ctrl_t ctrl, const std::vector<std::string> &filenames,
           iobuf_push_filter(inp, text_filter, &tfx);
         }
         iobuf_push_filter(inp, md_filter, &mfx);
-        while (iobuf_get(inp) != -1)
-          ;
+        hash_input(inp);
         iobuf_close(inp);
         inp = NULL;
       }
       if (opt.verbose) log_printf("\n");
     } else {
       /* read, so that the filter can calculate the digest */
-      while (iobuf_get(inp) != -1)
-        ;
+      hash_input(inp);
     }
   } else {
     rc = write_plaintext_packet(
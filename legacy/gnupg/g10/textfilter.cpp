@@ -55,38 +55,103 @@ static unsigned len_without_trailing_chars(byte *line, unsigned len,
   return mark ? (mark - line) : len;
 }
 
+/* The input of the text filter is read in blocks of this size.  It
+   must be larger than MAX_LINELEN.  */
+#define TEXT_READ_SIZE (64 * 1024)
+
+/* Canonicalize the text in blocks.  The lines are found with memchr
+   instead of reading them one by one.  The result is the same as
+   reading them with iobuf_read_line and trim_trailing_chars: Trailing
+   CRs and, because of strchr, NULs are removed, an LF becomes CR,LF,
+   and lines longer than MAX_LINELEN - 2 characters are truncated.
+   CRs and NULs at the end of a block stay in the buffer until it
+   is known whether more text follows on the line.  */
 static int standard(text_filter_context_t *tfx, IOBUF a, byte *buf, size_t size,
                     size_t *ret_len) {
   int rc = 0;
   size_t len = 0;
-  unsigned maxlen;
+  int more = 0;
 
   log_assert(size > 10);
-  size -= 2; /* reserve 2 bytes to append CR,LF */
-  while (!rc && len < size) {
-    int lf_seen;
+  if (!tfx->buffer) {
+    tfx->buffer_size = TEXT_READ_SIZE;
+    tfx->buffer = (byte *)xmalloc(tfx->buffer_size);
+  }
 
-    while (len < size && tfx->buffer_pos < tfx->buffer_len)
-      buf[len++] = tfx->buffer[tfx->buffer_pos++];
-    if (len >= size) continue;
+  while (len < size) {
+    const byte *p, *nl;
+    size_t n, seg, keep;
+    int eol, truncate;
+
+    if (tfx->flush_eol) {
+      if (size - len < 2) break;
+      buf[len++] = '\r';
+      buf[len++] = '\n';
+      tfx->flush_eol = 0;
+      continue;
+    }
 
-    /* read the next line */
-    maxlen = MAX_LINELEN;
-    tfx->buffer_pos = 0;
-    tfx->buffer_len =
-        iobuf_read_line(a, &tfx->buffer, &tfx->buffer_size, &maxlen);
-    if (!maxlen) tfx->truncated++;
-    if (!tfx->buffer_len) {
-      if (!len) rc = -1; /* eof */
-      break;
+    if (more || tfx->buffer_pos == tfx->buffer_len) {
+      int nread;
+
+      /* Keep the characters which might be trailing.  */
+      n = tfx->buffer_len - tfx->buffer_pos;
+      log_assert(n < tfx->buffer_size);
+      memmove(tfx->buffer, tfx->buffer + tfx->buffer_pos, n);
+      tfx->buffer_pos = 0;
+      tfx->buffer_len = n;
+      more = 0;
+
+      nread = iobuf_read(a, tfx->buffer + n, tfx->buffer_size - n);
+      if (nread == -1) {
+        /* The last line is trimmed even without an LF.  */
+        tfx->buffer_len = 0;
+        if (!len) rc = -1; /* eof */
+        break;
+      }
+      tfx->buffer_len += nread;
+      continue;
     }
-    lf_seen = tfx->buffer[tfx->buffer_len - 1] == '\n';
 
-    tfx->buffer_len = trim_trailing_chars(tfx->buffer, tfx->buffer_len, "\r\n");
+    p = tfx->buffer + tfx->buffer_pos;
+    n = tfx->buffer_len - tfx->buffer_pos;
+    nl = (const byte *)memchr(p, '\n', n);
 
-    if (lf_seen) {
-      tfx->buffer[tfx->buffer_len++] = '\r';
-      tfx->buffer[tfx->buffer_len++] = '\n';
+    if (tfx->skip_line) {
+      tfx->buffer_pos += nl ? nl - p + 1 : n;
+      if (nl) tfx->skip_line = 0;
+      continue;
+    }
+
+    seg = nl ? nl - p : n;
+    eol = !!nl;
+    truncate = tfx->line_len + seg > MAX_LINELEN - 2;
+    if (truncate) seg = MAX_LINELEN - 2 - tfx->line_len;
+
+    for (keep = seg; keep && (p[keep - 1] == '\r' || !p[keep - 1]); keep--)
+      ;
+    if (keep > size - len) {
+      keep = size - len;
+      seg = keep;
+      eol = truncate = 0;
+    }
+    memcpy(buf + len, p, keep);
+    len += keep;
+    tfx->line_len += keep;
+    tfx->buffer_pos += keep;
+
+    if (truncate) {
+      tfx->truncated++;
+      tfx->skip_line = 1;
+    } else if (eol)
+      tfx->buffer_pos += seg - keep + 1;
+    else if (keep == seg && keep < n)
+      continue;
+    else
+      more = 1;
+    if (truncate || eol) {
+      tfx->line_len = 0;
+      tfx->flush_eol = 1;
     }
   }
   *ret_len = len;
@@ -0,0 +1,194 @@
+/* Tests for the text filter
+   Copyright 2018 The NeoPG developers
+
+   NeoPG is released under the Simplified BSD License (see license.txt)
+*/
+
+#include <config.h>
+
+#include "gtest/gtest.h"
+
+#include <string.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "../common/iobuf.h"
+#include "../common/util.h"
+#include "filter.h"
+
+#include "legacy_environment.h"
+
+using namespace NeoPG;
+
+namespace {
+
+/* The limit of the line length in the text filter.  */
+const size_t MAX_LINELEN = 19995;
+
+/* The size of the blocks read by the text filter.  */
+const size_t TEXT_READ_SIZE = 64 * 1024;
+
+/* Return the canonical text for DATA as the text filter made it when
+   it read the input line by line with iobuf_read_line and removed
+   the trailing CRs, LFs and NULs with trim_trailing_chars.  Lines
+   with MAX_LINELEN - 1 or more characters are cut to MAX_LINELEN - 2
+   characters and get an LF even at the end of the input.  Trailing
+   spaces and tabs are kept.  R_TRUNCATED is the number of such
+   lines.  */
+std::string canonical(const std::string &data, int &r_truncated) {
+  std::string result;
+  size_t pos = 0;
+
+  r_truncated = 0;
+  while (pos < data.size()) {
+    size_t end = data.find('\n', pos);
+    bool lf = end != std::string::npos;
+    if (!lf) end = data.size();
+
+    std::string line = data.substr(pos, end - pos);
+    pos = lf ? end + 1 : end;
+    if (line.size() >= MAX_LINELEN - 1) {
+      line.resize(MAX_LINELEN - 2);
+      lf = true;
+      r_truncated++;
+    }
+    while (!line.empty() && (line.back() == '\r' || line.back() == '\0'))
+      line.pop_back();
+    result += line;
+    if (lf) result += "\r\n";
+  }
+  return result;
+}
+
+/* Run DATA through the text filter, reading the output in pieces of
+   READ_SIZE bytes.  The result is returned in R_TEXT and the number
+   of truncated lines in R_TRUNCATED.  */
+void filter_text(const std::string &fname, const std::string &data,
+                 size_t read_size, std::string &r_text, int &r_truncated) {
+  text_filter_context_t tfx;
+  std::vector<char> buffer(read_size);
+  iobuf_t inp;
+  int n;
+
+  std::ofstream(fname, std::ios::binary) << data;
+  inp = iobuf_open(fname.c_str());
+  ASSERT_NE(inp, nullptr);
+  memset(&tfx, 0, sizeof tfx);
+  ASSERT_EQ(iobuf_push_filter(inp, text_filter, &tfx), 0);
+  r_text.clear();
+  while ((n = iobuf_read(inp, buffer.data(), read_size)) != -1)
+    r_text.append(buffer.data(), n);
+  iobuf_close(inp);
+  r_truncated = tfx.truncated;
+}
+
+/* Return an input with the special cases about TEXT_READ_SIZE bytes
+   apart.  The distances vary, so that some of them straddle the
+   blocks read by the filter.  */
+std::string make_input(void) {
+  const std::string tail[] = {"a \t\r\n",
+                              "b\rc\r\r\n",
+                              std::string("d\r\0\r\n", 5),
+                              "\r\r\r\n",
+                              std::string("e\0f\n", 4),
+                              "\n",
+                              "g \r",
+                              "h\r\rx\n"};
+  std::string data;
+
+  for (int shift = -4; shift <= 4; shift++)
+    for (const std::string &special : tail) {
+      size_t start = data.size();
+      while (data.size() < start + TEXT_READ_SIZE + shift - 1) {
+        data += std::to_string(data.size()) + " \t";
+        data += data.size() % 3 ? "\r\n" : "\n";
+      }
+      data.resize(start + TEXT_READ_SIZE + shift - 1);
+      data += special;
+    }
+
+  /* Lines around the length limit, one of them straddling a block.  */
+  for (size_t len = MAX_LINELEN - 4; len <= MAX_LINELEN + 1; len++)
+    data += std::string(len, 'l') + "\n";
+  data += std::string(MAX_LINELEN - 3, 'm') + "\r\r\n";
+  data += std::string(3 * TEXT_READ_SIZE, 'n') + "\r\nend\r";
+  return data;
+}
+
+/* Restore the size of the iobuf buffers.  */
+class SavedBufferSize {
+ public:
+  SavedBufferSize() : m_kilobyte(iobuf_get_buffer_size() / 1024) {}
+  ~SavedBufferSize() { iobuf_set_buffer_size(m_kilobyte); }
+
+ private:
+  unsigned int m_kilobyte;
+};
+
+}  // namespace
+
+TEST(NeopgLegacyTest, g10_text_filter_test) {
+  TemporaryDirectory dir;
+  std::string fname = dir.path() + "/input.txt";
+  const struct {
+    std::string input;
+    std::string output;
+  } cases[] = {
+      {"", ""},
+      {"\n", "\r\n"},
+      {"one\ntwo\n", "one\r\ntwo\r\n"},
+      /* CR,LF and lone CRs.  */
+      {"one\r\ntwo\r\r\n", "one\r\ntwo\r\n"},
+      {"one\rtwo\r\nthree\r", "one\rtwo\r\nthree"},
+      {"\r", ""},
+      {"\r\n\r\n", "\r\n\r\n"},
+      /* Trailing white space is kept.  */
+      {"one \t\ntwo  \r\n", "one \t\r\ntwo  \r\n"},
+      /* No final newline.  */
+      {"one\ntwo", "one\r\ntwo"},
+      {"one\ntwo \t", "one\r\ntwo \t"},
+      /* Trailing NULs are removed as well.  */
+      {std::string("one\0\r\0\ntwo\0three", 16),
+       std::string("one\r\ntwo\0three", 14)},
+  };
+
+  for (const auto &test : cases) {
+    std::string text;
+    int truncated;
+
+    ASSERT_NO_FATAL_FAILURE(
+        filter_text(fname, test.input, 4096, text, truncated));
+    ASSERT_EQ(text, test.output);
+    ASSERT_EQ(truncated, 0);
+    ASSERT_EQ(canonical(test.input, truncated), test.output);
+  }
+}
+
+TEST(NeopgLegacyTest, g10_text_filter_blocks_test) {
+  TemporaryDirectory dir;
+  SavedBufferSize saved;
+  std::string fname = dir.path() + "/input.txt";
+  std::string data = make_input();
+  int expected_truncated;
+  std::string expected = canonical(data, expected_truncated);
+
+  ASSERT_EQ(expected_truncated, 5);
+  /* The file is read in pieces of the iobuf buffer size, and the
+     output in pieces which are smaller or larger than that.  */
+  for (unsigned int kilobyte : {4, 64})
+    for (size_t read_size : {1, 11, 4096, 100000, 1 << 20}) {
+      std::string text;
+      int truncated;
+
+      iobuf_set_buffer_size(kilobyte);
+      ASSERT_NO_FATAL_FAILURE(
+          filter_text(fname, data, read_size, text, truncated));
+      ASSERT_EQ(text.size(), expected.size())
+          << "buffer " << kilobyte << " KiB, read size " << read_size;
+      ASSERT_TRUE(text == expected)
+          << "buffer " << kilobyte << " KiB, read size " << read_size;
+      ASSERT_EQ(truncated, expected_truncated);
+    }
+}
@@ -227,6 +227,82 @@ int assuan_pending_line(assuan_context_t ctx) {
   return ctx && ctx->inbound.attic.pending;
 }
 
+/* Parse the length of a binary data frame from LINE, which is the
+   text following the "B " prefix, and store it at R_LENGTH.  If the
+   header is invalid, the payload can't be skipped and the following
+   bytes can't be trusted to be lines.  Thus the inbound side of CTX
+   is then closed and any further read fails.  */
+gpg_error_t _assuan_parse_binary_header(assuan_context_t ctx,
+                                        const char *line, size_t *r_length) {
+  gpg_error_t rc = 0;
+  size_t length = 0;
+
+  *r_length = 0;
+  if (*line < '0' || *line > '9') rc = GPG_ERR_ASS_INV_RESPONSE;
+  for (; !rc && *line >= '0' && *line <= '9'; line++) {
+    length = length * 10 + (*line - '0');
+    if (length > ASSUAN_BINARY_MAXFRAME) rc = GPG_ERR_ASS_TOO_MUCH_DATA;
+  }
+  if (!rc && *line) rc = GPG_ERR_ASS_INV_RESPONSE;
+
+  if (rc) {
+    _assuan_log_control_channel(ctx, 0, "invalid binary data frame", NULL, 0,
+                                NULL, 0);
+    ctx->inbound.eof = 1;
+    ctx->inbound.attic.linelen = 0;
+    ctx->inbound.attic.pending = 0;
+    return rc;
+  }
+
+  *r_length = length;
+  return 0;
+}
+
+/* Read exactly LENGTH bytes of a binary data frame into BUFFER.  The
+   header line has already been read by _assuan_read_line, thus the
+   first part of the payload may already be in the attic.  Returns 0
+   on success or an Assuan error code.  */
+gpg_error_t _assuan_read_binary(assuan_context_t ctx, void *buffer,
+                                size_t length) {
+  char *p = (char *)buffer;
+  size_t n;
+
+  n = ctx->inbound.attic.linelen;
+  if (n) {
+    if (n > length) n = length;
+    memcpy(p, ctx->inbound.attic.line, n);
+    ctx->inbound.attic.linelen -= n;
+    memmove(ctx->inbound.attic.line, ctx->inbound.attic.line + n,
+            ctx->inbound.attic.linelen);
+    p += n;
+    length -= n;
+  }
+  ctx->inbound.attic.pending =
+      memchr(ctx->inbound.attic.line, '\n', ctx->inbound.attic.linelen) ? 1
+                                                                         : 0;
+
+  while (length) {
+    ssize_t nread = ctx->engine.readfnc(ctx, p, length);
+
+    if (nread < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN) {
+        _assuan_usleep(ctx, 100000);
+        continue;
+      }
+      return gpg_error_from_syserror();
+    } else if (!nread) {
+      ctx->inbound.eof = 1;
+      _assuan_log_control_channel(ctx, 0, "eof in binary data", NULL, 0, NULL,
+                                  0);
+      return GPG_ERR_ASS_READ_ERROR;
+    }
+    p += nread;
+    length -= nread;
+  }
+  return 0;
+}
+
 gpg_error_t _assuan_write_line(assuan_context_t ctx, const char *prefix,
                                const char *line, size_t len) {
   gpg_error_t rc = 0;
@@ -383,6 +459,32 @@ int _assuan_cookie_write_flush(void *cookie) {
   return 0;
 }
 
+/* Write out BUFFER of LENGTH bytes as binary data frames.  Buffered
+   data lines are flushed first so that the order of the data is
+   kept.  */
+static gpg_error_t write_binary_data(assuan_context_t ctx, const char *buffer,
+                                     size_t length) {
+  char header[30];
+  size_t n;
+  int headerlen;
+
+  _assuan_cookie_write_flush(ctx);
+  if (ctx->outbound.data.error) return ctx->outbound.data.error;
+
+  while (length) {
+    n = length > ASSUAN_BINARY_MAXFRAME ? ASSUAN_BINARY_MAXFRAME : length;
+    headerlen = snprintf(header, sizeof header, "B %lu\n", (unsigned long)n);
+    _assuan_log_control_channel(ctx, 1, NULL, header, headerlen - 1, NULL, 0);
+    if (writen(ctx, header, headerlen) || writen(ctx, buffer, n)) {
+      ctx->outbound.data.error = gpg_error_from_syserror();
+      return ctx->outbound.data.error;
+    }
+    buffer += n;
+    length -= n;
+  }
+  return 0;
+}
+
 /**
  * assuan_send_data:
  * @ctx: An assuan context
@@ -401,6 +503,10 @@ int _assuan_cookie_write_flush(void *cookie) {
  * If BUFFER is NULL and LENGTH is 1 and we are a client, a "CAN" is
  * send instead of an "END".
  *
+ * If binary data frames have been negotiated, large buffers are sent
+ * as raw binary frames without escaping and line wrapping.  This is
+ * not done if an I/O monitor is installed because it expects lines.
+ *
  * Return value: 0 on success or an error code
  **/
 
@@ -414,6 +520,9 @@ gpg_error_t assuan_send_data(assuan_context_t ctx, const void *buffer,
     if (ctx->outbound.data.error) return ctx->outbound.data.error;
     if (!ctx->is_server)
       return assuan_write_line(ctx, length == 1 ? "CAN" : "END");
+  } else if (ctx->flags.binary_data && !ctx->io_monitor &&
+             length >= ASSUAN_BINARY_THRESHOLD) {
+    return write_binary_data(ctx, (const char *)(buffer), length);
   } else {
     _assuan_cookie_write_data(ctx, (const char *)(buffer), length);
     if (ctx->outbound.data.error) return ctx->outbound.data.error;
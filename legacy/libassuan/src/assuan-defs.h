@@ -75,6 +75,7 @@ struct assuan_context_s {
     unsigned int convey_comments : 1;
     unsigned int no_logging : 1;
     unsigned int force_close : 1;
+    unsigned int binary_data : 1;
   } flags;
 
   /* If set, this is called right before logging an I/O line.  */
@@ -247,6 +248,10 @@ int _assuan_cookie_write_data(void *cookie, const char *buffer, size_t size);
 int _assuan_cookie_write_flush(void *cookie);
 gpg_error_t _assuan_write_line(assuan_context_t ctx, const char *prefix,
                                const char *line, size_t len);
+gpg_error_t _assuan_parse_binary_header(assuan_context_t ctx,
+                                        const char *line, size_t *r_length);
+gpg_error_t _assuan_read_binary(assuan_context_t ctx, void *buffer,
+                                size_t length);
 
 /*-- client.c --*/
 gpg_error_t _assuan_read_from_server(assuan_context_t ctx,
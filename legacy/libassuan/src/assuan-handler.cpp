@@ -66,7 +66,11 @@ static const char std_help_option[] =
     "trailing spaces around <NAME> and <VALUE> are allowed but should be\n"
     "ignored.  For compatibility reasons, <NAME> may be prefixed with two\n"
     "dashes.  The use of the equal sign is optional but suggested if\n"
-    "<VALUE> is given.";
+    "<VALUE> is given.\n"
+    "\n"
+    "The option \"binary-data\" is handled by Assuan itself and allows\n"
+    "both peers to send data as \"B <length>\" followed by the raw\n"
+    "bytes instead of escaped data lines.";
 static gpg_error_t std_handler_option(assuan_context_t ctx, char *line) {
   char *key, *value, *p;
 
@@ -106,6 +110,14 @@ static gpg_error_t std_handler_option(assuan_context_t ctx, char *line) {
                         set_error(ctx, GPG_ERR_ASS_SYNTAX,
                                   "option should not begin with one dash"));
 
+  /* The confirmation text tells the client that the option has not
+     just been ignored by a server predating binary data frames.  */
+  if (!strcmp(key, "binary-data")) {
+    ctx->flags.binary_data = 1;
+    assuan_set_okay_line(ctx, "binary-data");
+    return PROCESS_DONE(ctx, 0);
+  }
+
   if (ctx->option_handler_fnc)
     return PROCESS_DONE(ctx, ctx->option_handler_fnc(ctx, key, value));
   return PROCESS_DONE(ctx, 0);
@@ -107,6 +107,30 @@ static void free_membuf(assuan_context_t ctx, struct membuf *mb) {
   mb->buf = NULL;
 }
 
+/* Read the payload of the binary data frame announced by LINE (the
+   text after the "B " prefix) and append it to MB.  The payload is
+   always read so that the connection stays in sync even if MB is
+   already too large or NULL because no data is expected.  */
+static gpg_error_t get_binary_frame(assuan_context_t ctx, struct membuf *mb,
+                                    const char *line) {
+  gpg_error_t rc;
+  size_t length;
+  char *buf;
+
+  rc = _assuan_parse_binary_header(ctx, line, &length);
+  if (rc) return rc;
+
+  buf = (char *)_assuan_malloc(ctx, length ? length : 1);
+  if (!buf) return gpg_error_from_syserror();
+
+  rc = _assuan_read_binary(ctx, buf, length);
+  if (!rc && mb) put_membuf(ctx, mb, buf, length);
+
+  wipememory(buf, length);
+  _assuan_free(ctx, buf);
+  return rc;
+}
+
 /**
  * assuan_inquire:
  * @ctx: An assuan context
@@ -175,6 +199,13 @@ gpg_error_t assuan_inquire(assuan_context_t ctx, const char *keyword,
       rc = GPG_ERR_ASS_CANCELED;
       goto out;
     }
+    if (line[0] == 'B' && line[1] == ' ' && ctx->flags.binary_data) {
+      rc = get_binary_frame(ctx, nodataexpected ? NULL : &mb,
+                            (char *)line + 2);
+      if (!rc && nodataexpected) rc = GPG_ERR_ASS_UNEXPECTED_CMD;
+      if (rc) goto out;
+      continue;
+    }
     if ((line[0] != 'D' && line[0] != 'd') || line[1] != ' ' ||
         nodataexpected) {
       rc = GPG_ERR_ASS_UNEXPECTED_CMD;
@@ -252,6 +283,17 @@ gpg_error_t _assuan_inquire_ext_cb(assuan_context_t ctx) {
     goto out;
   }
 
+  if (line[0] == 'B' && line[1] == ' ' && ctx->flags.binary_data) {
+    rc = get_binary_frame(ctx, mb, (char *)line + 2);
+    if (!rc && !mb) rc = GPG_ERR_ASS_UNEXPECTED_CMD;
+    if (rc) goto out;
+    if (mb->too_large) {
+      rc = GPG_ERR_ASS_TOO_MUCH_DATA;
+      goto out;
+    }
+    return 0;
+  }
+
   if ((line[0] != 'D' && line[0] != 'd') || line[1] != ' ' || mb == NULL) {
     rc = GPG_ERR_ASS_UNEXPECTED_CMD;
     goto out;
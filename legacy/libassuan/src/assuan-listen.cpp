@@ -68,6 +68,9 @@ gpg_error_t assuan_accept(assuan_context_t ctx) {
     if (ctx->max_accepts-- == 0)
       return -1; /* second invocation for pipemode -> terminate */
   }
+  /* Binary data frames need to be negotiated per connection.  */
+  ctx->flags.binary_data = 0;
+
   if (ctx->accept_handler) {
     /* FIXME: This should be superfluous, if everything else is
        correct.  */
@@ -49,6 +49,13 @@ typedef struct msghdr *assuan_msghdr_t;
 
 #define ASSUAN_LINELENGTH 1002 /* 1000 + [CR,]LF */
 
+/* Data sent with assuan_send_data in chunks of at least this size is
+   transmitted as a binary data frame "B <length>" followed by the raw
+   bytes, if the peer negotiated this with "OPTION binary-data".  */
+#define ASSUAN_BINARY_THRESHOLD (ASSUAN_LINELENGTH - 2)
+/* The maximum payload of a single binary data frame.  */
+#define ASSUAN_BINARY_MAXFRAME (1024 * 1024)
+
 struct assuan_context_s;
 typedef struct assuan_context_s *assuan_context_t;
 #ifdef _WIN32
@@ -170,6 +177,9 @@ typedef unsigned int assuan_flag_t;
 #define ASSUAN_NO_LOGGING 5
 /* This flag forces a connection close.  */
 #define ASSUAN_FORCE_CLOSE 6
+/* This flag is set if both peers agreed on the use of binary data
+   frames.  See assuan_negotiate_binary_data.  */
+#define ASSUAN_BINARY_DATA 7
 
 /* For context CTX, set the flag FLAG to VALUE.  Values for flags
    are usually 1 or 0 but certain flags might allow for other values;
@@ -336,6 +346,7 @@ pid_t assuan_get_pid(assuan_context_t ctx);
 #define ASSUAN_RESPONSE_STATUS 4
 #define ASSUAN_RESPONSE_END 5
 #define ASSUAN_RESPONSE_COMMENT 6
+#define ASSUAN_RESPONSE_BINARY 7
 typedef int assuan_response_t;
 
 /* This already de-escapes data lines.  */
@@ -353,6 +364,11 @@ gpg_error_t assuan_transact(
     gpg_error_t (*inquire_cb)(void *, const char *), void *inquire_cb_arg,
     gpg_error_t (*status_cb)(void *, const char *), void *status_cb_arg);
 
+/* Ask the server to accept and send binary data frames.  Returns
+   GPG_ERR_NOT_SUPPORTED if the server does not know about them, in
+   which case the classic data lines are used.  */
+gpg_error_t assuan_negotiate_binary_data(assuan_context_t ctx);
+
 /*-- assuan-inquire.c --*/
 gpg_error_t assuan_inquire(assuan_context_t ctx, const char *keyword,
                            unsigned char **r_buffer, size_t *r_length,
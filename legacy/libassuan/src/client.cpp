@@ -22,6 +22,7 @@
 #endif
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "assuan-defs.h"
 #include "debug.h"
@@ -111,6 +112,9 @@ gpg_error_t assuan_client_parse_response(assuan_context_t ctx, char *line,
   if (linelen >= 1 && line[0] == 'D' && line[1] == ' ') {
     *response = ASSUAN_RESPONSE_DATA; /* data line */
     *off = 2;
+  } else if (linelen >= 2 && line[0] == 'B' && line[1] == ' ') {
+    *response = ASSUAN_RESPONSE_BINARY; /* binary data frame */
+    *off = 2;
   } else if (linelen >= 1 && line[0] == 'S' &&
              (line[1] == '\0' || line[1] == ' ')) {
     *response = ASSUAN_RESPONSE_STATUS;
@@ -164,6 +168,33 @@ gpg_error_t _assuan_read_from_server(assuan_context_t ctx,
   return rc;
 }
 
+/* Read the payload of the binary data frame with the header LINE and
+   pass it to DATA_CB.  Without DATA_CB the payload is still read, so
+   that the connection stays in sync, and GPG_ERR_ASS_NO_DATA_CB is
+   returned.  */
+static gpg_error_t transact_binary_data(
+    assuan_context_t ctx, const char *line,
+    gpg_error_t (*data_cb)(void *, const void *, size_t), void *data_cb_arg) {
+  gpg_error_t rc;
+  size_t length;
+  void *buffer;
+
+  rc = _assuan_parse_binary_header(ctx, line, &length);
+  if (rc) return rc;
+
+  buffer = _assuan_malloc(ctx, length ? length : 1);
+  if (!buffer) return gpg_error_from_syserror();
+
+  rc = _assuan_read_binary(ctx, buffer, length);
+  if (!rc)
+    rc = data_cb ? data_cb(data_cb_arg, buffer, length)
+                 : GPG_ERR_ASS_NO_DATA_CB;
+
+  if (ctx->flags.confidential) wipememory(buffer, length);
+  _assuan_free(ctx, buffer);
+  return rc;
+}
+
 /**
  * assuan_transact:
  * @ctx: The Assuan context
@@ -216,6 +247,9 @@ again:
       rc = data_cb(data_cb_arg, line, linelen);
       if (!rc) goto again;
     }
+  } else if (response == ASSUAN_RESPONSE_BINARY) {
+    rc = transact_binary_data(ctx, line, data_cb, data_cb_arg);
+    if (!rc) goto again;
   } else if (response == ASSUAN_RESPONSE_INQUIRE) {
     if (!inquire_cb) {
       assuan_write_line(ctx, "END"); /* get out of inquire mode */
@@ -254,3 +288,31 @@ again:
 
   return rc;
 }
+
+/**
+ * assuan_negotiate_binary_data:
+ * @ctx: The Assuan context
+ *
+ * Ask the server to use binary data frames for the remaining
+ * connection.  Servers predating this extension either reject the
+ * option or accept it silently; only an explicit confirmation enables
+ * binary frames on our side.  On failure the classic data lines keep
+ * being used, thus the caller may ignore the error.
+ *
+ * Return value: 0 on success, GPG_ERR_NOT_SUPPORTED if the server did
+ * not confirm the option, or another error code.
+ **/
+gpg_error_t assuan_negotiate_binary_data(assuan_context_t ctx) {
+  gpg_error_t rc;
+
+  if (!ctx) return GPG_ERR_ASS_INV_VALUE;
+  if (ctx->is_server) return GPG_ERR_ASS_NOT_A_CLIENT;
+
+  rc = assuan_transact(ctx, "OPTION binary-data", NULL, NULL, NULL, NULL, NULL,
+                       NULL);
+  if (rc) return rc;
+  if (strcmp(ctx->inbound.line, "OK binary-data")) return GPG_ERR_NOT_SUPPORTED;
+
+  ctx->flags.binary_data = 1;
+  return 0;
+}
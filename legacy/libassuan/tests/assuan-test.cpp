@@ -3,8 +3,14 @@
 #include "gtest/gtest.h"
 
 int fdpassing_main(int argc, char* argv[]);
+int binarydata_main(int argc, char* argv[]);
 
 TEST(AssuanTest, fdpassing) {
   int result = fdpassing_main(0, NULL);
   ASSERT_EQ(result, 0);
 }
+
+TEST(AssuanTest, binarydata) {
+  int result = binarydata_main(0, NULL);
+  ASSERT_EQ(result, 0);
+}
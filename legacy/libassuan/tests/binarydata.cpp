@@ -0,0 +1,375 @@
+/* binarydata - Check and benchmark binary data frames.
+   Copyright (C) 2018 The NeoPG developers
+
+   This file is part of Assuan.
+
+   Assuan is free software; you can redistribute it and/or modify it
+   under the terms of the GNU Lesser General Public License as
+   published by the Free Software Foundation; either version 3 of
+   the License, or (at your option) any later version.
+
+   Assuan is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "../src/assuan.h"
+#include "common.h"
+
+/* Size of the data transferred per command and the number of
+   commands per direction and mode.  */
+#define TRANSFER_SIZE (16 * 1024 * 1024)
+#define TRANSFER_COUNT 2
+
+/* Chunk size used with assuan_send_data.  */
+#define CHUNK_SIZE (64 * 1024)
+
+/* Return the test pattern byte at offset OFF.  The pattern contains
+   all characters which need escaping in data lines.  */
+static unsigned char pattern_byte(size_t off) {
+  return (unsigned char)(off * 7 + (off >> 8));
+}
+
+static void fill_pattern(unsigned char *buf, size_t off, size_t len) {
+  size_t i;
+
+  for (i = 0; i < len; i++) buf[i] = pattern_byte(off + i);
+}
+
+static int check_pattern(const unsigned char *buf, size_t off, size_t len) {
+  size_t i;
+
+  for (i = 0; i < len; i++)
+    if (buf[i] != pattern_byte(off + i)) return -1;
+  return 0;
+}
+
+static double timestamp(void) {
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/*
+
+       S E R V E R
+
+*/
+
+static gpg_error_t cmd_getdata(assuan_context_t ctx, char *line) {
+  unsigned char *buf;
+  size_t total, off, n;
+  gpg_error_t rc = 0;
+
+  total = strtoul(line, NULL, 10);
+  buf = (unsigned char *)xmalloc(CHUNK_SIZE);
+  for (off = 0; off < total && !rc; off += n) {
+    n = total - off > CHUNK_SIZE ? CHUNK_SIZE : total - off;
+    fill_pattern(buf, off, n);
+    rc = assuan_send_data(ctx, buf, n);
+  }
+  xfree(buf);
+  return rc;
+}
+
+static gpg_error_t cmd_putdata(assuan_context_t ctx, char *line) {
+  unsigned char *value;
+  size_t valuelen;
+  char numbuf[35];
+  gpg_error_t rc;
+
+  (void)line;
+
+  rc = assuan_inquire(ctx, "DATA", &value, &valuelen, 0);
+  if (rc) return rc;
+  if (check_pattern(value, 0, valuelen))
+    rc = GPG_ERR_ASS_GENERAL;
+  else {
+    snprintf(numbuf, sizeof numbuf, "%lu", (unsigned long)valuelen);
+    rc = assuan_write_status(ctx, "LENGTH", numbuf);
+  }
+  xfree(value);
+  return rc;
+}
+
+/* Announce a binary data frame which is too large and send a line as
+   its payload.  */
+static gpg_error_t cmd_badframe(assuan_context_t ctx, char *line) {
+  gpg_error_t rc;
+
+  (void)line;
+
+  rc = assuan_write_line(ctx, "B 99999999999");
+  if (!rc) rc = assuan_write_line(ctx, "OK");
+  return rc;
+}
+
+/* Send an inquiry which expects no data.  */
+static gpg_error_t cmd_nodata(assuan_context_t ctx, char *line) {
+  (void)line;
+
+  return assuan_inquire(ctx, "NODATA", NULL, NULL, 0);
+}
+
+static gpg_error_t register_commands(assuan_context_t ctx) {
+  static struct {
+    const char *name;
+    gpg_error_t (*handler)(assuan_context_t, char *line);
+  } table[] = {
+      {"GETDATA", cmd_getdata},
+      {"PUTDATA", cmd_putdata},
+      {"BADFRAME", cmd_badframe},
+      {"NODATA", cmd_nodata},
+      {NULL, NULL}};
+  int i;
+  gpg_error_t rc;
+
+  for (i = 0; table[i].name; i++) {
+    rc = assuan_register_command(ctx, table[i].name, table[i].handler, NULL);
+    if (rc) return rc;
+  }
+  return 0;
+}
+
+static void server(void) {
+  int rc;
+  assuan_context_t ctx;
+
+  rc = assuan_new(&ctx);
+  if (rc) log_fatal("assuan_new failed: %s\n", gpg_strerror(rc));
+
+  rc = assuan_init_pipe_server(ctx, NULL);
+  if (rc) log_fatal("assuan_init_pipe_server failed: %s\n", gpg_strerror(rc));
+
+  rc = register_commands(ctx);
+  if (rc) log_fatal("register_commands failed: %s\n", gpg_strerror(rc));
+
+  for (;;) {
+    rc = assuan_accept(ctx);
+    if (rc) {
+      if (rc != -1) log_error("assuan_accept failed: %s\n", gpg_strerror(rc));
+      break;
+    }
+
+    rc = assuan_process(ctx);
+    if (rc) log_error("assuan_process failed: %s\n", gpg_strerror(rc));
+  }
+
+  assuan_release(ctx);
+}
+
+/*
+
+       C L I E N T
+
+*/
+
+struct getdata_parm_s {
+  size_t received;
+  int bad;
+};
+
+static gpg_error_t getdata_cb(void *opaque, const void *buffer, size_t length) {
+  struct getdata_parm_s *parm = (struct getdata_parm_s *)opaque;
+
+  if (!buffer) return 0; /* END.  */
+  if (check_pattern((const unsigned char *)buffer, parm->received, length))
+    parm->bad = 1;
+  parm->received += length;
+  return 0;
+}
+
+struct putdata_parm_s {
+  assuan_context_t ctx;
+  unsigned char *data;
+  size_t datalen;
+};
+
+static gpg_error_t putdata_inq_cb(void *opaque, const char *line) {
+  struct putdata_parm_s *parm = (struct putdata_parm_s *)opaque;
+  size_t off, n;
+  gpg_error_t rc = 0;
+
+  if (strcmp(line, "DATA")) return GPG_ERR_ASS_UNKNOWN_INQUIRE;
+
+  for (off = 0; off < parm->datalen && !rc; off += n) {
+    n = parm->datalen - off > CHUNK_SIZE ? CHUNK_SIZE : parm->datalen - off;
+    rc = assuan_send_data(parm->ctx, parm->data + off, n);
+  }
+  return rc;
+}
+
+/* Answer the NODATA inquiry with a frame whose payload consists of
+   NOP commands.  */
+static gpg_error_t nodata_inq_cb(void *opaque, const char *line) {
+  assuan_context_t ctx = (assuan_context_t)opaque;
+  char buf[2000];
+  size_t i;
+
+  if (strcmp(line, "NODATA")) return GPG_ERR_ASS_UNKNOWN_INQUIRE;
+
+  for (i = 0; i + 4 <= sizeof buf; i += 4) memcpy(buf + i, "NOP\n", 4);
+  return assuan_send_data(ctx, buf, sizeof buf);
+}
+
+/* Run the transfers over CTX and print the throughput using the
+   label MODE.  */
+static int client(assuan_context_t ctx, const char *mode) {
+  char line[ASSUAN_LINELENGTH];
+  struct getdata_parm_s getparm;
+  struct putdata_parm_s putparm;
+  double start, elapsed;
+  gpg_error_t rc;
+  int i;
+
+  snprintf(line, sizeof line, "GETDATA %u", (unsigned int)TRANSFER_SIZE);
+  start = timestamp();
+  for (i = 0; i < TRANSFER_COUNT; i++) {
+    memset(&getparm, 0, sizeof getparm);
+    rc = assuan_transact(ctx, line, getdata_cb, &getparm, NULL, NULL, NULL,
+                         NULL);
+    if (rc) {
+      log_error("GETDATA failed: %s\n", gpg_strerror(rc));
+      return -1;
+    }
+    if (getparm.bad || getparm.received != TRANSFER_SIZE) {
+      log_error("GETDATA returned corrupted data\n");
+      return -1;
+    }
+  }
+  elapsed = timestamp() - start;
+  printf("assuan %-8s server->client: %8.1f MB/s\n", mode,
+         TRANSFER_COUNT * (TRANSFER_SIZE / 1e6) / elapsed);
+
+  putparm.ctx = ctx;
+  putparm.datalen = TRANSFER_SIZE;
+  putparm.data = (unsigned char *)xmalloc(putparm.datalen);
+  fill_pattern(putparm.data, 0, putparm.datalen);
+  start = timestamp();
+  for (i = 0; i < TRANSFER_COUNT; i++) {
+    rc = assuan_transact(ctx, "PUTDATA", NULL, NULL, putdata_inq_cb, &putparm,
+                         NULL, NULL);
+    if (rc) {
+      log_error("PUTDATA failed: %s\n", gpg_strerror(rc));
+      xfree(putparm.data);
+      return -1;
+    }
+  }
+  elapsed = timestamp() - start;
+  printf("assuan %-8s client->server: %8.1f MB/s\n", mode,
+         TRANSFER_COUNT * (TRANSFER_SIZE / 1e6) / elapsed);
+
+  xfree(putparm.data);
+  return 0;
+}
+
+/*
+
+     M A I N
+
+*/
+int binarydata_main(int argc, char **argv) {
+  static const char *modes[] = {"lines", "binary"};
+  assuan_context_t ctx;
+  gpg_error_t err;
+  int no_close_fds[2];
+  const char *loc;
+  int i;
+
+  (void)argc;
+  (void)argv;
+
+  no_close_fds[0] = 2;
+  no_close_fds[1] = -1;
+
+  for (i = 0; i < (int)DIM(modes); i++) {
+    err = assuan_new(&ctx);
+    if (err) log_fatal("assuan_new failed: %s\n", gpg_strerror(err));
+
+    err = assuan_pipe_connect(ctx, NULL, &loc, no_close_fds, NULL, NULL,
+                              ASSUAN_PIPE_CONNECT_FDPASSING);
+    if (err) {
+      log_error("assuan_pipe_connect failed: %s\n", gpg_strerror(err));
+      assuan_release(ctx);
+      errorcount++;
+      continue;
+    }
+    if (loc[0] == 's') {
+      /* We are the forked server.  */
+      server();
+      assuan_release(ctx);
+      _exit(0);
+    }
+
+    if (i == 1) {
+      err = assuan_negotiate_binary_data(ctx);
+      if (err) {
+        log_error("negotiating binary data failed: %s\n", gpg_strerror(err));
+        errorcount++;
+      }
+    }
+    if (client(ctx, modes[i])) errorcount++;
+
+    if (i == 1) {
+      struct getdata_parm_s getparm;
+
+      char *line;
+      size_t linelen;
+
+      /* The payload of an unexpected frame is skipped and not read as
+         commands.  The END of the inquiry is then answered as a
+         command by an error line, which is read here.  */
+      err = assuan_transact(ctx, "NODATA", NULL, NULL, nodata_inq_cb, ctx,
+                            NULL, NULL);
+      if (err != GPG_ERR_ASS_UNEXPECTED_CMD) {
+        log_error("NODATA returned: %s\n", gpg_strerror(err));
+        errorcount++;
+      }
+      err = assuan_read_line(ctx, &line, &linelen);
+      if (err || linelen < 4 || strncmp(line, "ERR ", 4) ||
+          strtoul(line + 4, NULL, 10) != GPG_ERR_NOT_IMPLEMENTED) {
+        log_error("END after NODATA not rejected\n");
+        errorcount++;
+      }
+      memset(&getparm, 0, sizeof getparm);
+      err = assuan_transact(ctx, "GETDATA 1", getdata_cb, &getparm, NULL,
+                            NULL, NULL, NULL);
+      if (err || getparm.received != 1) {
+        log_error("GETDATA after NODATA failed: %s\n", gpg_strerror(err));
+        errorcount++;
+      }
+
+      /* The payload of an invalid frame must not be read as lines,
+         thus the connection is unusable afterwards.  */
+      memset(&getparm, 0, sizeof getparm);
+      err = assuan_transact(ctx, "BADFRAME", getdata_cb, &getparm, NULL, NULL,
+                            NULL, NULL);
+      if (err != GPG_ERR_ASS_TOO_MUCH_DATA) {
+        log_error("BADFRAME returned: %s\n", gpg_strerror(err));
+        errorcount++;
+      }
+      err = assuan_transact(ctx, "GETDATA 1", getdata_cb, &getparm, NULL,
+                            NULL, NULL, NULL);
+      if (!err) {
+        log_error("connection still used after an invalid frame\n");
+        errorcount++;
+      }
+    }
+    assuan_release(ctx);
+  }
+
+  return errorcount ? 1 : 0;
+}
@@ -20,6 +20,13 @@
  */
 
 #include <config.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -100,6 +107,22 @@ typedef struct gcry_md_list {
   PROPERLY_ALIGNED_TYPE context;
 } GcryDigestEntry;
 
+/* The threads which update the contexts of a handle in parallel.
+   They are started by the first large write and run until the handle
+   is closed.  Thread I updates the context at index I + 1 of the
+   list; the first one is updated by the writer.  */
+struct md_workers {
+  std::mutex lock;
+  std::condition_variable work;
+  std::condition_variable done;
+  std::vector<std::thread> threads;
+  const void *inbuf{NULL};
+  size_t inlen{0};
+  unsigned long job{0}; /* Incremented for every write.  */
+  size_t pending{0};    /* Threads still busy with the current job.  */
+  bool stop{false};
+};
+
 /* This structure is put right after the gcry_md_hd_t buffer, so that
  * only one memory block is needed. */
 struct gcry_md_context {
@@ -113,6 +136,7 @@ struct gcry_md_context {
     unsigned int hmac : 1;
   } flags;
   GcryDigestEntry *list;
+  struct md_workers *workers; /* NULL until needed by md_write.  */
 };
 
 #define CTX_MAGIC_NORMAL 0x11071961
@@ -404,6 +428,7 @@ static gpg_error_t md_copy(gcry_md_hd_t ahd, gcry_md_hd_t *b_hd) {
   memcpy(b, a, sizeof *a);
   b->list = NULL;
   b->debug = NULL;
+  b->workers = NULL;
 
   /* Copy the complete list of algorithms.  The copied list is
      reversed, but that doesn't matter. */
@@ -466,6 +491,17 @@ static void md_close(gcry_md_hd_t a) {
 
   if (!a) return;
   if (a->ctx->debug) md_stop_debug(a);
+  if (a->ctx->workers) {
+    struct md_workers *w = a->ctx->workers;
+
+    {
+      std::lock_guard<std::mutex> lock(w->lock);
+      w->stop = true;
+    }
+    w->work.notify_all();
+    for (auto &thread : w->threads) thread.join();
+    delete w;
+  }
   for (r = a->ctx->list; r; r = r2) {
     r2 = r->next;
     wipememory(r, r->actual_struct_size);
@@ -478,6 +514,36 @@ static void md_close(gcry_md_hd_t a) {
 
 void _gcry_md_close(gcry_md_hd_t hd) { md_close(hd); }
 
+/* Writes of at least this many bytes to a handle with more than one
+   algorithm enabled update the contexts on separate threads.  */
+#define MD_PARALLEL_MIN (64 * 1024)
+
+/* The body of thread INDEX of the workers of CTX, started when JOB
+   was the last write.  */
+static void md_worker(struct gcry_md_context *ctx, size_t index,
+                      unsigned long job) {
+  struct md_workers *w = ctx->workers;
+
+  for (;;) {
+    GcryDigestEntry *r;
+    size_t n;
+
+    {
+      std::unique_lock<std::mutex> lock(w->lock);
+      w->work.wait(lock, [&] { return w->stop || w->job != job; });
+      if (w->stop) return;
+      job = w->job;
+    }
+    for (r = ctx->list, n = 0; r && n < index + 1; r = r->next, n++)
+      ;
+    if (r) (*r->spec->write)(&r->context.c, w->inbuf, w->inlen);
+    {
+      std::lock_guard<std::mutex> lock(w->lock);
+      if (!--w->pending) w->done.notify_one();
+    }
+  }
+}
+
 static void md_write(gcry_md_hd_t a, const void *inbuf, size_t inlen) {
   GcryDigestEntry *r;
 
@@ -486,9 +552,48 @@ static void md_write(gcry_md_hd_t a, const void *inbuf, size_t inlen) {
     if (inlen && fwrite(inbuf, inlen, 1, a->ctx->debug) != 1) BUG();
   }
 
-  for (r = a->ctx->list; r; r = r->next) {
-    if (a->bufpos) (*r->spec->write)(&r->context.c, a->buf, a->bufpos);
-    (*r->spec->write)(&r->context.c, inbuf, inlen);
+  if (inlen >= MD_PARALLEL_MIN && a->ctx->list && a->ctx->list->next) {
+    struct md_workers *w = a->ctx->workers;
+    size_t n, ncontexts = 0;
+
+    if (a->bufpos)
+      for (r = a->ctx->list; r; r = r->next)
+        (*r->spec->write)(&r->context.c, a->buf, a->bufpos);
+
+    /* Start a thread for every context but the first, including those
+       enabled since the last write.  */
+    for (r = a->ctx->list; r; r = r->next) ncontexts++;
+    if (!w) w = a->ctx->workers = new md_workers;
+    while (w->threads.size() < ncontexts - 1) {
+      try {
+        w->threads.emplace_back(md_worker, a->ctx, w->threads.size(), w->job);
+      } catch (const std::system_error &) {
+        break;
+      }
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(w->lock);
+      w->inbuf = inbuf;
+      w->inlen = inlen;
+      w->pending = w->threads.size();
+      w->job++;
+    }
+    w->work.notify_all();
+
+    /* The first context is updated by the calling thread, and so are
+       those for which no thread could be started.  */
+    for (r = a->ctx->list, n = 0; r; r = r->next, n++)
+      if (!n || n > w->threads.size())
+        (*r->spec->write)(&r->context.c, inbuf, inlen);
+
+    std::unique_lock<std::mutex> lock(w->lock);
+    w->done.wait(lock, [&] { return !w->pending; });
+  } else {
+    for (r = a->ctx->list; r; r = r->next) {
+      if (a->bufpos) (*r->spec->write)(&r->context.c, a->buf, a->bufpos);
+      (*r->spec->write)(&r->context.c, inbuf, inlen);
+    }
   }
   a->bufpos = 0;
 }
@@ -0,0 +1,241 @@
+/* Tree hashing of large inputs
+   Copyright 2018 The NeoPG developers
+
+   NeoPG is released under the Simplified BSD License (see license.txt)
+*/
+
+#include <neopg/tree_hash.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+
+namespace NeoPG {
+
+namespace {
+
+const size_t DEFAULT_LEAF_SIZE = 4 * 1024 * 1024;
+
+/* The largest leaf size, which also keeps a batch from overflowing.  */
+const size_t MAX_LEAF_SIZE = (size_t)2 * 1024 * 1024 * 1024;
+
+/* Input which comes in smaller pieces than a batch is collected in a
+   buffer of at most this size, or a single leaf if that is larger.  */
+const size_t MAX_BATCH_SIZE = 128 * 1024 * 1024;
+
+const struct {
+  const char* suffix;
+  size_t factor;
+} size_units[] = {{"GiB", 1024 * 1024 * 1024}, {"MiB", 1024 * 1024},
+                  {"KiB", 1024}};
+
+size_t parse_size(const std::string& text) {
+  size_t pos = 0;
+  unsigned long long value = 0;
+
+  if (text.empty() || text[0] < '0' || text[0] > '9')
+    throw std::invalid_argument("invalid leaf size: " + text);
+  value = std::stoull(text, &pos);
+
+  std::string suffix = text.substr(pos);
+  size_t factor = 1;
+  if (!suffix.empty()) {
+    factor = 0;
+    for (auto& unit : size_units)
+      if (suffix == unit.suffix) factor = unit.factor;
+  }
+  if (!value || !factor || value > MAX_LEAF_SIZE / factor)
+    throw std::invalid_argument("invalid leaf size: " + text);
+  return value * factor;
+}
+
+std::string format_size(size_t size) {
+  for (auto& unit : size_units)
+    if (size % unit.factor == 0)
+      return std::to_string(size / unit.factor) + unit.suffix;
+  return std::to_string(size);
+}
+
+}  // namespace
+
+std::unique_ptr<TreeHash> TreeHash::create(const std::string& spec,
+                                           size_t threads) {
+  const std::string prefix{"Tree("};
+  if (spec.compare(0, prefix.size(), prefix) != 0) return nullptr;
+  if (spec.back() != ')')
+    throw std::invalid_argument("invalid tree hash: " + spec);
+
+  /* The leaf size follows the last comma outside of the parentheses
+     of the hash function, as in "Tree(Tiger(24,3),1MiB)".  */
+  std::string args =
+      spec.substr(prefix.size(), spec.size() - prefix.size() - 1);
+  size_t comma = std::string::npos;
+  int depth = 0;
+  for (size_t i = 0; i < args.size(); i++) {
+    if (args[i] == '(')
+      depth++;
+    else if (args[i] == ')')
+      depth--;
+    else if (args[i] == ',' && !depth)
+      comma = i;
+  }
+
+  size_t leaf_size = DEFAULT_LEAF_SIZE;
+  if (comma != std::string::npos) {
+    leaf_size = parse_size(args.substr(comma + 1));
+    args.erase(comma);
+  }
+  return std::unique_ptr<TreeHash>(new TreeHash(
+      Botan::HashFunction::create_or_throw(args), leaf_size, threads));
+}
+
+TreeHash::TreeHash(std::unique_ptr<Botan::HashFunction> hash,
+                   size_t leaf_size, size_t threads)
+    : m_hash(std::move(hash)), m_leaf_size(leaf_size), m_threads(threads) {
+  if (!m_leaf_size || m_leaf_size > MAX_LEAF_SIZE)
+    throw std::invalid_argument("invalid leaf size: " +
+                                std::to_string(m_leaf_size));
+  if (!m_threads) m_threads = std::thread::hardware_concurrency();
+  if (!m_threads) m_threads = 1;
+  /* A batch has a leaf for each thread if the memory allows it.  */
+  size_t leaves = std::min(m_threads, MAX_BATCH_SIZE / m_leaf_size);
+  m_batch_size = std::max<size_t>(leaves, 1) * m_leaf_size;
+}
+
+Botan::secure_vector<uint8_t> TreeHash::leaf_digest(Botan::HashFunction& hash,
+                                                    const uint8_t* data,
+                                                    size_t len) {
+  hash.update(0x00);
+  hash.update(data, len);
+  return hash.final();
+}
+
+Botan::secure_vector<uint8_t> TreeHash::root_digest(Botan::HashFunction& hash,
+                                                    const Leaves& leaves) {
+  if (leaves.empty()) return leaf_digest(hash, nullptr, 0);
+
+  Leaves level = leaves;
+  while (level.size() > 1) {
+    Leaves parents;
+    for (size_t i = 0; i + 1 < level.size(); i += 2) {
+      hash.update(0x01);
+      hash.update(level[i]);
+      hash.update(level[i + 1]);
+      parents.push_back(hash.final());
+    }
+    if (level.size() % 2) parents.push_back(level.back());
+    level.swap(parents);
+  }
+  return level[0];
+}
+
+/* Hash the LEN bytes at DATA as consecutive leaves, of which only the
+   last one may be shorter than the leaf size.  The leaves are
+   distributed over the threads, and the calling thread takes part.  */
+void TreeHash::hash_leaves(const uint8_t* data, size_t len) {
+  size_t count = (len + m_leaf_size - 1) / m_leaf_size;
+  size_t first = m_leaves.size();
+  std::atomic<size_t> next{0};
+
+  m_leaves.resize(first + count);
+  auto work = [this, data, len, count, first,
+               &next](Botan::HashFunction& hash) {
+    size_t i;
+    while ((i = next++) < count) {
+      size_t offset = i * m_leaf_size;
+      m_leaves[first + i] = leaf_digest(
+          hash, data + offset, std::min(m_leaf_size, len - offset));
+    }
+  };
+
+  std::vector<std::unique_ptr<Botan::HashFunction>> hashes;
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < std::min(m_threads, count); i++) {
+    hashes.emplace_back(m_hash->clone());
+    try {
+      workers.emplace_back(work, std::ref(*hashes.back()));
+    } catch (const std::system_error&) {
+      break;
+    }
+  }
+  work(*m_hash);
+  for (auto& worker : workers) worker.join();
+}
+
+void TreeHash::add_data(const uint8_t input[], size_t length) {
+  while (length) {
+    if (m_buffer.empty() && length >= m_batch_size) {
+      /* Hash whole leaves directly from the input.  */
+      size_t len = length - length % m_leaf_size;
+      hash_leaves(input, len);
+      input += len;
+      length -= len;
+      continue;
+    }
+
+    size_t len = std::min(m_batch_size - m_buffer.size(), length);
+    m_buffer.insert(m_buffer.end(), input, input + len);
+    input += len;
+    length -= len;
+    if (m_buffer.size() == m_batch_size) {
+      hash_leaves(m_buffer.data(), m_buffer.size());
+      m_buffer.clear();
+    }
+  }
+}
+
+TreeHash::Leaves TreeHash::final_leaves() {
+  if (!m_buffer.empty())
+    hash_leaves(m_buffer.data(), m_buffer.size());
+  else if (m_leaves.empty())
+    m_leaves.push_back(leaf_digest(*m_hash, nullptr, 0));
+
+  Leaves leaves;
+  leaves.swap(m_leaves);
+  m_buffer.clear();
+  return leaves;
+}
+
+void TreeHash::resume(const Leaves& leaves) {
+  if (!m_buffer.empty() || !m_leaves.empty())
+    throw std::logic_error("tree hash already has data");
+  m_leaves = leaves;
+}
+
+void TreeHash::final_result(uint8_t output[]) {
+  auto root = root_digest(*m_hash, final_leaves());
+  memcpy(output, root.data(), root.size());
+}
+
+std::string TreeHash::name() const {
+  return "Tree(" + m_hash->name() + "," + format_size(m_leaf_size) + ")";
+}
+
+size_t TreeHash::output_length() const { return m_hash->output_length(); }
+
+Botan::HashFunction* TreeHash::clone() const {
+  return new TreeHash(std::unique_ptr<Botan::HashFunction>(m_hash->clone()),
+                      m_leaf_size, m_threads);
+}
+
+std::unique_ptr<Botan::HashFunction> TreeHash::copy_state() const {
+  std::unique_ptr<TreeHash> copy(
+      new TreeHash(std::unique_ptr<Botan::HashFunction>(m_hash->clone()),
+                   m_leaf_size, m_threads));
+  copy->m_buffer = m_buffer;
+  copy->m_leaves = m_leaves;
+  return std::move(copy);
+}
+
+void TreeHash::clear() {
+  m_hash->clear();
+  m_buffer.clear();
+  m_leaves.clear();
+}
+
+}  // namespace NeoPG
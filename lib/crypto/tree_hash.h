@@ -0,0 +1,103 @@
+/* Tree hashing of large inputs
+   Copyright 2018 The NeoPG developers
+
+   NeoPG is released under the Simplified BSD License (see license.txt)
+*/
+
+#pragma once
+
+#include <botan/hash.h>
+
+#include <neopg/common.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace NeoPG {
+
+/**
+   A hash function that splits its input into leaves of a fixed size
+   and combines their digests in a Merkle tree, as in RFC 6962: A leaf
+   is hashed as H(0x00 || leaf), and an inner node as H(0x01 || left ||
+   right).  A node without a sibling moves up a level unchanged.  The
+   empty input is a single empty leaf.  Full leaves are hashed on
+   several threads.
+
+   The leaf digests can be retrieved with final_leaves().  A modified
+   region can then be verified by hashing only the leaves which cover
+   it with leaf_digest() and combining all leaves with root_digest().
+   resume() continues a computation from the leaf digests of a prefix
+   of the input.
+
+   The name of a tree hash is "Tree(HASH,SIZE)", for example
+   "Tree(SHA-256,4MiB)".
+*/
+class NEOPG_UNSTABLE_API TreeHash : public Botan::HashFunction {
+ public:
+  typedef std::vector<Botan::secure_vector<uint8_t>> Leaves;
+
+  /**
+     Create a tree hash from a specification like "Tree(SHA-256,4MiB)".
+     The leaf size can be given in bytes or with a suffix of KiB, MiB
+     or GiB, and defaults to 4 MiB.  It must not exceed 2 GiB.  The
+     leaves are hashed on up to THREADS threads (0 for one per CPU).
+     Returns nullptr if SPEC is not a tree hash, and throws
+     std::invalid_argument if it is malformed.
+  */
+  static std::unique_ptr<TreeHash> create(const std::string& spec,
+                                          size_t threads = 0);
+
+  /**
+     Hash leaves of LEAF_SIZE bytes with HASH on up to THREADS threads
+     (0 for one per CPU).  Throws std::invalid_argument if LEAF_SIZE
+     is 0 or larger than 2 GiB.
+  */
+  TreeHash(std::unique_ptr<Botan::HashFunction> hash, size_t leaf_size,
+           size_t threads = 0);
+
+  /* The digest of the leaf of LEN bytes at DATA.  */
+  static Botan::secure_vector<uint8_t> leaf_digest(Botan::HashFunction& hash,
+                                                   const uint8_t* data,
+                                                   size_t len);
+
+  /* The root digest of the tree with LEAVES.  */
+  static Botan::secure_vector<uint8_t> root_digest(Botan::HashFunction& hash,
+                                                   const Leaves& leaves);
+
+  /* Finish the computation like final(), but return the leaf digests
+     instead of the root digest.  */
+  Leaves final_leaves();
+
+  /* Continue from the LEAVES of the first LEAVES.size() * leaf_size()
+     bytes of the input.  Throws std::logic_error if data has already
+     been added.  */
+  void resume(const Leaves& leaves);
+
+  size_t leaf_size() const { return m_leaf_size; }
+  size_t threads() const { return m_threads; }
+
+  /* The input collected before its leaves are hashed in parallel.  It
+     is limited to 128 MiB or a single leaf, whichever is larger.  */
+  size_t batch_size() const { return m_batch_size; }
+
+  std::string name() const override;
+  size_t output_length() const override;
+  Botan::HashFunction* clone() const override;
+  std::unique_ptr<Botan::HashFunction> copy_state() const override;
+  void clear() override;
+
+ private:
+  std::unique_ptr<Botan::HashFunction> m_hash;
+  size_t m_leaf_size;
+  size_t m_threads;
+  size_t m_batch_size;
+  std::vector<uint8_t> m_buffer;
+  Leaves m_leaves;
+
+  void hash_leaves(const uint8_t* data, size_t len);
+  void add_data(const uint8_t input[], size_t length) override;
+  void final_result(uint8_t output[]) override;
+};
+
+}  // namespace NeoPG
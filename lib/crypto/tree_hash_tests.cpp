@@ -0,0 +1,144 @@
+/* Tests for tree hashing
+   Copyright 2018 The NeoPG developers
+
+   NeoPG is released under the Simplified BSD License (see license.txt)
+*/
+
+#include "gtest/gtest.h"
+
+#include <botan/hex.h>
+
+#include <neopg/tree_hash.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace NeoPG;
+
+namespace {
+
+std::unique_ptr<TreeHash> tree(size_t leaf_size, size_t threads) {
+  return std::unique_ptr<TreeHash>(new TreeHash(
+      Botan::HashFunction::create_or_throw("SHA-256"), leaf_size, threads));
+}
+
+std::string hex(const Botan::secure_vector<uint8_t>& digest) {
+  return Botan::hex_encode(digest, false);
+}
+
+}  // namespace
+
+namespace NeoPG {
+
+TEST(NeopgTest, crypto_tree_hash_test) {
+  /* The empty input is a single empty leaf, as in RFC 6962.  */
+  ASSERT_EQ(hex(tree(4, 1)->final()),
+            "6e340b9cffb37a989ca544e6bb780a2c78901d3fb33738768511a30617afa01d");
+  ASSERT_EQ(hex(tree(4, 1)->process("abc")),
+            "609f6e36d2405585188d5cfd761f407c7cc46a7d3f314c88270469dde315fcd1");
+
+  /* Three leaves, of which the last moves up unchanged.  */
+  ASSERT_EQ(hex(tree(4, 1)->process("abcdefghij")),
+            "2a5b33d54d89d05737a7dd798d9862d55951564aafb5460691ad8a7a9ab6c678");
+
+  /* The result does not depend on the threads or on how the input is
+     split.  */
+  std::string data;
+  for (int i = 0; i < 100000; i++) data += (char)(i * 7 + i / 251);
+  std::string expected = hex(tree(1000, 1)->process(data));
+  for (size_t threads : {2, 3, 8}) {
+    auto hash = tree(1000, threads);
+    for (size_t i = 0; i < data.size(); i += 777)
+      hash->update((const uint8_t*)data.data() + i,
+                   std::min<size_t>(777, data.size() - i));
+    ASSERT_EQ(hex(hash->final()), expected);
+    ASSERT_EQ(hex(hash->process(data)), expected);
+  }
+
+  /* A copy of the state continues from the same point.  */
+  auto hash = tree(1000, 4);
+  hash->update((const uint8_t*)data.data(), 12345);
+  auto copy = hash->copy_state();
+  copy->update((const uint8_t*)data.data() + 12345, data.size() - 12345);
+  ASSERT_EQ(hex(copy->final()), expected);
+}
+
+TEST(NeopgTest, crypto_tree_hash_leaves_test) {
+  std::string data(10500, 'x');
+  for (size_t i = 0; i < data.size(); i += 13) data[i] = (char)i;
+  auto hash = tree(1000, 4);
+  hash->update(data);
+  auto leaves = hash->final_leaves();
+  ASSERT_EQ(leaves.size(), 11);
+  auto sha256 = Botan::HashFunction::create_or_throw("SHA-256");
+  std::string root = hex(hash->process(data));
+  ASSERT_EQ(hex(TreeHash::root_digest(*sha256, leaves)), root);
+
+  /* A modified region is verified by hashing only its leaves.  */
+  data[4321] ^= 1;
+  leaves[4] = TreeHash::leaf_digest(*sha256, (const uint8_t*)&data[4000], 1000);
+  ASSERT_EQ(hex(TreeHash::root_digest(*sha256, leaves)),
+            hex(hash->process(data)));
+  ASSERT_NE(hex(TreeHash::root_digest(*sha256, leaves)), root);
+
+  /* A computation resumes from the leaves of a prefix.  */
+  hash->update(data);
+  leaves = hash->final_leaves();
+  hash->resume(TreeHash::Leaves(leaves.begin(), leaves.begin() + 6));
+  hash->update((const uint8_t*)&data[6000], data.size() - 6000);
+  ASSERT_EQ(hash->final_leaves(), leaves);
+  hash->update(data);
+  ASSERT_THROW(hash->resume(leaves), std::logic_error);
+}
+
+TEST(NeopgTest, crypto_tree_hash_create_test) {
+  ASSERT_EQ(TreeHash::create("SHA-256"), nullptr);
+  ASSERT_EQ(TreeHash::create("Tree(SHA-256,4MiB)")->name(),
+            "Tree(SHA-256,4MiB)");
+  ASSERT_EQ(TreeHash::create("Tree(SHA-256)")->leaf_size(), 4 * 1024 * 1024);
+  ASSERT_EQ(TreeHash::create("Tree(SHA-512,65536)")->name(),
+            "Tree(SHA-512,64KiB)");
+  ASSERT_EQ(TreeHash::create("Tree(SHA-256,1000)")->leaf_size(), 1000);
+  ASSERT_EQ(TreeHash::create("Tree(SHA-256,2GiB)")->output_length(), 32);
+  ASSERT_GE(TreeHash::create("Tree(SHA-256)")->threads(), 1);
+  auto hash = TreeHash::create("Tree(SHA-256)", 3);
+  ASSERT_EQ(hash->threads(), 3);
+  ASSERT_EQ(dynamic_cast<TreeHash&>(*hash->copy_state()).threads(), 3);
+  ASSERT_THROW(TreeHash::create("Tree(SHA-256,0)"), std::invalid_argument);
+  ASSERT_THROW(TreeHash::create("Tree(SHA-256,4MB)"), std::invalid_argument);
+  ASSERT_THROW(TreeHash::create("Tree(SHA-256,-1)"), std::invalid_argument);
+  ASSERT_THROW(TreeHash::create("Tree(SHA-256"), std::invalid_argument);
+}
+
+TEST(NeopgTest, crypto_tree_hash_limits_test) {
+  const size_t GiB = 1024 * 1024 * 1024;
+
+  /* Leaf sizes which would overflow a batch are rejected.  */
+  ASSERT_THROW(TreeHash::create("Tree(SHA-256,8589934592GiB)", 2),
+               std::invalid_argument);
+  ASSERT_THROW(TreeHash::create("Tree(SHA-256,3GiB)"), std::invalid_argument);
+  ASSERT_THROW(TreeHash::create("Tree(SHA-256,18446744073709551615)", 2),
+               std::invalid_argument);
+  ASSERT_THROW(tree(SIZE_MAX, 2), std::invalid_argument);
+  ASSERT_THROW(tree(2 * GiB + 1, 2), std::invalid_argument);
+  ASSERT_THROW(tree(0, 2), std::invalid_argument);
+
+  /* A batch has a leaf per thread, but uses no more than 128 MiB
+     unless a single leaf is larger.  */
+  ASSERT_EQ(tree(1000, 4)->batch_size(), 4000);
+  ASSERT_EQ(tree(4 * 1024 * 1024, 64)->batch_size(), 128 * 1024 * 1024);
+  ASSERT_EQ(tree(GiB, 32)->batch_size(), GiB);
+  ASSERT_EQ(tree(2 * GiB, 32)->batch_size(), 2 * GiB);
+
+  /* Large leaves with many threads still hash small pieces of input,
+     here as a single leaf.  */
+  auto hash = tree(GiB, 32);
+  for (int i = 0; i < 3; i++) hash->update("abc");
+  auto sha256 = Botan::HashFunction::create_or_throw("SHA-256");
+  ASSERT_EQ(hex(hash->final()),
+            hex(TreeHash::leaf_digest(*sha256, (const uint8_t*)"abcabcabc",
+                                      9)));
+}
+
+}  // namespace NeoPG
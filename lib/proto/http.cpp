@@ -6,10 +6,44 @@
 
 #include <neopg/http.h>
 
+#include <cstdio>
 #include <iostream>
 
 namespace NeoPG {
 
+HttpPool::HttpPool() : m_handle(curl_share_init(), curl_share_cleanup) {
+  if (m_handle.get() == nullptr) throw std::bad_alloc();
+
+  curl_share_setopt(m_handle.get(), CURLSHOPT_LOCKFUNC, lock_fnc);
+  curl_share_setopt(m_handle.get(), CURLSHOPT_UNLOCKFUNC, unlock_fnc);
+  curl_share_setopt(m_handle.get(), CURLSHOPT_USERDATA, (void*)this);
+  curl_share_setopt(m_handle.get(), CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+  curl_share_setopt(m_handle.get(), CURLSHOPT_SHARE,
+                    CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+  /* Sharing the connection cache requires libcurl 7.57.0.  */
+  curl_share_setopt(m_handle.get(), CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+}
+
+HttpPool& HttpPool::global() {
+  /* Never destroyed, so that Http objects with static storage duration
+     can still use it during exit.  */
+  static HttpPool* pool = new HttpPool;
+  return *pool;
+}
+
+void HttpPool::lock_fnc(CURL* handle, curl_lock_data data,
+                        curl_lock_access access, void* userp) {
+  HttpPool* pool = (HttpPool*)userp;
+  pool->m_locks[data].lock();
+}
+
+void HttpPool::unlock_fnc(CURL* handle, curl_lock_data data, void* userp) {
+  HttpPool* pool = (HttpPool*)userp;
+  pool->m_locks[data].unlock();
+}
+
 Http::Http() : m_handle(curl_easy_init(), curl_easy_cleanup) {
   if (m_handle.get() == nullptr) throw std::bad_alloc();
 
@@ -22,6 +56,16 @@ Http& Http::forbid_reuse(bool no_reuse) {
   return set_opt_long(CURLOPT_FORBID_REUSE, no_reuse ? 1 : 0);
 }
 
+Http& Http::use_pool(HttpPool& pool) {
+  set_opt_long(CURLOPT_TCP_KEEPALIVE, 1);
+  return set_opt_ptr(CURLOPT_SHARE, (void*)pool.handle());
+}
+
+Http& Http::use_cache(HttpCache& cache) {
+  m_cache = &cache;
+  return *this;
+}
+
 Http& Http::set_url(const std::string& url) {
   URI uri(url);
   if (uri.scheme == "https")
@@ -32,8 +76,9 @@ Http& Http::set_url(const std::string& url) {
     throw std::runtime_error("unsupported protocol");
   }
 
+  m_url = url;
   /* Would be nice to have a URI check.  */
-  return set_opt_ptr(CURLOPT_URL, (void*)url.c_str());
+  return set_opt_ptr(CURLOPT_URL, (void*)m_url.c_str());
 }
 
 Http& Http::set_proxy(const std::string& proxy) {
@@ -111,48 +156,201 @@ Http& Http::set_maxfilesize(long maxfilesize) {
   return set_opt_long(CURLOPT_MAXFILESIZE, maxfilesize);
 }
 
-/* Must be an unbound function, because it is used as C callback.  */
-static size_t write_fnc(void* buffer, size_t size, size_t nmemb, void* userp) {
-  std::string* response = (std::string*)userp;
+size_t Http::write_fnc(void* buffer, size_t size, size_t nmemb,
+                       void* userp) {
+  Http* http = (Http*)userp;
   size_t amount = size * nmemb;  // Overflow?
-  response->append((char*)buffer, amount);
+
+  try {
+    if (!http->m_body_started) {
+      long http_code = 0;
+      curl_easy_getinfo(http->m_handle.get(), CURLINFO_RESPONSE_CODE,
+                        &http_code);
+      /* Do not pass error documents to the sink.  */
+      if (http->m_sink && http_code != 200)
+        throw std::runtime_error("HTTP " + std::to_string(http_code));
+      if (http_code == 200) http->open_cache_file();
+      http->m_body_started = true;
+    }
+
+    if (http->m_cache_file) {
+      if (fwrite(buffer, 1, amount, http->m_cache_file.get()) == amount)
+        http->m_cache_size += amount;
+      else
+        http->discard_cache_file();
+    }
+
+    if (http->m_sink)
+      (*http->m_sink)((const char*)buffer, amount);
+    else
+      http->m_response.append((char*)buffer, amount);
+  } catch (...) {
+    /* Exceptions must not pass through libcurl.  Returning a short
+       count aborts the transfer with CURLE_WRITE_ERROR.  */
+    http->m_write_error = std::current_exception();
+    return 0;
+  }
   return amount;
 }
 
-static int progress_fnc(void* userp, curl_off_t dltotal, curl_off_t dlnow,
-                        curl_off_t ultotal, curl_off_t ulnow) {
-  long* maxfilesize = (long*)userp;
-  if (dlnow >
-      (curl_off_t)maxfilesize) /* Aborts with CURLE_ABORTED_BY_CALLBACK.  */
-    return 1;
+size_t Http::header_fnc(char* buffer, size_t size, size_t nitems,
+                        void* userp) {
+  Http* http = (Http*)userp;
+  size_t amount = size * nitems;
+  std::string line(buffer, amount);
+
+  /* Each response, for example of a redirect, starts with a status
+     line.  We only keep the headers of the last one.  */
+  if (line.compare(0, 5, "HTTP/") == 0) {
+    http->m_response_headers.clear();
+    return amount;
+  }
+
+  size_t colon = line.find(':');
+  if (colon == std::string::npos) return amount;
+  std::string name = line.substr(0, colon);
+  for (auto& c : name) c = tolower(c);
+  size_t start = line.find_first_not_of(" \t", colon + 1);
+  size_t end = line.find_last_not_of(" \t\r\n");
+  if (start != std::string::npos && end >= start)
+    http->m_response_headers[name] = line.substr(start, end - start + 1);
+  return amount;
+}
+
+int Http::progress_fnc(void* userp, curl_off_t dltotal, curl_off_t dlnow,
+                       curl_off_t ultotal, curl_off_t ulnow) {
+  Http* http = (Http*)userp;
+  /* Returning non-zero aborts with CURLE_ABORTED_BY_CALLBACK.  */
+  if (http->m_abort) return 1;
+  if (http->m_maxfilesize > 0 && dlnow > http->m_maxfilesize) return 1;
   return 0;
 }
 
-std::string Http::fetch() {
+void Http::open_cache_file() {
+  HttpCache::Entry entry;
+
+  if (!m_cache || m_post_data ||
+      !HttpCache::make_entry(m_url, m_response_headers, entry))
+    return;
+
+  m_cache_temp = m_cache->temp_file(m_url);
+  m_cache_file.reset(fopen(m_cache_temp.c_str(), "wb"));
+  m_cache_size = 0;
+  if (!m_cache_file) m_cache_temp.clear();
+}
+
+void Http::discard_cache_file() {
+  if (m_cache_temp.empty()) return;
+  m_cache_file.reset();
+  std::remove(m_cache_temp.c_str());
+  m_cache_temp.clear();
+}
+
+void Http::commit_cache_file() {
+  HttpCache::Entry entry;
+
+  if (m_cache_temp.empty()) return;
+  /* Caching is best effort, so errors are ignored.  */
+  if (fclose(m_cache_file.release()) == 0 &&
+      HttpCache::make_entry(m_url, m_response_headers, entry)) {
+    entry.size = m_cache_size;
+    try {
+      m_cache->store(entry, m_cache_temp);
+      m_cache_temp.clear();
+      return;
+    } catch (const std::runtime_error&) {
+    }
+  }
+  discard_cache_file();
+}
+
+void Http::update_cache_entry() {
+  HttpCache::Entry entry;
+
+  /* A 304 response may update the freshness and the validators.  */
+  auto it = m_response_headers.find("cache-control");
+  if (it != m_response_headers.end() &&
+      it->second.find("no-store") != std::string::npos) {
+    m_cache->remove(m_url);
+    return;
+  }
+  HttpCache::make_entry(m_url, m_response_headers, entry);
+  if (entry.etag.empty()) entry.etag = m_cache_entry.etag;
+  if (entry.last_modified.empty())
+    entry.last_modified = m_cache_entry.last_modified;
+  entry.size = m_cache_entry.size;
+  try {
+    m_cache->store(entry);
+  } catch (const std::runtime_error&) {
+  }
+}
+
+std::string Http::read_cache() {
+  std::unique_ptr<FILE, int (*)(FILE*)> file(
+      fopen(m_cache->body_file(m_url).c_str(), "rb"), fclose);
   std::string response;
-  char last_error[CURL_ERROR_SIZE] = {'\0'};
-  std::unique_ptr<struct curl_slist, void (*)(struct curl_slist*)> headers{
-      nullptr, curl_slist_free_all};
-  std::unique_ptr<struct curl_slist, void (*)(struct curl_slist*)> connect_to{
-      nullptr, curl_slist_free_all};
+  char buffer[64 * 1024];
+  size_t n;
+
+  if (!file) throw std::runtime_error("can't read cached response");
+  while ((n = fread(buffer, 1, sizeof(buffer), file.get())) > 0) {
+    if (m_sink)
+      (*m_sink)(buffer, n);
+    else
+      response.append(buffer, n);
+  }
+  if (ferror(file.get()))
+    throw std::runtime_error("can't read cached response");
+  return response;
+}
+
+void Http::prepare() {
+  m_abort = false;
+  m_response.clear();
+  m_response_headers.clear();
+  m_body_started = false;
+  m_write_error = nullptr;
+  m_error_buffer[0] = '\0';
+  m_header_list.reset();
+  m_connect_to_list.reset();
+  discard_cache_file();
 
   set_opt_ptr(CURLOPT_WRITEFUNCTION, (void*)write_fnc);
-  set_opt_ptr(CURLOPT_WRITEDATA, (void*)&response);
+  set_opt_ptr(CURLOPT_WRITEDATA, (void*)this);
+  set_opt_ptr(CURLOPT_HEADERFUNCTION, (void*)header_fnc);
+  set_opt_ptr(CURLOPT_HEADERDATA, (void*)this);
   // FIXME: Proxy, IP resolve, header, post, cainfo, http_code?
-  set_opt_ptr(CURLOPT_ERRORBUFFER, last_error);
+  set_opt_ptr(CURLOPT_ERRORBUFFER, m_error_buffer);
+
+  std::vector<std::string> headers;
+  for (auto& item : m_header)
+    headers.push_back(item.first + ": " + item.second);
+
+  /* Use a cached response as is if it is still fresh, unless the
+     caller asked for an end-to-end reload.  Otherwise revalidate it
+     with a conditional request.  */
+  m_cache_hit =
+      m_cache && !m_post_data && m_cache->lookup(m_url, m_cache_entry);
+  m_cache_fresh = m_cache_hit && m_cache_entry.expires > time(NULL) &&
+                  !m_header.count("Cache-Control");
+  if (m_cache_hit) {
+    if (m_cache_entry.etag.size())
+      headers.push_back("If-None-Match: " + m_cache_entry.etag);
+    if (m_cache_entry.last_modified.size())
+      headers.push_back("If-Modified-Since: " + m_cache_entry.last_modified);
+  }
 
-  for (auto& item : m_header) {
-    std::string header = item.first;
-    header += ": " + item.second;
+  for (auto& header : headers) {
     /* A bit odd: curl_slist_append also does initialization.  The return
      * value is stable after first call. */
-    struct curl_slist* ptr = curl_slist_append(headers.get(), header.c_str());
+    struct curl_slist* ptr =
+        curl_slist_append(m_header_list.get(), header.c_str());
     if (!ptr)
       throw std::bad_alloc();
-    else if (!headers.get())
-      headers.reset(ptr);
+    else if (!m_header_list.get())
+      m_header_list.reset(ptr);
   }
-  set_opt_ptr(CURLOPT_HTTPHEADER, (void*)headers.get());
+  set_opt_ptr(CURLOPT_HTTPHEADER, (void*)m_header_list.get());
 
   if (m_connect_to.size()) {
     std::string arg;
@@ -161,25 +359,51 @@ std::string Http::fetch() {
     if (!ptr)
       throw std::bad_alloc();
     else
-      connect_to.reset(ptr);
-    set_opt_ptr(CURLOPT_CONNECT_TO, (void*)connect_to.get());
+      m_connect_to_list.reset(ptr);
+    set_opt_ptr(CURLOPT_CONNECT_TO, (void*)m_connect_to_list.get());
   }
 
-  /* Enforce maximum filesize.  */
+  /* Enforce maximum filesize and allow to abort.  */
   set_opt_ptr(CURLOPT_XFERINFOFUNCTION, (void*)progress_fnc);
-  set_opt_ptr(CURLOPT_XFERINFODATA, (void*)&m_maxfilesize);
+  set_opt_ptr(CURLOPT_XFERINFODATA, (void*)this);
   set_opt_long(CURLOPT_NOPROGRESS, 0);
+}
 
-  CURLcode result = curl_easy_perform(m_handle.get());
-  if (result != CURLE_OK) throw std::runtime_error(last_error);
-
-  m_last_error = last_error;
+std::string Http::finish(CURLcode result) {
+  std::string response;
 
-  long http_code;
-  curl_easy_getinfo(m_handle.get(), CURLINFO_RESPONSE_CODE, &http_code);
-  std::string reason;
-  reason += "HTTP " + std::to_string(http_code);
-  if (http_code != 200) throw std::runtime_error(reason);
+  if (m_cache_fresh)
+    response = read_cache();
+  else {
+    if (m_write_error) {
+      std::exception_ptr error = m_write_error;
+      m_write_error = nullptr;
+      discard_cache_file();
+      std::rethrow_exception(error);
+    }
+    if (result != CURLE_OK) {
+      discard_cache_file();
+      throw std::runtime_error(m_error_buffer);
+    }
+
+    m_last_error = m_error_buffer;
+
+    long http_code;
+    curl_easy_getinfo(m_handle.get(), CURLINFO_RESPONSE_CODE, &http_code);
+    if (http_code == 304 && m_cache_hit) {
+      update_cache_entry();
+      response = read_cache();
+    } else {
+      std::string reason;
+      reason += "HTTP " + std::to_string(http_code);
+      if (http_code != 200) {
+        discard_cache_file();
+        throw std::runtime_error(reason);
+      }
+      commit_cache_file();
+      response.swap(m_response);
+    }
+  }
 
   // Clear post data so it is never reused accidentially.
   set_post();
@@ -189,4 +413,110 @@ std::string Http::fetch() {
   return response;
 }
 
+std::string Http::fetch() {
+  prepare();
+  if (m_cache_fresh) return finish(CURLE_OK);
+  return finish(curl_easy_perform(m_handle.get()));
+}
+
+void Http::fetch(const Sink& sink) {
+  m_sink = &sink;
+  try {
+    prepare();
+    if (m_cache_fresh)
+      finish(CURLE_OK);
+    else
+      finish(curl_easy_perform(m_handle.get()));
+  } catch (...) {
+    m_sink = nullptr;
+    throw;
+  }
+  m_sink = nullptr;
+}
+
+HttpMulti::HttpMulti(size_t max_in_flight)
+    : m_handle(curl_multi_init(), curl_multi_cleanup),
+      m_max_in_flight(max_in_flight ? max_in_flight : 1) {
+  if (m_handle.get() == nullptr) throw std::bad_alloc();
+}
+
+HttpMulti::~HttpMulti() { cancel(); }
+
+void HttpMulti::add(std::unique_ptr<Http> request, Callback done) {
+  m_pending.push_back(Transfer{std::move(request), std::move(done)});
+}
+
+void HttpMulti::cancel() {
+  for (auto& item : m_active)
+    curl_multi_remove_handle(m_handle.get(), item.first);
+  m_active.clear();
+  m_pending.clear();
+}
+
+void HttpMulti::perform() {
+  while (!m_pending.empty() || !m_active.empty()) {
+    while (!m_pending.empty() && m_active.size() < m_max_in_flight) {
+      Transfer transfer = std::move(m_pending.front());
+      m_pending.pop_front();
+
+      CURL* handle = transfer.request->m_handle.get();
+      std::string error;
+      std::string response;
+      bool served = false;
+      try {
+        transfer.request->prepare();
+        if (transfer.request->m_cache_fresh) {
+          response = transfer.request->finish(CURLE_OK);
+          served = true;
+        } else {
+          CURLMcode mc = curl_multi_add_handle(m_handle.get(), handle);
+          if (mc != CURLM_OK)
+            throw std::runtime_error(curl_multi_strerror(mc));
+        }
+      } catch (const std::runtime_error& e) {
+        error = e.what();
+      }
+      if (error.size() || served)
+        transfer.done(*transfer.request, response, error);
+      else
+        m_active.emplace(handle, std::move(transfer));
+    }
+
+    int running;
+    CURLMcode mc = curl_multi_perform(m_handle.get(), &running);
+    if (mc != CURLM_OK) throw std::runtime_error(curl_multi_strerror(mc));
+
+    int completed = 0;
+    int queued;
+    CURLMsg* msg;
+    while ((msg = curl_multi_info_read(m_handle.get(), &queued))) {
+      if (msg->msg != CURLMSG_DONE) continue;
+
+      auto it = m_active.find(msg->easy_handle);
+      if (it == m_active.end()) continue;
+      CURLcode result = msg->data.result;
+      curl_multi_remove_handle(m_handle.get(), it->first);
+      Transfer transfer = std::move(it->second);
+      m_active.erase(it);
+      completed++;
+
+      std::string response;
+      std::string error;
+      try {
+        response = transfer.request->finish(result);
+      } catch (const std::runtime_error& e) {
+        error = e.what();
+      }
+      transfer.done(*transfer.request, response, error);
+    }
+
+    /* Only wait for activity if nothing finished, so that queued
+       requests are started right away.  */
+    if (running && !completed) {
+      mc = curl_multi_wait(m_handle.get(), nullptr, 0, 1000, nullptr);
+      if (mc != CURLM_OK) throw std::runtime_error(curl_multi_strerror(mc));
+    }
+  }
+}
+
 }  // Namespace NeoPG
@@ -8,13 +8,42 @@
 
 #include <curl/curl.h>
 #include <tao/json/external/optional.hpp>
+#include <atomic>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <functional>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <regex>
 
+#include <neopg/http_cache.h>
 #include <neopg/uri.h>
 
 namespace NeoPG {
 
+/* A pool of DNS results, TLS sessions and open connections which is
+   shared by all Http objects using it.  Connections are kept alive
+   and reused by later requests to the same server.  */
+class NEOPG_UNSTABLE_API HttpPool {
+ public:
+  HttpPool();
+
+  /* The process-wide pool.  */
+  static HttpPool& global();
+
+  CURLSH* handle() { return m_handle.get(); }
+
+ private:
+  std::unique_ptr<CURLSH, CURLSHcode (*)(CURLSH*)> m_handle;
+  std::mutex m_locks[CURL_LOCK_DATA_LAST];
+
+  static void lock_fnc(CURL* handle, curl_lock_data data,
+                       curl_lock_access access, void* userp);
+  static void unlock_fnc(CURL* handle, curl_lock_data data, void* userp);
+};
+
 class NEOPG_UNSTABLE_API Http {
   const long MAX_REDIRECTS_DEFAULT = 2;
   const long MAX_FILESIZE_DEFAULT = 2 * 1024 * 1024;
@@ -23,6 +52,13 @@ class NEOPG_UNSTABLE_API Http {
   Http();
 
   Http& forbid_reuse(bool no_reuse = true);
+  Http& use_pool(HttpPool& pool = HttpPool::global());
+
+  /* Store responses to GET requests in CACHE.  A cached response is
+     used without network access while it is fresh, and revalidated
+     with a conditional request otherwise.  With no_cache, the cached
+     response is always revalidated.  */
+  Http& use_cache(HttpCache& cache);
   Http& set_url(const std::string& url);
   Http& set_proxy(const std::string& proxy);
   Http& default_proxy(bool allow_default = true);
@@ -33,6 +69,9 @@ class NEOPG_UNSTABLE_API Http {
   Http& no_cache(bool no_cache = true);
   Http& set_cainfo(const std::string& pemfile);
   Http& set_connect_to(const std::string& host);
+  /* Abort transfers of more than SIZE bytes, whether the server
+     announces the size or not.  The default is 2 MiB, and 0 allows
+     responses of any size.  */
   Http& set_maxfilesize(long size);
 
   enum class Resolve : long {
@@ -44,6 +83,18 @@ class NEOPG_UNSTABLE_API Http {
 
   std::string fetch();
 
+  /* Receives the response body chunk by chunk.  An exception thrown
+     by the sink aborts the transfer and is rethrown by fetch.  */
+  typedef std::function<void(const char* data, size_t len)> Sink;
+
+  /* Pass the response body to SINK as it arrives instead of
+     collecting it in memory.  The sink is only called for successful
+     responses.  */
+  void fetch(const Sink& sink);
+
+  /* Abort a running fetch.  May be called from another thread.  */
+  void abort() { m_abort = true; }
+
   std::string get_last_error() { return m_last_error; }
 
   /* Add header here.  */
@@ -54,7 +105,53 @@ class NEOPG_UNSTABLE_API Http {
   std::string m_last_error;
   tao::optional<std::string> m_post_data;
   std::string m_connect_to;
-  long m_maxfilesize;
+  long m_maxfilesize{0};
+  std::string m_url;
+  HttpCache* m_cache{nullptr};
+
+  /* The state of the current transfer.  */
+  std::string m_response;
+  std::atomic<bool> m_abort{false};
+  const Sink* m_sink{nullptr};
+  bool m_body_started;
+  std::exception_ptr m_write_error;
+  std::map<std::string, std::string> m_response_headers;
+  char m_error_buffer[CURL_ERROR_SIZE];
+  std::unique_ptr<struct curl_slist, void (*)(struct curl_slist*)>
+      m_header_list{nullptr, curl_slist_free_all};
+  std::unique_ptr<struct curl_slist, void (*)(struct curl_slist*)>
+      m_connect_to_list{nullptr, curl_slist_free_all};
+
+  /* The cached response for the current transfer, if any, and whether
+     it can be used without revalidation.  */
+  bool m_cache_hit{false};
+  bool m_cache_fresh{false};
+  HttpCache::Entry m_cache_entry;
+  /* The temporary file receiving a new response for the cache.  */
+  std::string m_cache_temp;
+  std::unique_ptr<FILE, int (*)(FILE*)> m_cache_file{nullptr, fclose};
+  long long m_cache_size{0};
+
+  static size_t write_fnc(void* buffer, size_t size, size_t nmemb,
+                          void* userp);
+  static size_t header_fnc(char* buffer, size_t size, size_t nitems,
+                           void* userp);
+  static int progress_fnc(void* userp, curl_off_t dltotal, curl_off_t dlnow,
+                          curl_off_t ultotal, curl_off_t ulnow);
+
+  /* Set up the handle for a transfer.  */
+  void prepare();
+  /* Evaluate the RESULT of a transfer and return the response.  */
+  std::string finish(CURLcode result);
+
+  void open_cache_file();
+  void discard_cache_file();
+  void commit_cache_file();
+  void update_cache_entry();
+  /* Return the cached body, or pass it to the sink.  */
+  std::string read_cache();
+
+  friend class HttpMulti;
 
   template <typename T>
   Http& set_opt(CURLoption opt, const T& val) {
@@ -66,4 +163,38 @@ class NEOPG_UNSTABLE_API Http {
   Http& set_opt_ptr(CURLoption opt, void* ptr) { return set_opt<>(opt, ptr); }
 };
 
+/* Runs many Http requests concurrently.  At most MAX_IN_FLIGHT
+   requests are active at the same time, the others are queued.  The
+   callback of a request is invoked as soon as it completes, with the
+   response on success or a non-empty error message on failure.  */
+class NEOPG_UNSTABLE_API HttpMulti {
+ public:
+  typedef std::function<void(Http& request, const std::string& response,
+                              const std::string& error)>
+      Callback;
+
+  explicit HttpMulti(size_t max_in_flight = 8);
+  ~HttpMulti();
+
+  void add(std::unique_ptr<Http> request, Callback done);
+
+  /* Run all queued requests to completion.  */
+  void perform();
+
+  /* Drop all queued and active requests without invoking their
+     callbacks.  May be called from a callback.  */
+  void cancel();
+
+ private:
+  struct Transfer {
+    std::unique_ptr<Http> request;
+    Callback done;
+  };
+
+  std::unique_ptr<CURLM, CURLMcode (*)(CURLM*)> m_handle;
+  size_t m_max_in_flight;
+  std::deque<Transfer> m_pending;
+  std::map<CURL*, Transfer> m_active;
+};
+
 }  // Namespace NeoPG
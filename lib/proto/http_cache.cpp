@@ -0,0 +1,165 @@
+/* HTTP response cache
+   Copyright 2018 The NeoPG developers
+
+   NeoPG is released under the Simplified BSD License (see license.txt)
+*/
+
+#include <neopg/http_cache.h>
+
+#include <botan/hash.h>
+#include <botan/hex.h>
+
+#include <curl/curl.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace NeoPG {
+
+HttpCache::HttpCache(const std::string& directory) : m_directory(directory) {
+  /* Errors show up when the cache is used.  */
+  mkdir(m_directory.c_str(), 0700);
+}
+
+std::string HttpCache::base_name(const std::string& url) {
+  auto hash = Botan::HashFunction::create_or_throw("SHA-256");
+  hash->update(url);
+  return m_directory + "/" + Botan::hex_encode(hash->final(), false);
+}
+
+std::string HttpCache::body_file(const std::string& url) {
+  return base_name(url) + ".body";
+}
+
+std::string HttpCache::temp_file(const std::string& url) {
+  static std::atomic<unsigned int> counter{0};
+  return base_name(url) + ".tmp" + std::to_string(getpid()) + "-" +
+         std::to_string(counter++);
+}
+
+bool HttpCache::lookup(const std::string& url, Entry& entry) {
+  std::ifstream meta(base_name(url) + ".meta");
+  std::string line;
+  Entry found;
+
+  while (std::getline(meta, line)) {
+    size_t sep = line.find(' ');
+    if (sep == std::string::npos) continue;
+    std::string key = line.substr(0, sep);
+    std::string value = line.substr(sep + 1);
+    if (key == "url")
+      found.url = value;
+    else if (key == "etag")
+      found.etag = value;
+    else if (key == "last-modified")
+      found.last_modified = value;
+    else if (key == "expires")
+      found.expires = strtoll(value.c_str(), NULL, 10);
+    else if (key == "size")
+      found.size = strtoll(value.c_str(), NULL, 10);
+  }
+  if (found.url != url) return false;
+
+  /* The body may have been replaced or removed in the meantime.  */
+  struct stat st;
+  if (stat(body_file(url).c_str(), &st) || st.st_size != found.size)
+    return false;
+
+  entry = found;
+  return true;
+}
+
+void HttpCache::store(const Entry& entry, const std::string& temp_file) {
+  std::string base = base_name(entry.url);
+  std::string meta_tmp = HttpCache::temp_file(entry.url);
+
+  if (temp_file.size() &&
+      std::rename(temp_file.c_str(), (base + ".body").c_str())) {
+    std::remove(temp_file.c_str());
+    throw std::runtime_error("can't store HTTP response");
+  }
+
+  {
+    std::ofstream meta(meta_tmp);
+    meta << "url " << entry.url << "\n"
+         << "etag " << entry.etag << "\n"
+         << "last-modified " << entry.last_modified << "\n"
+         << "expires " << (long long)entry.expires << "\n"
+         << "size " << entry.size << "\n";
+    if (!meta) {
+      std::remove(meta_tmp.c_str());
+      throw std::runtime_error("can't store HTTP response");
+    }
+  }
+  if (std::rename(meta_tmp.c_str(), (base + ".meta").c_str())) {
+    std::remove(meta_tmp.c_str());
+    throw std::runtime_error("can't store HTTP response");
+  }
+}
+
+void HttpCache::remove(const std::string& url) {
+  std::string base = base_name(url);
+  std::remove((base + ".meta").c_str());
+  std::remove((base + ".body").c_str());
+}
+
+bool HttpCache::make_entry(const std::string& url,
+                           const std::map<std::string, std::string>& headers,
+                           Entry& entry) {
+  time_t now = time(NULL);
+  bool have_max_age = false;
+  bool no_cache = false;
+
+  entry = Entry();
+  entry.url = url;
+
+  auto it = headers.find("etag");
+  if (it != headers.end()) entry.etag = it->second;
+  it = headers.find("last-modified");
+  if (it != headers.end()) entry.last_modified = it->second;
+
+  it = headers.find("cache-control");
+  if (it != headers.end()) {
+    std::istringstream directives(it->second);
+    std::string directive;
+    while (std::getline(directives, directive, ',')) {
+      size_t start = directive.find_first_not_of(" \t");
+      if (start == std::string::npos) continue;
+      directive = directive.substr(start);
+      directive = directive.substr(0, directive.find_last_not_of(" \t") + 1);
+
+      if (directive == "no-store")
+        return false;
+      else if (directive == "no-cache")
+        no_cache = true;
+      else if (directive.compare(0, 8, "max-age=") == 0) {
+        long age = strtol(directive.c_str() + 8, NULL, 10);
+        entry.expires = age > 0 ? now + age : 0;
+        have_max_age = true;
+      }
+    }
+  }
+
+  if (!have_max_age) {
+    it = headers.find("expires");
+    if (it != headers.end()) {
+      time_t expires = curl_getdate(it->second.c_str(), NULL);
+      if (expires > now) entry.expires = expires;
+    }
+  }
+  if (no_cache) entry.expires = 0;
+
+  /* Nothing to gain from storing a response which can neither be used
+     as is nor be revalidated.  */
+  return entry.etag.size() || entry.last_modified.size() || entry.expires;
+}
+
+}  // namespace NeoPG
@@ -0,0 +1,67 @@
+/* HTTP response cache
+   Copyright 2018 The NeoPG developers
+
+   NeoPG is released under the Simplified BSD License (see license.txt)
+*/
+
+#pragma once
+
+#include <neopg/common.h>
+
+#include <time.h>
+
+#include <map>
+#include <string>
+
+namespace NeoPG {
+
+/* An on-disk cache of HTTP responses.  Each response is stored with
+   its validators (ETag and Last-Modified) and the time until which it
+   is fresh according to Cache-Control or Expires, so that it can be
+   revalidated with a conditional request.  */
+class NEOPG_UNSTABLE_API HttpCache {
+ public:
+  struct Entry {
+    std::string url;
+    std::string etag;
+    std::string last_modified;
+    /* The response may be used without revalidation until then.  */
+    time_t expires{0};
+    /* The size of the body.  */
+    long long size{0};
+  };
+
+  /* Use DIRECTORY to store the responses.  It is created if it does
+     not exist.  */
+  explicit HttpCache(const std::string& directory);
+
+  /* Look up the response for URL.  */
+  bool lookup(const std::string& url, Entry& entry);
+
+  /* The name of the file holding the body for URL.  */
+  std::string body_file(const std::string& url);
+
+  /* A unique name for a temporary file for a new body for URL, which
+     can be committed with store.  */
+  std::string temp_file(const std::string& url);
+
+  /* Store ENTRY.  If TEMP_FILE is not empty, it replaces the body.  */
+  void store(const Entry& entry, const std::string& temp_file = "");
+
+  /* Remove the response for URL.  */
+  void remove(const std::string& url);
+
+  /* Compute the entry for a response to URL with the lower-cased
+     response HEADERS.  Returns false if the response must not be
+     stored.  */
+  static bool make_entry(const std::string& url,
+                         const std::map<std::string, std::string>& headers,
+                         Entry& entry);
+
+ private:
+  std::string m_directory;
+
+  std::string base_name(const std::string& url);
+};
+
+}  // namespace NeoPG
@@ -6,10 +6,164 @@
 
 #include <neopg/http.h>
 
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
 #include "gtest/gtest.h"
 
 using namespace NeoPG;
 
+namespace {
+
+const size_t LARGE_SIZE = 3 * 1024 * 1024;
+
+/* A minimal HTTP/1.1 server on the loopback interface.  It answers
+   every request with the body "hello", except for requests to
+   "/missing", keeps connections alive and counts the accepted
+   connections and the requests.  The body carries an ETag, except
+   for "/fresh" which may be cached for an hour.  "/large" returns
+   LARGE_SIZE bytes in chunks, without a Content-Length.  */
+class TestServer {
+ public:
+  TestServer() {
+    struct sockaddr_in addr = {};
+    socklen_t addrlen = sizeof(addr);
+
+    m_fd = socket(AF_INET, SOCK_STREAM, 0);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    if (m_fd < 0 || bind(m_fd, (struct sockaddr*)&addr, sizeof(addr)) ||
+        listen(m_fd, 16) ||
+        getsockname(m_fd, (struct sockaddr*)&addr, &addrlen))
+      throw std::runtime_error("can't start test server");
+    m_port = ntohs(addr.sin_port);
+    m_thread = std::thread(&TestServer::accept_loop, this);
+  }
+
+  ~TestServer() {
+    m_stop = true;
+    shutdown(m_fd, SHUT_RDWR);
+    m_thread.join();
+    close(m_fd);
+    {
+      std::lock_guard<std::mutex> lock(m_lock);
+      for (int fd : m_clients) shutdown(fd, SHUT_RDWR);
+    }
+    for (auto& thread : m_handlers) thread.join();
+  }
+
+  std::string url() {
+    return "http://127.0.0.1:" + std::to_string(m_port) + "/";
+  }
+
+  std::atomic<int> connections{0};
+  std::atomic<int> requests{0};
+  std::atomic<int> revalidated{0};
+
+ private:
+  int m_fd;
+  int m_port;
+  std::atomic<bool> m_stop{false};
+  std::thread m_thread;
+  std::mutex m_lock;
+  std::vector<int> m_clients;
+  std::vector<std::thread> m_handlers;
+
+  void accept_loop() {
+    for (;;) {
+      int fd = accept(m_fd, nullptr, nullptr);
+      if (fd < 0 || m_stop) {
+        if (fd >= 0) close(fd);
+        return;
+      }
+      connections++;
+      std::lock_guard<std::mutex> lock(m_lock);
+      m_clients.push_back(fd);
+      m_handlers.emplace_back(&TestServer::handle, this, fd);
+    }
+  }
+
+  void handle(int fd) {
+    static const std::string found =
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: text/plain\r\n"
+        "Content-Length: 5\r\n"
+        "ETag: \"v1\"\r\n"
+        "\r\n"
+        "hello";
+    static const std::string fresh =
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: text/plain\r\n"
+        "Content-Length: 5\r\n"
+        "Cache-Control: max-age=3600\r\n"
+        "\r\n"
+        "hello";
+    static const std::string not_modified =
+        "HTTP/1.1 304 Not Modified\r\n"
+        "ETag: \"v1\"\r\n"
+        "\r\n";
+    static const std::string missing =
+        "HTTP/1.1 404 Not Found\r\n"
+        "Content-Length: 0\r\n"
+        "\r\n";
+    static const std::string large = [] {
+      std::string response =
+          "HTTP/1.1 200 OK\r\n"
+          "Content-Type: text/plain\r\n"
+          "Transfer-Encoding: chunked\r\n"
+          "\r\n";
+      for (size_t i = 0; i < LARGE_SIZE; i += 0x10000)
+        response += "10000\r\n" + std::string(0x10000, 'x') + "\r\n";
+      return response + "0\r\n\r\n";
+    }();
+    std::string buffer;
+    char chunk[1024];
+    ssize_t n;
+
+    while ((n = read(fd, chunk, sizeof(chunk))) > 0) {
+      buffer.append(chunk, n);
+      size_t end;
+      while ((end = buffer.find("\r\n\r\n")) != std::string::npos) {
+        std::string request = buffer.substr(0, end + 2);
+        const std::string* response = &found;
+        if (request.compare(0, 13, "GET /missing ") == 0)
+          response = &missing;
+        else if (request.compare(0, 11, "GET /fresh ") == 0)
+          response = &fresh;
+        else if (request.compare(0, 11, "GET /large ") == 0)
+          response = &large;
+        else if (request.find("If-None-Match: \"v1\"\r\n") !=
+                 std::string::npos) {
+          response = &not_modified;
+          revalidated++;
+        }
+        buffer.erase(0, end + 4);
+        requests++;
+        /* The client may close the connection before reading all of
+           a large response.  */
+        if (send(fd, response->data(), response->size(), MSG_NOSIGNAL) !=
+            (ssize_t)response->size())
+          break;
+      }
+    }
+    close(fd);
+  }
+};
+
+}  // namespace
+
 namespace NeoPG {
 
 TEST(NeopgTest, proto_http_test) {
@@ -21,4 +175,233 @@ TEST(NeopgTest, proto_http_test) {
     // request.fetch();
   }
 }
+
+TEST(NeopgTest, proto_http_pool_test) {
+  {
+    /* Without a pool, every request opens a new connection.  */
+    TestServer server;
+
+    for (int i = 0; i < 5; i++) {
+      Http request;
+      request.set_url(server.url()).default_proxy(false).forbid_reuse();
+      ASSERT_EQ(request.fetch(), "hello");
+    }
+    ASSERT_EQ(server.requests, 5);
+    ASSERT_EQ(server.connections, 5);
+  }
+
+  {
+    /* With a pool, the connection is kept alive and reused by later
+       Http objects.  */
+    TestServer server;
+    HttpPool pool;
+
+    for (int i = 0; i < 50; i++) {
+      Http request;
+      request.set_url(server.url()).default_proxy(false).use_pool(pool);
+      ASSERT_EQ(request.fetch(), "hello");
+    }
+    ASSERT_EQ(server.requests, 50);
+    ASSERT_EQ(server.connections, 1);
+  }
+}
+
+TEST(NeopgTest, proto_http_stream_test) {
+  TestServer server;
+  std::string body;
+  Http::Sink sink = [&](const char* data, size_t len) {
+    body.append(data, len);
+  };
+
+  {
+    Http request;
+    request.set_url(server.url()).default_proxy(false);
+    request.fetch(sink);
+    ASSERT_EQ(body, "hello");
+  }
+
+  {
+    /* Error documents are not passed to the sink.  */
+    Http request;
+    body.clear();
+    request.set_url(server.url() + "missing").default_proxy(false);
+    ASSERT_THROW(request.fetch(sink), std::runtime_error);
+    ASSERT_EQ(body, "");
+  }
+
+  {
+    /* Exceptions thrown by the sink abort the transfer.  */
+    Http request;
+    Http::Sink failing = [](const char*, size_t) {
+      throw std::length_error("too long");
+    };
+    request.set_url(server.url()).default_proxy(false);
+    ASSERT_THROW(request.fetch(failing), std::length_error);
+  }
+}
+
+TEST(NeopgTest, proto_http_maxfilesize_test) {
+  TestServer server;
+
+  {
+    /* By default, responses of more than 2 MiB are rejected.  */
+    Http request;
+    request.set_url(server.url() + "large").default_proxy(false);
+    ASSERT_THROW(request.fetch(), std::runtime_error);
+  }
+
+  {
+    Http request;
+    request.set_url(server.url() + "large")
+        .default_proxy(false)
+        .set_maxfilesize(0);
+    ASSERT_EQ(request.fetch(), std::string(LARGE_SIZE, 'x'));
+  }
+
+  {
+    /* A limit also applies if the size is not announced.  */
+    Http request;
+    request.set_url(server.url() + "large")
+        .default_proxy(false)
+        .set_maxfilesize(LARGE_SIZE / 2);
+    ASSERT_THROW(request.fetch(), std::runtime_error);
+  }
+
+  {
+    Http request;
+    request.set_url(server.url() + "large")
+        .default_proxy(false)
+        .set_maxfilesize(LARGE_SIZE);
+    ASSERT_EQ(request.fetch().size(), LARGE_SIZE);
+  }
+}
+
+TEST(NeopgTest, proto_http_multi_test) {
+  TestServer server;
+  HttpMulti multi(4);
+  int good = 0;
+  int bad = 0;
+
+  for (int i = 0; i < 20; i++) {
+    std::unique_ptr<Http> request(new Http);
+    request->set_url(server.url() + (i == 7 ? "missing" : ""))
+        .default_proxy(false);
+    multi.add(std::move(request), [&](Http&, const std::string& response,
+                                      const std::string& error) {
+      if (error.empty() && response == "hello")
+        good++;
+      else if (error == "HTTP 404")
+        bad++;
+    });
+  }
+  multi.perform();
+
+  ASSERT_EQ(good, 19);
+  ASSERT_EQ(bad, 1);
+  ASSERT_EQ(server.requests, 20);
+  /* Never more than four requests are in flight.  */
+  ASSERT_LE(server.connections, 4);
+
+  /* Cancelling from a callback drops the remaining requests.  */
+  int calls = 0;
+  for (int i = 0; i < 20; i++) {
+    std::unique_ptr<Http> request(new Http);
+    request->set_url(server.url()).default_proxy(false);
+    multi.add(std::move(request),
+              [&](Http&, const std::string&, const std::string&) {
+                calls++;
+                multi.cancel();
+              });
+  }
+  multi.perform();
+  ASSERT_EQ(calls, 1);
+}
+
+TEST(NeopgTest, proto_http_cache_test) {
+  char tmpl[] = "/tmp/neopg-http-cache-XXXXXX";
+  ASSERT_NE(mkdtemp(tmpl), nullptr);
+  std::string directory = tmpl;
+
+  {
+    TestServer server;
+    HttpCache cache(directory);
+    std::string body;
+    Http::Sink sink = [&](const char* data, size_t len) {
+      body.append(data, len);
+    };
+
+    /* The first request stores the response, later requests revalidate
+       it with its ETag and get the body from the cache.  */
+    for (int i = 0; i < 3; i++) {
+      Http request;
+      request.set_url(server.url()).default_proxy(false).use_cache(cache);
+      ASSERT_EQ(request.fetch(), "hello");
+    }
+    ASSERT_EQ(server.requests, 3);
+    ASSERT_EQ(server.revalidated, 2);
+
+    {
+      Http request;
+      request.set_url(server.url()).default_proxy(false).use_cache(cache);
+      request.fetch(sink);
+      ASSERT_EQ(body, "hello");
+      ASSERT_EQ(server.revalidated, 3);
+    }
+
+    /* A fresh response is used without asking the server, unless a
+       reload is requested.  */
+    for (int i = 0; i < 3; i++) {
+      Http request;
+      request.set_url(server.url() + "fresh").default_proxy(false).use_cache(
+          cache);
+      ASSERT_EQ(request.fetch(), "hello");
+    }
+    ASSERT_EQ(server.requests, 5);
+    {
+      Http request;
+      request.set_url(server.url() + "fresh")
+          .default_proxy(false)
+          .use_cache(cache)
+          .no_cache();
+      ASSERT_EQ(request.fetch(), "hello");
+      ASSERT_EQ(server.requests, 6);
+    }
+
+    /* Error responses are not cached.  */
+    for (int i = 0; i < 2; i++) {
+      Http request;
+      request.set_url(server.url() + "missing")
+          .default_proxy(false)
+          .use_cache(cache);
+      ASSERT_THROW(request.fetch(), std::runtime_error);
+    }
+    ASSERT_EQ(server.requests, 8);
+
+    /* Fresh responses are also served from the cache by HttpMulti.  */
+    HttpMulti multi;
+    int good = 0;
+    for (int i = 0; i < 4; i++) {
+      std::unique_ptr<Http> request(new Http);
+      request->set_url(server.url() + "fresh").default_proxy(false).use_cache(
+          cache);
+      multi.add(std::move(request), [&](Http&, const std::string& response,
+                                        const std::string& error) {
+        if (error.empty() && response == "hello") good++;
+      });
+    }
+    multi.perform();
+    ASSERT_EQ(good, 4);
+    ASSERT_EQ(server.requests, 8);
+  }
+
+  DIR* dir = opendir(directory.c_str());
+  ASSERT_NE(dir, nullptr);
+  struct dirent* entry;
+  while ((entry = readdir(dir)))
+    if (entry->d_name[0] != '.')
+      unlink((directory + "/" + entry->d_name).c_str());
+  closedir(dir);
+  rmdir(directory.c_str());
+}
+
 }  // namespace NeoPG
@@ -0,0 +1,516 @@
+/* Radix64 (ASCII armor) encoding and CRC-24
+   Copyright 2018 The NeoPG developers
+
+   NeoPG is released under the Simplified BSD License (see license.txt)
+*/
+
+#include <neopg/radix64.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define NEOPG_RADIX64_X86 1
+#include <immintrin.h>
+#endif
+
+namespace NeoPG {
+
+namespace {
+
+const char alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* Maps characters to their value, or to 0xff for characters outside
+   of the alphabet.  */
+struct DecodeTable {
+  uint8_t value[256];
+
+  DecodeTable() {
+    memset(value, 0xff, sizeof(value));
+    for (int i = 0; i < 64; i++) value[(uint8_t)alphabet[i]] = i;
+  }
+};
+
+/* Tables for computing the CRC-24 eight bytes at a time ("slicing by
+   eight").  The checksum is kept in the upper 24 bits of a 32 bit
+   word, so that the usual MSB-first table method applies.  */
+struct Crc24Tables {
+  uint32_t table[8][256];
+
+  Crc24Tables() {
+    const uint32_t poly = 0x864CFB00;
+    for (int i = 0; i < 256; i++) {
+      uint32_t crc = (uint32_t)i << 24;
+      for (int bit = 0; bit < 8; bit++)
+        crc = (crc & 0x80000000) ? (crc << 1) ^ poly : (crc << 1);
+      table[0][i] = crc;
+    }
+    for (int k = 1; k < 8; k++)
+      for (int i = 0; i < 256; i++)
+        table[k][i] =
+            (table[k - 1][i] << 8) ^ table[0][table[k - 1][i] >> 24];
+  }
+};
+
+inline bool is_space(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+inline uint32_t load_be32(const uint8_t* p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+         ((uint32_t)p[2] << 8) | p[3];
+}
+
+/* The vectorized kernels process a prefix of the input and return its
+   length.  The scalar code handles the rest.  */
+typedef size_t (*encode_kernel)(const uint8_t* data, size_t len, char* out);
+typedef size_t (*decode_kernel)(const char* data, size_t len, uint8_t* out);
+
+size_t encode_none(const uint8_t*, size_t, char*) { return 0; }
+size_t decode_none(const char*, size_t, uint8_t*) { return 0; }
+
+#ifdef NEOPG_RADIX64_X86
+
+/* The SIMD codec follows Wojciech Muła and Daniel Lemire, "Faster
+   Base64 Encoding and Decoding Using AVX2 Instructions", ACM TOW
+   2018.  */
+
+__attribute__((target("ssse3"))) inline __m128i encode_block_ssse3(
+    __m128i in) {
+  /* Spread the 12 input bytes into 16 bytes of 6 bit indices.  */
+  in = _mm_shuffle_epi8(
+      in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+  const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+  const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+  const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+  const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+  const __m128i indices = _mm_or_si128(t1, t3);
+
+  /* Translate the indices into characters by adding an offset that
+     depends on the range the index falls into.  */
+  __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+  const __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+  range = _mm_or_si128(range, _mm_and_si128(less, _mm_set1_epi8(13)));
+  const __m128i offsets = _mm_setr_epi8(
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+  return _mm_add_epi8(_mm_shuffle_epi8(offsets, range), indices);
+}
+
+__attribute__((target("ssse3"))) size_t encode_ssse3(const uint8_t* data,
+                                                     size_t len, char* out) {
+  size_t i = 0;
+
+  /* Each step reads 16 bytes and uses 12 of them.  */
+  for (; i + 16 <= len; i += 12, out += 16) {
+    __m128i in = _mm_loadu_si128((const __m128i*)(data + i));
+    _mm_storeu_si128((__m128i*)out, encode_block_ssse3(in));
+  }
+  return i;
+}
+
+/* Translate 16 characters into their 6 bit values in VALUES.  Returns
+   false if any of them is not in the alphabet.  */
+__attribute__((target("ssse3"))) inline bool decode_values_ssse3(
+    __m128i in, __m128i& values) {
+  const __m128i higher = _mm_and_si128(_mm_srli_epi32(in, 4),
+                                       _mm_set1_epi8(0x0f));
+  const __m128i lower = _mm_and_si128(in, _mm_set1_epi8(0x0f));
+  const __m128i shift_lut = _mm_setr_epi8(0, 0, 19, 4, -65, -65, -71, -71, 0,
+                                          0, 0, 0, 0, 0, 0, 0);
+  const __m128i mask_lut = _mm_setr_epi8(
+      (char)0xa8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8,
+      (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf0, 0x54, 0x50,
+      0x50, 0x50, 0x54);
+  const __m128i bit_lut = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, (char)128, 0,
+                                        0, 0, 0, 0, 0, 0, 0);
+
+  const __m128i mask = _mm_shuffle_epi8(mask_lut, lower);
+  const __m128i bit = _mm_shuffle_epi8(bit_lut, higher);
+  const __m128i invalid =
+      _mm_cmpeq_epi8(_mm_and_si128(mask, bit), _mm_setzero_si128());
+  if (_mm_movemask_epi8(invalid)) return false;
+
+  /* '/' shares its upper nibble with '+', but needs an offset of 16
+     instead of 19.  */
+  const __m128i slash = _mm_cmpeq_epi8(in, _mm_set1_epi8('/'));
+  __m128i shift = _mm_shuffle_epi8(shift_lut, higher);
+  shift = _mm_add_epi8(shift, _mm_and_si128(slash, _mm_set1_epi8(-3)));
+  values = _mm_add_epi8(in, shift);
+  return true;
+}
+
+/* Pack 16 6 bit values into 12 bytes at the start of the result.  */
+__attribute__((target("ssse3"))) inline __m128i decode_pack_ssse3(
+    __m128i values) {
+  const __m128i merged =
+      _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+  const __m128i packed = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+  return _mm_shuffle_epi8(packed, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8,
+                                                14, 13, 12, -1, -1, -1, -1));
+}
+
+__attribute__((target("ssse3"))) size_t decode_ssse3(const char* data,
+                                                     size_t len,
+                                                     uint8_t* out) {
+  size_t i = 0;
+
+  for (; i + 16 <= len; i += 16, out += 12) {
+    __m128i values;
+    uint8_t block[16];
+    if (!decode_values_ssse3(_mm_loadu_si128((const __m128i*)(data + i)),
+                             values))
+      break;
+    _mm_storeu_si128((__m128i*)block, decode_pack_ssse3(values));
+    memcpy(out, block, 12);
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) size_t encode_avx2(const uint8_t* data,
+                                                   size_t len, char* out) {
+  const __m256i spread = _mm256_setr_epi8(
+      1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10, 1, 0, 2, 1, 4, 3, 5,
+      4, 7, 6, 8, 7, 10, 9, 11, 10);
+  const __m256i offsets = _mm256_setr_epi8(
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+  size_t i = 0;
+
+  /* Each step encodes 24 bytes, 12 from each of two 16 byte loads.  */
+  for (; i + 28 <= len; i += 24, out += 32) {
+    __m128i lo = _mm_loadu_si128((const __m128i*)(data + i));
+    __m128i hi = _mm_loadu_si128((const __m128i*)(data + i + 12));
+    __m256i in =
+        _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+    in = _mm256_shuffle_epi8(in, spread);
+    const __m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+    const __m256i t1 =
+        _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+    const __m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+    const __m256i t3 =
+        _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+    const __m256i indices = _mm256_or_si256(t1, t3);
+
+    __m256i range = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+    const __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+    range =
+        _mm256_or_si256(range, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+    _mm256_storeu_si256(
+        (__m256i*)out,
+        _mm256_add_epi8(_mm256_shuffle_epi8(offsets, range), indices));
+  }
+  return i + encode_ssse3(data + i, len - i, out);
+}
+
+__attribute__((target("avx2"))) size_t decode_avx2(const char* data,
+                                                   size_t len, uint8_t* out) {
+  const __m256i shift_lut = _mm256_setr_epi8(
+      0, 0, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 19, 4,
+      -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m256i mask_lut = _mm256_setr_epi8(
+      (char)0xa8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8,
+      (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf0, 0x54, 0x50,
+      0x50, 0x50, 0x54, (char)0xa8, (char)0xf8, (char)0xf8, (char)0xf8,
+      (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8,
+      (char)0xf0, 0x54, 0x50, 0x50, 0x50, 0x54);
+  const __m256i bit_lut = _mm256_setr_epi8(
+      1, 2, 4, 8, 16, 32, 64, (char)128, 0, 0, 0, 0, 0, 0, 0, 0, 1, 2, 4, 8,
+      16, 32, 64, (char)128, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m256i pack = _mm256_setr_epi8(
+      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1, 2, 1, 0, 6, 5,
+      4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  size_t i = 0;
+
+  for (; i + 32 <= len; i += 32, out += 24) {
+    const __m256i in = _mm256_loadu_si256((const __m256i*)(data + i));
+    const __m256i higher = _mm256_and_si256(_mm256_srli_epi32(in, 4),
+                                            _mm256_set1_epi8(0x0f));
+    const __m256i lower = _mm256_and_si256(in, _mm256_set1_epi8(0x0f));
+    const __m256i mask = _mm256_shuffle_epi8(mask_lut, lower);
+    const __m256i bit = _mm256_shuffle_epi8(bit_lut, higher);
+    const __m256i invalid =
+        _mm256_cmpeq_epi8(_mm256_and_si256(mask, bit), _mm256_setzero_si256());
+    if (_mm256_movemask_epi8(invalid)) break;
+
+    const __m256i slash = _mm256_cmpeq_epi8(in, _mm256_set1_epi8('/'));
+    __m256i shift = _mm256_shuffle_epi8(shift_lut, higher);
+    shift = _mm256_add_epi8(shift,
+                            _mm256_and_si256(slash, _mm256_set1_epi8(-3)));
+    const __m256i values = _mm256_add_epi8(in, shift);
+
+    const __m256i merged =
+        _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+    __m256i packed =
+        _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+    packed = _mm256_shuffle_epi8(packed, pack);
+    packed = _mm256_permutevar8x32_epi32(
+        packed, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+    uint8_t block[32];
+    _mm256_storeu_si256((__m256i*)block, packed);
+    memcpy(out, block, 24);
+  }
+  return i + decode_ssse3(data + i, len - i, out);
+}
+
+#endif
+
+struct Kernels {
+  Radix64Kernel kernel;
+  encode_kernel encode;
+  decode_kernel decode;
+};
+
+const Kernels all_kernels[] = {
+    {Radix64Kernel::Scalar, encode_none, decode_none},
+#ifdef NEOPG_RADIX64_X86
+    {Radix64Kernel::SSSE3, encode_ssse3, decode_ssse3},
+    {Radix64Kernel::AVX2, encode_avx2, decode_avx2},
+#endif
+};
+
+/* The kernels used by radix64_encode and radix64_decode, by default
+   the last supported one of ALL_KERNELS.  */
+std::atomic<const Kernels*>& selected_kernels() {
+  static std::atomic<const Kernels*> selected{[] {
+    const Kernels* best = &all_kernels[0];
+    for (const auto& kernels : all_kernels)
+      if (radix64_kernel_supported(kernels.kernel)) best = &kernels;
+    return best;
+  }()};
+  return selected;
+}
+
+const Kernels& kernels() {
+  return *selected_kernels().load(std::memory_order_relaxed);
+}
+
+const DecodeTable& decode_table() {
+  static const DecodeTable table;
+  return table;
+}
+
+const Crc24Tables& crc24_tables() {
+  static const Crc24Tables tables;
+  return tables;
+}
+
+}  // namespace
+
+bool radix64_kernel_supported(Radix64Kernel kernel) {
+  switch (kernel) {
+    case Radix64Kernel::Scalar:
+      return true;
+#ifdef NEOPG_RADIX64_X86
+    case Radix64Kernel::SSSE3:
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("ssse3");
+    case Radix64Kernel::AVX2:
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("avx2");
+#endif
+    default:
+      return false;
+  }
+}
+
+Radix64Kernel radix64_kernel() { return kernels().kernel; }
+
+void radix64_set_kernel(Radix64Kernel kernel) {
+  if (radix64_kernel_supported(kernel))
+    for (const auto& kernels : all_kernels)
+      if (kernels.kernel == kernel) {
+        selected_kernels().store(&kernels, std::memory_order_relaxed);
+        return;
+      }
+  throw std::invalid_argument("radix64 kernel not supported");
+}
+
+uint32_t crc24_update(uint32_t crc, const uint8_t* data, size_t len) {
+  const auto& t = crc24_tables().table;
+  uint32_t c = (crc & 0xffffff) << 8;
+
+  for (; len >= 8; data += 8, len -= 8) {
+    uint32_t a = c ^ load_be32(data);
+    uint32_t b = load_be32(data + 4);
+    c = t[7][a >> 24] ^ t[6][(a >> 16) & 0xff] ^ t[5][(a >> 8) & 0xff] ^
+        t[4][a & 0xff] ^ t[3][b >> 24] ^ t[2][(b >> 16) & 0xff] ^
+        t[1][(b >> 8) & 0xff] ^ t[0][b & 0xff];
+  }
+  for (; len; data++, len--) c = (c << 8) ^ t[0][(c >> 24) ^ *data];
+  return c >> 8;
+}
+
+size_t radix64_encode(const uint8_t* data, size_t len, char* out) {
+  size_t i = kernels().encode(data, len, out);
+  char* p = out + i / 3 * 4;
+
+  for (; i + 3 <= len; i += 3, p += 4) {
+    uint32_t group = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+    p[0] = alphabet[group >> 18];
+    p[1] = alphabet[(group >> 12) & 0x3f];
+    p[2] = alphabet[(group >> 6) & 0x3f];
+    p[3] = alphabet[group & 0x3f];
+  }
+  if (i < len) {
+    uint32_t group = data[i] << 16;
+    if (i + 1 < len) group |= data[i + 1] << 8;
+    p[0] = alphabet[group >> 18];
+    p[1] = alphabet[(group >> 12) & 0x3f];
+    p[2] = (i + 1 < len) ? alphabet[(group >> 6) & 0x3f] : '=';
+    p[3] = '=';
+    p += 4;
+  }
+  return p - out;
+}
+
+size_t radix64_decode(const char* data, size_t len, uint8_t* out) {
+  const auto& table = decode_table().value;
+  size_t i = kernels().decode(data, len, out);
+
+  out += i / 4 * 3;
+  for (; i + 4 <= len; i += 4, out += 3) {
+    uint8_t a = table[(uint8_t)data[i]];
+    uint8_t b = table[(uint8_t)data[i + 1]];
+    uint8_t c = table[(uint8_t)data[i + 2]];
+    uint8_t d = table[(uint8_t)data[i + 3]];
+    if ((a | b | c | d) & 0x80) break;
+    out[0] = (a << 2) | (b >> 4);
+    out[1] = (b << 4) | (c >> 2);
+    out[2] = (c << 6) | d;
+  }
+  return i;
+}
+
+Radix64Encoder::Radix64Encoder(size_t width, const std::string& eol)
+    : m_width(width), m_eol(eol) {
+  if (m_width % 4)
+    throw std::invalid_argument("radix64 line width must be a multiple of 4");
+}
+
+void Radix64Encoder::update(const uint8_t* data, size_t len,
+                            std::string& out) {
+  m_crc = crc24_update(m_crc, data, len);
+
+  if (m_carry_len) {
+    while (m_carry_len < 3 && len) {
+      m_carry[m_carry_len++] = *data++;
+      len--;
+    }
+    if (m_carry_len < 3) return;
+    encode_groups(m_carry, 3, out);
+    m_carry_len = 0;
+  }
+
+  size_t full = len - len % 3;
+  encode_groups(data, full, out);
+  m_carry_len = len - full;
+  memcpy(m_carry, data + full, m_carry_len);
+}
+
+void Radix64Encoder::finish(std::string& out) {
+  if (m_carry_len) {
+    char group[4];
+    out.append(group, radix64_encode(m_carry, m_carry_len, group));
+    m_column += 4;
+    m_carry_len = 0;
+  }
+  if (m_column) {
+    out += m_eol;
+    m_column = 0;
+  }
+}
+
+std::string Radix64Encoder::checksum() const {
+  uint8_t crc[3] = {(uint8_t)(m_crc >> 16), (uint8_t)(m_crc >> 8),
+                    (uint8_t)m_crc};
+  char group[4];
+  radix64_encode(crc, sizeof(crc), group);
+  return "=" + std::string(group, sizeof(group));
+}
+
+void Radix64Encoder::encode_groups(const uint8_t* data, size_t len,
+                                   std::string& out) {
+  /* LEN is a multiple of 3.  Reserve space for the characters and for
+     every line end that can occur.  */
+  size_t pos = out.size();
+  size_t lines = m_width ? len / (m_width / 4 * 3) + 1 : 0;
+  out.resize(pos + len / 3 * 4 + lines * m_eol.size());
+
+  char* start = &out[0];
+  char* p = start + pos;
+  while (len) {
+    size_t n = len;
+    if (m_width) n = std::min(len, (m_width - m_column) / 4 * 3);
+    size_t chars = radix64_encode(data, n, p);
+    data += n;
+    len -= n;
+    p += chars;
+    m_column += chars;
+    if (m_width && m_column == m_width) {
+      memcpy(p, m_eol.data(), m_eol.size());
+      p += m_eol.size();
+      m_column = 0;
+    }
+  }
+  out.resize(p - start);
+}
+
+void Radix64Decoder::update(const char* data, size_t len, std::string& out) {
+  const auto& table = decode_table().value;
+  size_t pos = out.size();
+  out.resize(pos + (m_group_len + len) / 4 * 3 + 3);
+
+  uint8_t* start = (uint8_t*)&out[0] + pos;
+  uint8_t* p = start;
+  for (size_t i = 0; i < len;) {
+    if (!m_group_len && !m_done) {
+      size_t n = radix64_decode(data + i, len - i, p);
+      i += n;
+      p += n / 4 * 3;
+      if (i == len) break;
+    }
+
+    char c = data[i++];
+    if (is_space(c)) continue;
+    if (m_done) {
+      if (c == '=') continue;
+      throw std::runtime_error("radix64 data after padding");
+    }
+    if (c == '=') {
+      /* The padding completes a group of two or three characters,
+         which encode one or two bytes.  */
+      if (m_group_len < 2) throw std::runtime_error("invalid radix64 padding");
+      size_t bytes = m_group_len - 1;
+      while (m_group_len < 4) m_group[m_group_len++] = 'A';
+      uint8_t group[3];
+      radix64_decode(m_group, 4, group);
+      memcpy(p, group, bytes);
+      p += bytes;
+      m_group_len = 0;
+      m_done = true;
+      continue;
+    }
+    if (table[(uint8_t)c] == 0xff)
+      throw std::runtime_error("invalid radix64 character");
+    m_group[m_group_len++] = c;
+    if (m_group_len == 4) {
+      p += radix64_decode(m_group, 4, p) / 4 * 3;
+      m_group_len = 0;
+    }
+  }
+
+  m_crc = crc24_update(m_crc, start, p - start);
+  out.resize(pos + (p - start));
+}
+
+void Radix64Decoder::finish() {
+  if (m_group_len) throw std::runtime_error("truncated radix64 data");
+}
+
+}  // namespace NeoPG
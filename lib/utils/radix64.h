@@ -0,0 +1,125 @@
+/* Radix64 (ASCII armor) encoding and CRC-24
+   Copyright 2018 The NeoPG developers
+
+   NeoPG is released under the Simplified BSD License (see license.txt)
+*/
+
+#pragma once
+
+#include <neopg/common.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace NeoPG {
+
+/* The initial value of the CRC-24 checksum of the ASCII armor (RFC
+   4880, section 6.1).  */
+const uint32_t CRC24_INIT = 0xB704CE;
+
+/**
+   Update the CRC-24 checksum CRC with LEN bytes at DATA and return the
+   new checksum.
+*/
+uint32_t NEOPG_UNSTABLE_API crc24_update(uint32_t crc, const uint8_t* data,
+                                         size_t len);
+
+/**
+   Encode LEN bytes at DATA into radix64 characters at OUT, with
+   padding if LEN is not a multiple of 3.  OUT must have space for
+   (LEN + 2) / 3 * 4 characters.  Returns the number of characters
+   written.
+*/
+size_t NEOPG_UNSTABLE_API radix64_encode(const uint8_t* data, size_t len,
+                                         char* out);
+
+/**
+   Decode the longest prefix of LEN characters at DATA that consists of
+   complete groups of four radix64 characters into bytes at OUT, which
+   must have space for LEN / 4 * 3 bytes.  Decoding stops in front of
+   the first group which contains whitespace, padding or any other
+   character.  Returns the number of characters consumed, which is a
+   multiple of 4.
+*/
+size_t NEOPG_UNSTABLE_API radix64_decode(const char* data, size_t len,
+                                         uint8_t* out);
+
+/* The implementations of radix64_encode and radix64_decode.  The
+   vectorized ones handle long runs of input and leave the rest to the
+   scalar code.  */
+enum class NEOPG_UNSTABLE_API Radix64Kernel { Scalar, SSSE3, AVX2 };
+
+/**
+   Return true if KERNEL can be used on this machine.
+*/
+bool NEOPG_UNSTABLE_API radix64_kernel_supported(Radix64Kernel kernel);
+
+/**
+   Return the kernel in use, which by default is the fastest one
+   supported.
+*/
+Radix64Kernel NEOPG_UNSTABLE_API radix64_kernel();
+
+/**
+   Use KERNEL for all following calls, for testing and benchmarking.
+   Throws std::invalid_argument if KERNEL is not supported.
+*/
+void NEOPG_UNSTABLE_API radix64_set_kernel(Radix64Kernel kernel);
+
+/**
+   A streaming encoder for the body of an ASCII armor.  The input is
+   encoded into lines of WIDTH characters, which must be a multiple of
+   4, or into a single line if WIDTH is 0.  The CRC-24 checksum of the
+   input is computed along the way.
+*/
+class NEOPG_UNSTABLE_API Radix64Encoder {
+ public:
+  explicit Radix64Encoder(size_t width = 64, const std::string& eol = "\n");
+
+  /* Append the encoding of LEN bytes at DATA to OUT.  */
+  void update(const uint8_t* data, size_t len, std::string& out);
+
+  /* Append the remaining input with padding and end the last line.  */
+  void finish(std::string& out);
+
+  /* The checksum line ("=" and the encoded CRC-24), without line
+     end.  */
+  std::string checksum() const;
+
+ private:
+  size_t m_width;
+  std::string m_eol;
+  size_t m_column{0};
+  uint8_t m_carry[3];
+  size_t m_carry_len{0};
+  uint32_t m_crc{CRC24_INIT};
+
+  void encode_groups(const uint8_t* data, size_t len, std::string& out);
+};
+
+/**
+   A streaming decoder for the body of an ASCII armor.  Whitespace is
+   skipped, and padding ends the data.  The CRC-24 checksum of the
+   output is computed along the way.  Invalid input throws
+   std::runtime_error.
+*/
+class NEOPG_UNSTABLE_API Radix64Decoder {
+ public:
+  /* Append the bytes encoded by LEN characters at DATA to OUT.  */
+  void update(const char* data, size_t len, std::string& out);
+
+  /* Check that the input did not end in the middle of a group.  */
+  void finish();
+
+  /* The CRC-24 checksum of the output so far.  */
+  uint32_t crc() const { return m_crc; }
+
+ private:
+  char m_group[4];
+  size_t m_group_len{0};
+  bool m_done{false};
+  uint32_t m_crc{CRC24_INIT};
+};
+
+}  // namespace NeoPG
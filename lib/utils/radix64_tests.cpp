@@ -0,0 +1,226 @@
+/* Tests for radix64 encoding and CRC-24
+   Copyright 2018 The NeoPG developers
+
+   NeoPG is released under the Simplified BSD License (see license.txt)
+*/
+
+#include "gtest/gtest.h"
+
+#include <neopg/radix64.h>
+
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace NeoPG;
+
+namespace {
+
+std::string encode(const std::string& data) {
+  std::string out((data.size() + 2) / 3 * 4, '\0');
+  out.resize(
+      radix64_encode((const uint8_t*)data.data(), data.size(), &out[0]));
+  return out;
+}
+
+std::string decode(const std::string& data, size_t* consumed = nullptr) {
+  std::string out(data.size() / 4 * 3, '\0');
+  size_t len = radix64_decode(data.data(), data.size(), (uint8_t*)&out[0]);
+  if (consumed) *consumed = len;
+  out.resize(len / 4 * 3);
+  return out;
+}
+
+/* Restore the kernel in use at construction.  */
+class SavedKernel {
+ public:
+  SavedKernel() : m_kernel(radix64_kernel()) {}
+  ~SavedKernel() { radix64_set_kernel(m_kernel); }
+
+ private:
+  Radix64Kernel m_kernel;
+};
+
+}  // namespace
+
+namespace NeoPG {
+
+TEST(NeopgTest, utils_radix64_test) {
+  /* Test vectors from RFC 4648.  */
+  ASSERT_EQ(encode(""), "");
+  ASSERT_EQ(encode("f"), "Zg==");
+  ASSERT_EQ(encode("fo"), "Zm8=");
+  ASSERT_EQ(encode("foo"), "Zm9v");
+  ASSERT_EQ(encode("foob"), "Zm9vYg==");
+  ASSERT_EQ(encode("fooba"), "Zm9vYmE=");
+  ASSERT_EQ(encode("foobar"), "Zm9vYmFy");
+
+  /* Long enough for the vectorized code, with every byte value.  */
+  std::string data;
+  for (int i = 0; i < 3 * 256; i++) data += (char)(i * 7);
+  std::string encoded = encode(data);
+  ASSERT_EQ(encoded.size(), 1024);
+  ASSERT_EQ(encoded.substr(0, 8), "AAcOFRwj");
+  ASSERT_EQ(decode(encoded), data);
+
+  /* Decoding stops in front of the group with the first character
+     outside of the alphabet.  */
+  size_t consumed;
+  ASSERT_EQ(decode("Zm9vYmFy", &consumed), "foobar");
+  ASSERT_EQ(consumed, 8);
+  ASSERT_EQ(decode("Zm9vYg==", &consumed), "foo");
+  ASSERT_EQ(consumed, 4);
+  std::string broken = encoded;
+  broken[100] = '\n';
+  ASSERT_EQ(decode(broken, &consumed), data.substr(0, 75));
+  ASSERT_EQ(consumed, 100);
+  broken = encoded;
+  broken[998] = (char)0xc1;
+  decode(broken, &consumed);
+  ASSERT_EQ(consumed, 996);
+}
+
+TEST(NeopgTest, utils_radix64_kernels_test) {
+  SavedKernel saved;
+  std::mt19937 rng(4648);
+  ASSERT_TRUE(radix64_kernel_supported(Radix64Kernel::Scalar));
+  ASSERT_TRUE(radix64_kernel_supported(radix64_kernel()));
+
+  /* All lengths up to a few vectors, so that every length of the tail
+     left to the scalar code occurs, and random longer ones.  */
+  std::vector<size_t> lengths;
+  for (size_t len = 0; len <= 100; len++) lengths.push_back(len);
+  for (int i = 0; i < 100; i++) lengths.push_back(rng() % 5000);
+
+  for (auto kernel : {Radix64Kernel::SSSE3, Radix64Kernel::AVX2}) {
+    if (!radix64_kernel_supported(kernel)) {
+      ASSERT_THROW(radix64_set_kernel(kernel), std::invalid_argument);
+      continue;
+    }
+    for (size_t len : lengths) {
+      /* Random bytes, and their encoding with a character outside of
+         the alphabet at a random position in half of the cases.  */
+      std::string data(len, '\0');
+      for (auto& c : data) c = (char)rng();
+      radix64_set_kernel(Radix64Kernel::Scalar);
+      std::string expected = encode(data);
+      std::string encoded = expected;
+      if (!encoded.empty() && rng() % 2)
+        encoded[rng() % encoded.size()] = "\n=*\xc1"[rng() % 4];
+      size_t consumed;
+      std::string decoded = decode(encoded, &consumed);
+
+      radix64_set_kernel(kernel);
+      ASSERT_EQ(radix64_kernel(), kernel);
+      ASSERT_EQ(encode(data), expected) << len;
+      size_t kernel_consumed;
+      ASSERT_EQ(decode(encoded, &kernel_consumed), decoded) << len;
+      ASSERT_EQ(kernel_consumed, consumed) << len;
+    }
+  }
+}
+
+TEST(NeopgTest, utils_crc24_test) {
+  const std::string check{"123456789"};
+  ASSERT_EQ(crc24_update(CRC24_INIT, (const uint8_t*)check.data(),
+                         check.size()),
+            0x21cf02);
+
+  /* Updates can be split anywhere.  */
+  std::vector<uint8_t> data(1000);
+  for (size_t i = 0; i < data.size(); i++) data[i] = i * 13;
+  uint32_t crc = crc24_update(CRC24_INIT, data.data(), data.size());
+  uint32_t split = crc24_update(CRC24_INIT, data.data(), 333);
+  split = crc24_update(split, data.data() + 333, data.size() - 333);
+  ASSERT_EQ(crc, split);
+}
+
+TEST(NeopgTest, utils_radix64_encoder_test) {
+  {
+    Radix64Encoder encoder;
+    std::string out;
+    encoder.finish(out);
+    ASSERT_EQ(out, "");
+    ASSERT_EQ(encoder.checksum(), "=twTO");
+  }
+
+  {
+    /* Lines are wrapped independently of how the input is split.  */
+    std::string data(100, 'x');
+    std::string out;
+    Radix64Encoder encoder(8);
+    for (size_t i = 0; i < data.size(); i += 7)
+      encoder.update((const uint8_t*)data.data() + i,
+                     std::min<size_t>(7, data.size() - i), out);
+    encoder.finish(out);
+
+    std::string expected;
+    std::string encoded = encode(data);
+    for (size_t i = 0; i < encoded.size(); i += 8)
+      expected += encoded.substr(i, 8) + "\n";
+    ASSERT_EQ(out, expected);
+
+    uint32_t crc =
+        crc24_update(CRC24_INIT, (const uint8_t*)data.data(), data.size());
+    std::string crc_bytes{(char)(crc >> 16), (char)(crc >> 8), (char)crc};
+    ASSERT_EQ(encoder.checksum(), "=" + encode(crc_bytes));
+  }
+
+  {
+    Radix64Encoder encoder(0, "\r\n");
+    std::string out;
+    encoder.update((const uint8_t*)"foobar", 6, out);
+    encoder.update((const uint8_t*)"f", 1, out);
+    encoder.finish(out);
+    ASSERT_EQ(out, "Zm9vYmFyZg==\r\n");
+  }
+
+  ASSERT_THROW(Radix64Encoder(63), std::invalid_argument);
+}
+
+TEST(NeopgTest, utils_radix64_decoder_test) {
+  {
+    /* Whitespace is skipped, also within groups, and padding ends the
+       data.  */
+    const std::string input{"Zm9v\nYm\r\nFy Zg=\n=\n"};
+    Radix64Decoder decoder;
+    std::string out;
+    for (size_t i = 0; i < input.size(); i += 3)
+      decoder.update(input.data() + i, std::min<size_t>(3, input.size() - i),
+                     out);
+    decoder.finish();
+    ASSERT_EQ(out, "foobarf");
+    ASSERT_EQ(decoder.crc(),
+              crc24_update(CRC24_INIT, (const uint8_t*)out.data(), 7));
+  }
+
+  {
+    Radix64Decoder decoder;
+    std::string out;
+    decoder.update("Zm9vYmE", 7, out);
+    ASSERT_EQ(out, "foo");
+    ASSERT_THROW(decoder.finish(), std::runtime_error);
+  }
+
+  {
+    Radix64Decoder decoder;
+    std::string out;
+    ASSERT_THROW(decoder.update("Zm9v*mFy", 8, out), std::runtime_error);
+  }
+
+  {
+    Radix64Decoder decoder;
+    std::string out;
+    ASSERT_THROW(decoder.update("Zm9vYg==Zm9v", 12, out), std::runtime_error);
+  }
+
+  {
+    Radix64Decoder decoder;
+    std::string out;
+    ASSERT_THROW(decoder.update("Zm9vY===", 8, out), std::runtime_error);
+  }
+}
+
+}  // namespace NeoPG
@@ -4,65 +4,240 @@
    NeoPG is released under the Simplified BSD License (see license.txt)
 */
 
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <vector>
 
-#include <botan/filters.h>
+#include <unistd.h>
+
+#include <botan/data_src.h>
+
+#include <neopg/radix64.h>
 
 #include <neopg-tool/armor_command.h>
 
 namespace NeoPG {
 
+namespace {
+
+/* Reads lines from a data source with a fixed buffer.  Lines that do
+   not fit into the buffer are returned in pieces.  */
+class LineReader {
+ public:
+  explicit LineReader(Botan::DataSource& in) : m_in(in), m_buffer(64 * 1024) {}
+
+  /* Set DATA and LEN to the next piece of a line, without the line
+     end, and COMPLETE to whether the piece ends the line.  Returns
+     false at the end of the input.  */
+  bool next(const char*& data, size_t& len, bool& complete) {
+    char* start = m_buffer.data() + m_pos;
+    char* eol = (char*)memchr(start, '\n', m_end - m_pos);
+
+    if (!eol) {
+      /* Move the partial line to the front and read more.  */
+      m_end -= m_pos;
+      memmove(m_buffer.data(), start, m_end);
+      m_pos = 0;
+      start = m_buffer.data();
+      while (!eol && !m_eof && m_end < m_buffer.size()) {
+        size_t got =
+            m_in.read((uint8_t*)start + m_end, m_buffer.size() - m_end);
+        if (!got) m_eof = true;
+        eol = (char*)memchr(start + m_end, '\n', got);
+        m_end += got;
+      }
+    }
+
+    data = start;
+    if (eol) {
+      len = eol - start;
+      m_pos += len + 1;
+      complete = true;
+    } else {
+      if (m_pos == m_end) return false;
+      len = m_end - m_pos;
+      m_pos = m_end;
+      complete = m_eof;
+    }
+    if (complete && len && data[len - 1] == '\r') len--;
+    return true;
+  }
+
+ private:
+  Botan::DataSource& m_in;
+  std::vector<char> m_buffer;
+  size_t m_pos{0};
+  size_t m_end{0};
+  bool m_eof{false};
+};
+
+bool starts_with(const char* data, size_t len, const std::string& prefix) {
+  return len >= prefix.size() && !memcmp(data, prefix.data(), prefix.size());
+}
+
+/* The length of the line without trailing whitespace.  */
+size_t trimmed(const char* data, size_t len) {
+  while (len && (data[len - 1] == ' ' || data[len - 1] == '\t')) len--;
+  return len;
+}
+
+/* Decode the ASCII armored data from IN to OUT.  With HAS_TITLE, the
+   input can hold any number of armored blocks between BEGIN and END
+   lines, and text outside of them is ignored.  Otherwise the input is
+   the bare radix64 data, optionally followed by the checksum.  */
+void dearmor(Botan::DataSource& in, std::ostream& out, bool has_title) {
+  enum { SEARCH, HEADERS, BODY, CHECKSUM, DONE } state;
+  LineReader reader(in);
+  std::unique_ptr<Radix64Decoder> decoder(new Radix64Decoder);
+  std::string title;
+  std::string decoded;
+  const char* data;
+  size_t len;
+  bool complete;
+  bool line_start = true;
+  bool found = false;
+
+  state = has_title ? SEARCH : BODY;
+  for (; reader.next(data, len, complete); line_start = complete) {
+    size_t content = complete ? trimmed(data, len) : len;
+
+    if (state == SEARCH) {
+      if (line_start && complete && starts_with(data, content, "-----BEGIN ") &&
+          content >= 16 && !memcmp(data + content - 5, "-----", 5)) {
+        title.assign(data + 11, content - 16);
+        state = HEADERS;
+        found = true;
+      }
+    } else if (state == HEADERS) {
+      if (!complete) throw std::runtime_error("armor header line too long");
+      if (!content)
+        state = BODY;
+      else if (!memchr(data, ':', content))
+        throw std::runtime_error("invalid armor header");
+    } else if (state == BODY && line_start && content == 5 && data[0] == '=') {
+      uint8_t crc[3];
+      if (radix64_decode(data + 1, 4, crc) != 4)
+        throw std::runtime_error("invalid armor checksum");
+      decoder->finish();
+      uint32_t expected = (crc[0] << 16) | (crc[1] << 8) | crc[2];
+      if (expected != decoder->crc())
+        throw std::runtime_error("armor checksum mismatch");
+      state = has_title ? CHECKSUM : DONE;
+    } else if ((state == BODY || state == CHECKSUM) && line_start &&
+               starts_with(data, content, "-----END ")) {
+      if (state == BODY) decoder->finish();
+      if (!has_title || content != title.size() + 14 ||
+          title.compare(0, title.size(), data + 9, title.size()) ||
+          memcmp(data + 9 + title.size(), "-----", 5))
+        throw std::runtime_error("invalid armor end line");
+      decoder.reset(new Radix64Decoder);
+      state = SEARCH;
+    } else if (state == BODY) {
+      decoder->update(data, len, decoded);
+      if (decoded.size() >= 64 * 1024) {
+        out.write(decoded.data(), decoded.size());
+        decoded.clear();
+      }
+    } else if (content)
+      throw std::runtime_error("unexpected data after armor checksum");
+  }
+
+  out.write(decoded.data(), decoded.size());
+  if (state == BODY && !has_title)
+    decoder->finish();
+  else if (state != SEARCH && state != DONE)
+    throw std::runtime_error("armored data is truncated");
+  else if (has_title && !found)
+    throw std::runtime_error("no armored data found");
+  out.flush();
+}
+
+}  // namespace
+
 void ArmorCommand::encode() {
   bool has_title = !m_title.empty();
 
   if (m_files.empty()) m_files.emplace_back("-");
 
   for (auto& file : m_files) {
-    Botan::Filter* sink = (file == "-")
-                              ? new Botan::DataSink_Stream(std::cout)
-                              : new Botan::DataSink_Stream(file + ".asc", true);
+    std::unique_ptr<std::ofstream> output;
+    std::unique_ptr<Botan::DataSource> in;
+
+    if (file == "-")
+      in.reset(new Botan::DataSource_Stream{std::cin});
+    else {
+      in.reset(new Botan::DataSource_Stream{file, true});
+      output.reset(new std::ofstream(file + ".asc", std::ios::binary));
+      if (!*output)
+        throw std::runtime_error("can't open output file " + file + ".asc");
+    }
+    std::ostream& out = output ? *output : std::cout;
+
+    if (has_title) out << "-----BEGIN " << m_title << "-----\n\n";
 
     const int PGP_WIDTH{64};
-    Botan::Pipe pipe(new Botan::Fork(
-        new Botan::Chain(new Botan::Base64_Encoder(true, PGP_WIDTH), sink),
-        new Botan::Chain(new Botan::Hash_Filter("CRC24"),
-                         new Botan::Base64_Encoder())));
-
-    if (has_title) {
-      std::stringstream header_;
-      header_ << "-----BEGIN " << m_title << "-----\n\n";
-      const auto header = header_.str();
-      sink->write((uint8_t*)header.data(), header.size());
+    Radix64Encoder encoder(PGP_WIDTH);
+    std::vector<uint8_t> buffer(64 * 1024);
+    std::string encoded;
+    size_t len;
+    while ((len = in->read(buffer.data(), buffer.size())) > 0) {
+      encoded.clear();
+      encoder.update(buffer.data(), len, encoded);
+      out.write(encoded.data(), encoded.size());
     }
+    encoded.clear();
+    encoder.finish(encoded);
+    out.write(encoded.data(), encoded.size());
+
+    if (m_crc24) out << encoder.checksum() << "\n";
+
+    if (has_title) out << "-----END " << m_title << "-----\n";
+    out.flush();
+  }
+}
+
+void ArmorCommand::decode() {
+  bool has_title = !m_title.empty();
 
+  if (m_files.empty()) m_files.emplace_back("-");
+
+  for (auto& file : m_files) {
     if (file == "-") {
       Botan::DataSource_Stream in{std::cin};
-      pipe.process_msg(in);
-    } else {
-      Botan::DataSource_Stream in{file, true};
-      pipe.process_msg(in);
+      dearmor(in, std::cout, has_title);
+      continue;
     }
 
-    if (m_crc24) {
-      std::stringstream crc_;
-      crc_ << "=" << pipe.read_all_as_string(1) << "\n";
-      const auto crc = crc_.str();
-      sink->write((uint8_t*)crc.data(), crc.size());
-    }
-
-    if (has_title) {
-      std::stringstream footer_;
-      footer_ << "-----END " << m_title << "-----\n";
-      const auto footer = footer_.str();
-      sink->write((uint8_t*)footer.data(), footer.size());
+    /* The output goes to FILE without its ".asc" suffix, or to
+       FILE.bin.  It is written to a temporary file first, so that
+       invalid input leaves no partial output behind.  */
+    std::string name = file;
+    if (name.size() > 4 && name.compare(name.size() - 4, 4, ".asc") == 0)
+      name.resize(name.size() - 4);
+    else
+      name += ".bin";
+    std::string temp_name = name + ".tmp" + std::to_string(getpid());
+
+    Botan::DataSource_Stream in{file, true};
+    std::ofstream output(temp_name, std::ios::binary);
+    if (!output) throw std::runtime_error("can't open output file " + name);
+    try {
+      dearmor(in, output, has_title);
+      output.close();
+      if (!output) throw std::runtime_error("can't write output file " + name);
+      if (std::rename(temp_name.c_str(), name.c_str()))
+        throw std::runtime_error("can't create output file " + name);
+    } catch (...) {
+      std::remove(temp_name.c_str());
+      throw;
     }
   }
 }
 
-void ArmorCommand::decode() {
-  // TODO
-}
-
 void ArmorCommand::run() {
   if (m_decode)
     decode();
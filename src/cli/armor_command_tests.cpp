@@ -0,0 +1,160 @@
+/* Tests for the armor command
+   Copyright 2018 The NeoPG developers
+
+   NeoPG is released under the Simplified BSD License (see license.txt)
+*/
+
+#include "gtest/gtest.h"
+
+#include <dirent.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include <neopg/radix64.h>
+
+#include <neopg-tool/armor_command.h>
+
+using namespace NeoPG;
+
+namespace {
+
+/* A temporary directory which is removed with its contents.  */
+class TempDir {
+ public:
+  TempDir() {
+    const char* tmpdir = getenv("TMPDIR");
+    m_path = std::string(tmpdir ? tmpdir : "/tmp") + "/neopg-XXXXXX";
+    if (!mkdtemp(&m_path[0]))
+      throw std::runtime_error("can't create temporary directory");
+  }
+
+  ~TempDir() {
+    nftw(m_path.c_str(),
+         [](const char* fpath, const struct stat*, int, struct FTW*) {
+           return remove(fpath);
+         },
+         16, FTW_DEPTH | FTW_PHYS);
+  }
+
+  const std::string& path() const { return m_path; }
+
+  /* The names of the files in the directory.  */
+  std::set<std::string> files() const {
+    std::set<std::string> names;
+    DIR* dir = opendir(m_path.c_str());
+    struct dirent* entry;
+
+    while (dir && (entry = readdir(dir)))
+      if (entry->d_name[0] != '.') names.insert(entry->d_name);
+    if (dir) closedir(dir);
+    return names;
+  }
+
+ private:
+  std::string m_path;
+};
+
+/* Return DATA as an armored block with TITLE and the armor header
+   lines HEADERS.  */
+std::string armor(const std::string& title, const std::string& data,
+                  const std::string& headers = "") {
+  Radix64Encoder encoder(64);
+  std::string body;
+
+  encoder.update((const uint8_t*)data.data(), data.size(), body);
+  encoder.finish(body);
+  return "-----BEGIN " + title + "-----\n" + headers + "\n" + body +
+         encoder.checksum() + "\n-----END " + title + "-----\n";
+}
+
+std::string read_file(const std::string& name) {
+  std::ifstream in(name, std::ios::binary);
+  std::stringstream data;
+
+  data << in.rdbuf();
+  return data.str();
+}
+
+/* Decode the file NAME.asc in DIR with the armor command.  */
+void decode(const TempDir& dir, const std::string& name,
+            const std::string& input) {
+  CLI::App app;
+  ArmorCommand command(app, "armor", "armor");
+  std::string fname = dir.path() + "/" + name + ".asc";
+
+  std::ofstream(fname, std::ios::binary) << input;
+  command.m_decode = true;
+  command.m_files.push_back(fname);
+  command.run();
+}
+
+}  // namespace
+
+namespace NeoPG {
+
+TEST(NeopgToolTest, cli_armor_decode_test) {
+  TempDir dir;
+  std::string data(1000, 'x');
+  for (size_t i = 0; i < data.size(); i++) data[i] = (char)(i * 7);
+
+  /* Armor header lines and text outside of the blocks are skipped.  */
+  decode(dir, "one",
+         "Some text\n" +
+             armor("PGP MESSAGE", data, "Version: 1\nComment: a: b\n") +
+             "\nMore text\n" + armor("PGP SIGNATURE", "second"));
+  ASSERT_EQ(read_file(dir.path() + "/one"), data + "second");
+
+  /* Line ends with CR and trailing whitespace are accepted.  */
+  std::string block = armor("PGP MESSAGE", "third");
+  std::string crlf;
+  for (char c : block) crlf += c == '\n' ? " \r\n" : std::string(1, c);
+  decode(dir, "two", crlf);
+  ASSERT_EQ(read_file(dir.path() + "/two"), "third");
+  ASSERT_EQ(dir.files(),
+            (std::set<std::string>{"one", "one.asc", "two", "two.asc"}));
+}
+
+TEST(NeopgToolTest, cli_armor_decode_error_test) {
+  TempDir dir;
+  std::string data(100000, 'x');
+  std::string block = armor("PGP MESSAGE", data);
+
+  std::string bad_crc = block;
+  size_t crc = bad_crc.find("\n=") + 2;
+  bad_crc[crc] = bad_crc[crc] == 'A' ? 'B' : 'A';
+
+  std::string bad_end = block;
+  bad_end.replace(bad_end.rfind("MESSAGE"), 7, "SIGNATURE");
+
+  const std::string invalid[] = {
+      /* Mismatched BEGIN and END lines.  */
+      bad_end,
+      /* A wrong checksum.  */
+      bad_crc,
+      /* An invalid armor header line.  */
+      "-----BEGIN PGP MESSAGE-----\nno header\n\n" + block.substr(29),
+      /* A valid block followed by a truncated one.  */
+      block + block.substr(0, block.size() / 2),
+      /* No armored data at all.  */
+      "Some text\n",
+  };
+
+  /* The output file is neither created nor replaced.  */
+  std::ofstream(dir.path() + "/old") << "old";
+  for (auto& input : invalid) {
+    ASSERT_THROW(decode(dir, "new", input), std::runtime_error);
+    ASSERT_THROW(decode(dir, "old", input), std::runtime_error);
+    ASSERT_EQ(dir.files(),
+              (std::set<std::string>{"new.asc", "old", "old.asc"}));
+    ASSERT_EQ(read_file(dir.path() + "/old"), "old");
+  }
+}
+
+}  // namespace NeoPG
@@ -4,15 +4,115 @@
    NeoPG is released under the Simplified BSD License (see license.txt)
 */
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
-#include <botan/filters.h>
+#include <botan/data_src.h>
 #include <botan/hash.h>
+#include <botan/hex.h>
+
+#include <neopg/tree_hash.h>
 
 #include <neopg-tool/hash_command.h>
 
 namespace NeoPG {
 
+namespace {
+
+/* Files are read in blocks of this size.  */
+const size_t HASH_READ_SIZE = 1024 * 1024;
+
+/* Standard input can be given more than once, but only one worker may
+   read it at a time.  */
+std::mutex stdin_mutex;
+
+/* The digests of a file for each hash function, and the leaf digests
+   of the tree hashes among them if requested.  */
+struct FileDigests {
+  std::vector<Botan::secure_vector<uint8_t>> digests;
+  std::vector<TreeHash::Leaves> leaves;
+};
+
+/* Split a list of hash functions at the commas which are not inside of
+   parentheses, as in "SHA-256,Tiger(24,3)".  */
+std::vector<std::string> split_algos(const std::string& list) {
+  std::vector<std::string> algos;
+  std::string algo;
+  int depth = 0;
+
+  for (char c : list) {
+    if (c == ',' && !depth) {
+      algos.push_back(algo);
+      algo.clear();
+      continue;
+    }
+    if (c == '(') depth++;
+    if (c == ')') depth--;
+    algo += c;
+  }
+  algos.push_back(algo);
+  return algos;
+}
+
+/* Hash the file NAME, or standard input for "-", with all of ALGOS in
+   a single pass over the data.  With WITH_LEAVES, the leaf digests of
+   tree hashes are returned as well.  Tree hashes use up to THREADS
+   threads (0 for one per CPU).  */
+FileDigests hash_file(const std::string& name,
+                      const std::vector<std::string>& algos, bool with_leaves,
+                      size_t threads) {
+  std::vector<std::unique_ptr<Botan::HashFunction>> hashes;
+  std::vector<TreeHash*> trees;
+  for (auto& algo : algos) {
+    std::unique_ptr<TreeHash> tree = TreeHash::create(algo, threads);
+    trees.push_back(tree.get());
+    if (tree)
+      hashes.emplace_back(std::move(tree));
+    else
+      hashes.emplace_back(Botan::HashFunction::create_or_throw(algo));
+  }
+
+  std::unique_lock<std::mutex> lock(stdin_mutex, std::defer_lock);
+  std::unique_ptr<Botan::DataSource> in;
+  if (name == "-") {
+    lock.lock();
+    in.reset(new Botan::DataSource_Stream(std::cin));
+  } else
+    in.reset(new Botan::DataSource_Stream(name, true));
+
+  std::vector<uint8_t> buffer(HASH_READ_SIZE);
+  size_t len;
+  while ((len = in->read(buffer.data(), buffer.size())) > 0)
+    for (auto& hash : hashes) hash->update(buffer.data(), len);
+
+  FileDigests result;
+  for (size_t i = 0; i < hashes.size(); i++) {
+    result.leaves.emplace_back();
+    if (with_leaves && trees[i]) {
+      result.leaves.back() = trees[i]->final_leaves();
+      trees[i]->resume(result.leaves.back());
+    }
+    result.digests.push_back(hashes[i]->final());
+  }
+  return result;
+}
+
+/* The result of hashing one file on a worker thread.  */
+struct HashResult {
+  bool done{false};
+  FileDigests digests;
+  std::exception_ptr error;
+};
+
+}  // namespace
+
 void ListHashCommand::run() {
   std::cout << "Any Botan-compatible algorithm specifier can be used:\n\n";
 #if defined(BOTAN_HAS_SHA1)
@@ -104,6 +204,9 @@ void ListHashCommand::run() {
 #if defined(BOTAN_HAS_COMB4P)
   std::cout << "Comb4P(hash1, hash2) with two distinct hashes\n";
 #endif
+
+  std::cout << "Tree(hash, size) where size is the leaf size in bytes, KiB, "
+               "MiB or GiB (default 4MiB)\n";
 }
 
 void HashCommand::run() {
@@ -113,25 +216,93 @@ void HashCommand::run() {
 
   if (m_files.empty())
     m_files.emplace_back("-");
-  else if (m_files.size() > 1) {
-    m_raw = false;
+  else if (m_files.size() > 1)
     multi_files = true;
+
+  auto algos = split_algos(m_algo);
+  bool multi_algos = algos.size() > 1;
+
+  /* Binary digests can't be told apart, so only a single one is
+     output in binary.  --leaves is excluded by the option parser.  */
+  if (m_raw && (multi_files || multi_algos))
+    throw CLI::ValidationError(
+        "--raw", "requires a single file and hash function");
+
+  auto print_line = [&](const std::string& algo, const std::string& leaf,
+                        const Botan::secure_vector<uint8_t>& digest,
+                        const std::string& file) {
+    if (multi_algos) std::cout << algo << " ";
+    std::cout << leaf << Botan::hex_encode(digest, false);
+    if (multi_files) std::cout << " " << file;
+    if (multi_files || multi_algos || m_leaves) std::cout << "\n";
+  };
+  auto print = [&](const std::string& file, const FileDigests& result) {
+    for (size_t i = 0; i < result.digests.size(); i++) {
+      auto& digest = result.digests[i];
+      if (m_raw) {
+        std::cout.write((const char*)digest.data(), digest.size());
+        continue;
+      }
+      print_line(algos[i], "", digest, file);
+      for (size_t j = 0; j < result.leaves[i].size(); j++)
+        print_line(algos[i], "leaf " + std::to_string(j) + " ",
+                   result.leaves[i][j], file);
+    }
+  };
+
+  size_t ncpu = std::thread::hardware_concurrency();
+  size_t jobs = m_jobs ? m_jobs : ncpu;
+  if (jobs > m_files.size()) jobs = m_files.size();
+  if (jobs <= 1) {
+    for (auto& file : m_files)
+      print(file, hash_file(file, algos, m_leaves, 0));
+    return;
   }
 
-  Botan::Pipe pipe{
-      new Botan::Hash_Filter(m_algo),
-      m_raw ? nullptr : new Botan::Hex_Encoder(Botan::Hex_Encoder::Lowercase),
-      new Botan::DataSink_Stream(std::cout)};
-
-  for (auto& file : m_files) {
-    if (file == "-") {
-      Botan::DataSource_Stream in{std::cin};
-      pipe.process_msg(in);
-    } else {
-      Botan::DataSource_Stream in{file, true};
-      pipe.process_msg(in);
+  /* The CPUs are shared by the files hashed in parallel, so that the
+     tree hashes do not start a thread per CPU for each of them.  */
+  size_t threads = std::max<size_t>(1, ncpu / jobs);
+
+  /* The files are hashed on a pool of workers, and the results are
+     printed in the order of the files as they become available.  */
+  std::vector<HashResult> results(m_files.size());
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::atomic<size_t> next{0};
+  std::atomic<bool> stop{false};
+  auto worker = [&]() {
+    size_t i;
+    while (!stop && (i = next++) < m_files.size()) {
+      HashResult result;
+      try {
+        result.digests = hash_file(m_files[i], algos, m_leaves, threads);
+      } catch (...) {
+        result.error = std::current_exception();
+      }
+      result.done = true;
+      std::lock_guard<std::mutex> lock(mutex);
+      results[i] = std::move(result);
+      cond.notify_all();
+    }
+  };
+
+  struct Pool {
+    std::vector<std::thread> threads;
+    std::atomic<bool>& stop;
+    ~Pool() {
+      stop = true;
+      for (auto& thread : threads) thread.join();
     }
-    if (multi_files) std::cout << " " << file << "\n";
+  } pool{{}, stop};
+  for (size_t i = 0; i < jobs; i++) pool.threads.emplace_back(worker);
+
+  for (size_t i = 0; i < m_files.size(); i++) {
+    std::unique_lock<std::mutex> lock(mutex);
+    cond.wait(lock, [&]() { return results[i].done; });
+    HashResult result = std::move(results[i]);
+    lock.unlock();
+    if (result.error) std::rethrow_exception(result.error);
+    print(m_files[i], result.digests);
   }
 }
 
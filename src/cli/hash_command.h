@@ -24,6 +24,8 @@ class HashCommand : public Command {
   std::vector<std::string> m_files;
   std::string m_algo{"SHA-256"};
   bool m_raw = false;
+  unsigned int m_jobs{0};
+  bool m_leaves{false};
   const std::string group = "Commands";
   ListHashCommand cmd_list;
 
@@ -34,8 +36,17 @@ class HashCommand : public Command {
       : Command(app, flag, description, group_name),
         cmd_list(m_cmd, "list", "list supported hash functions", group) {
     m_cmd.add_option("file", m_files, "file to hash");
-    m_cmd.add_option("--algo", m_algo, "hash function", true);
-    m_cmd.add_flag("--raw", m_raw, "output as binary instead hex encoded");
+    m_cmd.add_option("--algo", m_algo,
+                     "hash function (several separated by commas)", true);
+    auto raw = m_cmd.add_flag(
+        "--raw", m_raw,
+        "output as binary instead hex encoded (one file and hash function)");
+    m_cmd.add_option("-j,--jobs", m_jobs,
+                     "number of files hashed in parallel (0 for one per CPU)",
+                     true);
+    auto leaves = m_cmd.add_flag(
+        "--leaves", m_leaves, "also output the leaf digests of tree hashes");
+    raw->excludes(leaves);
   }
   virtual ~HashCommand() {}
 };
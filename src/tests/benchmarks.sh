@@ -1,6 +1,88 @@
 bench  'dd if=/dev/urandom bs=4M count=20 | src/neopg armor' 'dd if=/dev/urandom bs=4M count=20 | gpg2 --enarmor' --output report.html
+
+# Armor throughput; dd reports the rate in MB/s.
+dd if=/dev/urandom bs=4M count=256 of=armor-bench.bin
+src/neopg armor < armor-bench.bin | dd of=/dev/null bs=4M
+bench 'src/neopg armor < armor-bench.bin > /dev/null' 'src/neopg gpg2 --enarmor < armor-bench.bin > /dev/null'
+src/neopg armor < armor-bench.bin > armor-bench.asc
+src/neopg armor --decode < armor-bench.asc | dd of=/dev/null bs=4M
+bench 'src/neopg armor --decode < armor-bench.asc > /dev/null' 'src/neopg gpg2 --dearmor < armor-bench.asc > /dev/null'
 bench 'dd if=/dev/urandom bs=4M count=50 | gpg2 --print-md SHA1' 'dd if=/dev/urandom bs=4M count=50 | src/neopg hash --algo SHA-1'
 
+# Hashing many files one at a time and on one thread per CPU, and with
+# two hash functions in one pass.
+mkdir -p hash-bench
+for i in $(seq 16); do dd if=/dev/urandom bs=4M count=16 of=hash-bench/$i.bin; done
+bench 'src/neopg hash --jobs 1 hash-bench/*.bin' 'src/neopg hash hash-bench/*.bin' 'src/neopg hash --algo SHA-256,SHA-512 hash-bench/*.bin'
+
+# Hashing a single large file with SHA-256 and with the parallel tree
+# hash.
+dd if=/dev/urandom bs=4M count=512 of=hash-bench/large.bin
+bench 'src/neopg hash hash-bench/large.bin' "src/neopg hash --algo 'Tree(SHA-256,4MiB)' hash-bench/large.bin"
+
 dd if=/dev/urandom bs=4M count=10 | src/neopg gpg2 --compress-algo zip --encrypt -r obama  | src/neopg gpg2 --decrypt > /dev/null
 dd if=/dev/urandom bs=4M count=10 | src/neopg gpg2 --compress-algo zlib --encrypt -r obama  | src/neopg gpg2 --decrypt > /dev/null
 dd if=/dev/urandom bs=4M count=10 | src/neopg gpg2 --compress-algo bzip2 --encrypt -r obama  | src/neopg gpg2 --decrypt > /dev/null
+
+# Compression of a compressible input on one and on several threads.
+seq -f 'line %.0f' 10000000 > compress-bench.txt
+bench 'src/neopg gpg2 --compress-algo zlib --batch --passphrase bench --symmetric < compress-bench.txt > /dev/null' 'src/neopg gpg2 --compress-threads 4 --compress-algo zlib --batch --passphrase bench --symmetric < compress-bench.txt > /dev/null'
+
+# Decompression throughput on highly compressible input; dd reports
+# the rate in MB/s.
+dd if=/dev/zero bs=4M count=256 | src/neopg gpg2 --batch --passphrase bench --compress-algo zlib --symmetric > decompress-bench.gpg
+src/neopg gpg2 --batch --passphrase bench --decrypt decompress-bench.gpg | dd of=/dev/null bs=4M
+bench 'src/neopg gpg2 --batch --passphrase bench --decrypt decompress-bench.gpg > /dev/null'
+
+# Decryption throughput; dd reports the rate in MB/s.
+dd if=/dev/zero bs=4M count=256 | src/neopg gpg2 --batch --passphrase bench --compress-algo none --symmetric > decrypt-bench.gpg
+src/neopg gpg2 --batch --passphrase bench --decrypt decrypt-bench.gpg | dd of=/dev/null bs=4M
+bench 'src/neopg gpg2 --batch --passphrase bench --decrypt decrypt-bench.gpg > /dev/null'
+
+# Encryption and decryption throughput with the default and with large
+# I/O buffers.
+for size in 64 1024; do
+  bench "dd if=/dev/zero bs=4M count=256 | src/neopg gpg2 --iobuf-size $size --batch --passphrase bench --compress-algo none --symmetric > /dev/null"
+  bench "src/neopg gpg2 --iobuf-size $size --batch --passphrase bench --decrypt decrypt-bench.gpg > /dev/null"
+done
+
+# Compressed encryption with and without the pipelined output stages.
+bench 'dd if=/dev/urandom bs=4M count=64 | src/neopg gpg2 --batch --passphrase bench --symmetric > /dev/null' 'dd if=/dev/urandom bs=4M count=64 | src/neopg gpg2 --pipelined-encryption --batch --passphrase bench --symmetric > /dev/null'
+
+# Detached signatures over a large binary and a large text file.
+dd if=/dev/urandom bs=4M count=256 of=sign-bench.bin
+seq -f 'line %.0f' 50000000 > sign-bench.txt
+bench 'src/neopg gpg2 --batch -u obama --detach-sign < sign-bench.bin > /dev/null' 'src/neopg gpg2 --batch -u obama --textmode --detach-sign < sign-bench.txt > /dev/null'
+
+# Loading a synthetic CRL with one million entries into the dirmngr
+# cache.  The CRL signature is only checked against trusted roots, so
+# the benchmark CA is installed in the trusted-certs directory below
+# GNUPG_SYSCONFDIR while the benchmark runs.  The CA key is deleted as
+# soon as the CRL is signed, an existing file is never replaced, and
+# the certificate is removed on exit even if the script is aborted.
+# A load that fails would only time the parser, so it is checked
+# first.
+bench_ca=/etc/neopg/trusted-certs/neopg-bench-ca.der
+mkdir -p crl-bench/home && cd crl-bench
+openssl req -x509 -newkey rsa:2048 -nodes -keyout ca.key -out ca.pem -days 30 -subj "/CN=NeoPG Benchmark CA" -addext keyUsage=critical,keyCertSign,cRLSign
+openssl x509 -in ca.pem -outform DER -out ca.der
+awk 'BEGIN { for (i = 1; i <= 1000000; i++) printf "R\t300101000000Z\t180101000000Z,keyCompromise\t%08X\tunknown\t/CN=cert %d\n", i, i }' > index.txt
+printf '[ca]\ndefault_ca=bench\n[bench]\ndatabase=index.txt\ndefault_md=sha256\ndefault_crl_days=7\n' > ca.cnf
+openssl ca -config ca.cnf -batch -gencrl -keyfile ca.key -cert ca.pem -out crl.pem
+rm -f ca.key
+openssl crl -in crl.pem -outform DER -out crl.der
+cd ..
+if sudo test -e "$bench_ca"; then
+  echo "$bench_ca exists, skipping the CRL benchmark" >&2
+else
+  trap 'sudo rm -f "$bench_ca"' EXIT
+  trap 'exit 1' HUP INT TERM
+  sudo install -D -m 644 crl-bench/ca.der "$bench_ca"
+  if src/neopg dirmngr --homedir crl-bench/home --load-crl crl-bench/crl.der; then
+    bench 'src/neopg dirmngr --homedir crl-bench/home --load-crl crl-bench/crl.der'
+  else
+    echo "loading the benchmark CRL failed" >&2
+  fi
+  sudo rm -f "$bench_ca"
+  trap - EXIT HUP INT TERM
+fi
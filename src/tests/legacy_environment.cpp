@@ -0,0 +1,58 @@
+/* Test environment for the legacy GnuPG components
+   Copyright 2018 The NeoPG developers
+
+   NeoPG is released under the Simplified BSD License (see license.txt)
+*/
+
+#include "legacy_environment.h"
+
+#include "gtest/gtest.h"
+
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <stdexcept>
+
+#include <gcrypt.h>
+
+/* The legacy code runs the agent and the dirmngr as subcommands of
+   the NeoPG binary.  */
+char* neopg_program = (char*)NEOPG_PROGRAM;
+
+namespace NeoPG {
+
+TemporaryDirectory::TemporaryDirectory() {
+  const char* tmpdir = getenv("TMPDIR");
+  std::string name = std::string(tmpdir ? tmpdir : "/tmp") + "/neopg-XXXXXX";
+
+  if (!mkdtemp(&name[0]))
+    throw std::runtime_error("can't create temporary directory");
+  m_path = name;
+}
+
+TemporaryDirectory::~TemporaryDirectory() {
+  nftw(m_path.c_str(),
+       [](const char* fpath, const struct stat*, int, struct FTW*) {
+         return remove(fpath);
+       },
+       16, FTW_DEPTH | FTW_PHYS);
+}
+
+}  // namespace NeoPG
+
+namespace {
+
+class LegacyEnvironment : public ::testing::Environment {
+ public:
+  void SetUp() override {
+    gcry_control(GCRYCTL_DISABLE_SECMEM_WARN);
+    gcry_control(GCRYCTL_INIT_SECMEM, 32768, 0);
+    gcry_control(GCRYCTL_INITIALIZATION_FINISHED, 0);
+  }
+};
+
+::testing::Environment* const legacy_environment =
+    ::testing::AddGlobalTestEnvironment(new LegacyEnvironment);
+
+}  // namespace
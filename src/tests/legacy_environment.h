@@ -0,0 +1,26 @@
+/* Test environment for the legacy GnuPG components
+   Copyright 2018 The NeoPG developers
+
+   NeoPG is released under the Simplified BSD License (see license.txt)
+*/
+
+#pragma once
+
+#include <string>
+
+namespace NeoPG {
+
+/* A new empty directory which is removed with its contents when the
+   object is destroyed.  */
+class TemporaryDirectory {
+ public:
+  TemporaryDirectory();
+  ~TemporaryDirectory();
+
+  const std::string& path() const { return m_path; }
+
+ private:
+  std::string m_path;
+};
+
+}  // namespace NeoPG